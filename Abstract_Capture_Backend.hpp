@@ -8,6 +8,7 @@
 #include <unordered_map>
 #include <array>
 #include <cstddef>
+#include <chrono>
 
 namespace Cartrack
 {
@@ -35,22 +36,13 @@ enum class Pixel_Format : uint {
 		YUV422P,
 		MJPEG,
 		BGR24,
-		RGB24
+		RGB24,
+		RGBA32,
+		GRAY8
 };
 using Camera_ID = short;
 static inline long long _timeout_in_milli = 200;
 
-static const inline std::unordered_map<Pixel_Format, std::array<char, 4>>
-		pixel_formats_fourcc{
-												 {Pixel_Format::YUYV422, {'Y', 'U', 'Y', 'V'}},
-												 {Pixel_Format::YUV422P, {'4', '2', '2', 'P'}},
-												 {Pixel_Format::NV12, {'N', 'V', '1', '2'}},
-												 {Pixel_Format::NV12sp, {'N', 'M', '1', '2'}},
-												 {Pixel_Format::MJPEG, {'M', 'J', 'P', 'G'}},
-												 {Pixel_Format::BGR24, {'B', 'G', 'R', '3'}},
-												 {Pixel_Format::RGB24, {'R', 'G', 'B', '3'}},
-												 };
-
 
 struct Stream_Configuration
 {
@@ -63,6 +55,10 @@ struct Stream_Configuration
 				 */
 		enum class Capture_Backends {
 				isgursoy_V4L2 = 0 // Fastest, zero copy and minimum overhead
+				,
+				Synthetic // Generated frames, no device needed. Benchmarks and CI.
+				,
+				Replay // Frames of a raw recording, see Replay_Backend.
 #ifdef OCV_AVAILABLE
 				,
 				OpenCV_V4L2 // CAP_V4L2, next fastest, 1 extra memcpy
@@ -108,6 +104,16 @@ struct Stream_Configuration
 				*/
 		Camera_ID device_index = -1;
 
+		/**
+				* @brief device_identity names the camera independently of /dev/videoN
+				* numbering, which changes across boots and when metadata nodes appear.
+				* A /dev/v4l/by-id or /dev/v4l/by-path link, "serial:<usb serial>",
+				* "bus:<bus_info>" or "card:<name>". Takes precedence over device_index
+				* when not empty. See Device_Discovery::resolve_all to resolve a whole
+				* rig with one scan.
+				*/
+		std::string device_identity;
+
 		/**
 				 * @brief num_max_internal_buffers num_max_buffers is the maximum number
 				 * of buffers that will be allocated. The number of buffers that will be
@@ -147,8 +153,77 @@ struct Stream_Configuration
 						 */
 				bool contiguous = true;
 
+				/**
+						 * @brief Enumerate formats, frame sizes, intervals and control ranges once per
+						 * device identity (bus info, driver, firmware) and keep them on disk. Later
+						 * opens pick the closest offered mode for width, height and fps without
+						 * probing, and clamp control writes to the reported ranges.
+						 *
+						 * Cache lives in $XDG_CACHE_HOME/cartrack_v4l2 or ~/.cache/cartrack_v4l2.
+						 */
+				bool device_profile_cache = false;
+
 		} v4l2;
 
+		struct Synthetic
+		{
+			public:
+				/**
+						 * @brief Deliver frames as fast as they are asked for instead of at fps.
+						 * Timestamps still follow the fps schedule. fps 0 also means unthrottled.
+						 */
+				bool unthrottled = false;
+				/**
+						 * @brief Standard deviation of capture timestamps around the ideal
+						 * schedule, clamped to half a frame period. USB cameras typically show
+						 * 0.1-2 ms.
+						 */
+				std::chrono::nanoseconds jitter{0};
+				/**
+						 * @brief Chance of each frame being dropped, which leaves a gap in
+						 * timestamps and sequence numbers like a driver that ran out of buffers.
+						 */
+				double drop_probability = 0;
+				/**
+						 * @brief Same seed, same jitter and drops, runs are comparable.
+						 */
+				uint64_t seed = 1;
+				/**
+						 * @brief Frames are rendered once at construction and cycled, so
+						 * generation does not show up in measurements.
+						 */
+				unsigned int distinct_frames = 8;
+		} synthetic;
+
+		struct Replay
+		{
+			public:
+				enum class Pacing {
+						Original = 0 // Gaps between frames as they were recorded
+						,
+						Fixed_Fps // One frame every 1 / fps, whatever the recorded timing
+						,
+						Unthrottled // As fast as frames are requested
+				};
+
+			public:
+				/**
+						 * @brief Raw recording to read, see Raw_Recording.hpp. Pixel format and
+						 * resolution come from the file, width, height and pixel_format of the
+						 * outer configuration are ignored.
+						 *
+						 * MANDATORY for Capture_Backends::Replay.
+						 */
+				std::string path;
+
+				Pacing pacing = Pacing::Original;
+				/**
+						 * @brief Start over at the end instead of returning empty frames.
+						 * Timestamps keep increasing across loops.
+						 */
+				bool loop = false;
+		} replay;
+
 #ifdef OCV_VIDEOIO_AVAILABLE
 		/**
 				 * @brief OpenCV FFmpeg backend can be configured using the environment
@@ -279,6 +354,15 @@ class Capture_Backend
 				return _frame_order_;
 		}
 
+		/**
+				 * @brief Capture time of the last frame returned, CLOCK_MONOTONIC for V4L2
+				 * devices, so frames of cameras on the same host can be compared.
+				 */
+		[[nodiscard]] virtual std::chrono::nanoseconds get_frame_timestamp() const
+		{
+				return _frame_timestamp_;
+		}
+
 		[[nodiscard]] virtual unsigned int get_width() const = 0;
 
 		[[nodiscard]] virtual unsigned int get_height() const = 0;
@@ -288,6 +372,7 @@ class Capture_Backend
 	protected:
 		Stream_Configuration _configuration_;
 		uintmax_t _frame_order_ = 0;
+		std::chrono::nanoseconds _frame_timestamp_{0};
 };
 
 } // namespace Cartrack
@@ -0,0 +1,186 @@
+#ifndef CAPTURE_GROUP_HPP
+#define CAPTURE_GROUP_HPP
+
+#include "Abstract_Capture_Backend.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+
+namespace Cartrack
+{
+
+struct Frame_Set_Member
+{
+		Multiplanar_Buffer_View planes;
+		std::chrono::nanoseconds timestamp{0};
+		uintmax_t frame_order = 0;
+};
+
+/**
+ * @brief Frames of every camera of a group, in the order the backends were given.
+ * Planes point to the backends' buffers, they are valid until the next
+ * Capture_Group::next_set call.
+ */
+struct Frame_Set
+{
+		std::vector<Frame_Set_Member> frames;
+		/**
+		 * @brief Newest minus oldest timestamp of the set.
+		 */
+		std::chrono::nanoseconds skew{0};
+};
+
+struct Sync_Statistics
+{
+		uintmax_t emitted_sets = 0;
+		/**
+		 * @brief Sets given up because a camera returned no frame or no match was
+		 * found within the attempt budget.
+		 */
+		uintmax_t failed_sets = 0;
+		std::vector<uintmax_t> dropped_frames;
+		std::chrono::nanoseconds max_skew{0};
+		std::chrono::nanoseconds total_skew{0};
+
+		[[nodiscard]] std::chrono::nanoseconds mean_skew() const
+		{
+				return emitted_sets ? total_skew / static_cast<std::chrono::nanoseconds::rep>(emitted_sets) : std::chrono::nanoseconds{0};
+		}
+};
+
+/**
+ * @brief Pulls from several backends and returns frames captured within a
+ * tolerance of each other, e.g. for stereo or surround view.
+ *
+ * A camera lagging behind the newest frame of the set by more than the tolerance
+ * drops its frame and pulls the next one, until all fit or the attempt budget is
+ * spent. Nothing is copied, each backend keeps owning the frame it returned.
+ * Backends must report comparable timestamps, which all V4L2 devices of a host
+ * do (CLOCK_MONOTONIC).
+ */
+class Capture_Group
+{
+	public:
+		Capture_Group(std::vector<std::shared_ptr<Capture_Backend>> backends,
+									std::chrono::nanoseconds tolerance,
+									unsigned int max_attempts_per_set = 8)
+				: _backends_(std::move(backends))
+				, _tolerance_(tolerance)
+				, _max_attempts_per_set_(max_attempts_per_set)
+		{
+				if(_backends_.empty())
+				{
+						throw std::runtime_error("Capture_Group needs at least one backend");
+				}
+				_statistics_.dropped_frames.resize(_backends_.size());
+				_current_.frames.resize(_backends_.size());
+		}
+
+		/**
+		 * @brief Next matched set, or nothing if a camera stopped delivering or the
+		 * cameras drifted apart more than the attempt budget can recover.
+		 */
+		[[nodiscard]] std::optional<Frame_Set> next_set()
+		{
+				for(std::size_t camera = 0; camera < _backends_.size(); ++camera)
+				{
+						if(not pull(camera))
+						{
+								++_statistics_.failed_sets;
+								return std::nullopt;
+						}
+				}
+
+				/* Every attempt replaces the lagging frames, its pulls are checked by the next round. */
+				for(unsigned int attempt = 0;; ++attempt)
+				{
+						const auto newest = std::max_element(_current_.frames.begin(),
+																								 _current_.frames.end(),
+																								 [](const auto& a, const auto& b)
+																								 { return a.timestamp < b.timestamp; })
+																		->timestamp;
+
+						bool matched = true;
+						for(const auto& member : _current_.frames)
+						{
+								matched = matched and newest - member.timestamp <= _tolerance_;
+						}
+
+						if(matched)
+						{
+								const auto oldest = std::min_element(_current_.frames.begin(),
+																										 _current_.frames.end(),
+																										 [](const auto& a, const auto& b)
+																										 { return a.timestamp < b.timestamp; })
+																				->timestamp;
+								_current_.skew = newest - oldest;
+
+								++_statistics_.emitted_sets;
+								_statistics_.total_skew += _current_.skew;
+								_statistics_.max_skew = std::max(_statistics_.max_skew, _current_.skew);
+								return _current_;
+						}
+						if(attempt == _max_attempts_per_set_)
+						{
+								break;
+						}
+
+						for(std::size_t camera = 0; camera < _backends_.size(); ++camera)
+						{
+								if(newest - _current_.frames[camera].timestamp <= _tolerance_)
+								{
+										continue;
+								}
+
+								++_statistics_.dropped_frames[camera];
+								if(not pull(camera))
+								{
+										++_statistics_.failed_sets;
+										return std::nullopt;
+								}
+						}
+				}
+
+				++_statistics_.failed_sets;
+				return std::nullopt;
+		}
+
+		[[nodiscard]] const Sync_Statistics& statistics() const
+		{
+				return _statistics_;
+		}
+
+		[[nodiscard]] std::size_t size() const
+		{
+				return _backends_.size();
+		}
+
+	private:
+		bool pull(std::size_t camera)
+		{
+				auto& backend = *_backends_[camera];
+				auto& member	= _current_.frames[camera];
+
+				member.planes = backend.get_frame_data();
+				if(member.planes.empty())
+				{
+						return false;
+				}
+				member.timestamp	 = backend.get_frame_timestamp();
+				member.frame_order = backend.get_frame_order();
+				return true;
+		}
+
+	private:
+		std::vector<std::shared_ptr<Capture_Backend>> _backends_;
+		std::chrono::nanoseconds _tolerance_;
+		unsigned int _max_attempts_per_set_;
+		Frame_Set _current_;
+		Sync_Statistics _statistics_;
+};
+
+} // namespace Cartrack
+
+#endif // CAPTURE_GROUP_HPP
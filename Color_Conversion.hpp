@@ -0,0 +1,1425 @@
+#ifndef COLOR_CONVERSION_HPP
+#define COLOR_CONVERSION_HPP
+
+#include "Image_View.hpp"
+#include "Row_Bands.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#if defined(__x86_64__) or defined(__i386__)
+#		include <immintrin.h>
+#		define CARTRACK_X86_KERNELS
+#elif defined(__ARM_NEON)
+#		include <arm_neon.h>
+#endif
+
+namespace Cartrack
+{
+
+/**
+ * @brief Implementations of the color conversions. They all compute the same
+ * fixed point formula and produce identical bytes, Scalar is the reference the
+ * others are checked against.
+ */
+enum class Color_Conversion_Kernel
+{
+		Scalar,
+		SSE4,
+		AVX2,
+		NEON
+};
+
+static constexpr std::array<Color_Conversion_Kernel, 4> color_conversion_kernels{Color_Conversion_Kernel::Scalar,
+																																								Color_Conversion_Kernel::SSE4,
+																																								Color_Conversion_Kernel::AVX2,
+																																								Color_Conversion_Kernel::NEON};
+
+[[nodiscard]] inline const char*
+color_conversion_kernel_name(Color_Conversion_Kernel kernel)
+{
+		switch(kernel)
+		{
+				case Color_Conversion_Kernel::Scalar:
+						return "scalar";
+				case Color_Conversion_Kernel::SSE4:
+						return "sse4";
+				case Color_Conversion_Kernel::AVX2:
+						return "avx2";
+				case Color_Conversion_Kernel::NEON:
+						return "neon";
+		}
+		return "unknown";
+}
+
+/**
+ * @brief Whether the kernel was compiled in and the CPU runs it. x86 kernels
+ * are always compiled and picked at run time, NEON is part of every ARMv8.
+ */
+[[nodiscard]] inline bool
+color_conversion_kernel_available(Color_Conversion_Kernel kernel)
+{
+		switch(kernel)
+		{
+				case Color_Conversion_Kernel::Scalar:
+						return true;
+#ifdef CARTRACK_X86_KERNELS
+				case Color_Conversion_Kernel::SSE4:
+						return __builtin_cpu_supports("sse4.1");
+				case Color_Conversion_Kernel::AVX2:
+						return __builtin_cpu_supports("avx2");
+#endif
+#ifdef __ARM_NEON
+				case Color_Conversion_Kernel::NEON:
+						return true;
+#endif
+				default:
+						return false;
+		}
+}
+
+[[nodiscard]] inline Color_Conversion_Kernel
+best_color_conversion_kernel()
+{
+		static const auto best = []
+		{
+				for(const auto kernel :
+						{Color_Conversion_Kernel::AVX2, Color_Conversion_Kernel::NEON, Color_Conversion_Kernel::SSE4})
+				{
+						if(color_conversion_kernel_available(kernel))
+						{
+								return kernel;
+						}
+				}
+				return Color_Conversion_Kernel::Scalar;
+		}();
+		return best;
+}
+
+/**
+ * @brief Formats convert_image writes. RGB targets are always full range, a
+ * GRAY8 target gets the range its layout says.
+ */
+static constexpr std::array<Pixel_Format, 4> color_conversion_targets{Pixel_Format::RGB24,
+																																			 Pixel_Format::BGR24,
+																																			 Pixel_Format::RGBA32,
+																																			 Pixel_Format::GRAY8};
+
+/**
+ * @brief Every uncompressed format converts to every target. MJPEG has to be
+ * decoded first.
+ */
+[[nodiscard]] constexpr bool
+color_conversion_supported(Pixel_Format source, Pixel_Format target)
+{
+		const auto& descriptor = describe(source);
+		return descriptor.valid() and not descriptor.compressed
+					 and std::find(color_conversion_targets.begin(), color_conversion_targets.end(), target)
+									 != color_conversion_targets.end();
+}
+
+namespace detail
+{
+
+/*
+ * Y'CbCr to R'G'B' with 6 fractional bits, the precision 16 bit SIMD lanes
+ * afford. For BT.601 limited range:
+ *
+ *   y' = (Y * 257 * 18997) >> 16		 74.5 * Y, 1.164 in Q6
+ *   R	= (y' - 1160 + 102 * V')>> 6				 1160 = 16 * 74.5 - 32 for rounding
+ *   G	= (y' - 1160 - 25 * U' - 52 * V') >> 6
+ *   B	= (y' - 1160 + 129 * U') >> 6
+ *
+ * with U' = U - 128, V' = V - 128, each clamped to 0..255. Full range scales Y
+ * by 1.0 (16320 gives 64 * Y - 1) and has no black level, BT.709 only changes
+ * the chroma factors. In every combination only the R and B sums can leave
+ * int16, and only above 255 << 6, so saturating adds in the SIMD kernels clamp
+ * to the same byte as the int arithmetic of the reference.
+ */
+struct Yuv_Coefficients
+{
+		int luma_scale	 = 0;
+		int luma_offset	 = 0;
+		int red_from_v	 = 0;
+		int green_from_u = 0;
+		int green_from_v = 0;
+		int blue_from_u	 = 0;
+};
+
+static constexpr int Fraction_Bits = 6;
+
+[[nodiscard]] constexpr Yuv_Coefficients
+yuv_coefficients(const Color_Encoding& encoding)
+{
+		const bool limited = encoding.range == Quantization_Range::Limited;
+		if(encoding.ycbcr_encoding == Ycbcr_Encoding::BT709)
+		{
+				return limited ? Yuv_Coefficients{18997, 1160, 115, 14, 34, 135}
+											 : Yuv_Coefficients{16320, -32, 101, 12, 30, 119};
+		}
+		return limited ? Yuv_Coefficients{18997, 1160, 102, 25, 52, 129} : Yuv_Coefficients{16320, -32, 90, 22, 46, 113};
+}
+
+/**
+ * @brief Where the samples of a Y'CbCr row are. Semi_Planar is NV12 (u and v
+ * point into one interleaved row), Planar is 422P, Packed is YUYV (all three
+ * point into the same row).
+ */
+enum class Yuv_Layout
+{
+		Semi_Planar,
+		Planar,
+		Packed
+};
+
+enum class Rgb_Order
+{
+		RGB,
+		BGR,
+		RGBA
+};
+
+struct Yuv_Row
+{
+		const uint8_t* luma = nullptr;
+		const uint8_t* u		= nullptr;
+		const uint8_t* v		= nullptr;
+};
+
+template <Yuv_Layout Layout>
+static constexpr uint32_t Luma_Step = Layout == Yuv_Layout::Packed ? 2 : 1;
+
+template <Yuv_Layout Layout>
+static constexpr uint32_t Chroma_Step = Layout == Yuv_Layout::Planar ? 1 : Layout == Yuv_Layout::Semi_Planar ? 2 : 4;
+
+template <Rgb_Order Order>
+static constexpr uint32_t Pixel_Bytes = Order == Rgb_Order::RGBA ? 4 : 3;
+
+inline uint8_t
+clamp_pixel(int value)
+{
+		return static_cast<uint8_t>(std::clamp(value >> Fraction_Bits, 0, 255));
+}
+
+/**
+ * @brief Converts pixels [begin, width) of one row, the tail the SIMD kernels
+ * leave and the whole row for the reference.
+ */
+template <Yuv_Layout Layout, Rgb_Order Order>
+inline void
+yuv_row_to_rgb_scalar(const Yuv_Row& row,
+											uint8_t* target,
+											uint32_t begin,
+											uint32_t width,
+											const Yuv_Coefficients& coefficients)
+{
+		constexpr int red	 = Order == Rgb_Order::BGR ? 2 : 0;
+		constexpr int blue = Order == Rgb_Order::BGR ? 0 : 2;
+		for(uint32_t x = begin; x < width; ++x)
+		{
+				const int y = static_cast<int>((uint32_t(row.luma[x * Luma_Step<Layout>]) * 257u
+																				* static_cast<uint32_t>(coefficients.luma_scale))
+																			 >> 16)
+											- coefficients.luma_offset;
+				const int u = row.u[x / 2 * Chroma_Step<Layout>] - 128;
+				const int v = row.v[x / 2 * Chroma_Step<Layout>] - 128;
+
+				uint8_t* pixel = target + Pixel_Bytes<Order> * std::size_t(x);
+				pixel[red]		 = clamp_pixel(y + coefficients.red_from_v * v);
+				pixel[1]			 = clamp_pixel(y - coefficients.green_from_u * u - coefficients.green_from_v * v);
+				pixel[blue]		 = clamp_pixel(y + coefficients.blue_from_u * u);
+				if constexpr(Order == Rgb_Order::RGBA)
+				{
+						pixel[3] = 255;
+				}
+		}
+}
+
+#ifdef CARTRACK_X86_KERNELS
+
+/**
+ * @brief pshufb masks interleaving 16 bytes of each channel into 48 bytes of
+ * packed pixels: mask[block][channel] picks the bytes of that channel going to
+ * output block.
+ */
+static constexpr auto interleave_masks = []
+{
+		std::array<std::array<std::array<int8_t, 16>, 3>, 3> masks{};
+		for(int block = 0; block < 3; ++block)
+		{
+				for(int byte = 0; byte < 16; ++byte)
+				{
+						const int output = 16 * block + byte;
+						for(int channel = 0; channel < 3; ++channel)
+						{
+								masks[block][channel][byte] = output % 3 == channel ? static_cast<int8_t>(output / 3) : int8_t(-128);
+						}
+				}
+		}
+		return masks;
+}();
+
+__attribute__((target("sse4.1"))) inline void
+store_interleaved(uint8_t* target, __m128i first, __m128i second, __m128i third)
+{
+		for(int block = 0; block < 3; ++block)
+		{
+				const auto& masks = interleave_masks[block];
+				const auto a			= _mm_shuffle_epi8(first, _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks[0].data())));
+				const auto b			= _mm_shuffle_epi8(second, _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks[1].data())));
+				const auto c			= _mm_shuffle_epi8(third, _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks[2].data())));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(target + 16 * block), _mm_or_si128(_mm_or_si128(a, b), c));
+		}
+}
+
+/**
+ * @brief Stores 16 pixels given as one register per channel.
+ */
+template <Rgb_Order Order>
+__attribute__((target("sse4.1"))) inline void
+store_pixels(uint8_t* target, __m128i red, __m128i green, __m128i blue)
+{
+		if constexpr(Order == Rgb_Order::RGBA)
+		{
+				const auto alpha					= _mm_set1_epi8(-1);
+				const __m128i red_green[]	= {_mm_unpacklo_epi8(red, green), _mm_unpackhi_epi8(red, green)};
+				const __m128i blue_alpha[] = {_mm_unpacklo_epi8(blue, alpha), _mm_unpackhi_epi8(blue, alpha)};
+				for(int half = 0; half < 2; ++half)
+				{
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(target + 32 * half),
+														 _mm_unpacklo_epi16(red_green[half], blue_alpha[half]));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(target + 32 * half + 16),
+														 _mm_unpackhi_epi16(red_green[half], blue_alpha[half]));
+				}
+		}
+		else if constexpr(Order == Rgb_Order::BGR)
+		{
+				store_interleaved(target, blue, green, red);
+		}
+		else
+		{
+				store_interleaved(target, red, green, blue);
+		}
+}
+
+/**
+ * @brief Loads the 16 luma bytes of pixels [x, x + 16) and the 8 U and V
+ * samples they share, zero extended to 16 bit lanes.
+ */
+template <Yuv_Layout Layout>
+__attribute__((target("sse4.1"))) inline void
+load_yuv(const Yuv_Row& row, uint32_t x, __m128i& luma, __m128i& u, __m128i& v)
+{
+		const auto low_bytes = _mm_set1_epi16(0x00ff);
+		if constexpr(Layout == Yuv_Layout::Planar)
+		{
+				luma = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row.luma + x));
+				u		 = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row.u + x / 2)));
+				v		 = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row.v + x / 2)));
+		}
+		else
+		{
+				__m128i uv;
+				if constexpr(Layout == Yuv_Layout::Packed)
+				{
+						/* Y U Y V: luma in the even bytes, the chroma pairs in the odd ones. */
+						const auto first	= _mm_loadu_si128(reinterpret_cast<const __m128i*>(row.luma + 2 * x));
+						const auto second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row.luma + 2 * x + 16));
+						luma = _mm_packus_epi16(_mm_and_si128(first, low_bytes), _mm_and_si128(second, low_bytes));
+						uv	 = _mm_packus_epi16(_mm_srli_epi16(first, 8), _mm_srli_epi16(second, 8));
+				}
+				else
+				{
+						luma = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row.luma + x));
+						uv	 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row.u + x));
+				}
+				u = _mm_and_si128(uv, low_bytes);
+				v = _mm_srli_epi16(uv, 8);
+		}
+}
+
+template <Yuv_Layout Layout, Rgb_Order Order>
+__attribute__((target("sse4.1"))) inline void
+yuv_row_to_rgb_sse4(const Yuv_Row& row, uint8_t* target, uint32_t width, const Yuv_Coefficients& coefficients)
+{
+		const auto luma_scale		= _mm_set1_epi16(static_cast<int16_t>(coefficients.luma_scale));
+		const auto luma_offset	= _mm_set1_epi16(static_cast<int16_t>(coefficients.luma_offset));
+		const auto chroma_bias	= _mm_set1_epi16(128);
+		const auto red_from_v		= _mm_set1_epi16(static_cast<int16_t>(coefficients.red_from_v));
+		const auto green_from_u = _mm_set1_epi16(static_cast<int16_t>(coefficients.green_from_u));
+		const auto green_from_v = _mm_set1_epi16(static_cast<int16_t>(coefficients.green_from_v));
+		const auto blue_from_u	= _mm_set1_epi16(static_cast<int16_t>(coefficients.blue_from_u));
+
+		uint32_t x = 0;
+		for(; x + 16 <= width; x += 16)
+		{
+				__m128i y_bytes, u, v;
+				load_yuv<Layout>(row, x, y_bytes, u, v);
+
+				/* 8 chroma pairs, each shared by two pixels. */
+				u										= _mm_sub_epi16(u, chroma_bias);
+				v										= _mm_sub_epi16(v, chroma_bias);
+				const auto red_term = _mm_mullo_epi16(v, red_from_v);
+				const auto green_term =
+						_mm_add_epi16(_mm_mullo_epi16(u, green_from_u), _mm_mullo_epi16(v, green_from_v));
+				const auto blue_term = _mm_mullo_epi16(u, blue_from_u);
+
+				__m128i red[2], green[2], blue[2];
+				for(int half = 0; half < 2; ++half)
+				{
+						/* Y * 257 is Y in both bytes of a lane. */
+						const auto y_wide = half == 0 ? _mm_unpacklo_epi8(y_bytes, y_bytes) : _mm_unpackhi_epi8(y_bytes, y_bytes);
+						const auto y			= _mm_sub_epi16(_mm_mulhi_epu16(y_wide, luma_scale), luma_offset);
+						const auto r			= half == 0 ? _mm_unpacklo_epi16(red_term, red_term) : _mm_unpackhi_epi16(red_term, red_term);
+						const auto g = half == 0 ? _mm_unpacklo_epi16(green_term, green_term)
+																		 : _mm_unpackhi_epi16(green_term, green_term);
+						const auto b = half == 0 ? _mm_unpacklo_epi16(blue_term, blue_term)
+																		 : _mm_unpackhi_epi16(blue_term, blue_term);
+						red[half]		 = _mm_srai_epi16(_mm_adds_epi16(y, r), Fraction_Bits);
+						green[half]	 = _mm_srai_epi16(_mm_subs_epi16(y, g), Fraction_Bits);
+						blue[half]	 = _mm_srai_epi16(_mm_adds_epi16(y, b), Fraction_Bits);
+				}
+				store_pixels<Order>(target + Pixel_Bytes<Order> * std::size_t(x),
+														_mm_packus_epi16(red[0], red[1]),
+														_mm_packus_epi16(green[0], green[1]),
+														_mm_packus_epi16(blue[0], blue[1]));
+		}
+		yuv_row_to_rgb_scalar<Layout, Order>(row, target, x, width, coefficients);
+}
+
+/**
+ * @brief 8 chroma samples to 16 lanes, each sample twice.
+ */
+__attribute__((target("avx2"))) inline __m256i
+spread_chroma(__m128i samples)
+{
+		return _mm256_inserti128_si256(
+				_mm256_castsi128_si256(_mm_unpacklo_epi16(samples, samples)), _mm_unpackhi_epi16(samples, samples), 1);
+}
+
+template <Yuv_Layout Layout, Rgb_Order Order>
+__attribute__((target("avx2"))) inline void
+yuv_row_to_rgb_avx2(const Yuv_Row& row, uint8_t* target, uint32_t width, const Yuv_Coefficients& coefficients)
+{
+		const auto luma_scale		= _mm256_set1_epi16(static_cast<int16_t>(coefficients.luma_scale));
+		const auto luma_offset	= _mm256_set1_epi16(static_cast<int16_t>(coefficients.luma_offset));
+		const auto chroma_bias	= _mm256_set1_epi16(128);
+		const auto red_from_v		= _mm256_set1_epi16(static_cast<int16_t>(coefficients.red_from_v));
+		const auto green_from_u = _mm256_set1_epi16(static_cast<int16_t>(coefficients.green_from_u));
+		const auto green_from_v = _mm256_set1_epi16(static_cast<int16_t>(coefficients.green_from_v));
+		const auto blue_from_u	= _mm256_set1_epi16(static_cast<int16_t>(coefficients.blue_from_u));
+
+		uint32_t x = 0;
+		for(; x + 16 <= width; x += 16)
+		{
+				__m128i y_bytes, u_pairs, v_pairs;
+				load_yuv<Layout>(row, x, y_bytes, u_pairs, v_pairs);
+
+				/* Widened in pixel order, each chroma sample spread over both its pixels. */
+				const auto u			= _mm256_sub_epi16(spread_chroma(u_pairs), chroma_bias);
+				const auto v			= _mm256_sub_epi16(spread_chroma(v_pairs), chroma_bias);
+				const auto y_wide = _mm256_cvtepu8_epi16(y_bytes);
+
+				const auto y = _mm256_sub_epi16(
+						_mm256_mulhi_epu16(_mm256_or_si256(y_wide, _mm256_slli_epi16(y_wide, 8)), luma_scale), luma_offset);
+				const auto red	 = _mm256_srai_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(v, red_from_v)), Fraction_Bits);
+				const auto green = _mm256_srai_epi16(
+						_mm256_subs_epi16(
+								y, _mm256_add_epi16(_mm256_mullo_epi16(u, green_from_u), _mm256_mullo_epi16(v, green_from_v))),
+						Fraction_Bits);
+				const auto blue = _mm256_srai_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(u, blue_from_u)), Fraction_Bits);
+
+				store_pixels<Order>(target + Pixel_Bytes<Order> * std::size_t(x),
+														_mm_packus_epi16(_mm256_castsi256_si128(red), _mm256_extracti128_si256(red, 1)),
+														_mm_packus_epi16(_mm256_castsi256_si128(green), _mm256_extracti128_si256(green, 1)),
+														_mm_packus_epi16(_mm256_castsi256_si128(blue), _mm256_extracti128_si256(blue, 1)));
+		}
+		yuv_row_to_rgb_scalar<Layout, Order>(row, target, x, width, coefficients);
+}
+
+#endif
+
+#ifdef __ARM_NEON
+
+/**
+ * @brief Loads the 16 luma bytes of pixels [x, x + 16) and the 8 U and V
+ * samples they share.
+ */
+template <Yuv_Layout Layout>
+inline void
+load_yuv(const Yuv_Row& row, uint32_t x, uint8x16_t& luma, uint8x8_t& u, uint8x8_t& v)
+{
+		if constexpr(Layout == Yuv_Layout::Planar)
+		{
+				luma = vld1q_u8(row.luma + x);
+				u		 = vld1_u8(row.u + x / 2);
+				v		 = vld1_u8(row.v + x / 2);
+		}
+		else if constexpr(Layout == Yuv_Layout::Packed)
+		{
+				/* val[0] and val[2] are the even and odd pixels of Y U Y V. */
+				const auto yuyv = vld4_u8(row.luma + 2 * x);
+				const auto y		= vzip_u8(yuyv.val[0], yuyv.val[2]);
+				luma						= vcombine_u8(y.val[0], y.val[1]);
+				u								= yuyv.val[1];
+				v								= yuyv.val[3];
+		}
+		else
+		{
+				luma					= vld1q_u8(row.luma + x);
+				const auto uv = vld2_u8(row.u + x);
+				u							= uv.val[0];
+				v							= uv.val[1];
+		}
+}
+
+/**
+ * @brief Loads 16 pixels as one register per channel, alpha is dropped.
+ */
+template <Rgb_Order Order>
+inline void
+load_pixels(const uint8_t* source, uint8x16_t& red, uint8x16_t& green, uint8x16_t& blue)
+{
+		if constexpr(Order == Rgb_Order::RGBA)
+		{
+				const auto pixels = vld4q_u8(source);
+				red								= pixels.val[0];
+				green							= pixels.val[1];
+				blue							= pixels.val[2];
+		}
+		else
+		{
+				const auto pixels = vld3q_u8(source);
+				red								= pixels.val[Order == Rgb_Order::BGR ? 2 : 0];
+				green							= pixels.val[1];
+				blue							= pixels.val[Order == Rgb_Order::BGR ? 0 : 2];
+		}
+}
+
+/**
+ * @brief Stores 16 pixels given as one register per channel.
+ */
+template <Rgb_Order Order>
+inline void
+store_pixels(uint8_t* target, uint8x16_t red, uint8x16_t green, uint8x16_t blue)
+{
+		if constexpr(Order == Rgb_Order::RGBA)
+		{
+				vst4q_u8(target, uint8x16x4_t{{red, green, blue, vdupq_n_u8(255)}});
+		}
+		else if constexpr(Order == Rgb_Order::BGR)
+		{
+				vst3q_u8(target, uint8x16x3_t{{blue, green, red}});
+		}
+		else
+		{
+				vst3q_u8(target, uint8x16x3_t{{red, green, blue}});
+		}
+}
+
+/**
+ * @brief Unsigned high half of the product, what _mm_mulhi_epu16 gives.
+ */
+inline uint16x8_t
+mulhi_u16(uint16x8_t a, uint16x8_t b)
+{
+		const auto low	= vmull_u16(vget_low_u16(a), vget_low_u16(b));
+		const auto high = vmull_u16(vget_high_u16(a), vget_high_u16(b));
+		return vcombine_u16(vshrn_n_u32(low, 16), vshrn_n_u32(high, 16));
+}
+
+template <Yuv_Layout Layout, Rgb_Order Order>
+inline void
+yuv_row_to_rgb_neon(const Yuv_Row& row, uint8_t* target, uint32_t width, const Yuv_Coefficients& coefficients)
+{
+		const auto luma_scale		= vdupq_n_u16(static_cast<uint16_t>(coefficients.luma_scale));
+		const auto luma_offset	= vdupq_n_s16(static_cast<int16_t>(coefficients.luma_offset));
+		const auto chroma_bias	= vdupq_n_s16(128);
+		const auto red_from_v		= vdupq_n_s16(static_cast<int16_t>(coefficients.red_from_v));
+		const auto green_from_u = vdupq_n_s16(static_cast<int16_t>(coefficients.green_from_u));
+		const auto green_from_v = vdupq_n_s16(static_cast<int16_t>(coefficients.green_from_v));
+		const auto blue_from_u	= vdupq_n_s16(static_cast<int16_t>(coefficients.blue_from_u));
+
+		uint32_t x = 0;
+		for(; x + 16 <= width; x += 16)
+		{
+				uint8x16_t y_bytes;
+				uint8x8_t u_bytes, v_bytes;
+				load_yuv<Layout>(row, x, y_bytes, u_bytes, v_bytes);
+				const auto u					= vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u_bytes)), chroma_bias);
+				const auto v					= vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v_bytes)), chroma_bias);
+				const auto red_term		= vmulq_s16(v, red_from_v);
+				const auto green_term = vmlaq_s16(vmulq_s16(u, green_from_u), v, green_from_v);
+				const auto blue_term	= vmulq_s16(u, blue_from_u);
+
+				int16x8_t red[2], green[2], blue[2];
+				for(int half = 0; half < 2; ++half)
+				{
+						const auto y8			= half == 0 ? vget_low_u8(y_bytes) : vget_high_u8(y_bytes);
+						const auto y_wide = vorrq_u16(vmovl_u8(y8), vshll_n_u8(y8, 8));
+						const auto y			= vsubq_s16(vreinterpretq_s16_u16(mulhi_u16(y_wide, luma_scale)), luma_offset);
+
+						const auto r = vzipq_s16(red_term, red_term).val[half];
+						const auto g = vzipq_s16(green_term, green_term).val[half];
+						const auto b = vzipq_s16(blue_term, blue_term).val[half];
+						red[half]		 = vqaddq_s16(y, r);
+						green[half]	 = vqsubq_s16(y, g);
+						blue[half]	 = vqaddq_s16(y, b);
+				}
+
+				/* Saturating narrowing shift, the arithmetic shift and clamp of the reference. */
+				const auto r8 = vcombine_u8(vqshrun_n_s16(red[0], Fraction_Bits), vqshrun_n_s16(red[1], Fraction_Bits));
+				const auto g8 = vcombine_u8(vqshrun_n_s16(green[0], Fraction_Bits), vqshrun_n_s16(green[1], Fraction_Bits));
+				const auto b8 = vcombine_u8(vqshrun_n_s16(blue[0], Fraction_Bits), vqshrun_n_s16(blue[1], Fraction_Bits));
+				store_pixels<Order>(target + Pixel_Bytes<Order> * std::size_t(x), r8, g8, b8);
+		}
+		yuv_row_to_rgb_scalar<Layout, Order>(row, target, x, width, coefficients);
+}
+
+#endif
+
+template <Yuv_Layout Layout, Rgb_Order Order>
+inline void
+yuv_row_to_rgb(Color_Conversion_Kernel kernel,
+							 const Yuv_Row& row,
+							 uint8_t* target,
+							 uint32_t width,
+							 const Yuv_Coefficients& coefficients)
+{
+		switch(kernel)
+		{
+#ifdef CARTRACK_X86_KERNELS
+				case Color_Conversion_Kernel::SSE4:
+						yuv_row_to_rgb_sse4<Layout, Order>(row, target, width, coefficients);
+						return;
+				case Color_Conversion_Kernel::AVX2:
+						yuv_row_to_rgb_avx2<Layout, Order>(row, target, width, coefficients);
+						return;
+#endif
+#ifdef __ARM_NEON
+				case Color_Conversion_Kernel::NEON:
+						yuv_row_to_rgb_neon<Layout, Order>(row, target, width, coefficients);
+						return;
+#endif
+				default:
+						yuv_row_to_rgb_scalar<Layout, Order>(row, target, 0, width, coefficients);
+						return;
+		}
+}
+
+/**
+ * @brief How luma codes change between the range of the source and the one of
+ * a GRAY8 target. Expand goes through the luma part of the Y'CbCr formula, so
+ * GRAY8 matches the RGB targets of a neutral pixel.
+ */
+enum class Range_Mapping
+{
+		Identity,
+		Expand,
+		Compress
+};
+
+[[nodiscard]] inline Range_Mapping
+range_mapping(Quantization_Range from, Quantization_Range to)
+{
+		return from == to ? Range_Mapping::Identity
+					 : to == Quantization_Range::Full ? Range_Mapping::Expand
+																						: Range_Mapping::Compress;
+}
+
+template <Range_Mapping Mapping>
+inline uint8_t
+map_luma(uint32_t code)
+{
+		if constexpr(Mapping == Range_Mapping::Expand)
+		{
+				constexpr auto limited = yuv_coefficients({Ycbcr_Encoding::BT601, Quantization_Range::Limited});
+				return clamp_pixel(static_cast<int>((code * 257u * static_cast<uint32_t>(limited.luma_scale)) >> 16)
+													 - limited.luma_offset);
+		}
+		else if constexpr(Mapping == Range_Mapping::Compress)
+		{
+				return static_cast<uint8_t>(16 + (code * 219 + 127) / 255);
+		}
+		else
+		{
+				return static_cast<uint8_t>(code);
+		}
+}
+
+[[nodiscard]] inline Rgb_Order
+rgb_order(Pixel_Format px_format)
+{
+		return px_format == Pixel_Format::BGR24 ? Rgb_Order::BGR
+					 : px_format == Pixel_Format::RGBA32 ? Rgb_Order::RGBA
+																							 : Rgb_Order::RGB;
+}
+
+/**
+ * @brief Calls function with the Rgb_Order as a compile time constant.
+ */
+template <typename Function>
+inline void
+with_rgb_order(Rgb_Order order, Function&& function)
+{
+		switch(order)
+		{
+				case Rgb_Order::RGB:
+						function(std::integral_constant<Rgb_Order, Rgb_Order::RGB>{});
+						return;
+				case Rgb_Order::BGR:
+						function(std::integral_constant<Rgb_Order, Rgb_Order::BGR>{});
+						return;
+				case Rgb_Order::RGBA:
+						function(std::integral_constant<Rgb_Order, Rgb_Order::RGBA>{});
+						return;
+		}
+}
+
+template <typename Function>
+inline void
+with_range_mapping(Range_Mapping mapping, Function&& function)
+{
+		switch(mapping)
+		{
+				case Range_Mapping::Identity:
+						function(std::integral_constant<Range_Mapping, Range_Mapping::Identity>{});
+						return;
+				case Range_Mapping::Expand:
+						function(std::integral_constant<Range_Mapping, Range_Mapping::Expand>{});
+						return;
+				case Range_Mapping::Compress:
+						function(std::integral_constant<Range_Mapping, Range_Mapping::Compress>{});
+						return;
+		}
+}
+
+template <Range_Mapping Mapping, uint32_t Step>
+inline void
+luma_row_to_gray(const uint8_t* luma, uint8_t* gray, uint32_t width)
+{
+		for(uint32_t x = 0; x < width; ++x)
+		{
+				gray[x] = map_luma<Mapping>(luma[x * Step]);
+		}
+}
+
+inline void
+convert_yuv(const Image_View& source, const Image_View& target, Color_Conversion_Kernel kernel)
+{
+		const auto& descriptor = describe(source.pixel_format);
+		const auto row_at			 = [&](uint32_t y) -> Yuv_Row
+		{
+				const auto* luma = source.plane(0).row(y);
+				switch(source.pixel_format)
+				{
+						case Pixel_Format::YUYV422:
+								return {luma, luma + 1, luma + 3};
+						case Pixel_Format::YUV422P:
+								return {luma, source.plane(1).row(y), source.plane(2).row(y)};
+						default:
+						{
+								const auto* chroma = source.plane(1).row(y / descriptor.planes[1].vertical_subsampling);
+								return {luma, chroma, chroma + 1};
+						}
+				}
+		};
+
+		if(target.pixel_format == Pixel_Format::GRAY8)
+		{
+				const bool packed = source.pixel_format == Pixel_Format::YUYV422;
+				with_range_mapping(range_mapping(source.color_encoding.range, target.color_encoding.range),
+													 [&](auto mapping)
+													 {
+															 constexpr auto Mapping = decltype(mapping)::value;
+															 for(uint32_t y = 0; y < source.height; ++y)
+															 {
+																	 if(packed)
+																	 {
+																			 luma_row_to_gray<Mapping, 2>(
+																					 source.plane(0).row(y), target.plane(0).row(y), source.width);
+																	 }
+																	 else
+																	 {
+																			 luma_row_to_gray<Mapping, 1>(
+																					 source.plane(0).row(y), target.plane(0).row(y), source.width);
+																	 }
+															 }
+													 });
+				return;
+		}
+
+		const auto coefficients = yuv_coefficients(source.color_encoding);
+		const auto convert_rows = [&]<Yuv_Layout Layout>(auto order)
+		{
+				for(uint32_t y = 0; y < source.height; ++y)
+				{
+						yuv_row_to_rgb<Layout, decltype(order)::value>(
+								kernel, row_at(y), target.plane(0).row(y), source.width, coefficients);
+				}
+		};
+		with_rgb_order(rgb_order(target.pixel_format),
+									 [&](auto order)
+									 {
+											 switch(source.pixel_format)
+											 {
+													 case Pixel_Format::YUYV422:
+															 convert_rows.template operator()<Yuv_Layout::Packed>(order);
+															 return;
+													 case Pixel_Format::YUV422P:
+															 convert_rows.template operator()<Yuv_Layout::Planar>(order);
+															 return;
+													 default:
+															 convert_rows.template operator()<Yuv_Layout::Semi_Planar>(order);
+															 return;
+											 }
+									 });
+}
+
+/**
+ * @brief Reorders the channels of packed R'G'B' pixels [begin, width) and
+ * makes alpha opaque. Equal formats never get here, they are copied.
+ */
+template <Rgb_Order From, Rgb_Order To>
+inline void
+rgb_row_to_rgb_scalar(const uint8_t* source, uint8_t* target, uint32_t begin, uint32_t width)
+{
+		constexpr int from_red	= From == Rgb_Order::BGR ? 2 : 0;
+		constexpr int from_blue = From == Rgb_Order::BGR ? 0 : 2;
+		constexpr int to_red		= To == Rgb_Order::BGR ? 2 : 0;
+		constexpr int to_blue		= To == Rgb_Order::BGR ? 0 : 2;
+		for(uint32_t x = begin; x < width; ++x)
+		{
+				const uint8_t* in		= source + Pixel_Bytes<From> * std::size_t(x);
+				uint8_t* out				= target + Pixel_Bytes<To> * std::size_t(x);
+				const uint8_t red		= in[from_red];
+				const uint8_t green = in[1];
+				const uint8_t blue	= in[from_blue];
+				out[to_red]					= red;
+				out[1]							= green;
+				out[to_blue]				= blue;
+				if constexpr(To == Rgb_Order::RGBA)
+				{
+						out[3] = 255;
+				}
+		}
+}
+
+/**
+ * @brief Luma weights of the matrix in Q8, each set sums to 256.
+ */
+[[nodiscard]] constexpr std::array<uint32_t, 3>
+luma_weights(Ycbcr_Encoding ycbcr_encoding)
+{
+		return ycbcr_encoding == Ycbcr_Encoding::BT709 ? std::array<uint32_t, 3>{54, 183, 19}
+																									 : std::array<uint32_t, 3>{77, 150, 29};
+}
+
+/**
+ * @brief Calls function with the Ycbcr_Encoding as a compile time constant.
+ */
+template <typename Function>
+inline void
+with_ycbcr_encoding(Ycbcr_Encoding ycbcr_encoding, Function&& function)
+{
+		switch(ycbcr_encoding)
+		{
+				case Ycbcr_Encoding::BT601:
+						function(std::integral_constant<Ycbcr_Encoding, Ycbcr_Encoding::BT601>{});
+						return;
+				case Ycbcr_Encoding::BT709:
+						function(std::integral_constant<Ycbcr_Encoding, Ycbcr_Encoding::BT709>{});
+						return;
+		}
+}
+
+/**
+ * @brief Gray codes of pixels [begin, width). A white pixel sums to
+ * 255 * 256 + 128, so the SIMD kernels compute the same sum in 16 bit lanes.
+ */
+template <Rgb_Order From, Ycbcr_Encoding Encoding, Range_Mapping Mapping>
+inline void
+rgb_row_to_gray_scalar(const uint8_t* source, uint8_t* gray, uint32_t begin, uint32_t width)
+{
+		constexpr auto weights = luma_weights(Encoding);
+		constexpr int red			 = From == Rgb_Order::BGR ? 2 : 0;
+		constexpr int blue		 = From == Rgb_Order::BGR ? 0 : 2;
+		for(uint32_t x = begin; x < width; ++x)
+		{
+				const uint8_t* pixel = source + Pixel_Bytes<From> * std::size_t(x);
+				gray[x] = map_luma<Mapping>((weights[0] * pixel[red] + weights[1] * pixel[1] + weights[2] * pixel[blue] + 128)
+																		>> 8);
+		}
+}
+
+#ifdef CARTRACK_X86_KERNELS
+
+/**
+ * @brief pshufb masks gathering 16 bytes of each channel from 48 bytes of
+ * packed pixels, the inverse of interleave_masks: mask[block][channel] picks
+ * the bytes of that channel in input block.
+ */
+static constexpr auto deinterleave_masks = []
+{
+		std::array<std::array<std::array<int8_t, 16>, 3>, 3> masks{};
+		for(int block = 0; block < 3; ++block)
+		{
+				for(int channel = 0; channel < 3; ++channel)
+				{
+						for(int pixel = 0; pixel < 16; ++pixel)
+						{
+								const int input								= 3 * pixel + channel;
+								masks[block][channel][pixel] = input / 16 == block ? static_cast<int8_t>(input % 16) : int8_t(-128);
+						}
+				}
+		}
+		return masks;
+}();
+
+__attribute__((target("sse4.1"))) inline void
+load_interleaved(const uint8_t* source, __m128i& first, __m128i& second, __m128i& third)
+{
+		__m128i channels[3] = {_mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128()};
+		for(int block = 0; block < 3; ++block)
+		{
+				const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16 * block));
+				for(int channel = 0; channel < 3; ++channel)
+				{
+						const auto mask		= _mm_loadu_si128(reinterpret_cast<const __m128i*>(deinterleave_masks[block][channel].data()));
+						channels[channel] = _mm_or_si128(channels[channel], _mm_shuffle_epi8(bytes, mask));
+				}
+		}
+		first	 = channels[0];
+		second = channels[1];
+		third	 = channels[2];
+}
+
+/**
+ * @brief Loads 16 pixels as one register per channel, alpha is dropped.
+ */
+template <Rgb_Order Order>
+__attribute__((target("sse4.1"))) inline void
+load_pixels(const uint8_t* source, __m128i& red, __m128i& green, __m128i& blue)
+{
+		if constexpr(Order == Rgb_Order::RGBA)
+		{
+				/* Every 4 pixels to r r r r g g g g b b b b a a a a, then a 4x4 transpose of 32 bit words. */
+				const auto by_channel = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+				__m128i blocks[4];
+				for(int block = 0; block < 4; ++block)
+				{
+						blocks[block] =
+								_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16 * block)), by_channel);
+				}
+				const auto red_green_low	 = _mm_unpacklo_epi32(blocks[0], blocks[1]);
+				const auto red_green_high	 = _mm_unpacklo_epi32(blocks[2], blocks[3]);
+				const auto blue_alpha_low	 = _mm_unpackhi_epi32(blocks[0], blocks[1]);
+				const auto blue_alpha_high = _mm_unpackhi_epi32(blocks[2], blocks[3]);
+				red												 = _mm_unpacklo_epi64(red_green_low, red_green_high);
+				green											 = _mm_unpackhi_epi64(red_green_low, red_green_high);
+				blue											 = _mm_unpacklo_epi64(blue_alpha_low, blue_alpha_high);
+		}
+		else if constexpr(Order == Rgb_Order::BGR)
+		{
+				load_interleaved(source, blue, green, red);
+		}
+		else
+		{
+				load_interleaved(source, red, green, blue);
+		}
+}
+
+/**
+ * @brief AVX2 runs this one too, the shuffles of 16 pixels already outpace
+ * the memory they move.
+ */
+template <Rgb_Order From, Rgb_Order To>
+__attribute__((target("sse4.1"))) inline void
+rgb_row_to_rgb_sse4(const uint8_t* source, uint8_t* target, uint32_t width)
+{
+		uint32_t x = 0;
+		if constexpr(Pixel_Bytes<From> == 3 and Pixel_Bytes<To> == 3)
+		{
+				/* Swapping red and blue leaves pixels in place: 5 per shuffle, the 16th byte is rewritten by the next store. */
+				const auto swap = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+				for(; x + 6 <= width; x += 5)
+				{
+						const auto pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 3 * std::size_t(x)));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(target + 3 * std::size_t(x)), _mm_shuffle_epi8(pixels, swap));
+				}
+		}
+		else if constexpr(To == Rgb_Order::RGBA)
+		{
+				/* 4 pixels per shuffle, zeroing the alpha bytes for the opaque ones. */
+				const auto spread = From == Rgb_Order::BGR
+																? _mm_setr_epi8(2, 1, 0, -128, 5, 4, 3, -128, 8, 7, 6, -128, 11, 10, 9, -128)
+																: _mm_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128);
+				const auto opaque = _mm_set1_epi32(static_cast<int>(0xff000000u));
+				for(; x + 6 <= width; x += 4)
+				{
+						const auto pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 3 * std::size_t(x)));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(target + 4 * std::size_t(x)),
+														 _mm_or_si128(_mm_shuffle_epi8(pixels, spread), opaque));
+				}
+		}
+		else
+		{
+				for(; x + 16 <= width; x += 16)
+				{
+						__m128i red, green, blue;
+						load_pixels<From>(source + Pixel_Bytes<From> * std::size_t(x), red, green, blue);
+						store_pixels<To>(target + Pixel_Bytes<To> * std::size_t(x), red, green, blue);
+				}
+		}
+		rgb_row_to_rgb_scalar<From, To>(source, target, x, width);
+}
+
+/**
+ * @brief map_luma of codes in 16 bit lanes, the clamp is left to the
+ * saturating pack. Compress divides by 255 as (n * 0x8081) >> 23, which is
+ * exact for every n below 65536.
+ */
+template <Range_Mapping Mapping>
+__attribute__((target("sse4.1"))) inline __m128i
+map_luma_sse4(__m128i code)
+{
+		if constexpr(Mapping == Range_Mapping::Expand)
+		{
+				constexpr auto limited = yuv_coefficients({Ycbcr_Encoding::BT601, Quantization_Range::Limited});
+				const auto scaled			 = _mm_mulhi_epu16(_mm_or_si128(code, _mm_slli_epi16(code, 8)),
+																						 _mm_set1_epi16(static_cast<int16_t>(limited.luma_scale)));
+				return _mm_srai_epi16(_mm_sub_epi16(scaled, _mm_set1_epi16(static_cast<int16_t>(limited.luma_offset))),
+															Fraction_Bits);
+		}
+		else if constexpr(Mapping == Range_Mapping::Compress)
+		{
+				const auto scaled	 = _mm_add_epi16(_mm_mullo_epi16(code, _mm_set1_epi16(219)), _mm_set1_epi16(127));
+				const auto divided = _mm_srli_epi16(_mm_mulhi_epu16(scaled, _mm_set1_epi16(static_cast<int16_t>(0x8081))), 7);
+				return _mm_add_epi16(divided, _mm_set1_epi16(16));
+		}
+		else
+		{
+				return code;
+		}
+}
+
+template <Ycbcr_Encoding Encoding>
+__attribute__((target("sse4.1"))) inline __m128i
+luma_code_sse4(__m128i red, __m128i green, __m128i blue)
+{
+		constexpr auto weights = luma_weights(Encoding);
+		const auto sum				 = _mm_add_epi16(
+				_mm_add_epi16(_mm_mullo_epi16(red, _mm_set1_epi16(weights[0])), _mm_mullo_epi16(green, _mm_set1_epi16(weights[1]))),
+				_mm_add_epi16(_mm_mullo_epi16(blue, _mm_set1_epi16(weights[2])), _mm_set1_epi16(128)));
+		return _mm_srli_epi16(sum, 8);
+}
+
+template <Rgb_Order From, Ycbcr_Encoding Encoding, Range_Mapping Mapping>
+__attribute__((target("sse4.1"))) inline void
+rgb_row_to_gray_sse4(const uint8_t* source, uint8_t* gray, uint32_t width)
+{
+		const auto zero = _mm_setzero_si128();
+		uint32_t x			= 0;
+		for(; x + 16 <= width; x += 16)
+		{
+				__m128i red, green, blue;
+				load_pixels<From>(source + Pixel_Bytes<From> * std::size_t(x), red, green, blue);
+				const auto low	= luma_code_sse4<Encoding>(
+						 _mm_unpacklo_epi8(red, zero), _mm_unpacklo_epi8(green, zero), _mm_unpacklo_epi8(blue, zero));
+				const auto high = luma_code_sse4<Encoding>(
+						_mm_unpackhi_epi8(red, zero), _mm_unpackhi_epi8(green, zero), _mm_unpackhi_epi8(blue, zero));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(gray + x),
+												 _mm_packus_epi16(map_luma_sse4<Mapping>(low), map_luma_sse4<Mapping>(high)));
+		}
+		rgb_row_to_gray_scalar<From, Encoding, Mapping>(source, gray, x, width);
+}
+
+template <Range_Mapping Mapping>
+__attribute__((target("avx2"))) inline __m256i
+map_luma_avx2(__m256i code)
+{
+		if constexpr(Mapping == Range_Mapping::Expand)
+		{
+				constexpr auto limited = yuv_coefficients({Ycbcr_Encoding::BT601, Quantization_Range::Limited});
+				const auto scaled			 = _mm256_mulhi_epu16(_mm256_or_si256(code, _mm256_slli_epi16(code, 8)),
+																								_mm256_set1_epi16(static_cast<int16_t>(limited.luma_scale)));
+				return _mm256_srai_epi16(
+						_mm256_sub_epi16(scaled, _mm256_set1_epi16(static_cast<int16_t>(limited.luma_offset))), Fraction_Bits);
+		}
+		else if constexpr(Mapping == Range_Mapping::Compress)
+		{
+				const auto scaled = _mm256_add_epi16(_mm256_mullo_epi16(code, _mm256_set1_epi16(219)), _mm256_set1_epi16(127));
+				const auto divided =
+						_mm256_srli_epi16(_mm256_mulhi_epu16(scaled, _mm256_set1_epi16(static_cast<int16_t>(0x8081))), 7);
+				return _mm256_add_epi16(divided, _mm256_set1_epi16(16));
+		}
+		else
+		{
+				return code;
+		}
+}
+
+/**
+ * @brief The SSE4 deinterleave, then all 16 pixels in one register each.
+ */
+template <Rgb_Order From, Ycbcr_Encoding Encoding, Range_Mapping Mapping>
+__attribute__((target("avx2"))) inline void
+rgb_row_to_gray_avx2(const uint8_t* source, uint8_t* gray, uint32_t width)
+{
+		constexpr auto weights	= luma_weights(Encoding);
+		const auto red_weight		= _mm256_set1_epi16(weights[0]);
+		const auto green_weight = _mm256_set1_epi16(weights[1]);
+		const auto blue_weight	= _mm256_set1_epi16(weights[2]);
+		const auto rounding			= _mm256_set1_epi16(128);
+		uint32_t x							= 0;
+		for(; x + 16 <= width; x += 16)
+		{
+				__m128i red, green, blue;
+				load_pixels<From>(source + Pixel_Bytes<From> * std::size_t(x), red, green, blue);
+				const auto sum = _mm256_add_epi16(
+						_mm256_add_epi16(_mm256_mullo_epi16(_mm256_cvtepu8_epi16(red), red_weight),
+														 _mm256_mullo_epi16(_mm256_cvtepu8_epi16(green), green_weight)),
+						_mm256_add_epi16(_mm256_mullo_epi16(_mm256_cvtepu8_epi16(blue), blue_weight), rounding));
+				const auto codes = map_luma_avx2<Mapping>(_mm256_srli_epi16(sum, 8));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(gray + x),
+												 _mm_packus_epi16(_mm256_castsi256_si128(codes), _mm256_extracti128_si256(codes, 1)));
+		}
+		rgb_row_to_gray_scalar<From, Encoding, Mapping>(source, gray, x, width);
+}
+
+#endif
+
+#ifdef __ARM_NEON
+
+template <Rgb_Order From, Rgb_Order To>
+inline void
+rgb_row_to_rgb_neon(const uint8_t* source, uint8_t* target, uint32_t width)
+{
+		uint32_t x = 0;
+		for(; x + 16 <= width; x += 16)
+		{
+				uint8x16_t red, green, blue;
+				load_pixels<From>(source + Pixel_Bytes<From> * std::size_t(x), red, green, blue);
+				store_pixels<To>(target + Pixel_Bytes<To> * std::size_t(x), red, green, blue);
+		}
+		rgb_row_to_rgb_scalar<From, To>(source, target, x, width);
+}
+
+/**
+ * @brief map_luma of 8 codes. Compress divides by 255 as (n * 0x8081) >> 23,
+ * which is exact for every n below 65536.
+ */
+template <Range_Mapping Mapping>
+inline uint8x8_t
+map_luma_neon(uint8x8_t code)
+{
+		if constexpr(Mapping == Range_Mapping::Expand)
+		{
+				constexpr auto limited = yuv_coefficients({Ycbcr_Encoding::BT601, Quantization_Range::Limited});
+				const auto scaled			 = mulhi_u16(vorrq_u16(vmovl_u8(code), vshll_n_u8(code, 8)),
+																					 vdupq_n_u16(static_cast<uint16_t>(limited.luma_scale)));
+				return vqshrun_n_s16(
+						vsubq_s16(vreinterpretq_s16_u16(scaled), vdupq_n_s16(static_cast<int16_t>(limited.luma_offset))),
+						Fraction_Bits);
+		}
+		else if constexpr(Mapping == Range_Mapping::Compress)
+		{
+				const auto scaled	 = vmlaq_u16(vdupq_n_u16(127), vmovl_u8(code), vdupq_n_u16(219));
+				const auto divided = vshrq_n_u16(mulhi_u16(scaled, vdupq_n_u16(0x8081)), 7);
+				return vmovn_u16(vaddq_u16(divided, vdupq_n_u16(16)));
+		}
+		else
+		{
+				return code;
+		}
+}
+
+template <Rgb_Order From, Ycbcr_Encoding Encoding, Range_Mapping Mapping>
+inline void
+rgb_row_to_gray_neon(const uint8_t* source, uint8_t* gray, uint32_t width)
+{
+		constexpr auto weights	= luma_weights(Encoding);
+		const auto red_weight		= vdup_n_u8(static_cast<uint8_t>(weights[0]));
+		const auto green_weight = vdup_n_u8(static_cast<uint8_t>(weights[1]));
+		const auto blue_weight	= vdup_n_u8(static_cast<uint8_t>(weights[2]));
+		uint32_t x							= 0;
+		for(; x + 16 <= width; x += 16)
+		{
+				uint8x16_t red, green, blue;
+				load_pixels<From>(source + Pixel_Bytes<From> * std::size_t(x), red, green, blue);
+				uint8x8_t codes[2];
+				for(int half = 0; half < 2; ++half)
+				{
+						const auto r	 = half == 0 ? vget_low_u8(red) : vget_high_u8(red);
+						const auto g	 = half == 0 ? vget_low_u8(green) : vget_high_u8(green);
+						const auto b	 = half == 0 ? vget_low_u8(blue) : vget_high_u8(blue);
+						const auto sum = vmlal_u8(vmlal_u8(vmull_u8(r, red_weight), g, green_weight), b, blue_weight);
+						/* Rounding narrowing shift, the + 128 >> 8 of the reference. */
+						codes[half] = map_luma_neon<Mapping>(vrshrn_n_u16(sum, 8));
+				}
+				vst1q_u8(gray + x, vcombine_u8(codes[0], codes[1]));
+		}
+		rgb_row_to_gray_scalar<From, Encoding, Mapping>(source, gray, x, width);
+}
+
+#endif
+
+template <Rgb_Order From, Rgb_Order To>
+inline void
+rgb_row_to_rgb(Color_Conversion_Kernel kernel, const uint8_t* source, uint8_t* target, uint32_t width)
+{
+		switch(kernel)
+		{
+#ifdef CARTRACK_X86_KERNELS
+				case Color_Conversion_Kernel::SSE4:
+				case Color_Conversion_Kernel::AVX2:
+						rgb_row_to_rgb_sse4<From, To>(source, target, width);
+						return;
+#endif
+#ifdef __ARM_NEON
+				case Color_Conversion_Kernel::NEON:
+						rgb_row_to_rgb_neon<From, To>(source, target, width);
+						return;
+#endif
+				default:
+						rgb_row_to_rgb_scalar<From, To>(source, target, 0, width);
+						return;
+		}
+}
+
+template <Rgb_Order From, Ycbcr_Encoding Encoding, Range_Mapping Mapping>
+inline void
+rgb_row_to_gray(Color_Conversion_Kernel kernel, const uint8_t* source, uint8_t* gray, uint32_t width)
+{
+		switch(kernel)
+		{
+#ifdef CARTRACK_X86_KERNELS
+				case Color_Conversion_Kernel::SSE4:
+						rgb_row_to_gray_sse4<From, Encoding, Mapping>(source, gray, width);
+						return;
+				case Color_Conversion_Kernel::AVX2:
+						rgb_row_to_gray_avx2<From, Encoding, Mapping>(source, gray, width);
+						return;
+#endif
+#ifdef __ARM_NEON
+				case Color_Conversion_Kernel::NEON:
+						rgb_row_to_gray_neon<From, Encoding, Mapping>(source, gray, width);
+						return;
+#endif
+				default:
+						rgb_row_to_gray_scalar<From, Encoding, Mapping>(source, gray, 0, width);
+						return;
+		}
+}
+
+inline void
+convert_rgb(const Image_View& source, const Image_View& target, Color_Conversion_Kernel kernel)
+{
+		const auto row_bytes = std::size_t(source.width) * source.plane(0).bytes_per_sample;
+		if(source.pixel_format == target.pixel_format)
+		{
+				for(uint32_t y = 0; y < source.height; ++y)
+				{
+						std::memcpy(target.plane(0).row(y), source.plane(0).row(y), row_bytes);
+				}
+				return;
+		}
+
+		if(target.pixel_format == Pixel_Format::GRAY8)
+		{
+				const auto mapping = range_mapping(Quantization_Range::Full, target.color_encoding.range);
+				with_rgb_order(rgb_order(source.pixel_format),
+											 [&](auto from)
+											 {
+													 with_ycbcr_encoding(
+															 source.color_encoding.ycbcr_encoding,
+															 [&](auto encoding)
+															 {
+																	 with_range_mapping(
+																			 mapping,
+																			 [&](auto constant)
+																			 {
+																					 for(uint32_t y = 0; y < source.height; ++y)
+																					 {
+																							 rgb_row_to_gray<decltype(from)::value,
+																															 decltype(encoding)::value,
+																															 decltype(constant)::value>(
+																									 kernel, source.plane(0).row(y), target.plane(0).row(y), source.width);
+																					 }
+																			 });
+															 });
+											 });
+				return;
+		}
+
+		with_rgb_order(rgb_order(source.pixel_format),
+									 [&](auto from)
+									 {
+											 with_rgb_order(rgb_order(target.pixel_format),
+																			[&](auto to)
+																			{
+																					for(uint32_t y = 0; y < source.height; ++y)
+																					{
+																							rgb_row_to_rgb<decltype(from)::value, decltype(to)::value>(
+																									kernel, source.plane(0).row(y), target.plane(0).row(y), source.width);
+																					}
+																			});
+									 });
+}
+
+template <Range_Mapping Mapping, uint32_t Target_Bytes>
+inline void
+gray_row_to_gray(const uint8_t* gray, uint8_t* target, uint32_t width)
+{
+		for(uint32_t x = 0; x < width; ++x)
+		{
+				const uint8_t value = map_luma<Mapping>(gray[x]);
+				uint8_t* pixel			= target + Target_Bytes * std::size_t(x);
+				for(uint32_t channel = 0; channel < std::min<uint32_t>(Target_Bytes, 3); ++channel)
+				{
+						pixel[channel] = value;
+				}
+				if constexpr(Target_Bytes == 4)
+				{
+						pixel[3] = 255;
+				}
+		}
+}
+
+/**
+ * @brief GRAY8 source, replicated into every channel of RGB targets.
+ */
+inline void
+convert_gray(const Image_View& source, const Image_View& target)
+{
+		const bool gray_target = target.pixel_format == Pixel_Format::GRAY8;
+		const auto mapping =
+				range_mapping(source.color_encoding.range, gray_target ? target.color_encoding.range : Quantization_Range::Full);
+		const auto target_bytes = target.plane(0).bytes_per_sample;
+		with_range_mapping(mapping,
+											 [&](auto constant)
+											 {
+													 constexpr auto Mapping = decltype(constant)::value;
+													 for(uint32_t y = 0; y < source.height; ++y)
+													 {
+															 const auto* gray = source.plane(0).row(y);
+															 auto* out				= target.plane(0).row(y);
+															 if(target_bytes == 4)
+															 {
+																	 gray_row_to_gray<Mapping, 4>(gray, out, source.width);
+															 }
+															 else if(target_bytes == 3)
+															 {
+																	 gray_row_to_gray<Mapping, 3>(gray, out, source.width);
+															 }
+															 else
+															 {
+																	 gray_row_to_gray<Mapping, 1>(gray, out, source.width);
+															 }
+													 }
+											 });
+}
+
+inline void
+convert_band(const Image_View& source, const Image_View& target, Color_Conversion_Kernel kernel)
+{
+		switch(source.pixel_format)
+		{
+				case Pixel_Format::BGR24:
+				case Pixel_Format::RGB24:
+				case Pixel_Format::RGBA32:
+						convert_rgb(source, target, kernel);
+						return;
+				case Pixel_Format::GRAY8:
+						convert_gray(source, target);
+						return;
+				default:
+						convert_yuv(source, target, kernel);
+						return;
+		}
+}
+
+} // namespace detail
+
+/**
+ * @brief Converts any uncompressed frame to RGB24, BGR24, RGBA32 or GRAY8.
+ *
+ * The matrix and range of Y'CbCr sources come from source.color_encoding,
+ * which make_image_layout took from the format the driver negotiated. Strides
+ * come from the plane views, the target must be at least as large as the
+ * source. Rows are converted in cache sized bands, on as many threads as
+ * parallelism asks for.
+ */
+inline void
+convert_image(const Image_View& source,
+							const Image_View& target,
+							Color_Conversion_Kernel kernel = best_color_conversion_kernel(),
+							const Parallelism& parallelism = {})
+{
+		if(not color_conversion_kernel_available(kernel))
+		{
+				throw std::runtime_error(std::string{"Color conversion kernel not available: "}
+																 + color_conversion_kernel_name(kernel));
+		}
+		if(not color_conversion_supported(source.pixel_format, target.pixel_format))
+		{
+				const auto& from = describe(source.pixel_format).fourcc;
+				const auto& to	 = describe(target.pixel_format).fourcc;
+				throw std::runtime_error("No color conversion from " + std::string(from.begin(), from.end()) + " to "
+																 + std::string(to.begin(), to.end()));
+		}
+		if(source.empty() or target.empty() or target.width < source.width or target.height < source.height)
+		{
+				throw std::runtime_error("Color conversion target does not fit the source");
+		}
+		if(source.pixel_format == Pixel_Format::YUYV422 and source.width % 2 != 0)
+		{
+				throw std::runtime_error("YUYV422 frames must have an even width");
+		}
+
+		/* A band covers whole chroma rows and its source and target rows fit the budget. */
+		const auto& descriptor = describe(source.pixel_format);
+		uint32_t row_alignment = 1;
+		std::size_t row_bytes	 = target.plane(0).stride;
+		for(std::size_t i = 0; i < source.num_planes; ++i)
+		{
+				const auto subsampling = descriptor.planes[i].vertical_subsampling;
+				row_alignment					 = std::max(row_alignment, subsampling);
+				row_bytes += source.plane(i).stride / subsampling;
+		}
+		for_each_row_band(source.height,
+											band_rows(row_bytes, row_alignment, parallelism),
+											parallelism,
+											[&](uint32_t first_row, uint32_t rows)
+											{
+													detail::convert_band(
+															row_band(source, first_row, rows), row_band(target, first_row, rows), kernel);
+											});
+}
+
+/**
+ * @brief convert_image for a source whose format is known at compile time.
+ */
+template <Pixel_Format Format>
+inline void
+convert_image(const Typed_Image_View<Format>& source,
+							const Image_View& target,
+							Color_Conversion_Kernel kernel = best_color_conversion_kernel(),
+							const Parallelism& parallelism = {})
+{
+		Image_View view;
+		view.pixel_format		= Format;
+		view.width					= source.width;
+		view.height					= source.height;
+		view.num_planes			= source.planes.size();
+		view.color_encoding = source.color_encoding;
+		std::copy(source.planes.begin(), source.planes.end(), view.planes.begin());
+		convert_image(view, target, kernel, parallelism);
+}
+
+} // namespace Cartrack
+
+#endif // COLOR_CONVERSION_HPP
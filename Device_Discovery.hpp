@@ -0,0 +1,274 @@
+#ifndef DEVICE_DISCOVERY_HPP
+#define DEVICE_DISCOVERY_HPP
+
+#include "Abstract_Capture_Backend.hpp"
+#include "Device_IO.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <linux/videodev2.h>
+#include <optional>
+#include <span>
+
+namespace Cartrack
+{
+
+/**
+ * @brief One /dev/videoN node that can capture video, with everything needed to
+ * recognize the camera behind it after a reboot or a replug.
+ */
+struct Camera_Node
+{
+		std::string path;
+		Camera_ID index = -1;
+		std::string driver;
+		std::string card;
+		std::string bus_info;
+		uint32_t device_caps = 0;
+		/**
+		 * @brief USB serial number from sysfs, empty for cameras without one.
+		 */
+		std::string serial;
+		/**
+		 * @brief udev symlinks pointing to this node, empty if udev does not run.
+		 */
+		std::string by_id;
+		std::string by_path;
+};
+
+/**
+ * @brief Finds capture nodes and maps stable identities to them.
+ *
+ * /dev/videoN numbering depends on probe order and every UVC camera also
+ * registers a metadata node, so N is not an identity. Accepted identities:
+ * - a device path, /dev/videoN or a udev /dev/v4l/by-id, /dev/v4l/by-path link,
+ * - "serial:<usb serial>",
+ * - "bus:<bus_info>" as reported by VIDIOC_QUERYCAP, e.g. bus:usb-0000:00:14.0-3,
+ * - "card:<card name>", first match wins.
+ *
+ * Nodes are listed, opened and queried through a Device_IO, so discovery runs
+ * against Fake_V4L2_Device too. sysfs serials and udev links are read from the
+ * real filesystem and stay empty for nodes only the io knows.
+ */
+class Device_Discovery
+{
+	public:
+		/**
+		 * @brief Probes every /dev/video* node in parallel and returns the capture
+		 * nodes sorted by index. Metadata, output and busy-failing nodes are left out.
+		 */
+		[[nodiscard]] static std::vector<Camera_Node> scan(Device_IO& io = *linux_device_io())
+		{
+				const auto candidates = io.video_nodes();
+
+				std::vector<std::future<std::optional<Camera_Node>>> probes;
+				probes.reserve(candidates.size());
+				for(const auto& candidate : candidates)
+				{
+						probes.push_back(std::async(std::launch::async, [&io, candidate] { return probe(candidate, io); }));
+				}
+
+				std::vector<Camera_Node> nodes;
+				for(auto& pending : probes)
+				{
+						if(auto node = pending.get())
+						{
+								nodes.push_back(std::move(*node));
+						}
+				}
+
+				attach_udev_links(nodes);
+				std::sort(nodes.begin(),
+									nodes.end(),
+									[](const Camera_Node& a, const Camera_Node& b) { return a.index < b.index; });
+				return nodes;
+		}
+
+		/**
+		 * @brief Node of an identity among already scanned nodes.
+		 */
+		[[nodiscard]] static std::optional<Camera_Node> resolve(const std::string& identity,
+																														std::span<const Camera_Node> nodes,
+																														Device_IO& io = *linux_device_io())
+		{
+				auto find_if = [&](auto&& predicate) -> std::optional<Camera_Node>
+				{
+						const auto found = std::find_if(nodes.begin(), nodes.end(), predicate);
+						return found == nodes.end() ? std::nullopt : std::optional{*found};
+				};
+
+				if(identity.starts_with("serial:"))
+				{
+						const auto serial = identity.substr(7);
+						return find_if([&](const Camera_Node& node) { return node.serial == serial; });
+				}
+				if(identity.starts_with("bus:"))
+				{
+						const auto bus_info = identity.substr(4);
+						return find_if([&](const Camera_Node& node) { return node.bus_info == bus_info; });
+				}
+				if(identity.starts_with("card:"))
+				{
+						const auto card = identity.substr(5);
+						return find_if([&](const Camera_Node& node) { return node.card == card; });
+				}
+
+				const auto path = canonical_path(identity, io);
+				if(not path)
+				{
+						return std::nullopt;
+				}
+				return find_if([&](const Camera_Node& node) { return node.path == *path; });
+		}
+
+		/**
+		 * @brief Resolves a single identity. Device paths are followed without a
+		 * scan, everything else costs one parallel scan.
+		 */
+		[[nodiscard]] static std::optional<Camera_Node> resolve(const std::string& identity,
+																														Device_IO& io = *linux_device_io())
+		{
+				if(identity.starts_with("/"))
+				{
+						const auto path = canonical_path(identity, io);
+						if(not path)
+						{
+								return std::nullopt;
+						}
+						auto node = probe(*path, io);
+						if(node)
+						{
+								std::vector<Camera_Node> single{*node};
+								attach_udev_links(single);
+								return single.front();
+						}
+						return std::nullopt;
+				}
+
+				const auto nodes = scan(io);
+				return resolve(identity, nodes, io);
+		}
+
+		/**
+		 * @brief Resolves many identities with one scan, for opening a camera rig.
+		 * Unresolved identities give an empty optional at their position.
+		 */
+		[[nodiscard]] static std::vector<std::optional<Camera_Node>> resolve_all(
+				std::span<const std::string> identities,
+				Device_IO& io = *linux_device_io())
+		{
+				const auto nodes = scan(io);
+				std::vector<std::optional<Camera_Node>> resolved;
+				resolved.reserve(identities.size());
+				for(const auto& identity : identities)
+				{
+						resolved.push_back(resolve(identity, nodes, io));
+				}
+				return resolved;
+		}
+
+	private:
+		/**
+		 * @brief Symlinks followed on the real filesystem. A path that is not
+		 * there but that io can stat, a node of Fake_V4L2_Device, is kept as is.
+		 */
+		static std::optional<std::string> canonical_path(const std::string& path, Device_IO& io)
+		{
+				std::error_code error;
+				const auto canonical = std::filesystem::canonical(path, error);
+				if(not error)
+				{
+						return canonical.string();
+				}
+				struct stat status;
+				if(-1 == io.stat(path, status))
+				{
+						return std::nullopt;
+				}
+				return path;
+		}
+
+		static std::optional<Camera_Node> probe(const std::string& path, Device_IO& io)
+		{
+				const auto name = std::filesystem::path(path).filename().string();
+				if(name.size() <= 5
+					 or not std::all_of(name.begin() + 5, name.end(), [](char c) { return c >= '0' and c <= '9'; }))
+				{
+						return std::nullopt;
+				}
+
+				/* Opening does not start streaming, it works on nodes other processes use. */
+				const int fd = io.open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+				if(-1 == fd)
+				{
+						return std::nullopt;
+				}
+
+				v4l2_capability capability;
+				std::memset(&capability, 0, sizeof(capability));
+				const int r = xioctl(io, fd, VIDIOC_QUERYCAP, &capability);
+				io.close(fd);
+
+				if(-1 == r)
+				{
+						return std::nullopt;
+				}
+
+				const uint32_t caps = (capability.capabilities & V4L2_CAP_DEVICE_CAPS)
+																	? capability.device_caps
+																	: capability.capabilities;
+				if(not(caps & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE))
+					 or not(caps & V4L2_CAP_STREAMING))
+				{
+						/* UVC metadata nodes only have V4L2_CAP_META_CAPTURE. */
+						return std::nullopt;
+				}
+
+				Camera_Node node;
+				node.path				 = path;
+				node.index			 = static_cast<Camera_ID>(std::stoi(name.substr(5)));
+				node.driver			 = reinterpret_cast<const char*>(capability.driver);
+				node.card				 = reinterpret_cast<const char*>(capability.card);
+				node.bus_info		 = reinterpret_cast<const char*>(capability.bus_info);
+				node.device_caps = caps;
+
+				/* USB interface is device/, the usb_device holding the serial is its parent. */
+				std::ifstream serial_file(std::filesystem::path("/sys/class/video4linux") / name
+																	/ "device/../serial");
+				std::getline(serial_file, node.serial);
+
+				return node;
+		}
+
+		static void attach_udev_links(std::vector<Camera_Node>& nodes)
+		{
+				for(const auto* directory : {"/dev/v4l/by-id", "/dev/v4l/by-path"})
+				{
+						std::error_code error;
+						for(const auto& entry : std::filesystem::directory_iterator(directory, error))
+						{
+								const auto target = std::filesystem::canonical(entry.path(), error);
+								if(error)
+								{
+										continue;
+								}
+								for(auto& node : nodes)
+								{
+										if(node.path == target.string())
+										{
+												(std::string_view(directory).ends_with("by-id") ? node.by_id : node.by_path) =
+														entry.path().string();
+										}
+								}
+						}
+				}
+		}
+};
+
+} // namespace Cartrack
+
+#endif // DEVICE_DISCOVERY_HPP
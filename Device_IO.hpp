@@ -0,0 +1,143 @@
+#ifndef DEVICE_IO_HPP
+#define DEVICE_IO_HPP
+
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace Cartrack
+{
+
+/**
+ * @brief The system calls a backend makes on its device node. V4L2_Backend goes
+ * through this instead of calling the kernel directly, so tests and benchmarks
+ * can run it against Fake_V4L2_Device. Methods follow the system calls they
+ * stand for: -1 and errno on failure, MAP_FAILED for mmap.
+ *
+ * Implementations must be thread safe, Frame_Handle releases queue buffers
+ * from consumer threads.
+ */
+class Device_IO
+{
+	public:
+		virtual ~Device_IO() = default;
+
+		virtual int open(const std::string& path, int flags) = 0;
+
+		virtual int close(int fd) = 0;
+
+		virtual int stat(const std::string& path, struct stat& status) = 0;
+
+		virtual int ioctl(int fd, unsigned long request, void* arg) = 0;
+
+		/**
+		 * @brief select() for readability of a single fd: > 0 ready, 0 timeout, -1 error.
+		 */
+		virtual int wait_readable(int fd, std::chrono::microseconds timeout) = 0;
+
+		virtual void* mmap(std::size_t length, int protection, int flags, int fd, off_t offset) = 0;
+
+		virtual int munmap(void* address, std::size_t length) = 0;
+
+		/**
+		 * @brief Paths of the /dev/video* nodes, the candidates Device_Discovery probes.
+		 */
+		virtual std::vector<std::string> video_nodes() = 0;
+};
+
+class Linux_Device_IO final : public Device_IO
+{
+	public:
+		int open(const std::string& path, int flags) override
+		{
+				return ::open(path.c_str(), flags, 0);
+		}
+
+		int close(int fd) override
+		{
+				return ::close(fd);
+		}
+
+		int stat(const std::string& path, struct stat& status) override
+		{
+				return ::stat(path.c_str(), &status);
+		}
+
+		int ioctl(int fd, unsigned long request, void* arg) override
+		{
+				return ::ioctl(fd, request, arg);
+		}
+
+		int wait_readable(int fd, std::chrono::microseconds timeout) override
+		{
+				fd_set fds;
+				FD_ZERO(&fds);
+				FD_SET(fd, &fds);
+				timeval tv;
+				tv.tv_sec	 = static_cast<time_t>(timeout.count() / 1000000);
+				tv.tv_usec = static_cast<suseconds_t>(timeout.count() % 1000000);
+				return ::select(fd + 1, &fds, nullptr, nullptr, &tv);
+		}
+
+		void* mmap(std::size_t length, int protection, int flags, int fd, off_t offset) override
+		{
+				return ::mmap(nullptr, length, protection, flags, fd, offset);
+		}
+
+		int munmap(void* address, std::size_t length) override
+		{
+				return ::munmap(address, length);
+		}
+
+		std::vector<std::string> video_nodes() override
+		{
+				std::vector<std::string> nodes;
+				std::error_code error;
+				for(const auto& entry : std::filesystem::directory_iterator("/dev", error))
+				{
+						if(entry.path().filename().string().starts_with("video"))
+						{
+								nodes.push_back(entry.path().string());
+						}
+				}
+				return nodes;
+		}
+};
+
+/**
+ * @brief Process wide instance used when no Device_IO is injected.
+ */
+inline std::shared_ptr<Device_IO>
+linux_device_io()
+{
+		static const auto io = std::make_shared<Linux_Device_IO>();
+		return io;
+}
+
+/**
+ * @brief ioctl retried on EINTR, like the free xioctl of the backends.
+ */
+inline int
+xioctl(Device_IO& io, int fd, unsigned long request, void* arg)
+{
+		int r = -1;
+		do
+		{
+				r = io.ioctl(fd, request, arg);
+		} while(-1 == r and EINTR == errno);
+
+		return r;
+}
+
+} // namespace Cartrack
+
+#endif // DEVICE_IO_HPP
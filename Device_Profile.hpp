@@ -0,0 +1,644 @@
+#ifndef DEVICE_PROFILE_HPP
+#define DEVICE_PROFILE_HPP
+
+#include "Abstract_Capture_Backend.hpp"
+#include "Device_IO.hpp"
+#include "Pixel_Format_Descriptor.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <type_traits>
+
+namespace Cartrack
+{
+
+/**
+ * @brief One frame size, or a range of them, of one pixel format and the frame
+ * intervals the driver offers for it.
+ *
+ * Discrete sizes have min == max. Stepwise and continuous intervals are kept as
+ * two entries, fastest first, with stepwise_intervals set and their step in
+ * interval_step.
+ */
+struct Profile_Mode
+{
+		uint32_t fourcc			 = 0;
+		uint32_t min_width	 = 0;
+		uint32_t max_width	 = 0;
+		uint32_t step_width	 = 1;
+		uint32_t min_height	 = 0;
+		uint32_t max_height	 = 0;
+		uint32_t step_height = 1;
+		bool stepwise_intervals = false;
+		std::vector<v4l2_fract> intervals;
+		/**
+		 * @brief Stepwise intervals are min + k * step, 0/0 for continuous ones.
+		 */
+		v4l2_fract interval_step{0, 0};
+};
+
+struct Profile_Control
+{
+		uint32_t id						= 0;
+		uint32_t type					= 0;
+		uint32_t flags				= 0;
+		int64_t minimum				= 0;
+		int64_t maximum				= 0;
+		uint64_t step					= 1;
+		int64_t default_value = 0;
+};
+
+/**
+ * @brief Result of matching a Stream_Configuration against a profile.
+ */
+struct Profile_Mode_Choice
+{
+		uint32_t width = 0;
+		uint32_t height = 0;
+		double fps			= 0;
+		bool exact			= false;
+};
+
+/**
+ * @brief What a device can do: formats, frame sizes, frame intervals and control
+ * ranges. Probing it takes hundreds of ioctls, on UVC each one a USB control
+ * transfer, so it is done once per device identity and kept on disk.
+ *
+ * The identity is driver, card, bus_info, driver version and the firmware
+ * revision sysfs reports for USB devices. A firmware update or moving the
+ * camera to another port gives a new profile.
+ */
+class Device_Profile
+{
+	public:
+		std::string driver;
+		std::string card;
+		std::string bus_info;
+		uint32_t version = 0;
+		std::string firmware;
+		std::vector<Profile_Mode> modes;
+		std::vector<Profile_Control> controls;
+
+	public:
+		[[nodiscard]] std::string identity() const
+		{
+				return driver + "|" + card + "|" + bus_info + "|" + std::to_string(version) + "|"
+							 + firmware;
+		}
+
+		/**
+		 * @brief Enumerates everything with VIDIOC_ENUM_FMT, VIDIOC_ENUM_FRAMESIZES,
+		 * VIDIOC_ENUM_FRAMEINTERVALS and VIDIOC_QUERY_EXT_CTRL.
+		 */
+		[[nodiscard]] static Device_Profile probe(Device_IO& io,
+																							int fd,
+																							const std::string& device_path,
+																							const v4l2_capability& capability)
+		{
+				Device_Profile profile;
+				profile.driver	 = reinterpret_cast<const char*>(capability.driver);
+				profile.card		 = reinterpret_cast<const char*>(capability.card);
+				profile.bus_info = reinterpret_cast<const char*>(capability.bus_info);
+				profile.version	 = capability.version;
+				profile.firmware = read_firmware_revision(device_path);
+
+				const uint32_t caps = (capability.capabilities & V4L2_CAP_DEVICE_CAPS)
+																	? capability.device_caps
+																	: capability.capabilities;
+				std::vector<v4l2_buf_type> buffer_types;
+				if(caps & V4L2_CAP_VIDEO_CAPTURE)
+				{
+						buffer_types.push_back(V4L2_BUF_TYPE_VIDEO_CAPTURE);
+				}
+				if(caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE)
+				{
+						buffer_types.push_back(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
+				}
+
+				for(const auto buffer_type : buffer_types)
+				{
+						v4l2_fmtdesc format_description;
+						for(uint32_t format_index = 0;; ++format_index)
+						{
+								std::memset(&format_description, 0, sizeof(format_description));
+								format_description.index = format_index;
+								format_description.type	 = buffer_type;
+								if(-1 == xioctl(io, fd, VIDIOC_ENUM_FMT, &format_description))
+								{
+										break;
+								}
+								if(std::any_of(profile.modes.begin(),
+															 profile.modes.end(),
+															 [&](const Profile_Mode& mode)
+															 { return mode.fourcc == format_description.pixelformat; }))
+								{
+										continue;
+								}
+								probe_frame_sizes(io, fd, format_description.pixelformat, profile.modes);
+						}
+				}
+
+				v4l2_query_ext_ctrl query;
+				std::memset(&query, 0, sizeof(query));
+				query.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+				while(0 == xioctl(io, fd, VIDIOC_QUERY_EXT_CTRL, &query))
+				{
+						if(query.type != V4L2_CTRL_TYPE_CTRL_CLASS
+							 and not(query.flags & V4L2_CTRL_FLAG_DISABLED))
+						{
+								profile.controls.push_back(Profile_Control{query.id,
+																													 query.type,
+																													 query.flags,
+																													 query.minimum,
+																													 query.maximum,
+																													 query.step,
+																													 query.default_value});
+						}
+						query.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+				}
+
+				return profile;
+		}
+
+		/**
+		 * @brief Cached profile of the device if the identity still matches, probing
+		 * and caching it otherwise. Failing to write the cache is not an error.
+		 */
+		[[nodiscard]] static Device_Profile load_or_probe(Device_IO& io,
+																											int fd,
+																											const std::string& device_path,
+																											const v4l2_capability& capability)
+		{
+				Device_Profile expected;
+				expected.driver		= reinterpret_cast<const char*>(capability.driver);
+				expected.card			= reinterpret_cast<const char*>(capability.card);
+				expected.bus_info = reinterpret_cast<const char*>(capability.bus_info);
+				expected.version	= capability.version;
+				expected.firmware = read_firmware_revision(device_path);
+
+				const auto path = cache_path(expected.identity());
+				if(auto cached = load(path); cached and cached->identity() == expected.identity())
+				{
+						return *cached;
+				}
+
+				auto profile = probe(io, fd, device_path, capability);
+				if(not profile.save(path))
+				{
+						std::cerr << "Device profile could not be cached at " << path << std::endl;
+				}
+				return profile;
+		}
+
+		[[nodiscard]] const Profile_Control* find_control(uint32_t id) const
+		{
+				const auto found = std::find_if(controls.begin(),
+																				controls.end(),
+																				[id](const Profile_Control& control) { return control.id == id; });
+				return found == controls.end() ? nullptr : &*found;
+		}
+
+		/**
+		 * @brief Value snapped to the step and range the driver reported, so an out
+		 * of range write is fixed locally instead of failing with ERANGE.
+		 */
+		[[nodiscard]] int32_t clamp_control(uint32_t id, int32_t value) const
+		{
+				const auto* control = find_control(id);
+				if(not control or control->maximum < control->minimum
+					 or (control->type != V4L2_CTRL_TYPE_INTEGER and control->type != V4L2_CTRL_TYPE_BOOLEAN
+							 and control->type != V4L2_CTRL_TYPE_MENU
+							 and control->type != V4L2_CTRL_TYPE_INTEGER_MENU))
+				{
+						return value;
+				}
+
+				int64_t clamped = std::clamp<int64_t>(value, control->minimum, control->maximum);
+				if(control->step > 1)
+				{
+						const auto step = static_cast<int64_t>(control->step);
+						clamped					= control->minimum + (clamped - control->minimum + step / 2) / step * step;
+						clamped					= std::min(clamped, control->maximum);
+				}
+				return static_cast<int32_t>(std::clamp<int64_t>(
+						clamped, std::numeric_limits<int32_t>::min(), std::numeric_limits<int32_t>::max()));
+		}
+
+		/**
+		 * @brief Closest mode to the configuration: exact size if offered, else the
+		 * smallest one covering it, else the biggest one. Then the slowest interval
+		 * that still reaches the requested fps, else the fastest one.
+		 */
+		[[nodiscard]] std::optional<Profile_Mode_Choice> best_mode(
+				const Stream_Configuration& configuration) const
+		{
+				const uint32_t fourcc = describe(configuration.pixel_format).v4l2_pixel_format();
+
+				std::optional<Profile_Mode_Choice> best;
+				const Profile_Mode* best_mode = nullptr;
+				auto score										= [&](uint32_t width, uint32_t height)
+				{
+						const bool covers = width >= configuration.width and height >= configuration.height;
+						const double area = double(width) * height;
+						/* Covering sizes first, smallest of them; otherwise biggest. */
+						return covers ? area : std::numeric_limits<double>::max() / 2 - area;
+				};
+
+				for(const auto& mode : modes)
+				{
+						if(mode.fourcc != fourcc)
+						{
+								continue;
+						}
+
+						const uint32_t width	= snap(configuration.width, mode.min_width, mode.max_width, mode.step_width);
+						const uint32_t height = snap(
+								configuration.height, mode.min_height, mode.max_height, mode.step_height);
+						if(not best or score(width, height) < score(best->width, best->height))
+						{
+								best			= Profile_Mode_Choice{width, height, 0, false};
+								best_mode = &mode;
+						}
+				}
+
+				if(not best)
+				{
+						return std::nullopt;
+				}
+
+				best->fps		= choose_fps(*best_mode, configuration.fps);
+				best->exact = best->width == configuration.width and best->height == configuration.height
+											and (configuration.fps == 0 or std::abs(best->fps - configuration.fps) < 0.5);
+				return best;
+		}
+
+		[[nodiscard]] bool supports(const Stream_Configuration& configuration) const
+		{
+				const auto choice = best_mode(configuration);
+				return choice and choice->exact;
+		}
+
+		[[nodiscard]] bool save(const std::filesystem::path& path) const
+		{
+				std::error_code error;
+				std::filesystem::create_directories(path.parent_path(), error);
+
+				const auto temporary = path.string() + ".tmp";
+				{
+						std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+						if(not file)
+						{
+								return false;
+						}
+
+						write_value(file, Cache_Magic);
+						write_value(file, Cache_Version);
+						write_string(file, driver);
+						write_string(file, card);
+						write_string(file, bus_info);
+						write_value(file, version);
+						write_string(file, firmware);
+
+						write_value(file, uint32_t(modes.size()));
+						for(const auto& mode : modes)
+						{
+								write_value(file, mode.fourcc);
+								write_value(file, mode.min_width);
+								write_value(file, mode.max_width);
+								write_value(file, mode.step_width);
+								write_value(file, mode.min_height);
+								write_value(file, mode.max_height);
+								write_value(file, mode.step_height);
+								write_value(file, uint8_t(mode.stepwise_intervals));
+								write_fraction(file, mode.interval_step);
+								write_value(file, uint32_t(mode.intervals.size()));
+								for(const auto& interval : mode.intervals)
+								{
+										write_fraction(file, interval);
+								}
+						}
+
+						/* Field by field, the in-memory struct has padding. */
+						write_value(file, uint32_t(controls.size()));
+						for(const auto& control : controls)
+						{
+								write_value(file, control.id);
+								write_value(file, control.type);
+								write_value(file, control.flags);
+								write_value(file, control.minimum);
+								write_value(file, control.maximum);
+								write_value(file, control.step);
+								write_value(file, control.default_value);
+						}
+
+						if(not file)
+						{
+								return false;
+						}
+				}
+
+				/* Readers never see a half written profile. */
+				std::filesystem::rename(temporary, path, error);
+				return not error;
+		}
+
+		[[nodiscard]] static std::optional<Device_Profile> load(const std::filesystem::path& path)
+		{
+				std::ifstream file(path, std::ios::binary);
+				if(not file)
+				{
+						return std::nullopt;
+				}
+
+				uint32_t magic = 0, file_version = 0;
+				if(not read_value(file, magic) or magic != Cache_Magic or not read_value(file, file_version)
+					 or file_version != Cache_Version)
+				{
+						return std::nullopt;
+				}
+
+				Device_Profile profile;
+				uint32_t num_modes = 0;
+				if(not read_string(file, profile.driver) or not read_string(file, profile.card)
+					 or not read_string(file, profile.bus_info) or not read_value(file, profile.version)
+					 or not read_string(file, profile.firmware) or not read_value(file, num_modes)
+					 or num_modes > Max_Cached_Entries)
+				{
+						return std::nullopt;
+				}
+
+				profile.modes.resize(num_modes);
+				for(auto& mode : profile.modes)
+				{
+						uint8_t stepwise				= 0;
+						uint32_t num_intervals	= 0;
+						if(not read_value(file, mode.fourcc) or not read_value(file, mode.min_width)
+							 or not read_value(file, mode.max_width) or not read_value(file, mode.step_width)
+							 or not read_value(file, mode.min_height) or not read_value(file, mode.max_height)
+							 or not read_value(file, mode.step_height) or not read_value(file, stepwise)
+							 or not read_fraction(file, mode.interval_step) or not read_value(file, num_intervals)
+							 or num_intervals > Max_Cached_Entries)
+						{
+								return std::nullopt;
+						}
+						mode.stepwise_intervals = stepwise;
+						mode.intervals.resize(num_intervals);
+						for(auto& interval : mode.intervals)
+						{
+								if(not read_fraction(file, interval))
+								{
+										return std::nullopt;
+								}
+						}
+				}
+
+				uint32_t num_controls = 0;
+				if(not read_value(file, num_controls) or num_controls > Max_Cached_Entries)
+				{
+						return std::nullopt;
+				}
+				profile.controls.resize(num_controls);
+				for(auto& control : profile.controls)
+				{
+						if(not read_value(file, control.id) or not read_value(file, control.type)
+							 or not read_value(file, control.flags) or not read_value(file, control.minimum)
+							 or not read_value(file, control.maximum) or not read_value(file, control.step)
+							 or not read_value(file, control.default_value))
+						{
+								return std::nullopt;
+						}
+				}
+
+				return profile;
+		}
+
+		/**
+		 * @brief $XDG_CACHE_HOME/cartrack_v4l2, or ~/.cache/cartrack_v4l2, one file per
+		 * identity.
+		 */
+		[[nodiscard]] static std::filesystem::path cache_path(const std::string& identity)
+		{
+				std::filesystem::path directory;
+				if(const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg and *xdg)
+				{
+						directory = xdg;
+				}
+				else if(const char* home = std::getenv("HOME"); home and *home)
+				{
+						directory = std::filesystem::path(home) / ".cache";
+				}
+				else
+				{
+						directory = std::filesystem::temp_directory_path();
+				}
+
+				std::string file_name;
+				for(const char c : identity)
+				{
+						file_name += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+				}
+				return directory / "cartrack_v4l2" / (file_name + ".profile");
+		}
+
+	private:
+		static constexpr uint32_t Cache_Magic				 = 0x50445443; // "CTDP"
+		static constexpr uint32_t Cache_Version			 = 2;
+		static constexpr uint32_t Max_Cached_Entries = 1u << 16;
+
+		static std::string read_firmware_revision(const std::string& device_path)
+		{
+				/* USB devices expose bcdDevice on the usb_device, two levels above the interface. */
+				const auto node = std::filesystem::path(device_path).filename();
+				for(const auto* relative : {"device/../bcdDevice", "device/bcdDevice"})
+				{
+						std::ifstream file(std::filesystem::path("/sys/class/video4linux") / node / relative);
+						std::string revision;
+						if(file >> revision)
+						{
+								return revision;
+						}
+				}
+				return {};
+		}
+
+		static void probe_frame_sizes(Device_IO& io, int fd, uint32_t fourcc, std::vector<Profile_Mode>& modes)
+		{
+				v4l2_frmsizeenum frame_size;
+				for(uint32_t size_index = 0;; ++size_index)
+				{
+						std::memset(&frame_size, 0, sizeof(frame_size));
+						frame_size.index				= size_index;
+						frame_size.pixel_format = fourcc;
+						if(-1 == xioctl(io, fd, VIDIOC_ENUM_FRAMESIZES, &frame_size))
+						{
+								break;
+						}
+
+						Profile_Mode mode;
+						mode.fourcc = fourcc;
+						if(frame_size.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+						{
+								mode.min_width = mode.max_width = frame_size.discrete.width;
+								mode.min_height = mode.max_height = frame_size.discrete.height;
+						}
+						else
+						{
+								mode.min_width	 = frame_size.stepwise.min_width;
+								mode.max_width	 = frame_size.stepwise.max_width;
+								mode.step_width	 = std::max(frame_size.stepwise.step_width, 1u);
+								mode.min_height	 = frame_size.stepwise.min_height;
+								mode.max_height	 = frame_size.stepwise.max_height;
+								mode.step_height = std::max(frame_size.stepwise.step_height, 1u);
+						}
+
+						probe_frame_intervals(io, fd, fourcc, mode.max_width, mode.max_height, mode);
+						modes.push_back(std::move(mode));
+
+						if(frame_size.type != V4L2_FRMSIZE_TYPE_DISCRETE)
+						{
+								/* Stepwise and continuous ranges have a single entry. */
+								break;
+						}
+				}
+		}
+
+		static void probe_frame_intervals(
+				Device_IO& io, int fd, uint32_t fourcc, uint32_t width, uint32_t height, Profile_Mode& mode)
+		{
+				v4l2_frmivalenum frame_interval;
+				for(uint32_t interval_index = 0;; ++interval_index)
+				{
+						std::memset(&frame_interval, 0, sizeof(frame_interval));
+						frame_interval.index				= interval_index;
+						frame_interval.pixel_format = fourcc;
+						frame_interval.width				= width;
+						frame_interval.height				= height;
+						if(-1 == xioctl(io, fd, VIDIOC_ENUM_FRAMEINTERVALS, &frame_interval))
+						{
+								break;
+						}
+
+						if(frame_interval.type == V4L2_FRMIVAL_TYPE_DISCRETE)
+						{
+								mode.intervals.push_back(frame_interval.discrete);
+								continue;
+						}
+
+						mode.stepwise_intervals = true;
+						mode.intervals					= {frame_interval.stepwise.min, frame_interval.stepwise.max};
+						if(frame_interval.type == V4L2_FRMIVAL_TYPE_STEPWISE)
+						{
+								mode.interval_step = frame_interval.stepwise.step;
+						}
+						break;
+				}
+		}
+
+		static uint32_t snap(uint32_t value, uint32_t minimum, uint32_t maximum, uint32_t step)
+		{
+				const uint32_t clamped = std::clamp(value, minimum, std::max(minimum, maximum));
+				return minimum + (clamped - minimum) / std::max(step, 1u) * std::max(step, 1u);
+		}
+
+		static double to_fps(const v4l2_fract& interval)
+		{
+				return interval.numerator ? double(interval.denominator) / interval.numerator : 0;
+		}
+
+		static double to_seconds(const v4l2_fract& interval)
+		{
+				return interval.denominator ? double(interval.numerator) / interval.denominator : 0;
+		}
+
+		static double choose_fps(const Profile_Mode& mode, double requested)
+		{
+				if(mode.intervals.empty())
+				{
+						return requested;
+				}
+
+				if(mode.stepwise_intervals)
+				{
+						if(requested <= 0)
+						{
+								return to_fps(mode.intervals.front());
+						}
+						const double shortest = to_seconds(mode.intervals.front());
+						const double longest	= std::max(shortest, to_seconds(mode.intervals.back()));
+						double interval				= std::clamp(1.0 / requested, shortest, longest);
+						if(const double step = to_seconds(mode.interval_step); step > 0)
+						{
+								/* Only min + k * step exists, take the longest one still reaching the requested fps. */
+								interval = shortest + std::floor((interval - shortest) / step + 1e-9) * step;
+						}
+						return interval > 0 ? 1.0 / interval : requested;
+				}
+
+				double fastest = 0, chosen = 0;
+				for(const auto& interval : mode.intervals)
+				{
+						const double fps = to_fps(interval);
+						fastest					 = std::max(fastest, fps);
+						if(requested > 0 and fps + 0.01 >= requested and (chosen == 0 or fps < chosen))
+						{
+								chosen = fps;
+						}
+				}
+				return chosen ? chosen : fastest;
+		}
+
+		template <typename T>
+		static void write_value(std::ofstream& file, const T& value)
+		{
+				static_assert(std::is_trivially_copyable_v<T>);
+				file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
+
+		static void write_fraction(std::ofstream& file, const v4l2_fract& value)
+		{
+				write_value(file, value.numerator);
+				write_value(file, value.denominator);
+		}
+
+		static void write_string(std::ofstream& file, const std::string& value)
+		{
+				write_value(file, uint32_t(value.size()));
+				file.write(value.data(), value.size());
+		}
+
+		template <typename T>
+		static bool read_value(std::ifstream& file, T& value)
+		{
+				static_assert(std::is_trivially_copyable_v<T>);
+				return bool(file.read(reinterpret_cast<char*>(&value), sizeof(value)));
+		}
+
+		static bool read_fraction(std::ifstream& file, v4l2_fract& value)
+		{
+				return read_value(file, value.numerator) and read_value(file, value.denominator);
+		}
+
+		static bool read_string(std::ifstream& file, std::string& value)
+		{
+				uint32_t size = 0;
+				if(not read_value(file, size) or size > Max_Cached_Entries)
+				{
+						return false;
+				}
+				value.resize(size);
+				return bool(file.read(value.data(), size));
+		}
+};
+
+} // namespace Cartrack
+
+#endif // DEVICE_PROFILE_HPP
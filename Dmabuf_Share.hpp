@@ -0,0 +1,684 @@
+#ifndef DMABUF_SHARE_HPP
+#define DMABUF_SHARE_HPP
+
+#include "isgursoy_V4L2.hpp"
+
+#include <cstddef>
+#include <deque>
+#include <linux/dma-buf.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <type_traits>
+
+namespace Cartrack
+{
+
+/**
+ * @brief Wire format of Dmabuf_Publisher and Dmabuf_Subscriber. Both ends run on
+ * the same host with the same build, messages are plain structs over a
+ * SOCK_SEQPACKET socket, one message per struct.
+ *
+ * Publisher -> subscriber: one Dmabuf_Stream_Header, num_buffers
+ * Dmabuf_Buffer_Header each carrying the buffer's fds as SCM_RIGHTS, then a
+ * Dmabuf_Frame_Message per frame. Subscriber -> publisher: a
+ * Dmabuf_Release_Message per frame it is done with.
+ */
+static constexpr uint32_t Dmabuf_Share_Magic	 = 0x42414d44; // "DMAB"
+static constexpr uint32_t Dmabuf_Share_Version = 3;
+
+struct Dmabuf_Stream_Header
+{
+		uint32_t magic	 = Dmabuf_Share_Magic;
+		uint32_t version = Dmabuf_Share_Version;
+		Image_Layout_Record layout;
+		uint32_t num_buffers = 0;
+		uint32_t reserved		 = 0;
+};
+
+struct Dmabuf_Buffer_Header
+{
+		uint32_t index	 = 0;
+		uint32_t num_fds = 0;
+		std::array<uint64_t, VIDEO_MAX_PLANES> lengths{};
+};
+
+struct Dmabuf_Frame_Message
+{
+		uint64_t token				= 0;
+		uint32_t buffer_index = 0;
+		uint32_t sequence			= 0;
+		uint64_t frame_order	= 0;
+		int64_t timestamp			= 0;
+		std::array<uint64_t, VIDEO_MAX_PLANES> bytes_used{};
+};
+
+struct Dmabuf_Release_Message
+{
+		uint64_t token = 0;
+};
+
+static_assert(offsetof(Dmabuf_Stream_Header, layout) == 8
+									and sizeof(Dmabuf_Stream_Header) == 16 + sizeof(Image_Layout_Record),
+							"Dmabuf_Stream_Header has no padding, every byte sent is defined");
+static_assert(std::is_trivially_copyable_v<Dmabuf_Stream_Header>
+							and std::is_trivially_copyable_v<Dmabuf_Buffer_Header>
+							and std::is_trivially_copyable_v<Dmabuf_Frame_Message>);
+
+struct Dmabuf_Publisher_Statistics
+{
+		uintmax_t published = 0;
+		uintmax_t released	= 0;
+		/**
+		 * @brief Frames not sent to a subscriber that already held max_in_flight frames.
+		 */
+		uintmax_t skipped = 0;
+		uintmax_t disconnected = 0;
+};
+
+/**
+ * @brief Hands the driver buffers of a backend to other processes, e.g. a
+ * recorder and an inference process, without copying a byte.
+ *
+ * Every subscriber receives the exported DMABUF fds once when it connects and
+ * maps them itself. Afterwards only small frame messages naming the buffer go
+ * over the socket. The publisher keeps the Frame_Handle of a frame until every
+ * subscriber it was sent to has released it, so the driver cannot overwrite
+ * memory somebody is still reading. A subscriber holding max_in_flight frames
+ * skips frames instead of stalling capture; size num_buffers for
+ * subscribers * max_in_flight plus what the driver needs.
+ *
+ * Needs Buffering::Internal and a driver that supports VIDIOC_EXPBUF. Not thread
+ * safe, call publish from the capturing thread.
+ */
+class Dmabuf_Publisher
+{
+	public:
+		Dmabuf_Publisher(std::shared_ptr<V4L2_Backend> backend,
+										 std::string socket_path,
+										 unsigned int max_in_flight = 1)
+				: _backend_(std::move(backend))
+				, _socket_path_(std::move(socket_path))
+				, _max_in_flight_(max_in_flight)
+		{
+				const auto& dma_fds = _backend_->dma_buffer_fds();
+				if(dma_fds.empty()
+					 or std::any_of(dma_fds.begin(),
+													dma_fds.end(),
+													[](const auto& planes) { return planes.empty(); }))
+				{
+						throw std::runtime_error("Dmabuf_Publisher: driver did not export DMABUF fds");
+				}
+
+				sockaddr_un address = make_address(_socket_path_);
+				_listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+				if(-1 == _listen_fd_)
+				{
+						throw std::runtime_error("socket: " + std::string{strerror(errno)});
+				}
+				unlink(_socket_path_.c_str());
+				if(-1 == bind(_listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address))
+					 or -1 == listen(_listen_fd_, 8))
+				{
+						const std::string error{strerror(errno)};
+						close(_listen_fd_);
+						throw std::runtime_error("Cannot listen on " + _socket_path_ + ": " + error);
+				}
+		}
+
+		~Dmabuf_Publisher()
+		{
+				for(const auto& subscriber : _subscribers_)
+				{
+						close(subscriber.fd);
+				}
+				close(_listen_fd_);
+				unlink(_socket_path_.c_str());
+		}
+
+		Dmabuf_Publisher(const Dmabuf_Publisher&)						 = delete;
+		Dmabuf_Publisher& operator=(const Dmabuf_Publisher&) = delete;
+
+		/**
+		 * @brief Accepts new subscribers, collects releases and sends the frame to
+		 * every subscriber with room for it. Returns how many it was sent to.
+		 */
+		std::size_t publish(const Frame_Handle& frame)
+		{
+				service();
+				if(not frame)
+				{
+						return 0;
+				}
+
+				Dmabuf_Frame_Message message;
+				message.token				 = ++_last_token_;
+				message.buffer_index = frame->buffer_index;
+				message.sequence		 = frame->sequence;
+				message.frame_order	 = frame->frame_order;
+				message.timestamp		 = frame->timestamp.count();
+				for(std::size_t i = 0; i < frame->planes.size() and i < VIDEO_MAX_PLANES; ++i)
+				{
+						message.bytes_used[i] = frame->planes[i].size();
+				}
+
+				std::size_t sent = 0;
+				for(auto& subscriber : _subscribers_)
+				{
+						if(subscriber.in_flight.size() >= _max_in_flight_)
+						{
+								++_statistics_.skipped;
+								continue;
+						}
+						if(-1 == send(subscriber.fd, &message, sizeof(message), MSG_NOSIGNAL | MSG_DONTWAIT))
+						{
+								if(EAGAIN == errno or EWOULDBLOCK == errno)
+								{
+										++_statistics_.skipped;
+								}
+								else
+								{
+										subscriber.connected = false;
+								}
+								continue;
+						}
+						subscriber.in_flight.emplace(message.token, frame);
+						++sent;
+				}
+				_statistics_.published += sent;
+				drop_disconnected();
+				return sent;
+		}
+
+		/**
+		 * @brief Accepts subscribers and collects releases without publishing,
+		 * for loops that are idle between frames.
+		 */
+		void service()
+		{
+				accept_subscribers();
+				for(auto& subscriber : _subscribers_)
+				{
+						collect_releases(subscriber);
+				}
+				drop_disconnected();
+		}
+
+		[[nodiscard]] std::size_t subscriber_count() const
+		{
+				return _subscribers_.size();
+		}
+
+		[[nodiscard]] const Dmabuf_Publisher_Statistics& statistics() const
+		{
+				return _statistics_;
+		}
+
+		[[nodiscard]] const std::string& socket_path() const
+		{
+				return _socket_path_;
+		}
+
+	private:
+		struct Subscriber
+		{
+				int fd				 = -1;
+				bool connected = true;
+				std::unordered_map<uint64_t, Frame_Handle> in_flight;
+		};
+
+		static sockaddr_un make_address(const std::string& path)
+		{
+				sockaddr_un address;
+				std::memset(&address, 0, sizeof(address));
+				address.sun_family = AF_UNIX;
+				if(path.size() >= sizeof(address.sun_path))
+				{
+						throw std::runtime_error("Socket path too long: " + path);
+				}
+				std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+				return address;
+		}
+
+		void accept_subscribers()
+		{
+				for(;;)
+				{
+						const int fd = accept4(_listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+						if(-1 == fd)
+						{
+								return;
+						}
+
+						Subscriber subscriber;
+						subscriber.fd = fd;
+						if(send_buffers(fd))
+						{
+								_subscribers_.push_back(std::move(subscriber));
+						}
+						else
+						{
+								std::cerr << "Dmabuf_Publisher: handshake failed: " << strerror(errno) << std::endl;
+								close(fd);
+						}
+				}
+		}
+
+		bool send_buffers(int fd) const
+		{
+				const auto& dma_fds = _backend_->dma_buffer_fds();
+
+				Dmabuf_Stream_Header header;
+				std::memset(static_cast<void*>(&header), 0, sizeof(header));
+				header.magic			 = Dmabuf_Share_Magic;
+				header.version		 = Dmabuf_Share_Version;
+				header.layout			 = make_image_layout_record(_backend_->image_layout());
+				header.num_buffers = static_cast<uint32_t>(dma_fds.size());
+				if(-1 == send(fd, &header, sizeof(header), MSG_NOSIGNAL))
+				{
+						return false;
+				}
+
+				for(std::size_t index = 0; index < dma_fds.size(); ++index)
+				{
+						const auto& planes = dma_fds[index];
+
+						Dmabuf_Buffer_Header buffer;
+						buffer.index	 = static_cast<uint32_t>(index);
+						buffer.num_fds = static_cast<uint32_t>(std::min<std::size_t>(planes.size(), VIDEO_MAX_PLANES));
+						std::array<int, VIDEO_MAX_PLANES> fds{};
+						for(std::size_t plane = 0; plane < buffer.num_fds; ++plane)
+						{
+								fds[plane]						= planes[plane].first;
+								buffer.lengths[plane] = planes[plane].second;
+						}
+
+						iovec io{&buffer, sizeof(buffer)};
+						alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * VIDEO_MAX_PLANES)];
+						std::memset(control, 0, sizeof(control));
+
+						msghdr message;
+						std::memset(&message, 0, sizeof(message));
+						message.msg_iov				 = &io;
+						message.msg_iovlen		 = 1;
+						message.msg_control		 = control;
+						message.msg_controllen = CMSG_SPACE(sizeof(int) * buffer.num_fds);
+
+						cmsghdr* rights	 = CMSG_FIRSTHDR(&message);
+						rights->cmsg_level = SOL_SOCKET;
+						rights->cmsg_type	 = SCM_RIGHTS;
+						rights->cmsg_len	 = CMSG_LEN(sizeof(int) * buffer.num_fds);
+						std::memcpy(CMSG_DATA(rights), fds.data(), sizeof(int) * buffer.num_fds);
+
+						if(-1 == sendmsg(fd, &message, MSG_NOSIGNAL))
+						{
+								return false;
+						}
+				}
+				return true;
+		}
+
+		void collect_releases(Subscriber& subscriber)
+		{
+				Dmabuf_Release_Message release;
+				for(;;)
+				{
+						const auto received = recv(subscriber.fd, &release, sizeof(release), MSG_DONTWAIT);
+						if(received == sizeof(release))
+						{
+								if(subscriber.in_flight.erase(release.token))
+								{
+										++_statistics_.released;
+								}
+								continue;
+						}
+						if(0 == received or (-1 == received and EAGAIN != errno and EWOULDBLOCK != errno))
+						{
+								subscriber.connected = false;
+						}
+						return;
+				}
+		}
+
+		void drop_disconnected()
+		{
+				/* Frames held for a vanished subscriber go back to the driver here. */
+				std::erase_if(_subscribers_,
+											[this](const Subscriber& subscriber)
+											{
+													if(subscriber.connected)
+													{
+															return false;
+													}
+													close(subscriber.fd);
+													++_statistics_.disconnected;
+													return true;
+											});
+		}
+
+	private:
+		std::shared_ptr<V4L2_Backend> _backend_;
+		std::string _socket_path_;
+		unsigned int _max_in_flight_;
+		int _listen_fd_ = -1;
+		std::vector<Subscriber> _subscribers_;
+		uint64_t _last_token_ = 0;
+		Dmabuf_Publisher_Statistics _statistics_;
+};
+
+/**
+ * @brief A frame read from another process' driver buffer.
+ */
+struct Shared_Frame
+{
+		Multiplanar_Buffer_View planes;
+		Image_View image;
+		std::chrono::nanoseconds timestamp{0};
+		uintmax_t frame_order = 0;
+		uint32_t sequence			= 0;
+		unsigned int buffer_index = 0;
+};
+
+/**
+ * @brief The release token is sent back when the last copy is destroyed.
+ * Handles may outlive the subscriber, the mapping stays until they are gone.
+ */
+using Shared_Frame_Handle = std::shared_ptr<const Shared_Frame>;
+
+/**
+ * @brief Receiving end of Dmabuf_Publisher. Maps the publisher's buffers read
+ * only and wraps CPU access in DMA_BUF_IOCTL_SYNC, so caches are coherent on
+ * hardware where DMA does not snoop them.
+ *
+ * Releases never block the thread dropping a handle. When the socket is full
+ * they are queued and sent before next_frame waits for a frame, so the
+ * publisher gets every buffer back. A release the socket refuses for any
+ * other reason makes next_frame throw, or report a disconnect when the
+ * publisher went away.
+ */
+class Dmabuf_Subscriber
+{
+	public:
+		explicit Dmabuf_Subscriber(const std::string& socket_path)
+				: _connection_(std::make_shared<Connection>())
+		{
+				sockaddr_un address;
+				std::memset(&address, 0, sizeof(address));
+				address.sun_family = AF_UNIX;
+				if(socket_path.size() >= sizeof(address.sun_path))
+				{
+						throw std::runtime_error("Socket path too long: " + socket_path);
+				}
+				std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+				auto& connection	 = *_connection_;
+				connection.socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+				if(-1 == connection.socket
+					 or -1 == connect(connection.socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)))
+				{
+						throw std::runtime_error("Cannot connect to " + socket_path + ": " + strerror(errno));
+				}
+
+				Dmabuf_Stream_Header header;
+				if(recv(connection.socket, &header, sizeof(header), 0) != sizeof(header)
+					 or header.magic != Dmabuf_Share_Magic or header.version != Dmabuf_Share_Version)
+				{
+						throw std::runtime_error("Dmabuf_Subscriber: unexpected stream header");
+				}
+				const auto layout = image_layout_from_record(header.layout);
+				if(not layout)
+				{
+						throw std::runtime_error("Dmabuf_Subscriber: stream header has an invalid layout");
+				}
+				_layout_			= *layout;
+				_num_buffers_ = header.num_buffers;
+
+				connection.buffers.resize(_num_buffers_);
+				for(uint32_t i = 0; i < _num_buffers_; ++i)
+				{
+						receive_buffer();
+				}
+		}
+
+		Dmabuf_Subscriber(const Dmabuf_Subscriber&)						 = delete;
+		Dmabuf_Subscriber& operator=(const Dmabuf_Subscriber&) = delete;
+
+		/**
+		 * @brief Waits up to timeout for the next frame. Empty when nothing arrived
+		 * or the publisher went away, see connected().
+		 */
+		[[nodiscard]] Shared_Frame_Handle next_frame(std::chrono::milliseconds timeout = std::chrono::milliseconds{1000})
+		{
+				auto& connection = *_connection_;
+				{
+						std::lock_guard lock(connection.mutex);
+						send_releases(connection);
+						if(EPIPE == connection.release_error or ECONNRESET == connection.release_error)
+						{
+								_connected_ = false;
+								return {};
+						}
+						if(connection.release_error)
+						{
+								throw std::runtime_error("Dmabuf_Subscriber: sending a release failed: "
+																				 + std::string{strerror(connection.release_error)});
+						}
+				}
+
+				pollfd watched{connection.socket, POLLIN, 0};
+				if(poll(&watched, 1, static_cast<int>(timeout.count())) <= 0)
+				{
+						return {};
+				}
+
+				Dmabuf_Frame_Message message;
+				const auto received = recv(connection.socket, &message, sizeof(message), 0);
+				if(received != sizeof(message))
+				{
+						_connected_ = false;
+						return {};
+				}
+				if(message.buffer_index >= connection.buffers.size())
+				{
+						release(connection, message.token);
+						return {};
+				}
+
+				auto& buffer = connection.buffers[message.buffer_index];
+				sync(buffer, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+
+				auto* frame					= new Shared_Frame;
+				frame->timestamp		= std::chrono::nanoseconds{message.timestamp};
+				frame->frame_order	= message.frame_order;
+				frame->sequence			= message.sequence;
+				frame->buffer_index = message.buffer_index;
+				for(std::size_t plane = 0; plane < buffer.mappings.size(); ++plane)
+				{
+						const auto& mapping = buffer.mappings[plane];
+						frame->planes.emplace_back(mapping.data(),
+																			 std::min<std::size_t>(message.bytes_used[plane]
+																																 ? message.bytes_used[plane]
+																																 : mapping.size(),
+																														 mapping.size()));
+				}
+				frame->image = make_image_view(_layout_, frame->planes);
+
+				return Shared_Frame_Handle(frame,
+																	 [connection = _connection_, token = message.token](const Shared_Frame* released)
+																	 {
+																			 sync(connection->buffers[released->buffer_index],
+																						DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+																			 delete released;
+																			 release(*connection, token);
+																	 });
+		}
+
+		[[nodiscard]] const Image_Layout& image_layout() const
+		{
+				return _layout_;
+		}
+
+		[[nodiscard]] std::size_t num_buffers() const
+		{
+				return _num_buffers_;
+		}
+
+		[[nodiscard]] bool connected() const
+		{
+				return _connected_;
+		}
+
+	private:
+		struct Shared_Buffer
+		{
+				std::vector<int> fds;
+				Multiplanar_Buffer_View mappings;
+		};
+
+		struct Connection
+		{
+				int socket = -1;
+				std::mutex mutex;
+				std::vector<Shared_Buffer> buffers;
+				/**
+				 * @brief Tokens of released frames not sent yet, and the first send
+				 * error other than a full socket. Both guarded by mutex.
+				 */
+				std::deque<uint64_t> pending_releases;
+				int release_error = 0;
+
+				~Connection()
+				{
+						for(auto& buffer : buffers)
+						{
+								for(auto& mapping : buffer.mappings)
+								{
+										munmap(mapping.data(), mapping.size());
+								}
+								for(const int fd : buffer.fds)
+								{
+										close(fd);
+								}
+						}
+						if(-1 != socket)
+						{
+								close(socket);
+						}
+				}
+		};
+
+		void receive_buffer()
+		{
+				auto& connection = *_connection_;
+
+				Dmabuf_Buffer_Header header;
+				iovec io{&header, sizeof(header)};
+				alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * VIDEO_MAX_PLANES)];
+
+				msghdr message;
+				std::memset(&message, 0, sizeof(message));
+				message.msg_iov				 = &io;
+				message.msg_iovlen		 = 1;
+				message.msg_control		 = control;
+				message.msg_controllen = sizeof(control);
+
+				if(recvmsg(connection.socket, &message, MSG_CMSG_CLOEXEC) != sizeof(header)
+					 or header.index >= connection.buffers.size())
+				{
+						throw std::runtime_error("Dmabuf_Subscriber: unexpected buffer header");
+				}
+
+				auto& buffer = connection.buffers[header.index];
+				for(cmsghdr* rights = CMSG_FIRSTHDR(&message); rights; rights = CMSG_NXTHDR(&message, rights))
+				{
+						if(rights->cmsg_level == SOL_SOCKET and rights->cmsg_type == SCM_RIGHTS)
+						{
+								const std::size_t count = (rights->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+								buffer.fds.resize(count);
+								std::memcpy(buffer.fds.data(), CMSG_DATA(rights), sizeof(int) * count);
+						}
+				}
+				if(buffer.fds.size() != header.num_fds)
+				{
+						throw std::runtime_error("Dmabuf_Subscriber: buffer fds missing");
+				}
+				if(header.num_fds != _layout_.num_memory_planes)
+				{
+						throw std::runtime_error("Dmabuf_Subscriber: buffer has " + std::to_string(header.num_fds)
+																		 + " planes, the layout " + std::to_string(_layout_.num_memory_planes));
+				}
+				for(std::size_t plane = 0; plane < header.num_fds; ++plane)
+				{
+						if(header.lengths[plane] < _layout_.memory_plane_sizes[plane])
+						{
+								throw std::runtime_error("Dmabuf_Subscriber: plane " + std::to_string(plane) + " of buffer "
+																				 + std::to_string(header.index) + " is " + std::to_string(header.lengths[plane])
+																				 + " bytes, the layout needs "
+																				 + std::to_string(_layout_.memory_plane_sizes[plane]));
+						}
+				}
+
+				for(std::size_t plane = 0; plane < buffer.fds.size(); ++plane)
+				{
+						auto* data = mmap(nullptr, header.lengths[plane], PROT_READ, MAP_SHARED, buffer.fds[plane], 0);
+						if(MAP_FAILED == data)
+						{
+								throw std::runtime_error("Dmabuf_Subscriber: mmap: " + std::string{strerror(errno)});
+						}
+						buffer.mappings.emplace_back(static_cast<Data_Type*>(data), header.lengths[plane]);
+				}
+		}
+
+		static void sync(const Shared_Buffer& buffer, uint64_t flags)
+		{
+				dma_buf_sync sync_request{flags};
+				for(const int fd : buffer.fds)
+				{
+						/* Exporters without cache maintenance reject it, reading works anyway. */
+						xioctl(fd, DMA_BUF_IOCTL_SYNC, &sync_request);
+				}
+		}
+
+		static void release(Connection& connection, uint64_t token)
+		{
+				std::lock_guard lock(connection.mutex);
+				connection.pending_releases.push_back(token);
+				send_releases(connection);
+		}
+
+		/**
+		 * @brief Sends queued releases in order until the socket is full. Called
+		 * with the connection mutex held.
+		 */
+		static void send_releases(Connection& connection)
+		{
+				while(not connection.pending_releases.empty() and 0 == connection.release_error)
+				{
+						Dmabuf_Release_Message message{connection.pending_releases.front()};
+						if(-1 != send(connection.socket, &message, sizeof(message), MSG_NOSIGNAL | MSG_DONTWAIT))
+						{
+								connection.pending_releases.pop_front();
+								continue;
+						}
+						if(EINTR == errno)
+						{
+								continue;
+						}
+						if(EAGAIN != errno and EWOULDBLOCK != errno)
+						{
+								connection.release_error = errno;
+						}
+						return;
+				}
+		}
+
+	private:
+		std::shared_ptr<Connection> _connection_;
+		Image_Layout _layout_;
+		std::size_t _num_buffers_ = 0;
+		bool _connected_ = true;
+};
+
+} // namespace Cartrack
+
+#endif // DMABUF_SHARE_HPP
@@ -0,0 +1,848 @@
+#ifndef FAKE_V4L2_DEVICE_HPP
+#define FAKE_V4L2_DEVICE_HPP
+
+#include "Device_IO.hpp"
+#include "Image_View.hpp"
+#include "Pixel_Format_Descriptor.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <linux/videodev2.h>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace Cartrack
+{
+
+struct Fake_Device_Options
+{
+		/**
+		 * @brief Path the fake answers to, others fail with ENOENT like a missing node.
+		 */
+		std::string path = "/dev/video0";
+		/**
+		 * @brief Rate of the emulated sensor until the application sets one with
+		 * VIDIOC_S_PARM. 0 produces a frame whenever a buffer is queued, whatever
+		 * S_PARM asks for, to measure the userspace side alone.
+		 */
+		double fps = 30;
+		/**
+		 * @brief Added to every VIDIOC_DQBUF, roughly what a driver and the
+		 * syscall cost on the target.
+		 */
+		std::chrono::nanoseconds dequeue_latency{0};
+		bool dmabuf_export = true;
+};
+
+struct Fake_Device_Statistics
+{
+		uintmax_t ioctl_calls = 0;
+		uintmax_t queued			= 0;
+		uintmax_t dequeued		= 0;
+		uintmax_t produced		= 0;
+		/**
+		 * @brief Sensor frames lost because the application had no buffer queued.
+		 */
+		uintmax_t overrun = 0;
+		uintmax_t injected_errors = 0;
+};
+
+/**
+ * @brief In-process stand-in for a V4L2 capture node, for driving V4L2_Backend
+ * in benchmarks and fault tests without hardware.
+ *
+ * Emulates the parts of the API the backend uses: QUERYCAP, S_FMT/G_FMT with
+ * packed layouts for every Pixel_Format, S_PARM/G_PARM, REQBUFS, QUERYBUF,
+ * EXPBUF, QBUF/DQBUF for MMAP and USERPTR in single and multi planar flavours,
+ * STREAMON/STREAMOFF, plain and extended controls as stored values. A sensor
+ * fills the oldest queued buffer every frame period and stamps it with
+ * CLOCK_MONOTONIC; no buffer queued means the frame is lost, like a real driver.
+ * Plane 0 of every frame starts with its 32 bit sequence number.
+ *
+ * Failures are injected per request with inject_error, e.g. EAGAIN, EIO (the
+ * buffer is dequeued with V4L2_BUF_FLAG_ERROR, as drivers do) or ENODEV.
+ * disconnect() makes every later call fail with ENODEV and the device readable,
+ * which is what an unplugged USB camera looks like.
+ *
+ * Exported DMABUF fds are fake numbers, they can be mapped through this object
+ * but not passed to other processes. Format and control enumeration are not
+ * emulated, a Device_Profile probed through the fake is empty.
+ */
+class Fake_V4L2_Device final : public Device_IO
+{
+	public:
+		explicit Fake_V4L2_Device(Fake_Device_Options options = {})
+				: _options_(std::move(options))
+		{
+				set_fps(_options_.fps);
+		}
+
+		~Fake_V4L2_Device() override
+		{
+				release_buffers();
+		}
+
+		/**
+		 * @brief The next count calls of request fail with error.
+		 */
+		void inject_error(unsigned long request, int error, unsigned int count = 1)
+		{
+				std::lock_guard lock(_mutex_);
+				auto& injected = _injected_errors_[request];
+				for(unsigned int i = 0; i < count; ++i)
+				{
+						injected.push_back(error);
+				}
+		}
+
+		void disconnect()
+		{
+				std::lock_guard lock(_mutex_);
+				_disconnected_ = true;
+		}
+
+		/**
+		 * @brief Changes the sensor latency while streaming, e.g. to emulate a
+		 * USB bus that got busy.
+		 */
+		void set_dequeue_latency(std::chrono::nanoseconds latency)
+		{
+				std::lock_guard lock(_mutex_);
+				_options_.dequeue_latency = latency;
+		}
+
+		[[nodiscard]] Fake_Device_Statistics statistics() const
+		{
+				std::lock_guard lock(_mutex_);
+				return _statistics_;
+		}
+
+	public:
+		int open(const std::string& path, int) override
+		{
+				std::lock_guard lock(_mutex_);
+				if(path != _options_.path)
+				{
+						return fail(ENOENT);
+				}
+				if(_disconnected_)
+				{
+						return fail(ENODEV);
+				}
+				if(_device_fd_ != -1)
+				{
+						return fail(EBUSY);
+				}
+				_device_fd_ = Device_Fd;
+				return _device_fd_;
+		}
+
+		int close(int fd) override
+		{
+				std::lock_guard lock(_mutex_);
+				if(fd == _device_fd_ and fd != -1)
+				{
+						stop_streaming();
+						_device_fd_ = -1;
+						return 0;
+				}
+				if(_exported_.erase(fd))
+				{
+						return 0;
+				}
+				return fail(EBADF);
+		}
+
+		int stat(const std::string& path, struct stat& status) override
+		{
+				std::lock_guard lock(_mutex_);
+				if(path != _options_.path or _disconnected_)
+				{
+						return fail(ENOENT);
+				}
+				std::memset(&status, 0, sizeof(status));
+				status.st_mode = S_IFCHR | 0660;
+				return 0;
+		}
+
+		std::vector<std::string> video_nodes() override
+		{
+				std::lock_guard lock(_mutex_);
+				if(_disconnected_)
+				{
+						return {};
+				}
+				return {_options_.path};
+		}
+
+		int ioctl(int fd, unsigned long request, void* arg) override
+		{
+				/* Like the driver sleeping in DQBUF, without holding anyone else up. */
+				if(request == VIDIOC_DQBUF)
+				{
+						std::chrono::nanoseconds latency;
+						{
+								std::lock_guard lock(_mutex_);
+								latency = _options_.dequeue_latency;
+						}
+						if(latency.count() > 0)
+						{
+								std::this_thread::sleep_for(latency);
+						}
+				}
+
+				std::lock_guard lock(_mutex_);
+				++_statistics_.ioctl_calls;
+				if(fd != _device_fd_ or fd == -1)
+				{
+						return fail(EBADF);
+				}
+				if(_disconnected_)
+				{
+						return fail(ENODEV);
+				}
+				if(const int error = take_injected_error(request); error and error != EIO)
+				{
+						return fail(error);
+				}
+
+				switch(request)
+				{
+						case VIDIOC_QUERYCAP:
+								return query_capabilities(*static_cast<v4l2_capability*>(arg));
+						case VIDIOC_S_FMT:
+						case VIDIOC_TRY_FMT:
+								return set_format(*static_cast<v4l2_format*>(arg), request == VIDIOC_S_FMT);
+						case VIDIOC_G_FMT:
+								*static_cast<v4l2_format*>(arg) = _format_;
+								return 0;
+						case VIDIOC_S_PARM:
+						case VIDIOC_G_PARM:
+								return stream_parameters(*static_cast<v4l2_streamparm*>(arg), request == VIDIOC_S_PARM);
+						case VIDIOC_REQBUFS:
+								return request_buffers(*static_cast<v4l2_requestbuffers*>(arg));
+						case VIDIOC_QUERYBUF:
+								return query_buffer(*static_cast<v4l2_buffer*>(arg));
+						case VIDIOC_EXPBUF:
+								return export_buffer(*static_cast<v4l2_exportbuffer*>(arg));
+						case VIDIOC_QBUF:
+								return queue_buffer(*static_cast<v4l2_buffer*>(arg));
+						case VIDIOC_DQBUF:
+								return dequeue_buffer(*static_cast<v4l2_buffer*>(arg));
+						case VIDIOC_STREAMON:
+								_streaming_			= true;
+								_stream_start_	= now();
+								_next_sequence_ = 0;
+								return 0;
+						case VIDIOC_STREAMOFF:
+								stop_streaming();
+								return 0;
+						case VIDIOC_G_CTRL:
+						{
+								auto* control	 = static_cast<v4l2_control*>(arg);
+								control->value = _controls_[control->id];
+								return 0;
+						}
+						case VIDIOC_S_CTRL:
+						{
+								const auto* control		= static_cast<v4l2_control*>(arg);
+								_controls_[control->id] = control->value;
+								return 0;
+						}
+						case VIDIOC_G_EXT_CTRLS:
+						case VIDIOC_S_EXT_CTRLS:
+						case VIDIOC_TRY_EXT_CTRLS:
+						{
+								auto* batch = static_cast<v4l2_ext_controls*>(arg);
+								for(uint32_t i = 0; i < batch->count; ++i)
+								{
+										auto& control = batch->controls[i];
+										if(request == VIDIOC_G_EXT_CTRLS)
+										{
+												control.value = _controls_[control.id];
+										}
+										else if(request == VIDIOC_S_EXT_CTRLS)
+										{
+												_controls_[control.id] = control.value;
+										}
+								}
+								return 0;
+						}
+						case VIDIOC_SUBSCRIBE_EVENT:
+						case VIDIOC_UNSUBSCRIBE_EVENT:
+								return 0;
+						case VIDIOC_DQEVENT:
+								return fail(ENOENT);
+						default:
+								/* CROPCAP, control enumeration and the rest: not implemented. */
+								return fail(ENOTTY);
+				}
+		}
+
+		int wait_readable(int fd, std::chrono::microseconds timeout) override
+		{
+				const auto deadline = now() + timeout;
+				std::unique_lock lock(_mutex_);
+				if(fd != _device_fd_ or fd == -1)
+				{
+						return fail(EBADF);
+				}
+
+				for(;;)
+				{
+						if(_disconnected_)
+						{
+								/* POLLERR, select reports it as readable. */
+								return 1;
+						}
+						produce_frames();
+						if(not _done_.empty())
+						{
+								return 1;
+						}
+
+						auto wake_up = deadline;
+						if(_streaming_ and not _incoming_.empty() and _frame_interval_.count() > 0)
+						{
+								wake_up = std::min(wake_up, frame_time(_next_sequence_));
+						}
+						if(now() >= deadline)
+						{
+								return 0;
+						}
+
+						lock.unlock();
+						std::this_thread::sleep_for(std::max(wake_up - now(), std::chrono::nanoseconds{0}));
+						lock.lock();
+				}
+		}
+
+		void* mmap(std::size_t length, int, int, int fd, off_t offset) override
+		{
+				std::lock_guard lock(_mutex_);
+				std::size_t buffer = 0;
+				std::size_t plane	 = 0;
+				if(fd == _device_fd_ and fd != -1)
+				{
+						buffer = static_cast<std::size_t>(offset) / Offset_Step / VIDEO_MAX_PLANES;
+						plane	 = static_cast<std::size_t>(offset) / Offset_Step % VIDEO_MAX_PLANES;
+				}
+				else if(const auto exported = _exported_.find(fd); exported != _exported_.end())
+				{
+						buffer = exported->second.first;
+						plane	 = exported->second.second;
+				}
+				else
+				{
+						errno = EBADF;
+						return MAP_FAILED;
+				}
+
+				if(buffer >= _buffers_.size() or plane >= _buffers_[buffer].planes.size()
+					 or length > _buffers_[buffer].planes[plane].length)
+				{
+						errno = EINVAL;
+						return MAP_FAILED;
+				}
+				return _buffers_[buffer].planes[plane].memory;
+		}
+
+		int munmap(void*, std::size_t) override
+		{
+				/* Memory lives until REQBUFS 0 or destruction, as with vb2. */
+				return 0;
+		}
+
+	private:
+		static constexpr int Device_Fd				= 0x40000000;
+		static constexpr off_t Offset_Step		= 4096;
+		static constexpr unsigned Max_Buffers = VIDEO_MAX_FRAME;
+
+		struct Fake_Plane
+		{
+				Data_Type* memory	 = nullptr;
+				std::size_t length = 0;
+				unsigned long userptr = 0;
+				uint32_t bytesused		= 0;
+		};
+
+		struct Fake_Buffer
+		{
+				std::vector<Fake_Plane> planes;
+				bool queued = false;
+				timeval timestamp{};
+				uint32_t sequence = 0;
+				uint32_t flags		= 0;
+		};
+
+		static std::chrono::nanoseconds now()
+		{
+				timespec time;
+				clock_gettime(CLOCK_MONOTONIC, &time);
+				return std::chrono::seconds{time.tv_sec} + std::chrono::nanoseconds{time.tv_nsec};
+		}
+
+		int fail(int error)
+		{
+				errno = error;
+				return -1;
+		}
+
+		int take_injected_error(unsigned long request)
+		{
+				auto found = _injected_errors_.find(request);
+				if(found == _injected_errors_.end() or found->second.empty())
+				{
+						return 0;
+				}
+				if(found->second.front() == EIO and (request != VIDIOC_DQBUF or not frame_ready()))
+				{
+						/* EIO comes with a dequeued buffer, keep it for when one is ready. */
+						return 0;
+				}
+				const int error = found->second.front();
+				found->second.pop_front();
+				++_statistics_.injected_errors;
+				return error;
+		}
+
+		bool frame_ready()
+		{
+				produce_frames();
+				return not _done_.empty();
+		}
+
+		void set_fps(double fps)
+		{
+				_frame_interval_ = fps > 0 ? std::chrono::duration_cast<std::chrono::nanoseconds>(
+																				 std::chrono::duration<double>(1.0 / fps))
+																	 : std::chrono::nanoseconds{0};
+				_stream_start_ = now();
+				_next_sequence_ = 0;
+		}
+
+		std::chrono::nanoseconds frame_time(uint32_t sequence) const
+		{
+				return _stream_start_ + _frame_interval_ * static_cast<int64_t>(sequence + 1);
+		}
+
+		bool multiplanar() const
+		{
+				return _format_.type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+		}
+
+		/**
+		 * @brief Runs the sensor up to now: every elapsed frame period fills the
+		 * oldest queued buffer or is lost.
+		 */
+		void produce_frames()
+		{
+				if(not _streaming_)
+				{
+						return;
+				}
+
+				const auto current = now();
+				if(_frame_interval_.count() == 0)
+				{
+						while(not _incoming_.empty())
+						{
+								fill(current);
+						}
+						return;
+				}
+
+				/* After a long stall do not replay thousands of periods one by one. */
+				const auto elapsed = (current - _stream_start_) / _frame_interval_;
+				if(elapsed > _next_sequence_ + 2 * Max_Buffers)
+				{
+						const auto skipped = static_cast<uint32_t>(elapsed - _next_sequence_ - Max_Buffers);
+						_statistics_.overrun += skipped;
+						_next_sequence_ += skipped;
+				}
+
+				while(frame_time(_next_sequence_) <= current)
+				{
+						if(_incoming_.empty())
+						{
+								++_statistics_.overrun;
+								++_next_sequence_;
+								continue;
+						}
+						fill(frame_time(_next_sequence_));
+				}
+		}
+
+		void fill(std::chrono::nanoseconds timestamp)
+		{
+				const auto index = _incoming_.front();
+				_incoming_.pop_front();
+				auto& buffer = _buffers_[index];
+
+				const auto sequence = _next_sequence_++;
+				buffer.sequence			= sequence;
+				buffer.flags				= 0;
+				buffer.timestamp.tv_sec	 = static_cast<time_t>(timestamp.count() / 1000000000);
+				buffer.timestamp.tv_usec = static_cast<suseconds_t>(timestamp.count() % 1000000000 / 1000);
+
+				for(std::size_t plane = 0; plane < buffer.planes.size(); ++plane)
+				{
+						auto& target		 = buffer.planes[plane];
+						target.bytesused = static_cast<uint32_t>(plane_size(plane));
+						auto* memory = _memory_ == V4L2_MEMORY_USERPTR ? reinterpret_cast<Data_Type*>(target.userptr)
+																													 : target.memory;
+						if(plane == 0 and memory and target.length >= sizeof(sequence))
+						{
+								std::memcpy(memory, &sequence, sizeof(sequence));
+						}
+				}
+
+				_done_.push_back(index);
+				++_statistics_.produced;
+		}
+
+		std::size_t plane_size(std::size_t plane) const
+		{
+				return multiplanar() ? _format_.fmt.pix_mp.plane_fmt[plane].sizeimage : _format_.fmt.pix.sizeimage;
+		}
+
+		int query_capabilities(v4l2_capability& capability)
+		{
+				std::memset(&capability, 0, sizeof(capability));
+				std::strncpy(reinterpret_cast<char*>(capability.driver), "fake_v4l2", sizeof(capability.driver) - 1);
+				std::strncpy(reinterpret_cast<char*>(capability.card), "Fake V4L2 Device", sizeof(capability.card) - 1);
+				std::strncpy(reinterpret_cast<char*>(capability.bus_info), "platform:fake_v4l2", sizeof(capability.bus_info) - 1);
+				capability.version = 6u << 16;
+				capability.device_caps =
+						V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE | V4L2_CAP_STREAMING;
+				capability.capabilities = capability.device_caps | V4L2_CAP_DEVICE_CAPS;
+				return 0;
+		}
+
+		int set_format(v4l2_format& format, bool apply)
+		{
+				if(format.type != V4L2_BUF_TYPE_VIDEO_CAPTURE and format.type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+				{
+						return fail(EINVAL);
+				}
+				if(apply and not _buffers_.empty())
+				{
+						return fail(EBUSY);
+				}
+
+				const bool planes = format.type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+				auto pixel_format = pixel_format_from_v4l2(planes ? format.fmt.pix_mp.pixelformat : format.fmt.pix.pixelformat);
+				if(pixel_format == Pixel_Format::Invalid
+					 or (not planes and not describe(pixel_format).contiguous))
+				{
+						/* Drivers substitute what they can do instead of failing. */
+						pixel_format = Pixel_Format::NV12;
+				}
+				const auto& descriptor = describe(pixel_format);
+				uint32_t width	= std::clamp<uint32_t>(planes ? format.fmt.pix_mp.width : format.fmt.pix.width, 2, 8192);
+				uint32_t height = std::clamp<uint32_t>(planes ? format.fmt.pix_mp.height : format.fmt.pix.height, 2, 8192);
+				width &= ~1u;
+				height &= ~1u;
+
+				/*
+				 * Colorimetry as uvcvideo reports it: sRGB, everything else implied by it.
+				 * A requested quantization is ignored like drivers do without
+				 * V4L2_PIX_FMT_FLAG_SET_CSC.
+				 */
+				const auto layout = make_packed_image_layout(pixel_format, width, height, planes);
+				if(planes)
+				{
+						format.fmt.pix_mp.width				 = width;
+						format.fmt.pix_mp.height			 = height;
+						format.fmt.pix_mp.pixelformat	 = descriptor.v4l2_pixel_format();
+						format.fmt.pix_mp.field				 = V4L2_FIELD_NONE;
+						format.fmt.pix_mp.num_planes	 = static_cast<uint8_t>(layout.num_memory_planes);
+						format.fmt.pix_mp.colorspace	 = V4L2_COLORSPACE_SRGB;
+						format.fmt.pix_mp.ycbcr_enc		 = V4L2_YCBCR_ENC_DEFAULT;
+						format.fmt.pix_mp.quantization = V4L2_QUANTIZATION_DEFAULT;
+						format.fmt.pix_mp.xfer_func		 = V4L2_XFER_FUNC_DEFAULT;
+						for(std::size_t plane = 0; plane < layout.num_memory_planes; ++plane)
+						{
+								format.fmt.pix_mp.plane_fmt[plane].bytesperline = layout.planes[plane].stride;
+								format.fmt.pix_mp.plane_fmt[plane].sizeimage =
+										static_cast<uint32_t>(layout.memory_plane_sizes[plane]);
+						}
+				}
+				else
+				{
+						format.fmt.pix.width				= width;
+						format.fmt.pix.height				= height;
+						format.fmt.pix.pixelformat	= descriptor.v4l2_pixel_format();
+						format.fmt.pix.field				= V4L2_FIELD_NONE;
+						format.fmt.pix.bytesperline = layout.planes[0].stride;
+						format.fmt.pix.sizeimage		= static_cast<uint32_t>(layout.memory_plane_sizes[0]);
+						format.fmt.pix.colorspace		= V4L2_COLORSPACE_SRGB;
+						format.fmt.pix.ycbcr_enc		= V4L2_YCBCR_ENC_DEFAULT;
+						format.fmt.pix.quantization = V4L2_QUANTIZATION_DEFAULT;
+						format.fmt.pix.xfer_func		= V4L2_XFER_FUNC_DEFAULT;
+				}
+
+				if(apply)
+				{
+						_format_ = format;
+				}
+				return 0;
+		}
+
+		int stream_parameters(v4l2_streamparm& parameters, bool apply)
+		{
+				auto& capture = parameters.parm.capture;
+				if(apply and _options_.fps > 0 and capture.timeperframe.numerator
+					 and capture.timeperframe.denominator)
+				{
+						set_fps(capture.timeperframe.denominator / double(capture.timeperframe.numerator));
+				}
+				capture.capability = V4L2_CAP_TIMEPERFRAME;
+				if(_frame_interval_.count() > 0)
+				{
+						capture.timeperframe.numerator	 = 1000;
+						capture.timeperframe.denominator = static_cast<uint32_t>(
+								std::llround(1e12 / static_cast<double>(_frame_interval_.count())));
+				}
+				else
+				{
+						capture.timeperframe = {0, 0};
+				}
+				return 0;
+		}
+
+		void release_buffers()
+		{
+				for(auto& buffer : _buffers_)
+				{
+						for(auto& plane : buffer.planes)
+						{
+								std::free(plane.memory);
+						}
+				}
+				_buffers_.clear();
+				_exported_.clear();
+				_incoming_.clear();
+				_done_.clear();
+		}
+
+		int request_buffers(v4l2_requestbuffers& request)
+		{
+				if(request.type != _format_.type)
+				{
+						return fail(EINVAL);
+				}
+				if(request.memory != V4L2_MEMORY_MMAP and request.memory != V4L2_MEMORY_USERPTR)
+				{
+						return fail(EINVAL);
+				}
+				if(_streaming_)
+				{
+						return fail(EBUSY);
+				}
+
+				release_buffers();
+				_memory_			= static_cast<v4l2_memory>(request.memory);
+				request.count = std::min(request.count, Max_Buffers);
+				const std::size_t num_planes = multiplanar() ? _format_.fmt.pix_mp.num_planes : 1;
+
+				_buffers_.resize(request.count);
+				for(auto& buffer : _buffers_)
+				{
+						buffer.planes.resize(num_planes);
+						for(std::size_t plane = 0; plane < num_planes; ++plane)
+						{
+								auto& target	= buffer.planes[plane];
+								target.length = plane_size(plane);
+								if(_memory_ == V4L2_MEMORY_MMAP)
+								{
+										/* Page aligned like vb2 memory, callers assume at least Alignment_Size. */
+										const std::size_t rounded = (target.length + 4095) / 4096 * 4096;
+										target.memory							= static_cast<Data_Type*>(std::aligned_alloc(4096, rounded));
+										std::memset(target.memory, 0, rounded);
+								}
+						}
+				}
+				return 0;
+		}
+
+		int describe_buffer(v4l2_buffer& buf)
+		{
+				if(buf.type != _format_.type or buf.index >= _buffers_.size())
+				{
+						return fail(EINVAL);
+				}
+				const auto& buffer = _buffers_[buf.index];
+				buf.memory				 = _memory_;
+				buf.sequence			 = buffer.sequence;
+				buf.timestamp			 = buffer.timestamp;
+				buf.field					 = V4L2_FIELD_NONE;
+				buf.flags = buffer.flags | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+										| (buffer.queued ? V4L2_BUF_FLAG_QUEUED : 0);
+
+				for(std::size_t plane = 0; plane < buffer.planes.size(); ++plane)
+				{
+						const auto& source	 = buffer.planes[plane];
+						const off_t cookie	 = (buf.index * VIDEO_MAX_PLANES + plane) * Offset_Step;
+						if(multiplanar())
+						{
+								if(plane >= buf.length or not buf.m.planes)
+								{
+										return fail(EINVAL);
+								}
+								auto& target		 = buf.m.planes[plane];
+								target.length		 = static_cast<uint32_t>(source.length);
+								target.bytesused = source.bytesused;
+								if(_memory_ == V4L2_MEMORY_MMAP)
+								{
+										target.m.mem_offset = static_cast<uint32_t>(cookie);
+								}
+								else
+								{
+										target.m.userptr = source.userptr;
+								}
+						}
+						else
+						{
+								buf.length		= static_cast<uint32_t>(source.length);
+								buf.bytesused = source.bytesused;
+								if(_memory_ == V4L2_MEMORY_MMAP)
+								{
+										buf.m.offset = static_cast<uint32_t>(cookie);
+								}
+								else
+								{
+										buf.m.userptr = source.userptr;
+								}
+						}
+				}
+				if(multiplanar())
+				{
+						buf.length = static_cast<uint32_t>(buffer.planes.size());
+				}
+				return 0;
+		}
+
+		int query_buffer(v4l2_buffer& buf)
+		{
+				return describe_buffer(buf);
+		}
+
+		int export_buffer(v4l2_exportbuffer& request)
+		{
+				if(not _options_.dmabuf_export or _memory_ != V4L2_MEMORY_MMAP)
+				{
+						return fail(ENOTTY);
+				}
+				if(request.index >= _buffers_.size() or request.plane >= _buffers_[request.index].planes.size())
+				{
+						return fail(EINVAL);
+				}
+				request.fd = _next_exported_fd_++;
+				_exported_.emplace(request.fd, std::make_pair(request.index, request.plane));
+				return 0;
+		}
+
+		int queue_buffer(v4l2_buffer& buf)
+		{
+				if(buf.type != _format_.type or buf.memory != _memory_ or buf.index >= _buffers_.size())
+				{
+						return fail(EINVAL);
+				}
+				auto& buffer = _buffers_[buf.index];
+				if(buffer.queued)
+				{
+						return fail(EINVAL);
+				}
+
+				if(_memory_ == V4L2_MEMORY_USERPTR)
+				{
+						for(std::size_t plane = 0; plane < buffer.planes.size(); ++plane)
+						{
+								const auto userptr = multiplanar() ? buf.m.planes[plane].m.userptr : buf.m.userptr;
+								const auto length	 = multiplanar() ? buf.m.planes[plane].length : buf.length;
+								if(not userptr or length < buffer.planes[plane].length)
+								{
+										return fail(EINVAL);
+								}
+								buffer.planes[plane].userptr = userptr;
+						}
+				}
+
+				buffer.queued = true;
+				_incoming_.push_back(buf.index);
+				++_statistics_.queued;
+				return describe_buffer(buf);
+		}
+
+		int dequeue_buffer(v4l2_buffer& buf)
+		{
+				if(buf.type != _format_.type or buf.memory != _memory_)
+				{
+						return fail(EINVAL);
+				}
+				if(not _streaming_)
+				{
+						return fail(EINVAL);
+				}
+
+				const bool injected_io_error = take_injected_error(VIDIOC_DQBUF) == EIO;
+				if(not frame_ready())
+				{
+						return fail(EAGAIN);
+				}
+
+				const auto index = _done_.front();
+				_done_.pop_front();
+				auto& buffer	= _buffers_[index];
+				buffer.queued = false;
+				if(injected_io_error)
+				{
+						buffer.flags |= V4L2_BUF_FLAG_ERROR;
+				}
+
+				buf.index = index;
+				describe_buffer(buf);
+				++_statistics_.dequeued;
+				return injected_io_error ? fail(EIO) : 0;
+		}
+
+		void stop_streaming()
+		{
+				_streaming_ = false;
+				for(auto& buffer : _buffers_)
+				{
+						buffer.queued = false;
+				}
+				_incoming_.clear();
+				_done_.clear();
+		}
+
+	private:
+		mutable std::mutex _mutex_;
+		Fake_Device_Options _options_;
+		int _device_fd_ = -1;
+		bool _disconnected_ = false;
+		bool _streaming_		= false;
+		v4l2_format _format_{};
+		v4l2_memory _memory_ = V4L2_MEMORY_MMAP;
+		std::vector<Fake_Buffer> _buffers_;
+		std::deque<unsigned int> _incoming_;
+		std::deque<unsigned int> _done_;
+		std::unordered_map<int, std::pair<std::size_t, std::size_t>> _exported_;
+		int _next_exported_fd_ = Device_Fd + 1;
+		std::chrono::nanoseconds _frame_interval_{0};
+		std::chrono::nanoseconds _stream_start_{0};
+		uint32_t _next_sequence_ = 0;
+		std::map<unsigned long, std::deque<int>> _injected_errors_;
+		std::unordered_map<uint32_t, int32_t> _controls_;
+		Fake_Device_Statistics _statistics_;
+};
+
+} // namespace Cartrack
+
+#endif // FAKE_V4L2_DEVICE_HPP
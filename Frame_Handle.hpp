@@ -0,0 +1,33 @@
+#ifndef FRAME_HANDLE_HPP
+#define FRAME_HANDLE_HPP
+
+#include "Abstract_Capture_Backend.hpp"
+
+#include <memory>
+
+namespace Cartrack
+{
+
+/**
+ * @brief A captured frame that stays in userspace as long as someone holds it.
+ * buffer_index identifies the driver buffer, e.g. to find its exported DMABUF fds.
+ */
+struct Frame_Lease
+{
+		Multiplanar_Buffer_View planes;
+		std::chrono::nanoseconds timestamp{0};
+		uintmax_t frame_order = 0;
+		uint32_t sequence			= 0;
+		unsigned int buffer_index = 0;
+};
+
+/**
+ * @brief Reference counted frame. Copies are cheap and thread safe, the buffer
+ * goes back to the driver when the last copy is destroyed. Handles must not
+ * outlive the backend that produced them.
+ */
+using Frame_Handle = std::shared_ptr<const Frame_Lease>;
+
+} // namespace Cartrack
+
+#endif // FRAME_HANDLE_HPP
@@ -0,0 +1,1103 @@
+#ifndef IMAGE_RESIZE_HPP
+#define IMAGE_RESIZE_HPP
+
+#include "Color_Conversion.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Cartrack
+{
+
+/**
+ * @brief How resize_plane computes a target sample.
+ */
+enum class Resize_Filter : uint8_t
+{
+		/**
+		 * @brief Mean of the integer factor x factor block of source samples, the
+		 * rows and columns past the last whole block are left out. 2x2 runs on
+		 * SIMD kernels, it is what the pyramid uses.
+		 */
+		Box,
+		/**
+		 * @brief Pixel centers aligned like cv::resize with INTER_LINEAR.
+		 */
+		Bilinear,
+		/**
+		 * @brief Mean over the exact footprint of the target sample like
+		 * cv::resize with INTER_AREA, no aliasing at any downscale factor.
+		 * Upscaling falls back to Bilinear.
+		 */
+		Area
+};
+
+[[nodiscard]] inline const char*
+resize_filter_name(Resize_Filter filter)
+{
+		switch(filter)
+		{
+				case Resize_Filter::Box:
+						return "Box";
+				case Resize_Filter::Bilinear:
+						return "Bilinear";
+				case Resize_Filter::Area:
+						return "Area";
+		}
+		return "Unknown";
+}
+
+namespace detail
+{
+
+/**
+ * @brief Bilinear tap along one axis: the two samples and the weight of the second.
+ */
+struct Resample_Tap
+{
+		uint32_t first	= 0;
+		uint32_t second = 0;
+		float weight		= 0;
+};
+
+/**
+ * @brief Tap of output sample index for a source axis of source_size samples,
+ * pixel centers aligned like cv::resize with INTER_LINEAR. step is source
+ * samples per output sample, subsampling 2 maps into a chroma axis.
+ */
+inline Resample_Tap
+resample_tap(float index, float step, uint32_t source_size, uint32_t subsampling, bool cosited)
+{
+		float position = (index + 0.5f) * step - 0.5f;
+		/* Horizontally chroma sits on the even luma samples, vertically between rows. */
+		position			 = cosited ? position / float(subsampling) : (position + 0.5f) / float(subsampling) - 0.5f;
+		position			 = std::clamp(position, 0.0f, float(source_size - 1));
+		Resample_Tap tap;
+		tap.first	 = static_cast<uint32_t>(position);
+		tap.second = std::min(tap.first + 1, source_size - 1);
+		tap.weight = position - float(tap.first);
+		return tap;
+}
+
+/**
+ * @brief Bilinear weights are Q8, a blended row of two Q8 weighted bytes still
+ * fits 16 bits and vectorizes twice as wide as 32.
+ */
+static constexpr uint32_t Bilinear_Bits = 8;
+static constexpr uint32_t Bilinear_One	= 1u << Bilinear_Bits;
+
+[[nodiscard]] inline uint32_t
+fixed_weight(float weight)
+{
+		return static_cast<uint32_t>(std::lround(weight * Bilinear_One));
+}
+
+/**
+ * @brief Rounded mean of 2x2 blocks: target sample x of a row from samples 2x
+ * and 2x + 1 of the two source rows.
+ */
+template <uint32_t Channels>
+inline void
+halve_row_scalar(const uint8_t* top, const uint8_t* bottom, uint8_t* target, uint32_t x, uint32_t width)
+{
+		for(; x < width; ++x)
+		{
+				for(uint32_t channel = 0; channel < Channels; ++channel)
+				{
+						const uint32_t left	 = 2 * x * Channels + channel;
+						const uint32_t right = left + Channels;
+						target[x * Channels + channel] =
+								static_cast<uint8_t>((top[left] + top[right] + bottom[left] + bottom[right] + 2) >> 2);
+				}
+		}
+}
+
+#ifdef CARTRACK_X86_KERNELS
+
+/**
+ * @brief pshufb mask putting the two samples of every UV pair next to each
+ * other, U0 V0 U1 V1 becomes U0 U1 V0 V1, so pmaddubsw adds them.
+ */
+template <uint32_t Channels>
+__attribute__((target("sse4.1"))) inline __m128i
+pair_mask()
+{
+		if constexpr(Channels == 2)
+		{
+				return _mm_setr_epi8(0, 2, 1, 3, 4, 6, 5, 7, 8, 10, 9, 11, 12, 14, 13, 15);
+		}
+		else
+		{
+				return _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		}
+}
+
+/**
+ * @brief Sums of the sample pairs in 16 bytes of a row.
+ */
+__attribute__((target("sse4.1"))) inline __m128i
+pair_sums(const uint8_t* row, __m128i mask)
+{
+		return _mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row)), mask),
+														 _mm_set1_epi8(1));
+}
+
+__attribute__((target("avx2"))) inline __m256i
+pair_sums(const uint8_t* row, __m256i mask)
+{
+		return _mm256_maddubs_epi16(_mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row)), mask),
+																_mm256_set1_epi8(1));
+}
+
+template <uint32_t Channels>
+__attribute__((target("sse4.1"))) inline void
+halve_row_sse4(const uint8_t* top, const uint8_t* bottom, uint8_t* target, uint32_t width)
+{
+		const __m128i mask = pair_mask<Channels>();
+		const __m128i two	 = _mm_set1_epi16(2);
+
+		const uint32_t bytes = width * Channels;
+		uint32_t x					 = 0;
+		for(; x + 16 <= bytes; x += 16)
+		{
+				const __m128i low	 = _mm_add_epi16(pair_sums(top + 2 * x, mask), pair_sums(bottom + 2 * x, mask));
+				const __m128i high = _mm_add_epi16(pair_sums(top + 2 * x + 16, mask), pair_sums(bottom + 2 * x + 16, mask));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(target + x),
+												 _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(low, two), 2),
+																					_mm_srli_epi16(_mm_add_epi16(high, two), 2)));
+		}
+		halve_row_scalar<Channels>(top, bottom, target, x / Channels, width);
+}
+
+template <uint32_t Channels>
+__attribute__((target("avx2"))) inline void
+halve_row_avx2(const uint8_t* top, const uint8_t* bottom, uint8_t* target, uint32_t width)
+{
+		const __m256i mask = _mm256_broadcastsi128_si256(pair_mask<Channels>());
+		const __m256i two	 = _mm256_set1_epi16(2);
+
+		const uint32_t bytes = width * Channels;
+		uint32_t x					 = 0;
+		for(; x + 32 <= bytes; x += 32)
+		{
+				const __m256i low	 = _mm256_add_epi16(pair_sums(top + 2 * x, mask), pair_sums(bottom + 2 * x, mask));
+				const __m256i high = _mm256_add_epi16(pair_sums(top + 2 * x + 32, mask), pair_sums(bottom + 2 * x + 32, mask));
+				/* packus works per 128 bit lane, the permute puts the quarters back in order. */
+				const __m256i packed = _mm256_packus_epi16(_mm256_srli_epi16(_mm256_add_epi16(low, two), 2),
+																									 _mm256_srli_epi16(_mm256_add_epi16(high, two), 2));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(target + x), _mm256_permute4x64_epi64(packed, 0xd8));
+		}
+		halve_row_scalar<Channels>(top, bottom, target, x / Channels, width);
+}
+
+#endif
+
+#ifdef __ARM_NEON
+
+template <uint32_t Channels>
+inline void
+halve_row_neon(const uint8_t* top, const uint8_t* bottom, uint8_t* target, uint32_t width)
+{
+		const uint32_t bytes = width * Channels;
+		uint32_t x					 = 0;
+		for(; x + 16 <= bytes; x += 16)
+		{
+				if constexpr(Channels == 2)
+				{
+						/* vld4 splits 16 UV pairs into even U, even V, odd U and odd V. */
+						const uint8x8x4_t upper = vld4_u8(top + 2 * x);
+						const uint8x8x4_t lower = vld4_u8(bottom + 2 * x);
+						const uint16x8_t u			= vaddq_u16(vaddl_u8(upper.val[0], upper.val[2]), vaddl_u8(lower.val[0], lower.val[2]));
+						const uint16x8_t v			= vaddq_u16(vaddl_u8(upper.val[1], upper.val[3]), vaddl_u8(lower.val[1], lower.val[3]));
+						vst2_u8(target + x, uint8x8x2_t{{vrshrn_n_u16(u, 2), vrshrn_n_u16(v, 2)}});
+				}
+				else
+				{
+						const uint16x8_t low	= vpadalq_u8(vpaddlq_u8(vld1q_u8(top + 2 * x)), vld1q_u8(bottom + 2 * x));
+						const uint16x8_t high = vpadalq_u8(vpaddlq_u8(vld1q_u8(top + 2 * x + 16)), vld1q_u8(bottom + 2 * x + 16));
+						vst1q_u8(target + x, vcombine_u8(vrshrn_n_u16(low, 2), vrshrn_n_u16(high, 2)));
+				}
+		}
+		halve_row_scalar<Channels>(top, bottom, target, x / Channels, width);
+}
+
+#endif
+
+template <uint32_t Channels>
+inline void
+halve_row(Color_Conversion_Kernel kernel, const uint8_t* top, const uint8_t* bottom, uint8_t* target, uint32_t width)
+{
+		switch(kernel)
+		{
+#ifdef CARTRACK_X86_KERNELS
+				case Color_Conversion_Kernel::SSE4:
+						halve_row_sse4<Channels>(top, bottom, target, width);
+						return;
+				case Color_Conversion_Kernel::AVX2:
+						halve_row_avx2<Channels>(top, bottom, target, width);
+						return;
+#endif
+#ifdef __ARM_NEON
+				case Color_Conversion_Kernel::NEON:
+						halve_row_neon<Channels>(top, bottom, target, width);
+						return;
+#endif
+				default:
+						halve_row_scalar<Channels>(top, bottom, target, 0, width);
+						return;
+		}
+}
+
+/**
+ * @brief Bytes [begin, bytes) of a source row added to the 32 bit sums.
+ */
+inline void
+box_accumulate_scalar(const uint8_t* row, uint32_t* sums, uint32_t begin, uint32_t bytes)
+{
+		for(uint32_t i = begin; i < bytes; ++i)
+		{
+				sums[i] += row[i];
+		}
+}
+
+#ifdef CARTRACK_X86_KERNELS
+
+__attribute__((target("sse4.1"))) inline void
+box_accumulate_sse4(const uint8_t* row, uint32_t* sums, uint32_t bytes)
+{
+		uint32_t i = 0;
+		for(; i + 8 <= bytes; i += 8)
+		{
+				const auto samples = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + i));
+				auto* low					 = reinterpret_cast<__m128i*>(sums + i);
+				auto* high				 = reinterpret_cast<__m128i*>(sums + i + 4);
+				_mm_storeu_si128(low, _mm_add_epi32(_mm_loadu_si128(low), _mm_cvtepu8_epi32(samples)));
+				_mm_storeu_si128(high, _mm_add_epi32(_mm_loadu_si128(high), _mm_cvtepu8_epi32(_mm_srli_si128(samples, 4))));
+		}
+		box_accumulate_scalar(row, sums, i, bytes);
+}
+
+__attribute__((target("avx2"))) inline void
+box_accumulate_avx2(const uint8_t* row, uint32_t* sums, uint32_t bytes)
+{
+		uint32_t i = 0;
+		for(; i + 8 <= bytes; i += 8)
+		{
+				auto* sum = reinterpret_cast<__m256i*>(sums + i);
+				_mm256_storeu_si256(sum,
+														_mm256_add_epi32(_mm256_loadu_si256(sum),
+																						 _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + i)))));
+		}
+		box_accumulate_scalar(row, sums, i, bytes);
+}
+
+#endif
+
+#ifdef __ARM_NEON
+
+inline void
+box_accumulate_neon(const uint8_t* row, uint32_t* sums, uint32_t bytes)
+{
+		uint32_t i = 0;
+		for(; i + 8 <= bytes; i += 8)
+		{
+				const auto samples = vmovl_u8(vld1_u8(row + i));
+				vst1q_u32(sums + i, vaddw_u16(vld1q_u32(sums + i), vget_low_u16(samples)));
+				vst1q_u32(sums + i + 4, vaddw_u16(vld1q_u32(sums + i + 4), vget_high_u16(samples)));
+		}
+		box_accumulate_scalar(row, sums, i, bytes);
+}
+
+#endif
+
+inline void
+box_accumulate(Color_Conversion_Kernel kernel, const uint8_t* row, uint32_t* sums, uint32_t bytes)
+{
+		switch(kernel)
+		{
+#ifdef CARTRACK_X86_KERNELS
+				case Color_Conversion_Kernel::SSE4:
+						box_accumulate_sse4(row, sums, bytes);
+						return;
+				case Color_Conversion_Kernel::AVX2:
+						box_accumulate_avx2(row, sums, bytes);
+						return;
+#endif
+#ifdef __ARM_NEON
+				case Color_Conversion_Kernel::NEON:
+						box_accumulate_neon(row, sums, bytes);
+						return;
+#endif
+				default:
+						box_accumulate_scalar(row, sums, 0, bytes);
+						return;
+		}
+}
+
+/**
+ * @brief Box filter of any integer factor: the rows of a block are summed
+ * first, contiguous and on the SIMD kernels, then the columns.
+ */
+template <uint32_t Channels>
+inline void
+box_rows(const Plane_View& source,
+				 const Plane_View& target,
+				 uint32_t first_row,
+				 uint32_t rows,
+				 uint32_t factor_x,
+				 uint32_t factor_y,
+				 Color_Conversion_Kernel kernel)
+{
+		const uint32_t width = target.width;
+		const uint32_t bytes = width * factor_x * Channels;
+		const uint32_t count = factor_x * factor_y;
+		std::vector<uint32_t> sums(bytes);
+		for(uint32_t y = first_row; y < first_row + rows; ++y)
+		{
+				std::fill(sums.begin(), sums.end(), 0u);
+				for(uint32_t row = 0; row < factor_y; ++row)
+				{
+						box_accumulate(kernel, source.row(y * factor_y + row), sums.data(), bytes);
+				}
+
+				uint8_t* out = target.row(y);
+				for(uint32_t x = 0; x < width; ++x)
+				{
+						for(uint32_t channel = 0; channel < Channels; ++channel)
+						{
+								uint32_t sum = 0;
+								for(uint32_t column = 0; column < factor_x; ++column)
+								{
+										sum += sums[(x * factor_x + column) * Channels + channel];
+								}
+								out[x * Channels + channel] = static_cast<uint8_t>((sum + count / 2) / count);
+						}
+				}
+		}
+}
+
+/**
+ * @brief Bilinear taps of every byte of a target row, the sample of its
+ * channel on both sides and the Q8 weight of the second.
+ */
+struct Bilinear_Columns
+{
+		std::vector<uint32_t> first;
+		std::vector<uint32_t> second;
+		std::vector<uint32_t> weight;
+};
+
+template <uint32_t Channels>
+inline Bilinear_Columns
+bilinear_columns(uint32_t source_width, uint32_t target_width)
+{
+		const float step = float(source_width) / float(target_width);
+		Bilinear_Columns columns;
+		for(uint32_t x = 0; x < target_width; ++x)
+		{
+				const auto tap = resample_tap(float(x), step, source_width, 1, false);
+				for(uint32_t channel = 0; channel < Channels; ++channel)
+				{
+						columns.first.push_back(tap.first * Channels + channel);
+						columns.second.push_back(tap.second * Channels + channel);
+						columns.weight.push_back(fixed_weight(tap.weight));
+				}
+		}
+		return columns;
+}
+
+/**
+ * @brief Bytes [begin, bytes) of two rows blended with Q8 weights into 16 bits.
+ */
+inline void
+bilinear_blend_scalar(const uint8_t* top,
+											const uint8_t* bottom,
+											uint32_t upper,
+											uint32_t lower,
+											uint16_t* blended,
+											uint32_t begin,
+											uint32_t bytes)
+{
+		for(uint32_t i = begin; i < bytes; ++i)
+		{
+				blended[i] = static_cast<uint16_t>(top[i] * upper + bottom[i] * lower);
+		}
+}
+
+/**
+ * @brief Target bytes [begin, bytes) of a row from the blended source row.
+ */
+inline void
+bilinear_gather_scalar(const uint16_t* blended, const Bilinear_Columns& columns, uint8_t* target, uint32_t begin, uint32_t bytes)
+{
+		for(uint32_t i = begin; i < bytes; ++i)
+		{
+				const uint32_t right = columns.weight[i];
+				const uint32_t value = blended[columns.first[i]] * (Bilinear_One - right) + blended[columns.second[i]] * right;
+				target[i]						 = static_cast<uint8_t>((value + (1u << (2 * Bilinear_Bits - 1))) >> (2 * Bilinear_Bits));
+		}
+}
+
+/**
+ * @brief Bytes [begin, bytes) of a source row added to the float sums with
+ * the share of the row.
+ */
+inline void
+area_accumulate_scalar(const uint8_t* row, float weight, float* sums, uint32_t begin, uint32_t bytes)
+{
+		for(uint32_t i = begin; i < bytes; ++i)
+		{
+				sums[i] += weight * row[i];
+		}
+}
+
+#ifdef CARTRACK_X86_KERNELS
+
+__attribute__((target("sse4.1"))) inline void
+bilinear_blend_sse4(const uint8_t* top, const uint8_t* bottom, uint32_t upper, uint32_t lower, uint16_t* blended, uint32_t bytes)
+{
+		/* A weight may be 256 and a sum 255 * 256, both still fit 16 bit lanes. */
+		const auto upper_weight = _mm_set1_epi16(static_cast<int16_t>(upper));
+		const auto lower_weight = _mm_set1_epi16(static_cast<int16_t>(lower));
+		const auto zero					= _mm_setzero_si128();
+		uint32_t i							= 0;
+		for(; i + 16 <= bytes; i += 16)
+		{
+				const auto above = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + i));
+				const auto below = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(blended + i),
+												 _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(above, zero), upper_weight),
+																			 _mm_mullo_epi16(_mm_unpacklo_epi8(below, zero), lower_weight)));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(blended + i + 8),
+												 _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(above, zero), upper_weight),
+																			 _mm_mullo_epi16(_mm_unpackhi_epi8(below, zero), lower_weight)));
+		}
+		bilinear_blend_scalar(top, bottom, upper, lower, blended, i, bytes);
+}
+
+__attribute__((target("sse4.1"))) inline void
+area_accumulate_sse4(const uint8_t* row, float weight, float* sums, uint32_t bytes)
+{
+		const auto share = _mm_set1_ps(weight);
+		uint32_t i			 = 0;
+		for(; i + 8 <= bytes; i += 8)
+		{
+				const auto samples = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + i));
+				const auto low		 = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(samples));
+				const auto high		 = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(samples, 4)));
+				_mm_storeu_ps(sums + i, _mm_add_ps(_mm_loadu_ps(sums + i), _mm_mul_ps(share, low)));
+				_mm_storeu_ps(sums + i + 4, _mm_add_ps(_mm_loadu_ps(sums + i + 4), _mm_mul_ps(share, high)));
+		}
+		area_accumulate_scalar(row, weight, sums, i, bytes);
+}
+
+__attribute__((target("avx2"))) inline void
+bilinear_blend_avx2(const uint8_t* top, const uint8_t* bottom, uint32_t upper, uint32_t lower, uint16_t* blended, uint32_t bytes)
+{
+		const auto upper_weight = _mm256_set1_epi16(static_cast<int16_t>(upper));
+		const auto lower_weight = _mm256_set1_epi16(static_cast<int16_t>(lower));
+		uint32_t i							= 0;
+		for(; i + 16 <= bytes; i += 16)
+		{
+				const auto above = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(top + i)));
+				const auto below = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + i)));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(blended + i),
+														_mm256_add_epi16(_mm256_mullo_epi16(above, upper_weight), _mm256_mullo_epi16(below, lower_weight)));
+		}
+		bilinear_blend_scalar(top, bottom, upper, lower, blended, i, bytes);
+}
+
+/**
+ * @brief 8 target bytes per step, each side gathered as 32 bits at its 16 bit
+ * sample; the high half belongs to the next sample, or to the one padding
+ * sample behind the blended row.
+ */
+__attribute__((target("avx2"))) inline void
+bilinear_gather_avx2(const uint16_t* blended, const Bilinear_Columns& columns, uint8_t* target, uint32_t bytes)
+{
+		const auto* samples = reinterpret_cast<const int*>(blended);
+		const auto low_half = _mm256_set1_epi32(0xffff);
+		const auto one			= _mm256_set1_epi32(Bilinear_One);
+		const auto rounding = _mm256_set1_epi32(1 << (2 * Bilinear_Bits - 1));
+		uint32_t i					= 0;
+		for(; i + 8 <= bytes; i += 8)
+		{
+				const auto first	= _mm256_loadu_si256(reinterpret_cast<const __m256i*>(columns.first.data() + i));
+				const auto second = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(columns.second.data() + i));
+				const auto right	= _mm256_loadu_si256(reinterpret_cast<const __m256i*>(columns.weight.data() + i));
+				const auto left_sample	= _mm256_and_si256(_mm256_i32gather_epi32(samples, first, 2), low_half);
+				const auto right_sample = _mm256_and_si256(_mm256_i32gather_epi32(samples, second, 2), low_half);
+				const auto value				= _mm256_add_epi32(_mm256_mullo_epi32(left_sample, _mm256_sub_epi32(one, right)),
+																									 _mm256_mullo_epi32(right_sample, right));
+				const auto result				= _mm256_srli_epi32(_mm256_add_epi32(value, rounding), 2 * Bilinear_Bits);
+				const auto words = _mm_packus_epi32(_mm256_castsi256_si128(result), _mm256_extracti128_si256(result, 1));
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(target + i), _mm_packus_epi16(words, words));
+		}
+		bilinear_gather_scalar(blended, columns, target, i, bytes);
+}
+
+__attribute__((target("avx2"))) inline void
+area_accumulate_avx2(const uint8_t* row, float weight, float* sums, uint32_t bytes)
+{
+		const auto share = _mm256_set1_ps(weight);
+		uint32_t i			 = 0;
+		for(; i + 8 <= bytes; i += 8)
+		{
+				const auto samples =
+						_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + i))));
+				_mm256_storeu_ps(sums + i, _mm256_add_ps(_mm256_loadu_ps(sums + i), _mm256_mul_ps(share, samples)));
+		}
+		area_accumulate_scalar(row, weight, sums, i, bytes);
+}
+
+#endif
+
+#ifdef __ARM_NEON
+
+inline void
+bilinear_blend_neon(const uint8_t* top, const uint8_t* bottom, uint32_t upper, uint32_t lower, uint16_t* blended, uint32_t bytes)
+{
+		/* 16 bit multiplies, a weight of 256 does not fit the 8 bit vmull_u8. */
+		const auto upper_weight = vdupq_n_u16(static_cast<uint16_t>(upper));
+		const auto lower_weight = vdupq_n_u16(static_cast<uint16_t>(lower));
+		uint32_t i							= 0;
+		for(; i + 16 <= bytes; i += 16)
+		{
+				const auto above = vld1q_u8(top + i);
+				const auto below = vld1q_u8(bottom + i);
+				vst1q_u16(blended + i,
+									vmlaq_u16(vmulq_u16(vmovl_u8(vget_low_u8(above)), upper_weight), vmovl_u8(vget_low_u8(below)), lower_weight));
+				vst1q_u16(
+						blended + i + 8,
+						vmlaq_u16(vmulq_u16(vmovl_u8(vget_high_u8(above)), upper_weight), vmovl_u8(vget_high_u8(below)), lower_weight));
+		}
+		bilinear_blend_scalar(top, bottom, upper, lower, blended, i, bytes);
+}
+
+inline void
+area_accumulate_neon(const uint8_t* row, float weight, float* sums, uint32_t bytes)
+{
+		const auto share = vdupq_n_f32(weight);
+		uint32_t i			 = 0;
+		for(; i + 8 <= bytes; i += 8)
+		{
+				const auto samples = vmovl_u8(vld1_u8(row + i));
+				const auto low		 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(samples)));
+				const auto high		 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(samples)));
+				/* Multiply, then add: vfmaq would round differently from the reference. */
+				vst1q_f32(sums + i, vaddq_f32(vld1q_f32(sums + i), vmulq_f32(share, low)));
+				vst1q_f32(sums + i + 4, vaddq_f32(vld1q_f32(sums + i + 4), vmulq_f32(share, high)));
+		}
+		area_accumulate_scalar(row, weight, sums, i, bytes);
+}
+
+#endif
+
+inline void
+bilinear_blend(Color_Conversion_Kernel kernel,
+							 const uint8_t* top,
+							 const uint8_t* bottom,
+							 uint32_t upper,
+							 uint32_t lower,
+							 uint16_t* blended,
+							 uint32_t bytes)
+{
+		switch(kernel)
+		{
+#ifdef CARTRACK_X86_KERNELS
+				case Color_Conversion_Kernel::SSE4:
+						bilinear_blend_sse4(top, bottom, upper, lower, blended, bytes);
+						return;
+				case Color_Conversion_Kernel::AVX2:
+						bilinear_blend_avx2(top, bottom, upper, lower, blended, bytes);
+						return;
+#endif
+#ifdef __ARM_NEON
+				case Color_Conversion_Kernel::NEON:
+						bilinear_blend_neon(top, bottom, upper, lower, blended, bytes);
+						return;
+#endif
+				default:
+						bilinear_blend_scalar(top, bottom, upper, lower, blended, 0, bytes);
+						return;
+		}
+}
+
+/**
+ * @brief Only AVX2 gathers, SSE4 and NEON would load lane by lane like the
+ * scalar loop does.
+ */
+inline void
+bilinear_gather(Color_Conversion_Kernel kernel,
+								const uint16_t* blended,
+								const Bilinear_Columns& columns,
+								uint8_t* target,
+								uint32_t bytes)
+{
+#ifdef CARTRACK_X86_KERNELS
+		if(kernel == Color_Conversion_Kernel::AVX2)
+		{
+				bilinear_gather_avx2(blended, columns, target, bytes);
+				return;
+		}
+#endif
+		(void)kernel;
+		bilinear_gather_scalar(blended, columns, target, 0, bytes);
+}
+
+inline void
+area_accumulate(Color_Conversion_Kernel kernel, const uint8_t* row, float weight, float* sums, uint32_t bytes)
+{
+		switch(kernel)
+		{
+#ifdef CARTRACK_X86_KERNELS
+				case Color_Conversion_Kernel::SSE4:
+						area_accumulate_sse4(row, weight, sums, bytes);
+						return;
+				case Color_Conversion_Kernel::AVX2:
+						area_accumulate_avx2(row, weight, sums, bytes);
+						return;
+#endif
+#ifdef __ARM_NEON
+				case Color_Conversion_Kernel::NEON:
+						area_accumulate_neon(row, weight, sums, bytes);
+						return;
+#endif
+				default:
+						area_accumulate_scalar(row, weight, sums, 0, bytes);
+						return;
+		}
+}
+
+/**
+ * @brief Rows are blended first into a 16 bit row, then every target byte is
+ * gathered from it. The blended row has one padding sample for the gathers.
+ */
+template <uint32_t Channels>
+inline void
+bilinear_rows(const Plane_View& source,
+							const Plane_View& target,
+							uint32_t first_row,
+							uint32_t rows,
+							const Bilinear_Columns& columns,
+							Color_Conversion_Kernel kernel)
+{
+		const uint32_t bytes = source.width * Channels;
+		const float step		 = float(source.height) / float(target.height);
+		std::vector<uint16_t> blended(bytes + 1);
+		for(uint32_t y = first_row; y < first_row + rows; ++y)
+		{
+				const auto tap			 = resample_tap(float(y), step, source.height, 1, false);
+				const uint32_t lower = fixed_weight(tap.weight);
+				bilinear_blend(
+						kernel, source.row(tap.first), source.row(tap.second), Bilinear_One - lower, lower, blended.data(), bytes);
+				bilinear_gather(kernel, blended.data(), columns, target.row(y), target.width * Channels);
+		}
+}
+
+/**
+ * @brief Source samples covering each target sample along one axis, with the
+ * share of the target sample they cover: taps [begin[t], begin[t + 1]).
+ */
+struct Area_Taps
+{
+		std::vector<uint32_t> begin;
+		std::vector<uint32_t> index;
+		std::vector<float> weight;
+};
+
+inline Area_Taps
+area_taps(uint32_t source_size, uint32_t target_size, uint32_t stride = 1)
+{
+		const double scale = double(source_size) / double(target_size);
+		Area_Taps taps;
+		for(uint32_t t = 0; t < target_size; ++t)
+		{
+				taps.begin.push_back(static_cast<uint32_t>(taps.index.size()));
+				const double start = t * scale;
+				const double end	 = std::min((t + 1) * scale, double(source_size));
+				for(auto s = static_cast<uint32_t>(start); s < source_size and s < end; ++s)
+				{
+						const double overlap = std::min(end, s + 1.0) - std::max(start, double(s));
+						if(overlap > 1e-6)
+						{
+								taps.index.push_back(s * stride);
+								taps.weight.push_back(static_cast<float>(overlap / scale));
+						}
+				}
+		}
+		taps.begin.push_back(static_cast<uint32_t>(taps.index.size()));
+		return taps;
+}
+
+/**
+ * @brief The source rows of a target row are accumulated first, contiguous
+ * and on the SIMD kernels, then the columns are summed from them.
+ */
+template <uint32_t Channels>
+inline void
+area_rows(const Plane_View& source,
+					const Plane_View& target,
+					uint32_t first_row,
+					uint32_t rows,
+					const Area_Taps& columns,
+					const Area_Taps& row_taps,
+					Color_Conversion_Kernel kernel)
+{
+		const uint32_t bytes = source.width * Channels;
+		std::vector<float> accumulated(bytes);
+		for(uint32_t y = first_row; y < first_row + rows; ++y)
+		{
+				const float* sum = accumulated.data();
+				std::fill(accumulated.begin(), accumulated.end(), 0.0f);
+				for(uint32_t tap = row_taps.begin[y]; tap < row_taps.begin[y + 1]; ++tap)
+				{
+						area_accumulate(kernel, source.row(row_taps.index[tap]), row_taps.weight[tap], accumulated.data(), bytes);
+				}
+
+				uint8_t* out = target.row(y);
+				for(uint32_t x = 0; x < target.width; ++x)
+				{
+						for(uint32_t channel = 0; channel < Channels; ++channel)
+						{
+								float value = 0.5f;
+								for(uint32_t tap = columns.begin[x]; tap < columns.begin[x + 1]; ++tap)
+								{
+										value += columns.weight[tap] * sum[columns.index[tap] + channel];
+								}
+								out[x * Channels + channel] = static_cast<uint8_t>(std::min(value, 255.0f));
+						}
+				}
+		}
+}
+
+template <uint32_t Channels>
+inline void
+resize_plane(const Plane_View& source,
+						 const Plane_View& target,
+						 Resize_Filter filter,
+						 Color_Conversion_Kernel kernel,
+						 const Parallelism& parallelism)
+{
+		const auto run = [&](std::size_t row_bytes, auto&& rows)
+		{
+				for_each_row_band(target.height, band_rows(row_bytes, 1, parallelism), parallelism, rows);
+		};
+		const std::size_t source_row_bytes = std::size_t(source.width) * Channels;
+		const uint32_t factor_x						 = source.width / target.width;
+		const uint32_t factor_y						 = source.height / target.height;
+		const bool exact									 = source.width == factor_x * target.width and source.height == factor_y * target.height;
+
+		if(filter == Resize_Filter::Area and factor_x > 0 and factor_y > 0 and exact)
+		{
+				/* Whole blocks, the footprint of every target sample is its box. */
+				filter = Resize_Filter::Box;
+		}
+		else if(filter == Resize_Filter::Area and (factor_x == 0 or factor_y == 0))
+		{
+				filter = Resize_Filter::Bilinear;
+		}
+
+		switch(filter)
+		{
+				case Resize_Filter::Box:
+						if(factor_x == 0 or factor_y == 0)
+						{
+								throw std::runtime_error("Box resize cannot upscale");
+						}
+						if constexpr(Channels <= 2)
+						{
+								if(factor_x == 2 and factor_y == 2)
+								{
+										run(3 * source_row_bytes,
+												[&](uint32_t first_row, uint32_t rows)
+												{
+														for(uint32_t y = first_row; y < first_row + rows; ++y)
+														{
+																halve_row<Channels>(kernel, source.row(2 * y), source.row(2 * y + 1), target.row(y), target.width);
+														}
+												});
+										return;
+								}
+						}
+						run(factor_y * source_row_bytes,
+								[&](uint32_t first_row, uint32_t rows)
+								{ box_rows<Channels>(source, target, first_row, rows, factor_x, factor_y, kernel); });
+						return;
+				case Resize_Filter::Bilinear:
+				{
+						const auto columns = bilinear_columns<Channels>(source.width, target.width);
+						run(2 * source_row_bytes,
+								[&](uint32_t first_row, uint32_t rows)
+								{ bilinear_rows<Channels>(source, target, first_row, rows, columns, kernel); });
+						return;
+				}
+				case Resize_Filter::Area:
+				{
+						const auto columns	= area_taps(source.width, target.width, Channels);
+						const auto row_taps = area_taps(source.height, target.height);
+						run(std::max(factor_y, 1u) * source_row_bytes,
+								[&](uint32_t first_row, uint32_t rows)
+								{ area_rows<Channels>(source, target, first_row, rows, columns, row_taps, kernel); });
+						return;
+				}
+		}
+}
+
+} // namespace detail
+
+/**
+ * @brief Resizes one plane of 8 bit samples into another of the same sample
+ * size, e.g. the Y plane or the interleaved UV plane of NV12, without going
+ * through RGB. Both sizes come from the plane views, strides are honoured.
+ * Rows are split in cache sized bands over parallelism like convert_image,
+ * kernel picks the instruction set of the row kernels.
+ */
+inline void
+resize_plane(const Plane_View& source,
+						 const Plane_View& target,
+						 Resize_Filter filter = Resize_Filter::Bilinear,
+						 Color_Conversion_Kernel kernel = best_color_conversion_kernel(),
+						 const Parallelism& parallelism = {})
+{
+		if(not color_conversion_kernel_available(kernel))
+		{
+				throw std::runtime_error(std::string{"Resize kernel not available: "} + color_conversion_kernel_name(kernel));
+		}
+		if(source.data == nullptr or target.data == nullptr or source.width == 0 or source.height == 0
+			 or target.width == 0 or target.height == 0)
+		{
+				throw std::runtime_error("Resize of an empty plane");
+		}
+		if(source.bytes_per_sample != target.bytes_per_sample)
+		{
+				throw std::runtime_error("Resize planes differ in sample size");
+		}
+
+		switch(source.bytes_per_sample)
+		{
+				case 1:
+						detail::resize_plane<1>(source, target, filter, kernel, parallelism);
+						return;
+				case 2:
+						detail::resize_plane<2>(source, target, filter, kernel, parallelism);
+						return;
+				case 3:
+						detail::resize_plane<3>(source, target, filter, kernel, parallelism);
+						return;
+				case 4:
+						detail::resize_plane<4>(source, target, filter, kernel, parallelism);
+						return;
+				default:
+						throw std::runtime_error("Resize supports 1 to 4 bytes per sample, not "
+																		 + std::to_string(source.bytes_per_sample));
+		}
+}
+
+/**
+ * @brief Resizes every plane of a frame into target, which has the same pixel
+ * format and any size. Packed 4:2:2 (YUYV) and compressed formats are not
+ * planes of samples and are rejected.
+ */
+inline void
+resize_image(const Image_View& source,
+						 const Image_View& target,
+						 Resize_Filter filter = Resize_Filter::Bilinear,
+						 Color_Conversion_Kernel kernel = best_color_conversion_kernel(),
+						 const Parallelism& parallelism = {})
+{
+		const auto& descriptor = describe(source.pixel_format);
+		if(source.pixel_format != target.pixel_format)
+		{
+				throw std::runtime_error("Resize cannot change the pixel format");
+		}
+		if(descriptor.compressed or source.pixel_format == Pixel_Format::YUYV422)
+		{
+				throw std::runtime_error("No resize for " + std::string(descriptor.fourcc.begin(), descriptor.fourcc.end()));
+		}
+		if(source.empty() or target.empty())
+		{
+				throw std::runtime_error("Resize of an empty image");
+		}
+		for(std::size_t i = 0; i < source.num_planes; ++i)
+		{
+				resize_plane(source.plane(i), target.plane(i), filter, kernel, parallelism);
+		}
+}
+
+/**
+ * @brief What Pyramid_Builder builds. Levels halve, so Box and Area give the
+ * same bytes unless a level above has an odd size; Box runs on SIMD kernels.
+ */
+struct Pyramid_Options
+{
+		/**
+		 * @brief Levels below the source, each half the size of the one above.
+		 */
+		uint32_t levels = 4;
+		/**
+		 * @brief No level gets narrower or lower than this, fewer levels are built.
+		 */
+		uint32_t min_size							 = 16;
+		Resize_Filter filter					 = Resize_Filter::Box;
+		Color_Conversion_Kernel kernel = best_color_conversion_kernel();
+		Parallelism parallelism;
+};
+
+/**
+ * @brief Downscaled copies of one frame, level 0 is half the source. The
+ * source itself is not part of it, so it may be released while levels are used.
+ */
+class Image_Pyramid
+{
+	public:
+		[[nodiscard]] std::size_t size() const
+		{
+				return _levels_.size();
+		}
+
+		[[nodiscard]] const Image_View& level(std::size_t index) const
+		{
+				return _levels_[index].image;
+		}
+
+	private:
+		friend class Pyramid_Builder;
+
+		struct Level
+		{
+				Image_Layout layout;
+				Aligned_Buffer data;
+				Image_View image;
+		};
+
+		std::vector<Level> _levels_;
+};
+
+/**
+ * @brief Builds pyramids level by level from the one above into pooled
+ * buffers. A pyramid goes back to the pool once nobody holds its pointer any
+ * more, so a steady stream of frames settles on a few pyramids and stops
+ * allocating level buffers. build is meant to be called from one thread, the
+ * pyramids it returns may be read and dropped from any.
+ */
+class Pyramid_Builder
+{
+	public:
+		explicit Pyramid_Builder(Pyramid_Options options = {})
+				: _options_(options)
+		{
+		}
+
+		[[nodiscard]] std::shared_ptr<const Image_Pyramid> build(const Image_View& source)
+		{
+				const auto& descriptor = describe(source.pixel_format);
+				if(descriptor.compressed or source.pixel_format == Pixel_Format::YUYV422)
+				{
+						throw std::runtime_error("No pyramid for " + std::string(descriptor.fourcc.begin(), descriptor.fourcc.end()));
+				}
+
+				auto pyramid = recycle();
+				/* Levels stay multiples of the chroma subsampling, whole chroma samples halve too. */
+				uint32_t align_x = 1;
+				uint32_t align_y = 1;
+				for(std::size_t i = 0; i < descriptor.num_planes; ++i)
+				{
+						align_x = std::max(align_x, descriptor.planes[i].horizontal_subsampling);
+						align_y = std::max(align_y, descriptor.planes[i].vertical_subsampling);
+				}
+
+				Image_View above = source;
+				std::size_t count				= 0;
+				for(; count < _options_.levels; ++count)
+				{
+						const uint32_t width	= above.width / 2 / align_x * align_x;
+						const uint32_t height = above.height / 2 / align_y * align_y;
+						if(width < std::max(_options_.min_size, 1u) or height < std::max(_options_.min_size, 1u))
+						{
+								break;
+						}
+						if(pyramid->_levels_.size() <= count)
+						{
+								pyramid->_levels_.emplace_back();
+						}
+
+						auto& level = pyramid->_levels_[count];
+						if(level.layout.pixel_format != source.pixel_format or level.layout.width != width
+							 or level.layout.height != height)
+						{
+								level.layout = make_packed_image_layout(source.pixel_format, width, height, false);
+								level.data.resize(level.layout.memory_plane_sizes[0]);
+								++_allocations_;
+						}
+						level.layout.color_encoding = source.color_encoding;
+						level.image									= make_image_view(level.layout, Multiplanar_Buffer_View{std::span(level.data)});
+						resize_image(above, level.image, _options_.filter, _options_.kernel, _options_.parallelism);
+						above = level.image;
+				}
+				pyramid->_levels_.resize(count);
+				return pyramid;
+		}
+
+		/**
+		 * @brief Pyramids the pool holds, in use or free.
+		 */
+		[[nodiscard]] std::size_t pool_size() const
+		{
+				return _pool_.size();
+		}
+
+		/**
+		 * @brief Level buffers (re)allocated so far, it stops growing once the
+		 * pool covers the pyramids held at a time.
+		 */
+		[[nodiscard]] uintmax_t allocations() const
+		{
+				return _allocations_;
+		}
+
+	private:
+		/**
+		 * @brief A pooled pyramid and whether it is free. The deleter of the
+		 * pointer build hands out sets free with release and recycle takes it with
+		 * acquire, so the reads of the last holder happen before the next build
+		 * writes the levels. The deleter holds the slot, it outlives the builder.
+		 */
+		struct Slot
+		{
+				Image_Pyramid pyramid;
+				std::atomic<bool> free = true;
+		};
+
+		/**
+		 * @brief A free pyramid of the pool, or a new one. Handed out as a pointer
+		 * right away, so a throwing build returns it too.
+		 */
+		std::shared_ptr<Image_Pyramid> recycle()
+		{
+				auto slot = std::find_if(_pool_.begin(),
+																 _pool_.end(),
+																 [](const auto& pooled) { return pooled->free.load(std::memory_order_acquire); });
+				if(slot == _pool_.end())
+				{
+						slot = _pool_.insert(_pool_.end(), std::make_shared<Slot>());
+				}
+				(*slot)->free.store(false, std::memory_order_relaxed);
+				return std::shared_ptr<Image_Pyramid>(&(*slot)->pyramid,
+																							[slot = *slot](Image_Pyramid*) { slot->free.store(true, std::memory_order_release); });
+		}
+
+	private:
+		Pyramid_Options _options_;
+		std::vector<std::shared_ptr<Slot>> _pool_;
+		uintmax_t _allocations_ = 0;
+};
+
+} // namespace Cartrack
+
+#endif // IMAGE_RESIZE_HPP
@@ -0,0 +1,557 @@
+#ifndef IMAGE_VIEW_HPP
+#define IMAGE_VIEW_HPP
+
+#include "Pixel_Format_Descriptor.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <linux/videodev2.h>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+
+namespace Cartrack
+{
+
+/**
+ * @brief Geometry of one image plane inside the buffers handed out by the driver.
+ *
+ * A plane is not always a memory plane. NV12 with V4L2_BUF_TYPE_VIDEO_CAPTURE
+ * keeps both the Y and the interleaved UV plane in memory plane 0, the UV plane
+ * simply starts at offset bytesperline * height. With V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+ * (NM12) every image plane lives in its own memory plane at offset 0.
+ *
+ * width is in samples of that plane, so the UV plane of NV12 is width / 2 wide
+ * with 2 bytes per sample. stride is the driver's bytesperline, never assume
+ * width * bytes_per_sample.
+ */
+struct Plane_Layout
+{
+		std::size_t memory_plane = 0;
+		std::size_t offset			 = 0;
+		uint32_t width					 = 0;
+		uint32_t height					 = 0;
+		uint32_t stride					 = 0;
+		uint32_t bytes_per_sample = 0;
+
+		[[nodiscard]] constexpr std::size_t size() const
+		{
+				return std::size_t(stride) * height;
+		}
+};
+
+/**
+ * @brief Matrix turning Y'CbCr into R'G'B'. Other encodings V4L2 knows
+ * (BT.2020, SMPTE 240M) are mapped to BT.709, the closest of the two.
+ */
+enum class Ycbcr_Encoding : uint8_t
+{
+		BT601,
+		BT709
+};
+
+/**
+ * @brief Limited range puts black at 16 and white at 235 (240 for chroma),
+ * full range uses all 256 codes.
+ */
+enum class Quantization_Range : uint8_t
+{
+		Limited,
+		Full
+};
+
+/**
+ * @brief How the samples of a frame encode colour, what a conversion needs
+ * besides the pixel format. The default is what V4L2 assumes for SDTV YUV.
+ */
+struct Color_Encoding
+{
+		Ycbcr_Encoding ycbcr_encoding = Ycbcr_Encoding::BT601;
+		Quantization_Range range			= Quantization_Range::Limited;
+
+		[[nodiscard]] constexpr bool operator==(const Color_Encoding&) const = default;
+};
+
+/**
+ * @brief Encoding the driver reported in the negotiated format. Fields left
+ * at DEFAULT are resolved from the colorspace the way V4L2 documents it, e.g.
+ * a JPEG colorspace is full range BT.601, REC709 implies the BT.709 matrix and
+ * RGB formats are full range.
+ */
+[[nodiscard]] inline Color_Encoding
+color_encoding_from_v4l2(const v4l2_format& format, Pixel_Format px_format)
+{
+		const bool multiplanar = format.type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+														 or format.type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+		const uint32_t colorspace = multiplanar ? format.fmt.pix_mp.colorspace : format.fmt.pix.colorspace;
+		uint32_t ycbcr_encoding		= multiplanar ? format.fmt.pix_mp.ycbcr_enc : format.fmt.pix.ycbcr_enc;
+		uint32_t quantization			= multiplanar ? format.fmt.pix_mp.quantization : format.fmt.pix.quantization;
+
+		if(ycbcr_encoding == V4L2_YCBCR_ENC_DEFAULT)
+		{
+				ycbcr_encoding = V4L2_MAP_YCBCR_ENC_DEFAULT(colorspace);
+		}
+		if(quantization == V4L2_QUANTIZATION_DEFAULT)
+		{
+				quantization = V4L2_MAP_QUANTIZATION_DEFAULT(describe(px_format).rgb, colorspace, ycbcr_encoding);
+		}
+
+		Color_Encoding encoding;
+		encoding.ycbcr_encoding = ycbcr_encoding == V4L2_YCBCR_ENC_601 or ycbcr_encoding == V4L2_YCBCR_ENC_XV601
+																	? Ycbcr_Encoding::BT601
+																	: Ycbcr_Encoding::BT709;
+		encoding.range =
+				quantization == V4L2_QUANTIZATION_FULL_RANGE ? Quantization_Range::Full : Quantization_Range::Limited;
+		return encoding;
+}
+
+/**
+ * @brief Layout of a whole frame as negotiated by VIDIOC_S_FMT. It is computed
+ * once and bound to the buffer views of every frame, so kernels can work on
+ * driver memory with row padding instead of repacking.
+ */
+struct Image_Layout
+{
+		Pixel_Format pixel_format = Pixel_Format::Invalid;
+		uint32_t width						= 0;
+		uint32_t height						= 0;
+		std::array<Plane_Layout, Max_Image_Planes> planes{};
+		std::size_t num_planes = 0;
+		/**
+		 * @brief Bytes that has to be allocated for every memory plane. It is the
+		 * driver's sizeimage, which may be bigger than the sum of the planes it holds.
+		 */
+		std::array<std::size_t, VIDEO_MAX_PLANES> memory_plane_sizes{};
+		std::size_t num_memory_planes = 0;
+		Color_Encoding color_encoding;
+};
+
+/**
+ * @brief Image_Layout as it is stored in files and shared with other
+ * processes. Image_Layout uses size_t and enums whose width depends on the
+ * build, this record has fixed width fields at fixed offsets and no padding.
+ * Convert with make_image_layout_record and image_layout_from_record.
+ */
+struct Image_Plane_Record
+{
+		uint64_t memory_plane			= 0;
+		uint64_t offset						= 0;
+		uint32_t width						= 0;
+		uint32_t height						= 0;
+		uint32_t stride						= 0;
+		uint32_t bytes_per_sample = 0;
+};
+
+struct Image_Layout_Record
+{
+		uint32_t pixel_format			 = 0;
+		uint32_t width						 = 0;
+		uint32_t height						 = 0;
+		uint32_t num_planes				 = 0;
+		uint32_t num_memory_planes = 0;
+		uint8_t ycbcr_encoding		 = 0;
+		uint8_t range							 = 0;
+		uint16_t reserved					 = 0;
+		std::array<Image_Plane_Record, Max_Image_Planes> planes{};
+		std::array<uint64_t, VIDEO_MAX_PLANES> memory_plane_sizes{};
+};
+
+static_assert(sizeof(Image_Plane_Record) == 32 and offsetof(Image_Plane_Record, width) == 16
+									and offsetof(Image_Plane_Record, bytes_per_sample) == 28,
+							"Image_Plane_Record is stored, its layout must not change");
+static_assert(sizeof(Image_Layout_Record) == 24 + 32 * Max_Image_Planes + 8 * VIDEO_MAX_PLANES
+									and offsetof(Image_Layout_Record, ycbcr_encoding) == 20
+									and offsetof(Image_Layout_Record, planes) == 24
+									and offsetof(Image_Layout_Record, memory_plane_sizes) == 24 + 32 * Max_Image_Planes
+									and std::is_trivially_copyable_v<Image_Layout_Record>,
+							"Image_Layout_Record is stored, its layout must not change");
+
+[[nodiscard]] inline Image_Layout_Record
+make_image_layout_record(const Image_Layout& layout)
+{
+		/* Zeroed as a whole, unused planes must read back the same in every file. */
+		Image_Layout_Record record;
+		std::memset(static_cast<void*>(&record), 0, sizeof(record));
+		record.pixel_format			 = static_cast<uint32_t>(layout.pixel_format);
+		record.width						 = layout.width;
+		record.height						 = layout.height;
+		record.num_planes				 = static_cast<uint32_t>(layout.num_planes);
+		record.num_memory_planes = static_cast<uint32_t>(layout.num_memory_planes);
+		record.ycbcr_encoding		 = static_cast<uint8_t>(layout.color_encoding.ycbcr_encoding);
+		record.range						 = static_cast<uint8_t>(layout.color_encoding.range);
+		for(std::size_t i = 0; i < Max_Image_Planes; ++i)
+		{
+				const auto& plane									= layout.planes[i];
+				record.planes[i].memory_plane			= plane.memory_plane;
+				record.planes[i].offset						= plane.offset;
+				record.planes[i].width						= plane.width;
+				record.planes[i].height						= plane.height;
+				record.planes[i].stride						= plane.stride;
+				record.planes[i].bytes_per_sample = plane.bytes_per_sample;
+		}
+		for(std::size_t i = 0; i < VIDEO_MAX_PLANES; ++i)
+		{
+				record.memory_plane_sizes[i] = layout.memory_plane_sizes[i];
+		}
+		return record;
+}
+
+/**
+ * @brief Layout a record describes. Returns nothing when the record cannot be
+ * one written by make_image_layout_record: unknown pixel format or encoding,
+ * or plane counts out of range.
+ */
+[[nodiscard]] inline std::optional<Image_Layout>
+image_layout_from_record(const Image_Layout_Record& record)
+{
+		if(record.pixel_format > static_cast<uint32_t>(Pixel_Format::GRAY8)
+			 or not describe(static_cast<Pixel_Format>(record.pixel_format)).valid()
+			 or record.num_planes == 0 or record.num_planes > Max_Image_Planes or record.num_memory_planes == 0
+			 or record.num_memory_planes > VIDEO_MAX_PLANES
+			 or record.ycbcr_encoding > static_cast<uint8_t>(Ycbcr_Encoding::BT709)
+			 or record.range > static_cast<uint8_t>(Quantization_Range::Full))
+		{
+				return std::nullopt;
+		}
+
+		Image_Layout layout;
+		layout.pixel_format								 = static_cast<Pixel_Format>(record.pixel_format);
+		layout.width											 = record.width;
+		layout.height											 = record.height;
+		layout.num_planes									 = record.num_planes;
+		layout.num_memory_planes					 = record.num_memory_planes;
+		layout.color_encoding.ycbcr_encoding = static_cast<Ycbcr_Encoding>(record.ycbcr_encoding);
+		layout.color_encoding.range					 = static_cast<Quantization_Range>(record.range);
+		for(std::size_t i = 0; i < Max_Image_Planes; ++i)
+		{
+				const auto& plane = record.planes[i];
+				if(i < layout.num_planes and plane.memory_plane >= layout.num_memory_planes)
+				{
+						return std::nullopt;
+				}
+				layout.planes[i].memory_plane			= plane.memory_plane;
+				layout.planes[i].offset						= plane.offset;
+				layout.planes[i].width						= plane.width;
+				layout.planes[i].height						= plane.height;
+				layout.planes[i].stride						= plane.stride;
+				layout.planes[i].bytes_per_sample = plane.bytes_per_sample;
+		}
+		for(std::size_t i = 0; i < VIDEO_MAX_PLANES; ++i)
+		{
+				layout.memory_plane_sizes[i] = record.memory_plane_sizes[i];
+		}
+		return layout;
+}
+
+struct Plane_View
+{
+		Data_Type* data						= nullptr;
+		uint32_t width						= 0;
+		uint32_t height						= 0;
+		uint32_t stride						= 0;
+		uint32_t bytes_per_sample = 0;
+
+		template <typename T = uint8_t>
+		[[nodiscard]] T* row(uint32_t y) const
+		{
+				return reinterpret_cast<T*>(data + std::size_t(y) * stride);
+		}
+
+		[[nodiscard]] std::size_t size() const
+		{
+				return std::size_t(stride) * height;
+		}
+};
+
+struct Image_View
+{
+		Pixel_Format pixel_format = Pixel_Format::Invalid;
+		uint32_t width						= 0;
+		uint32_t height						= 0;
+		std::array<Plane_View, Max_Image_Planes> planes{};
+		std::size_t num_planes = 0;
+		Color_Encoding color_encoding;
+
+		[[nodiscard]] const Plane_View& plane(std::size_t index) const
+		{
+				return planes[index];
+		}
+
+		[[nodiscard]] bool empty() const
+		{
+				return num_planes == 0 or planes[0].data == nullptr;
+		}
+};
+
+/**
+ * @brief Builds the layout from the format negotiated with VIDIOC_S_FMT.
+ *
+ * Single planar buffers carry only one bytesperline, the chroma strides of
+ * multi-component formats are derived from it as V4L2 specifies: same stride for
+ * interleaved chroma (NV12), stride / subsampling for planar chroma (422P).
+ * Multi planar buffers carry a bytesperline per memory plane; when there are
+ * fewer memory planes than image planes the remaining ones follow the last
+ * memory plane with the same derivation.
+ */
+inline Image_Layout
+make_image_layout(const v4l2_format& format, Pixel_Format px_format)
+{
+		const auto& descriptor = describe(px_format);
+		if(descriptor.num_planes == 0)
+		{
+				throw std::runtime_error("Image layout requested for invalid pixel format");
+		}
+
+		Image_Layout layout;
+		layout.pixel_format		= px_format;
+		layout.num_planes			= descriptor.num_planes;
+		layout.color_encoding = color_encoding_from_v4l2(format, px_format);
+
+		const bool multiplanar = format.type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE
+														 or format.type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+
+		std::array<uint32_t, VIDEO_MAX_PLANES> memory_strides{};
+		if(multiplanar)
+		{
+				layout.width						 = format.fmt.pix_mp.width;
+				layout.height						 = format.fmt.pix_mp.height;
+				layout.num_memory_planes = std::max<std::size_t>(format.fmt.pix_mp.num_planes, 1);
+				for(std::size_t i = 0; i < layout.num_memory_planes; ++i)
+				{
+						memory_strides[i]						 = format.fmt.pix_mp.plane_fmt[i].bytesperline;
+						layout.memory_plane_sizes[i] = format.fmt.pix_mp.plane_fmt[i].sizeimage;
+				}
+		}
+		else
+		{
+				layout.width								 = format.fmt.pix.width;
+				layout.height								 = format.fmt.pix.height;
+				layout.num_memory_planes		 = 1;
+				memory_strides[0]						 = format.fmt.pix.bytesperline;
+				layout.memory_plane_sizes[0] = format.fmt.pix.sizeimage;
+		}
+
+		std::size_t memory_plane = 0;
+		std::size_t offset			 = 0;
+		for(std::size_t i = 0; i < descriptor.num_planes; ++i)
+		{
+				const auto& plane_geometry = descriptor.planes[i];
+				auto& plane								 = layout.planes[i];
+
+				plane.width = (layout.width + plane_geometry.horizontal_subsampling - 1)
+											/ plane_geometry.horizontal_subsampling;
+				plane.height = (layout.height + plane_geometry.vertical_subsampling - 1)
+											 / plane_geometry.vertical_subsampling;
+				plane.bytes_per_sample = plane_geometry.bytes_per_sample;
+
+				if(i < layout.num_memory_planes and (i == 0 or multiplanar))
+				{
+						memory_plane = i;
+						offset			 = 0;
+						plane.stride = memory_strides[i];
+				}
+				else
+				{
+						const auto& previous = layout.planes[i - 1];
+						offset += previous.size();
+						/* Interleaved chroma keeps the luma stride, planar chroma is subsampled. */
+						plane.stride = memory_strides[memory_plane] * plane.bytes_per_sample
+													 / (plane_geometry.horizontal_subsampling
+															* descriptor.planes[0].bytes_per_sample);
+				}
+
+				if(plane.stride == 0)
+				{
+						/* Compressed formats and drivers that do not report bytesperline. */
+						plane.stride = plane.width * plane.bytes_per_sample;
+				}
+
+				plane.memory_plane = memory_plane;
+				plane.offset			 = offset;
+		}
+
+		return layout;
+}
+
+/**
+ * @brief Layout of tightly packed userspace frames, stride equals the visible row.
+ */
+inline Image_Layout
+make_packed_image_layout(Pixel_Format px_format, uint32_t width, uint32_t height, bool multiplanar)
+{
+		const auto& descriptor = describe(px_format);
+
+		v4l2_format format{};
+		if(multiplanar)
+		{
+				format.type									 = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+				format.fmt.pix_mp.width			 = width;
+				format.fmt.pix_mp.height		 = height;
+				format.fmt.pix_mp.num_planes = descriptor.num_memory_planes;
+				for(std::size_t i = 0; i < descriptor.num_memory_planes; ++i)
+				{
+						const auto& plane_geometry = descriptor.planes[i];
+						const uint32_t plane_width = (width + plane_geometry.horizontal_subsampling - 1)
+																				 / plane_geometry.horizontal_subsampling;
+						format.fmt.pix_mp.plane_fmt[i].bytesperline =
+								plane_width * plane_geometry.bytes_per_sample;
+				}
+		}
+		else
+		{
+				format.type									= V4L2_BUF_TYPE_VIDEO_CAPTURE;
+				format.fmt.pix.width				= width;
+				format.fmt.pix.height				= height;
+				/* Chroma strides derive from this one, odd widths need room for the last chroma sample. */
+				uint32_t subsampling = 1;
+				for(std::size_t i = 1; i < descriptor.num_planes; ++i)
+				{
+						subsampling = std::max(subsampling, descriptor.planes[i].horizontal_subsampling);
+				}
+				format.fmt.pix.bytesperline = (width + subsampling - 1) / subsampling * subsampling
+																			* descriptor.planes[0].bytes_per_sample;
+		}
+
+		auto layout = make_image_layout(format, px_format);
+		for(std::size_t i = 0; i < layout.num_planes; ++i)
+		{
+				const auto& plane = layout.planes[i];
+				auto& memory_size = layout.memory_plane_sizes[plane.memory_plane];
+				memory_size				= std::max(memory_size, plane.offset + plane.size());
+		}
+		return layout;
+}
+
+/**
+ * @brief Binds a layout to the planes of one frame. Returns an empty view if
+ * the frame does not carry enough memory planes or bytes for the layout.
+ */
+inline Image_View
+make_image_view(const Image_Layout& layout, const Multiplanar_Buffer_View& frame)
+{
+		Image_View view;
+		if(frame.size() < layout.num_memory_planes)
+		{
+				return view;
+		}
+
+		for(std::size_t i = 0; i < layout.num_planes; ++i)
+		{
+				const auto& plane_layout = layout.planes[i];
+				const auto& memory			 = frame[plane_layout.memory_plane];
+				const bool compressed		 = layout.pixel_format == Pixel_Format::MJPEG;
+				if(not compressed and memory.size() < plane_layout.offset + plane_layout.size())
+				{
+						return {};
+				}
+
+				auto& plane						 = view.planes[i];
+				plane.data						 = memory.data() + plane_layout.offset;
+				plane.width						 = plane_layout.width;
+				plane.height					 = plane_layout.height;
+				plane.stride					 = plane_layout.stride;
+				plane.bytes_per_sample = plane_layout.bytes_per_sample;
+		}
+
+		view.pixel_format		= layout.pixel_format;
+		view.width					= layout.width;
+		view.height					= layout.height;
+		view.num_planes			= layout.num_planes;
+		view.color_encoding = layout.color_encoding;
+		return view;
+}
+
+/**
+ * @brief Rows [first_row, first_row + rows) of view as a view of their own, for
+ * kernels that split a frame into bands. first_row must be a multiple of the
+ * vertical subsampling of every plane.
+ */
+inline Image_View
+row_band(const Image_View& view, uint32_t first_row, uint32_t rows)
+{
+		const auto& descriptor = describe(view.pixel_format);
+		Image_View band				 = view;
+		band.height						 = rows;
+		for(std::size_t i = 0; i < band.num_planes; ++i)
+		{
+				const auto subsampling = descriptor.planes[i].vertical_subsampling;
+				auto& plane						 = band.planes[i];
+				plane.data += std::size_t(first_row / subsampling) * plane.stride;
+				plane.height = (rows + subsampling - 1) / subsampling;
+		}
+		return band;
+}
+
+/**
+ * @brief Image_View with the pixel format fixed at compile time. Kernels taking
+ * it are instantiated per format, plane count and geometry are constants there.
+ */
+template <Pixel_Format Format>
+struct Typed_Image_View
+{
+		using Traits = Pixel_Format_Traits<Format>;
+
+		static constexpr Pixel_Format pixel_format = Format;
+
+		uint32_t width	= 0;
+		uint32_t height = 0;
+		std::array<Plane_View, Traits::num_planes> planes{};
+		Color_Encoding color_encoding;
+
+		[[nodiscard]] const Plane_View& plane(std::size_t index) const
+		{
+				return planes[index];
+		}
+
+		[[nodiscard]] bool empty() const
+		{
+				return planes[0].data == nullptr;
+		}
+};
+
+/**
+ * @brief make_image_view for a layout whose format is known at compile time.
+ * The layout must have been made for Format, callers check it once.
+ */
+template <Pixel_Format Format>
+inline Typed_Image_View<Format>
+make_typed_image_view(const Image_Layout& layout, const Multiplanar_Buffer_View& frame)
+{
+		using Traits = Pixel_Format_Traits<Format>;
+
+		Typed_Image_View<Format> view;
+		if(frame.size() < Traits::num_memory_planes)
+		{
+				return view;
+		}
+
+		for(std::size_t i = 0; i < Traits::num_planes; ++i)
+		{
+				const auto& plane_layout = layout.planes[i];
+				const auto& memory			 = frame[plane_layout.memory_plane];
+				if constexpr(not Traits::descriptor.compressed)
+				{
+						if(memory.size() < plane_layout.offset + plane_layout.size())
+						{
+								return {};
+						}
+				}
+
+				auto& plane						 = view.planes[i];
+				plane.data						 = memory.data() + plane_layout.offset;
+				plane.width						 = plane_layout.width;
+				plane.height					 = plane_layout.height;
+				plane.stride					 = plane_layout.stride;
+				plane.bytes_per_sample = Traits::descriptor.planes[i].bytes_per_sample;
+		}
+
+		view.width					= layout.width;
+		view.height					= layout.height;
+		view.color_encoding = layout.color_encoding;
+		return view;
+}
+
+} // namespace Cartrack
+
+#endif // IMAGE_VIEW_HPP
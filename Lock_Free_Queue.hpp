@@ -0,0 +1,135 @@
+#ifndef LOCK_FREE_QUEUE_HPP
+#define LOCK_FREE_QUEUE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <utility>
+
+namespace Cartrack
+{
+
+/**
+ * @brief Bounded multi producer multi consumer queue (Vyukov). Every cell carries
+ * a sequence number that tells producers and consumers whose turn it is, so push
+ * and pop are one CAS on the shared index and never block each other.
+ *
+ * Capacity must be a power of two. try_push fails when the queue is full, it is
+ * the caller's decision to drop or retry.
+ */
+template <typename T, std::size_t Capacity>
+class Lock_Free_Queue
+{
+		static_assert(Capacity >= 2 and (Capacity & (Capacity - 1)) == 0,
+									"Capacity must be a power of two");
+
+	public:
+		Lock_Free_Queue()
+		{
+				for(std::size_t i = 0; i < Capacity; ++i)
+				{
+						_cells_[i].sequence.store(i, std::memory_order_relaxed);
+				}
+		}
+
+		Lock_Free_Queue(const Lock_Free_Queue&)						 = delete;
+		Lock_Free_Queue& operator=(const Lock_Free_Queue&) = delete;
+
+		bool try_push(T&& value)
+		{
+				std::size_t position = _enqueue_position_.load(std::memory_order_relaxed);
+				Cell* cell					 = nullptr;
+				for(;;)
+				{
+						cell = &_cells_[position & (Capacity - 1)];
+						const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+						const auto difference = static_cast<std::ptrdiff_t>(sequence)
+																		- static_cast<std::ptrdiff_t>(position);
+						if(difference == 0)
+						{
+								if(_enqueue_position_.compare_exchange_weak(
+											 position, position + 1, std::memory_order_relaxed))
+								{
+										break;
+								}
+						}
+						else if(difference < 0)
+						{
+								return false;
+						}
+						else
+						{
+								position = _enqueue_position_.load(std::memory_order_relaxed);
+						}
+				}
+
+				cell->value.emplace(std::move(value));
+				cell->sequence.store(position + 1, std::memory_order_release);
+				return true;
+		}
+
+		[[nodiscard]] std::optional<T> try_pop()
+		{
+				std::size_t position = _dequeue_position_.load(std::memory_order_relaxed);
+				Cell* cell					 = nullptr;
+				for(;;)
+				{
+						cell = &_cells_[position & (Capacity - 1)];
+						const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+						const auto difference = static_cast<std::ptrdiff_t>(sequence)
+																		- static_cast<std::ptrdiff_t>(position + 1);
+						if(difference == 0)
+						{
+								if(_dequeue_position_.compare_exchange_weak(
+											 position, position + 1, std::memory_order_relaxed))
+								{
+										break;
+								}
+						}
+						else if(difference < 0)
+						{
+								return std::nullopt;
+						}
+						else
+						{
+								position = _dequeue_position_.load(std::memory_order_relaxed);
+						}
+				}
+
+				std::optional<T> value{std::move(*cell->value)};
+				cell->value.reset();
+				cell->sequence.store(position + Capacity, std::memory_order_release);
+				return value;
+		}
+
+		/**
+		 * @brief Cheap hint for the consumer, may be stale by the time it returns.
+		 */
+		[[nodiscard]] bool empty() const
+		{
+				return _dequeue_position_.load(std::memory_order_relaxed)
+							 == _enqueue_position_.load(std::memory_order_relaxed);
+		}
+
+	private:
+		static constexpr std::size_t Cache_Line_Size = 64;
+
+		/**
+		 * @brief Empty cells hold no T, so neither construction nor pop creates
+		 * one, e.g. no promise state for a command that is not there.
+		 */
+		struct Cell
+		{
+				std::atomic<std::size_t> sequence;
+				std::optional<T> value;
+		};
+
+		std::array<Cell, Capacity> _cells_;
+		alignas(Cache_Line_Size) std::atomic<std::size_t> _enqueue_position_{0};
+		alignas(Cache_Line_Size) std::atomic<std::size_t> _dequeue_position_{0};
+};
+
+} // namespace Cartrack
+
+#endif // LOCK_FREE_QUEUE_HPP
@@ -0,0 +1,884 @@
+#ifndef MJPEG_DECODER_HPP
+#define MJPEG_DECODER_HPP
+
+#include "Frame_Handle.hpp"
+#include "Image_View.hpp"
+#include "Worker_Pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#ifdef LIBJPEG_AVAILABLE
+#		include <csetjmp>
+#		include <cstdio>
+#		include <jpeglib.h>
+#endif
+
+namespace Cartrack
+{
+
+/**
+ * @brief Formats Mjpeg_Decoder writes. Y'CbCr targets are full range BT.601
+ * like JFIF, their Color_Encoding says so for later conversions.
+ */
+static constexpr std::array<Pixel_Format, 6> mjpeg_decode_targets{Pixel_Format::NV12,
+																																	Pixel_Format::YUV422P,
+																																	Pixel_Format::RGB24,
+																																	Pixel_Format::BGR24,
+																																	Pixel_Format::RGBA32,
+																																	Pixel_Format::GRAY8};
+
+[[nodiscard]] constexpr bool
+mjpeg_decoding_available()
+{
+#ifdef LIBJPEG_AVAILABLE
+		return true;
+#else
+		return false;
+#endif
+}
+
+[[nodiscard]] constexpr bool
+mjpeg_decode_supported(Pixel_Format target)
+{
+		if(not mjpeg_decoding_available()
+			 or std::find(mjpeg_decode_targets.begin(), mjpeg_decode_targets.end(), target) == mjpeg_decode_targets.end())
+		{
+				return false;
+		}
+#if defined(LIBJPEG_AVAILABLE) and not defined(JCS_EXTENSIONS)
+		/* Plain libjpeg only knows RGB order, the extended color spaces are libjpeg-turbo's. */
+		if(target == Pixel_Format::BGR24)
+		{
+				return false;
+		}
+#endif
+#if defined(LIBJPEG_AVAILABLE) and not defined(JCS_ALPHA_EXTENSIONS)
+		if(target == Pixel_Format::RGBA32)
+		{
+				return false;
+		}
+#endif
+		return true;
+}
+
+struct Mjpeg_Decoder_Options
+{
+		Pixel_Format target = Pixel_Format::NV12;
+		/**
+		 * @brief 1, 2, 4 or 8. Frames are scaled down while the DCT is inverted,
+		 * which makes decoding itself cheaper, e.g. 2 turns 4K into 1080p.
+		 */
+		uint32_t scale_denominator = 1;
+		/**
+		 * @brief Decoding threads, 0 for one per hardware thread. Consecutive
+		 * frames are decoded in parallel.
+		 */
+		unsigned int workers = 0;
+		/**
+		 * @brief Frames copied in and waiting for a worker or for an earlier frame
+		 * to be delivered, more are dropped.
+		 */
+		unsigned int queue_depth = 8;
+};
+
+/**
+ * @brief One decoded frame in a pooled buffer, valid as long as it is held.
+ */
+struct Decoded_Frame
+{
+		Image_View image;
+		std::chrono::nanoseconds timestamp{0};
+		uintmax_t frame_order = 0;
+		uint32_t sequence			= 0;
+		/**
+		 * @brief False when the JPEG was broken, image is empty then. Such frames
+		 * are delivered anyway so the order shows the gap.
+		 */
+		bool valid = false;
+		/**
+		 * @brief Time the worker spent decoding it.
+		 */
+		std::chrono::nanoseconds decode_time{0};
+		/**
+		 * @brief From decode() to the callback, queueing and waiting for earlier
+		 * frames included.
+		 */
+		std::chrono::nanoseconds latency{0};
+
+	private:
+		friend class Mjpeg_Decoder;
+
+		Image_Layout _layout_;
+		Aligned_Buffer _data_;
+};
+
+using Decoded_Frame_Handle = std::shared_ptr<const Decoded_Frame>;
+
+struct Mjpeg_Decoder_Statistics
+{
+		uintmax_t decoded_frames = 0;
+		/**
+		 * @brief Frames refused because queue_depth frames were pending, the
+		 * workers are too slow for the camera.
+		 */
+		uintmax_t dropped_frames = 0;
+		uintmax_t failed_frames	 = 0;
+		/**
+		 * @brief Frame buffers allocated, it stops growing once the pool covers
+		 * the frames held at a time.
+		 */
+		uintmax_t allocations = 0;
+		/**
+		 * @brief Summed over workers, the CPU time decoding took.
+		 */
+		std::chrono::nanoseconds decode_time{0};
+		std::chrono::nanoseconds latency{0};
+		std::chrono::nanoseconds max_latency{0};
+		std::chrono::nanoseconds elapsed{0};
+		std::string last_error;
+
+		[[nodiscard]] double average_decode_milliseconds() const
+		{
+				const auto frames = decoded_frames + failed_frames;
+				return frames > 0 ? std::chrono::duration<double, std::milli>(decode_time).count() / frames : 0;
+		}
+
+		[[nodiscard]] double average_latency_milliseconds() const
+		{
+				const auto frames = decoded_frames + failed_frames;
+				return frames > 0 ? std::chrono::duration<double, std::milli>(latency).count() / frames : 0;
+		}
+
+		[[nodiscard]] double frames_per_second() const
+		{
+				return elapsed.count() > 0 ? decoded_frames / std::chrono::duration<double>(elapsed).count() : 0;
+		}
+};
+
+#ifdef LIBJPEG_AVAILABLE
+
+namespace detail
+{
+
+/**
+ * @brief libjpeg reports errors by calling error_exit, which must not
+ * return. It jumps back to decode_jpeg, so nothing between the two may own
+ * anything with a destructor.
+ */
+struct Jpeg_Errors
+{
+		jpeg_error_mgr manager;
+		std::jmp_buf jump;
+		char message[JMSG_LENGTH_MAX];
+};
+
+[[noreturn]] inline void
+jpeg_error_exit(j_common_ptr info)
+{
+		auto* errors = reinterpret_cast<Jpeg_Errors*>(info->err);
+		(*info->err->format_message)(info, errors->message);
+		std::longjmp(errors->jump, 1);
+}
+
+/**
+ * @brief Webcams send plenty of slightly corrupt data, libjpeg's warnings
+ * about it would flood stderr.
+ */
+inline void
+jpeg_ignore_message(j_common_ptr, int)
+{
+}
+
+/**
+ * @brief Memory of the frames in flight on one worker, kept between frames.
+ */
+struct Jpeg_Scratch
+{
+		Aligned_Buffer samples;
+		std::vector<JSAMPROW> rows;
+};
+
+inline Jpeg_Scratch&
+jpeg_scratch()
+{
+		static thread_local Jpeg_Scratch scratch;
+		return scratch;
+}
+
+/**
+ * @brief Rows one component brings per iMCU row, and its row width in
+ * samples including the padding to whole blocks, after DCT scaling.
+ * libjpeg-turbo scales chroma up in the IDCT instead of upsampling it when
+ * it can, so these may differ from the stored sampling.
+ */
+inline uint32_t
+component_rows(const jpeg_component_info& component)
+{
+#if JPEG_LIB_VERSION >= 70
+		return component.v_samp_factor * component.DCT_v_scaled_size;
+#else
+		return component.v_samp_factor * component.DCT_scaled_size;
+#endif
+}
+
+inline uint32_t
+component_stride(const jpeg_component_info& component)
+{
+#if JPEG_LIB_VERSION >= 70
+		return component.width_in_blocks * component.DCT_h_scaled_size;
+#else
+		return component.width_in_blocks * component.DCT_scaled_size;
+#endif
+}
+
+inline uint32_t
+component_columns(const jpeg_component_info& component)
+{
+#if JPEG_LIB_VERSION >= 70
+		return component.h_samp_factor * component.DCT_h_scaled_size;
+#else
+		return component.h_samp_factor * component.DCT_scaled_size;
+#endif
+}
+
+/**
+ * @brief Whether read_raw_planes handles the decoded sampling: chroma at the
+ * full or half luma width and height, 4:4:4, 4:2:2 or 4:2:0.
+ */
+inline bool
+raw_sampling(const jpeg_decompress_struct& info)
+{
+		if(info.jpeg_color_space != JCS_YCbCr or info.num_components != 3)
+		{
+				return false;
+		}
+		const auto& luma = info.comp_info[0];
+		for(int chroma = 1; chroma < 3; ++chroma)
+		{
+				const auto& component = info.comp_info[chroma];
+				if((component_columns(luma) != component_columns(component)
+						and component_columns(luma) != 2 * component_columns(component))
+					 or (component_rows(luma) != component_rows(component)
+							 and component_rows(luma) != 2 * component_rows(component)))
+				{
+						return false;
+				}
+		}
+		return component_rows(info.comp_info[1]) == component_rows(info.comp_info[2])
+					 and component_columns(info.comp_info[1]) == component_columns(info.comp_info[2]);
+}
+
+/**
+ * @brief Rounded mean of horizontal sample pairs, for chroma decoded at the
+ * full luma width.
+ */
+inline void
+halve_chroma_row(const uint8_t* full, uint8_t* half, uint32_t width, uint32_t full_width)
+{
+		for(uint32_t x = 0; x < width; ++x)
+		{
+				const uint32_t right = std::min(2 * x + 1, full_width - 1);
+				half[x]							 = static_cast<uint8_t>((full[2 * x] + full[right] + 1) >> 1);
+		}
+}
+
+/**
+ * @brief Rounded mean of two chroma rows interleaved into one NV12 UV row,
+ * a single row when bottom is null.
+ */
+inline void
+interleave_chroma(const uint8_t* u_top,
+									const uint8_t* v_top,
+									const uint8_t* u_bottom,
+									const uint8_t* v_bottom,
+									uint8_t* uv,
+									uint32_t width)
+{
+		if(u_bottom == nullptr)
+		{
+				for(uint32_t x = 0; x < width; ++x)
+				{
+						uv[2 * x]			= u_top[x];
+						uv[2 * x + 1] = v_top[x];
+				}
+				return;
+		}
+		for(uint32_t x = 0; x < width; ++x)
+		{
+				uv[2 * x]			= static_cast<uint8_t>((u_top[x] + u_bottom[x] + 1) >> 1);
+				uv[2 * x + 1] = static_cast<uint8_t>((v_top[x] + v_bottom[x] + 1) >> 1);
+		}
+}
+
+/**
+ * @brief 4:2:0 and 4:2:2 frames with raw_data_out: the planes leave the IDCT
+ * as they are stored, no upsampling and no color conversion. Chroma rows are
+ * only interleaved, averaged in pairs (4:2:2 to NV12) or doubled (4:2:0 to
+ * 422P).
+ */
+inline void
+read_raw_planes(jpeg_decompress_struct& info, const Image_View& target)
+{
+		const uint32_t rows_per_call = component_rows(info.comp_info[0]);
+		const uint32_t chroma_rows	 = component_rows(info.comp_info[1]);
+		const bool vertical_chroma	 = rows_per_call == 2 * chroma_rows;
+		const uint32_t luma_stride	 = component_stride(info.comp_info[0]);
+		const uint32_t chroma_stride = component_stride(info.comp_info[1]);
+		const uint32_t chroma_width	 = (info.output_width + 1) / 2;
+		const bool full_width				 = component_columns(info.comp_info[0]) == component_columns(info.comp_info[1]);
+		const bool nv12							 = target.pixel_format == Pixel_Format::NV12;
+
+		/* Luma rows, U rows and V rows of one iMCU row, the U and V row waiting
+		 * for its pair, then the U and V row halved from full width. */
+		auto& scratch = jpeg_scratch();
+		scratch.samples.resize(std::size_t(rows_per_call) * luma_stride + std::size_t(2 * chroma_rows + 4) * chroma_stride);
+		scratch.rows.resize(rows_per_call + 2 * chroma_rows);
+		auto* samples = reinterpret_cast<uint8_t*>(scratch.samples.data());
+		for(uint32_t row = 0; row < rows_per_call; ++row)
+		{
+				scratch.rows[row] = samples + std::size_t(row) * luma_stride;
+		}
+		auto* chroma = samples + std::size_t(rows_per_call) * luma_stride;
+		for(uint32_t row = 0; row < 2 * chroma_rows; ++row)
+		{
+				scratch.rows[rows_per_call + row] = chroma + std::size_t(row) * chroma_stride;
+		}
+		uint8_t* pending_u = chroma + std::size_t(2 * chroma_rows) * chroma_stride;
+		uint8_t* pending_v = pending_u + chroma_stride;
+		uint8_t* halved_u	 = pending_v + chroma_stride;
+		uint8_t* halved_v	 = halved_u + chroma_stride;
+		JSAMPARRAY planes[3] = {scratch.rows.data(),
+														scratch.rows.data() + rows_per_call,
+														scratch.rows.data() + rows_per_call + chroma_rows};
+
+		const auto& luma_plane	 = target.plane(0);
+		const uint32_t height		 = info.output_height;
+		while(info.output_scanline < height)
+		{
+				const uint32_t first = info.output_scanline;
+				if(jpeg_read_raw_data(&info, planes, rows_per_call) == 0)
+				{
+						break;
+				}
+				const uint32_t rows = std::min(rows_per_call, height - first);
+				for(uint32_t row = 0; row < rows; ++row)
+				{
+						std::memcpy(luma_plane.row(first + row), planes[0][row], info.output_width);
+				}
+
+				for(uint32_t row = 0; row < chroma_rows; ++row)
+				{
+						const uint8_t* u = planes[1][row];
+						const uint8_t* v = planes[2][row];
+						if(full_width)
+						{
+								halve_chroma_row(u, halved_u, chroma_width, info.output_width);
+								halve_chroma_row(v, halved_v, chroma_width, info.output_width);
+								u = halved_u;
+								v = halved_v;
+						}
+						if(vertical_chroma)
+						{
+								const uint32_t luma_row = first + 2 * row;
+								if(luma_row >= height)
+								{
+										break;
+								}
+								if(nv12)
+								{
+										interleave_chroma(u, v, nullptr, nullptr, target.plane(1).row(luma_row / 2), chroma_width);
+								}
+								else
+								{
+										for(uint32_t copy = luma_row; copy < std::min(luma_row + 2, height); ++copy)
+										{
+												std::memcpy(target.plane(1).row(copy), u, chroma_width);
+												std::memcpy(target.plane(2).row(copy), v, chroma_width);
+										}
+								}
+								continue;
+						}
+
+						const uint32_t luma_row = first + row;
+						if(luma_row >= height)
+						{
+								break;
+						}
+						if(not nv12)
+						{
+								std::memcpy(target.plane(1).row(luma_row), u, chroma_width);
+								std::memcpy(target.plane(2).row(luma_row), v, chroma_width);
+						}
+						else if(luma_row % 2 == 0 and luma_row + 1 < height)
+						{
+								/* The pair may end in the next call when an iMCU row is a single row. */
+								std::memcpy(pending_u, u, chroma_width);
+								std::memcpy(pending_v, v, chroma_width);
+						}
+						else if(luma_row % 2 == 0)
+						{
+								interleave_chroma(u, v, nullptr, nullptr, target.plane(1).row(luma_row / 2), chroma_width);
+						}
+						else
+						{
+								interleave_chroma(pending_u, pending_v, u, v, target.plane(1).row(luma_row / 2), chroma_width);
+						}
+				}
+		}
+}
+
+/**
+ * @brief Any other sampling: libjpeg upsamples to 4:4:4 Y'CbCr scanlines,
+ * two at a time, and chroma is averaged back down to the target's sampling.
+ */
+inline void
+read_full_planes(jpeg_decompress_struct& info, const Image_View& target)
+{
+		const uint32_t width	= info.output_width;
+		const uint32_t height = info.output_height;
+		const bool nv12				= target.pixel_format == Pixel_Format::NV12;
+		auto& scratch					= jpeg_scratch();
+		scratch.samples.resize(std::size_t(6) * width);
+		scratch.rows.resize(2);
+		auto* samples		= reinterpret_cast<uint8_t*>(scratch.samples.data());
+		scratch.rows[0] = samples;
+		scratch.rows[1] = samples + std::size_t(3) * width;
+
+		while(info.output_scanline < height)
+		{
+				const uint32_t first = info.output_scanline;
+				uint32_t rows				 = 0;
+				while(rows < 2 and info.output_scanline < height)
+				{
+						rows += jpeg_read_scanlines(&info, scratch.rows.data() + rows, 2 - rows);
+				}
+
+				for(uint32_t row = 0; row < rows; ++row)
+				{
+						const uint8_t* in = scratch.rows[row];
+						uint8_t* luma			= target.plane(0).row(first + row);
+						for(uint32_t x = 0; x < width; ++x)
+						{
+								luma[x] = in[3 * x];
+						}
+						if(nv12)
+						{
+								continue;
+						}
+						uint8_t* u = target.plane(1).row(first + row);
+						uint8_t* v = target.plane(2).row(first + row);
+						for(uint32_t x = 0; x < width; x += 2)
+						{
+								const uint32_t right = std::min(x + 1, width - 1);
+								u[x / 2]						 = static_cast<uint8_t>((in[3 * x + 1] + in[3 * right + 1] + 1) >> 1);
+								v[x / 2]						 = static_cast<uint8_t>((in[3 * x + 2] + in[3 * right + 2] + 1) >> 1);
+						}
+				}
+
+				if(nv12 and rows > 0)
+				{
+						const uint8_t* top		= scratch.rows[0];
+						const uint8_t* bottom = scratch.rows[rows - 1];
+						uint8_t* uv						= target.plane(1).row(first / 2);
+						for(uint32_t x = 0; x < width; x += 2)
+						{
+								const uint32_t right = std::min(x + 1, width - 1);
+								for(uint32_t channel = 1; channel <= 2; ++channel)
+								{
+										uv[x + channel - 1] = static_cast<uint8_t>((top[3 * x + channel] + top[3 * right + channel]
+																																+ bottom[3 * x + channel] + bottom[3 * right + channel] + 2)
+																															 >> 2);
+								}
+						}
+				}
+		}
+}
+
+/**
+ * @brief Scanlines straight into the target rows, for packed targets and
+ * grayscale JPEGs.
+ */
+inline void
+read_scanlines(jpeg_decompress_struct& info, const Plane_View& plane)
+{
+		auto& scratch = jpeg_scratch();
+		scratch.rows.resize(info.output_height);
+		for(uint32_t row = 0; row < info.output_height; ++row)
+		{
+				scratch.rows[row] = plane.row(row);
+		}
+		while(info.output_scanline < info.output_height)
+		{
+				if(jpeg_read_scanlines(&info,
+															 scratch.rows.data() + info.output_scanline,
+															 info.output_height - info.output_scanline)
+					 == 0)
+				{
+						break;
+				}
+		}
+}
+
+/**
+ * @brief Decodes jpeg into frame, whose storage is (re)laid out for the
+ * decoded size. Returns false with message filled when libjpeg gave up.
+ */
+inline bool
+decode_jpeg(std::span<const Data_Type> jpeg,
+						Pixel_Format target,
+						uint32_t scale_denominator,
+						const std::function<Image_View(uint32_t, uint32_t)>& prepare,
+						char* message)
+{
+		jpeg_decompress_struct info;
+		Jpeg_Errors errors;
+		info.err										 = jpeg_std_error(&errors.manager);
+		errors.manager.error_exit		 = jpeg_error_exit;
+		errors.manager.emit_message	 = jpeg_ignore_message;
+		errors.message[0]						 = '\0';
+		jpeg_create_decompress(&info);
+		if(setjmp(errors.jump))
+		{
+				std::strncpy(message, errors.message, JMSG_LENGTH_MAX);
+				jpeg_destroy_decompress(&info);
+				return false;
+		}
+
+		/* libjpeg before 9 and libjpeg-turbo before 1.5 take a mutable buffer, neither writes it. */
+		jpeg_mem_src(&info,
+								 const_cast<unsigned char*>(reinterpret_cast<const unsigned char*>(jpeg.data())),
+								 static_cast<unsigned long>(jpeg.size()));
+		jpeg_read_header(&info, TRUE);
+		info.scale_num	 = 1;
+		info.scale_denom = scale_denominator;
+
+		const bool planar					= target == Pixel_Format::NV12 or target == Pixel_Format::YUV422P;
+		const bool gray_source		= info.jpeg_color_space == JCS_GRAYSCALE;
+		jpeg_calc_output_dimensions(&info);
+		const bool raw						= detail::raw_sampling(info);
+		switch(target)
+		{
+				case Pixel_Format::RGB24:
+						info.out_color_space = JCS_RGB;
+						break;
+#ifdef JCS_EXTENSIONS
+				case Pixel_Format::BGR24:
+						info.out_color_space = JCS_EXT_BGR;
+						break;
+#endif
+#ifdef JCS_ALPHA_EXTENSIONS
+				case Pixel_Format::RGBA32:
+						info.out_color_space = JCS_EXT_RGBA;
+						break;
+#endif
+				case Pixel_Format::GRAY8:
+						info.out_color_space = JCS_GRAYSCALE;
+						break;
+				default:
+						info.out_color_space = gray_source ? JCS_GRAYSCALE : JCS_YCbCr;
+						info.raw_data_out		 = raw ? TRUE : FALSE;
+						break;
+		}
+
+		jpeg_start_decompress(&info);
+		const auto image = prepare(info.output_width, info.output_height);
+		if(not planar)
+		{
+				read_scanlines(info, image.plane(0));
+		}
+		else if(gray_source)
+		{
+				read_scanlines(info, image.plane(0));
+				for(std::size_t plane = 1; plane < image.num_planes; ++plane)
+				{
+						std::memset(image.plane(plane).data, 128, image.plane(plane).size());
+				}
+		}
+		else if(raw)
+		{
+				read_raw_planes(info, image);
+		}
+		else
+		{
+				read_full_planes(info, image);
+		}
+
+		/* Frames cut short still show what arrived, the rest is left as it was. */
+		if(info.output_scanline == info.output_height)
+		{
+				jpeg_finish_decompress(&info);
+		}
+		jpeg_destroy_decompress(&info);
+		return true;
+}
+
+} // namespace detail
+
+#endif
+
+/**
+ * @brief Decodes MJPEG frames on a worker pool into pooled buffers, so
+ * MJPEG-only USB cameras deliver usable frames at high resolutions.
+ *
+ * decode copies the JPEG into one of queue_depth slots of an
+ * Ordered_Slot_Pipeline and returns, the driver buffer is free again right
+ * away. Frames are decoded in parallel and handed to the callback in the order
+ * they were given, on the pipeline's consumer thread, each with its decode
+ * time and latency. Y'CbCr targets skip libjpeg's color
+ * conversion and upsampling entirely for the 4:2:2 and 4:2:0 frames cameras
+ * send. libjpeg-turbo falls back to the standard Huffman tables MJPEG frames
+ * leave out.
+ *
+ * Delivered frames return to the pool once the callback and everyone it
+ * passed them to let go. When every slot is taken the frame is dropped and
+ * counted, decode never waits for the workers. decode is meant to be called
+ * from one capturing thread.
+ */
+class Mjpeg_Decoder
+{
+	public:
+		using Callback = std::function<void(const Decoded_Frame_Handle&)>;
+
+		explicit Mjpeg_Decoder(Callback callback, const Mjpeg_Decoder_Options& options = {})
+				: _options_(options)
+				, _callback_(std::move(callback))
+				, _pipeline_(std::max(2u, options.queue_depth),
+										 options.workers,
+										 [this](std::size_t index) { deliver_slot(index); })
+		{
+				if(not mjpeg_decode_supported(_options_.target))
+				{
+						const auto& fourcc = describe(_options_.target).fourcc;
+						throw std::runtime_error(mjpeg_decoding_available()
+																				 ? "Mjpeg_Decoder: cannot decode to " + std::string(fourcc.begin(), fourcc.end())
+																				 : std::string{"Mjpeg_Decoder: built without libjpeg"});
+				}
+				const auto denominator = _options_.scale_denominator;
+				if(denominator != 1 and denominator != 2 and denominator != 4 and denominator != 8)
+				{
+						throw std::runtime_error("Mjpeg_Decoder: scale_denominator must be 1, 2, 4 or 8");
+				}
+				if(not _callback_)
+				{
+						throw std::runtime_error("Mjpeg_Decoder without callback");
+				}
+
+				_slots_.resize(std::max(2u, _options_.queue_depth));
+				_started_ = std::chrono::steady_clock::now();
+		}
+
+		~Mjpeg_Decoder()
+		{
+				close();
+		}
+
+		Mjpeg_Decoder(const Mjpeg_Decoder&)						 = delete;
+		Mjpeg_Decoder& operator=(const Mjpeg_Decoder&) = delete;
+
+		bool decode(const Frame_Handle& frame)
+		{
+				return frame and not frame->planes.empty()
+							 and decode(frame->planes[0], frame->timestamp, frame->frame_order, frame->sequence);
+		}
+
+		/**
+		 * @brief Copies the JPEG and queues it, false if the frame was dropped.
+		 * The span can be reused as soon as this returns.
+		 */
+		bool decode(std::span<const Data_Type> jpeg,
+								std::chrono::nanoseconds timestamp,
+								uintmax_t frame_order,
+								uint32_t sequence)
+		{
+				const auto acquired = _pipeline_.acquire();
+				if(not acquired)
+				{
+						std::lock_guard lock(_mutex_);
+						++_statistics_.dropped_frames;
+						return false;
+				}
+
+				/* Only this thread touches a slot between acquiring and enqueueing it. */
+				const auto index = *acquired;
+				auto& slot			 = _slots_[index];
+				slot.jpeg.assign(jpeg.begin(), jpeg.end());
+				slot.timestamp	 = timestamp;
+				slot.frame_order = frame_order;
+				slot.sequence		 = sequence;
+				slot.submitted	 = std::chrono::steady_clock::now();
+				_pipeline_.enqueue(index, 1);
+				_pipeline_.submit([this, index] { decode_slot(index); });
+				return true;
+		}
+
+		/**
+		 * @brief Waits until every frame given so far went to the callback.
+		 */
+		void flush()
+		{
+				_pipeline_.flush();
+		}
+
+		/**
+		 * @brief Flushes and stops the delivery thread. Called by the destructor.
+		 */
+		void close()
+		{
+				_pipeline_.close();
+		}
+
+		[[nodiscard]] Mjpeg_Decoder_Statistics statistics()
+		{
+				std::lock_guard lock(_mutex_);
+				auto statistics		 = _statistics_;
+				statistics.elapsed = std::chrono::steady_clock::now() - _started_;
+				return statistics;
+		}
+
+		[[nodiscard]] std::size_t workers() const
+		{
+				return _pipeline_.workers();
+		}
+
+	private:
+		struct Slot
+		{
+				Aligned_Buffer jpeg;
+				std::chrono::nanoseconds timestamp{0};
+				uintmax_t frame_order = 0;
+				uint32_t sequence			= 0;
+				std::chrono::steady_clock::time_point submitted;
+				std::shared_ptr<Decoded_Frame> frame;
+		};
+
+		/**
+		 * @brief A pooled frame and whether it is free. The deleter of the handle
+		 * sets free with release and recycle takes it with acquire, so whatever
+		 * the last holder read happens before a worker decodes into it again. The
+		 * deleter holds the pooled frame, a handle may outlive the decoder.
+		 */
+		struct Pooled_Frame
+		{
+				Decoded_Frame frame;
+				std::atomic<bool> free = true;
+		};
+
+		/**
+		 * @brief A pooled frame nobody holds any more, or a new one, with _mutex_
+		 * held.
+		 */
+		std::shared_ptr<Decoded_Frame> recycle()
+		{
+				auto pooled = std::find_if(_frames_.begin(),
+																	 _frames_.end(),
+																	 [](const auto& frame) { return frame->free.load(std::memory_order_acquire); });
+				if(pooled == _frames_.end())
+				{
+						pooled = _frames_.insert(_frames_.end(), std::make_shared<Pooled_Frame>());
+				}
+				(*pooled)->free.store(false, std::memory_order_relaxed);
+				return std::shared_ptr<Decoded_Frame>(&(*pooled)->frame,
+																							[pooled = *pooled](Decoded_Frame*)
+																							{ pooled->free.store(true, std::memory_order_release); });
+		}
+
+		void decode_slot(std::size_t index)
+		{
+				auto& slot = _slots_[index];
+				{
+						std::lock_guard lock(_mutex_);
+						slot.frame = recycle();
+				}
+				auto& frame				= *slot.frame;
+				frame.timestamp		= slot.timestamp;
+				frame.frame_order = slot.frame_order;
+				frame.sequence		= slot.sequence;
+				frame.image				= {};
+
+				bool reallocated = false;
+				const auto started = std::chrono::steady_clock::now();
+#ifdef LIBJPEG_AVAILABLE
+				char message[JMSG_LENGTH_MAX] = {};
+				const auto prepare						= [&](uint32_t width, uint32_t height)
+				{
+						auto& layout = frame._layout_;
+						if(layout.pixel_format != _options_.target or layout.width != width or layout.height != height)
+						{
+								layout = make_packed_image_layout(_options_.target, width, height, false);
+								layout.color_encoding = {Ycbcr_Encoding::BT601, Quantization_Range::Full};
+								frame._data_.resize(layout.memory_plane_sizes[0]);
+								reallocated = true;
+						}
+						return make_image_view(layout, Multiplanar_Buffer_View{std::span(frame._data_)});
+				};
+				frame.valid = detail::decode_jpeg(slot.jpeg, _options_.target, _options_.scale_denominator, prepare, message);
+				if(frame.valid)
+				{
+						frame.image = make_image_view(frame._layout_, Multiplanar_Buffer_View{std::span(frame._data_)});
+				}
+#else
+				const char* message = "built without libjpeg";
+				frame.valid					= false;
+#endif
+				frame.decode_time = std::chrono::steady_clock::now() - started;
+
+				std::lock_guard lock(_mutex_);
+				_statistics_.decode_time += frame.decode_time;
+				_statistics_.allocations += reallocated;
+				if(not frame.valid)
+				{
+						++_statistics_.failed_frames;
+						_statistics_.last_error = message;
+				}
+				_pipeline_.complete(index);
+		}
+
+		/**
+		 * @brief Hands one frame to the callback, on the pipeline's consumer
+		 * thread in the order the frames were given. The slot is free again
+		 * before the callback runs.
+		 */
+		void deliver_slot(std::size_t index)
+		{
+				auto& slot		 = _slots_[index];
+				auto frame		 = std::move(slot.frame);
+				frame->latency = std::chrono::steady_clock::now() - slot.submitted;
+				{
+						std::lock_guard lock(_mutex_);
+						_statistics_.latency += frame->latency;
+						_statistics_.max_latency = std::max(_statistics_.max_latency, frame->latency);
+						_statistics_.decoded_frames += frame->valid;
+				}
+				_pipeline_.release(index);
+
+				try
+				{
+						_callback_(frame);
+				}
+				catch(const std::exception& e)
+				{
+						std::cerr << "Mjpeg_Decoder callback: " << e.what() << std::endl;
+				}
+		}
+
+	private:
+		Mjpeg_Decoder_Options _options_;
+		Callback _callback_;
+		std::vector<Slot> _slots_;
+		std::vector<std::shared_ptr<Pooled_Frame>> _frames_;
+		Mjpeg_Decoder_Statistics _statistics_;
+		std::chrono::steady_clock::time_point _started_;
+		std::mutex _mutex_;
+		Ordered_Slot_Pipeline _pipeline_;
+};
+
+} // namespace Cartrack
+
+#endif // MJPEG_DECODER_HPP
@@ -0,0 +1,134 @@
+#ifndef PIXEL_FORMAT_DESCRIPTOR_HPP
+#define PIXEL_FORMAT_DESCRIPTOR_HPP
+
+#include "Abstract_Capture_Backend.hpp"
+
+#include <linux/videodev2.h>
+
+namespace Cartrack
+{
+
+static constexpr std::size_t Max_Image_Planes = 3;
+
+/**
+ * @brief Subsampling and sample size of one image plane, relative to the frame
+ * width and height.
+ */
+struct Plane_Geometry
+{
+		uint32_t horizontal_subsampling = 1;
+		uint32_t vertical_subsampling		= 1;
+		uint32_t bytes_per_sample				= 1;
+};
+
+/**
+ * @brief Everything the capture and processing code needs to know about a pixel
+ * format. All of it is known at compile time, so a format can be a template
+ * argument and kernels can be specialized for it.
+ *
+ * num_planes counts image planes (Y, UV...), num_memory_planes counts the
+ * buffers V4L2 hands out for one frame. A contiguous format keeps all its image
+ * planes in one memory plane, it can be captured with either buffer type.
+ * rgb formats carry R'G'B' samples, which V4L2 defaults to full range.
+ */
+struct Pixel_Format_Descriptor
+{
+		Pixel_Format pixel_format = Pixel_Format::Invalid;
+		std::array<char, 4> fourcc{};
+		std::size_t num_planes				= 0;
+		std::size_t num_memory_planes = 0;
+		std::array<Plane_Geometry, Max_Image_Planes> planes{};
+		uint32_t bits_per_pixel = 0;
+		bool contiguous					= true;
+		bool compressed					= false;
+		bool rgb								= false;
+
+		[[nodiscard]] constexpr uint32_t v4l2_pixel_format() const
+		{
+				return v4l2_fourcc(fourcc[0], fourcc[1], fourcc[2], fourcc[3]);
+		}
+
+		[[nodiscard]] constexpr bool valid() const
+		{
+				return pixel_format != Pixel_Format::Invalid;
+		}
+};
+
+/**
+ * @brief Indexed by Pixel_Format, keep the order of the enum.
+ */
+static constexpr std::array<Pixel_Format_Descriptor, 10> pixel_format_descriptors{{
+		{Pixel_Format::Invalid, {'\0', '\0', '\0', '\0'}, 0, 0, {}, 0, true, false},
+		{Pixel_Format::YUYV422, {'Y', 'U', 'Y', 'V'}, 1, 1, {{{1, 1, 2}}}, 16, true, false},
+		{Pixel_Format::NV12, {'N', 'V', '1', '2'}, 2, 1, {{{1, 1, 1}, {2, 2, 2}}}, 12, true, false},
+		{Pixel_Format::NV12sp,
+		 {'N', 'M', '1', '2'},
+		 2,
+		 2,
+		 {{{1, 1, 1}, {2, 2, 2}}},
+		 12,
+		 false,
+		 false},
+		{Pixel_Format::YUV422P,
+		 {'4', '2', '2', 'P'},
+		 3,
+		 1,
+		 {{{1, 1, 1}, {2, 1, 1}, {2, 1, 1}}},
+		 16,
+		 true,
+		 false},
+		{Pixel_Format::MJPEG, {'M', 'J', 'P', 'G'}, 1, 1, {{{1, 1, 1}}}, 0, true, true},
+		{Pixel_Format::BGR24, {'B', 'G', 'R', '3'}, 1, 1, {{{1, 1, 3}}}, 24, true, false, true},
+		{Pixel_Format::RGB24, {'R', 'G', 'B', '3'}, 1, 1, {{{1, 1, 3}}}, 24, true, false, true},
+		{Pixel_Format::RGBA32, {'A', 'B', '2', '4'}, 1, 1, {{{1, 1, 4}}}, 32, true, false, true},
+		{Pixel_Format::GRAY8, {'G', 'R', 'E', 'Y'}, 1, 1, {{{1, 1, 1}}}, 8, true, false},
+}};
+
+[[nodiscard]] constexpr const Pixel_Format_Descriptor&
+describe(Pixel_Format px_format)
+{
+		const auto index = static_cast<std::size_t>(px_format);
+		return index < pixel_format_descriptors.size() ? pixel_format_descriptors[index]
+																									 : pixel_format_descriptors[0];
+}
+
+[[nodiscard]] constexpr Pixel_Format
+pixel_format_from_v4l2(uint32_t v4l2_pixel_format)
+{
+		for(const auto& descriptor : pixel_format_descriptors)
+		{
+				if(descriptor.valid() and descriptor.v4l2_pixel_format() == v4l2_pixel_format)
+				{
+						return descriptor.pixel_format;
+				}
+		}
+		return Pixel_Format::Invalid;
+}
+
+static_assert([]
+							{
+									for(std::size_t i = 0; i < pixel_format_descriptors.size(); ++i)
+									{
+											if(static_cast<std::size_t>(pixel_format_descriptors[i].pixel_format) != i)
+											{
+													return false;
+											}
+									}
+									return true;
+							}(),
+							"pixel_format_descriptors must follow the order of Pixel_Format");
+
+template <Pixel_Format Format>
+struct Pixel_Format_Traits
+{
+		static_assert(describe(Format).valid(), "No descriptor for this pixel format");
+
+		static constexpr const Pixel_Format_Descriptor& descriptor = describe(Format);
+		static constexpr std::size_t num_planes										 = descriptor.num_planes;
+		static constexpr std::size_t num_memory_planes						 = descriptor.num_memory_planes;
+		static constexpr uint32_t v4l2_pixel_format = descriptor.v4l2_pixel_format();
+};
+
+} // namespace Cartrack
+
+#endif // PIXEL_FORMAT_DESCRIPTOR_HPP
@@ -0,0 +1,494 @@
+#ifndef PRE_EVENT_RING_HPP
+#define PRE_EVENT_RING_HPP
+
+#include "Recording_Compression.hpp"
+
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace Cartrack
+{
+
+struct Pre_Event_Ring_Options
+{
+		/**
+		 * @brief How far back a dump reaches from the trigger.
+		 */
+		std::chrono::milliseconds window{std::chrono::seconds(10)};
+		/**
+		 * @brief Compress frames as they enter the ring, with a key frame codec
+		 * only: the oldest frames are evicted one by one, a delta chain would not
+		 * survive that.
+		 */
+		bool compress = false;
+		Raw_Codec codec = default_raw_codec();
+		int level				= 1;
+		/**
+		 * @brief Arena size for compressed rings, 0 for the uncompressed size.
+		 * Smaller arenas hold less than window when frames compress badly.
+		 * Ignored without compression, the arena is then exactly window long.
+		 */
+		std::size_t arena_bytes = 0;
+		/**
+		 * @brief Frame_Handles waiting to be copied in, their driver buffers are
+		 * held meanwhile. Frames beyond are dropped.
+		 */
+		unsigned int queue_depth	= 2;
+		uint32_t frames_per_chunk = 64;
+};
+
+struct Pre_Event_Ring_Statistics
+{
+		uintmax_t stored_frames = 0;
+		/**
+		 * @brief Frames refused because queue_depth frames were waiting.
+		 */
+		uintmax_t dropped_frames = 0;
+		/**
+		 * @brief Frames refused because storing them would have overwritten a
+		 * frame a dump had not written yet.
+		 */
+		uintmax_t dropped_while_dumping = 0;
+		uintmax_t evicted_frames				= 0;
+		uintmax_t dumps									= 0;
+		uintmax_t dumped_frames					= 0;
+		uintmax_t dump_errors						= 0;
+		std::size_t held_frames					= 0;
+		std::size_t held_bytes					= 0;
+		/**
+		 * @brief Time between the oldest and the newest held frame.
+		 */
+		std::chrono::nanoseconds held_duration{0};
+};
+
+/**
+ * @brief Keeps the last window of frames in memory so that a trigger, a crash
+ * detected by the IMU say, can save what happened before it.
+ *
+ * All frame data lives in one arena allocated up front, nothing is allocated
+ * while running. Without compression the arena holds exactly
+ * frames_for(fps, window) frames of the layout's memory plane sizes, see
+ * memory_footprint(). Frames are packed one after the other and wrap around,
+ * the oldest are evicted for new ones and once they are older than window.
+ *
+ * push() only queues the Frame_Handle, a thread of the ring copies it in, or
+ * compresses it straight into the arena, and lets the driver buffer go.
+ *
+ * trigger() freezes the frames of the last window and writes them to a raw
+ * recording from a dump thread, while new frames keep coming in. Frames not
+ * yet dumped are never overwritten: should the ring come around to them, new
+ * frames are dropped instead, counted in dropped_while_dumping. The dump
+ * writes oldest first, so this only happens when the disk is slower than the
+ * camera.
+ */
+class Pre_Event_Ring
+{
+	public:
+		Pre_Event_Ring(const Image_Layout& layout, double fps, const Pre_Event_Ring_Options& options = {})
+				: _options_(options)
+				, _layout_(layout)
+				, _fps_(fps)
+		{
+				if(fps <= 0)
+				{
+						throw std::runtime_error("Pre_Event_Ring needs the frame rate to size its arena");
+				}
+				if(_options_.compress and not raw_codec_available(_options_.codec))
+				{
+						throw std::runtime_error(std::string{"Pre_Event_Ring: "} + raw_codec_name(_options_.codec)
+																		 + " is not built in");
+				}
+				_options_.queue_depth = std::max(1u, _options_.queue_depth);
+
+				_frame_bytes_	 = frame_bytes(layout);
+				_arena_size_	 = _frame_bytes_ * frames_for(fps, _options_.window);
+				if(_options_.compress and _options_.arena_bytes > 0)
+				{
+						_arena_size_ = std::max(_frame_bytes_, _options_.arena_bytes / Plane_Alignment * Plane_Alignment);
+				}
+				_arena_ = Raw_Block::allocate(_arena_size_);
+				/* Frames older than window go anyway, compressed or not. */
+				_entries_.resize(frames_for(fps, _options_.window));
+
+				_ingest_thread_ = std::thread(&Pre_Event_Ring::ingest_loop, this);
+		}
+
+		~Pre_Event_Ring()
+		{
+				{
+						std::lock_guard lock(_mutex_);
+						_stopping_ = true;
+				}
+				_frame_queued_.notify_all();
+				_ingest_thread_.join();
+				wait_for_dump();
+		}
+
+		Pre_Event_Ring(const Pre_Event_Ring&)						 = delete;
+		Pre_Event_Ring& operator=(const Pre_Event_Ring&) = delete;
+
+		/**
+		 * @brief Frames a window of that long holds at fps, one more than the
+		 * frame periods it spans.
+		 */
+		[[nodiscard]] static std::size_t frames_for(double fps, std::chrono::milliseconds window)
+		{
+				return static_cast<std::size_t>(std::ceil(fps * std::chrono::duration<double>(window).count())) + 1;
+		}
+
+		/**
+		 * @brief Bytes an uncompressed frame of layout takes in the arena.
+		 */
+		[[nodiscard]] static std::size_t frame_bytes(const Image_Layout& layout)
+		{
+				std::size_t bytes = 0;
+				for(std::size_t plane = 0; plane < layout.num_memory_planes; ++plane)
+				{
+						bytes += round_up(layout.memory_plane_sizes[plane]);
+				}
+				return bytes;
+		}
+
+		/**
+		 * @brief Arena bytes of an uncompressed ring, what it allocates besides a
+		 * small index per frame.
+		 */
+		[[nodiscard]] static std::size_t memory_footprint(const Image_Layout& layout,
+																											double fps,
+																											std::chrono::milliseconds window)
+		{
+				return frame_bytes(layout) * frames_for(fps, window);
+		}
+
+		[[nodiscard]] std::size_t arena_size() const
+		{
+				return _arena_size_;
+		}
+
+		/**
+		 * @brief Queues the frame, false if it was dropped. Never blocks.
+		 */
+		bool push(const Frame_Handle& frame)
+		{
+				if(not frame)
+				{
+						return false;
+				}
+				{
+						std::lock_guard lock(_mutex_);
+						if(_queue_.size() >= _options_.queue_depth)
+						{
+								++_statistics_.dropped_frames;
+								return false;
+						}
+						_queue_.push_back(frame);
+				}
+				_frame_queued_.notify_one();
+				return true;
+		}
+
+		/**
+		 * @brief Starts dumping the last window to a raw recording at path, false
+		 * if a dump is still running or there is nothing to dump.
+		 */
+		bool trigger(const std::string& path)
+		{
+				std::unique_lock lock(_mutex_);
+				if(_dumping_ or _count_ == 0)
+				{
+						return false;
+				}
+				const auto newest = entry(_next_id_ - 1).timestamp;
+				auto first				= _next_id_ - _count_;
+				while(first + 1 < _next_id_ and newest - entry(first).timestamp > _options_.window)
+				{
+						++first;
+				}
+				_dump_next_ = first;
+				_dump_end_	= _next_id_;
+				_dumping_		= true;
+				lock.unlock();
+
+				if(_dump_thread_.joinable())
+				{
+						_dump_thread_.join();
+				}
+				_dump_thread_ = std::thread(&Pre_Event_Ring::dump, this, path);
+				return true;
+		}
+
+		[[nodiscard]] bool dumping()
+		{
+				std::lock_guard lock(_mutex_);
+				return _dumping_;
+		}
+
+		void wait_for_dump()
+		{
+				if(_dump_thread_.joinable())
+				{
+						_dump_thread_.join();
+				}
+		}
+
+		[[nodiscard]] Pre_Event_Ring_Statistics statistics()
+		{
+				std::lock_guard lock(_mutex_);
+				auto statistics				 = _statistics_;
+				statistics.held_frames = _count_;
+				if(_count_ > 0)
+				{
+						statistics.held_duration = entry(_next_id_ - 1).timestamp - entry(_next_id_ - _count_).timestamp;
+				}
+				for(auto id = _next_id_ - _count_; id < _next_id_; ++id)
+				{
+						statistics.held_bytes += entry(id).size;
+				}
+				return statistics;
+		}
+
+	private:
+		static constexpr std::size_t Plane_Alignment = 64;
+
+		struct Entry
+		{
+				std::size_t offset = 0;
+				std::size_t size	 = 0;
+				std::chrono::nanoseconds timestamp{0};
+				uintmax_t frame_order = 0;
+				uint32_t sequence			= 0;
+				Raw_Codec codec				= Raw_Codec::Stored;
+				std::array<std::size_t, VIDEO_MAX_PLANES> stored_bytes{};
+				std::array<std::size_t, VIDEO_MAX_PLANES> bytes_used{};
+		};
+
+		static constexpr std::size_t round_up(std::size_t bytes)
+		{
+				return (bytes + Plane_Alignment - 1) / Plane_Alignment * Plane_Alignment;
+		}
+
+		Entry& entry(uintmax_t id)
+		{
+				return _entries_[id % _entries_.size()];
+		}
+
+		/**
+		 * @brief Where a frame of bytes fits without touching held frames, if it
+		 * does. With _mutex_ held.
+		 */
+		bool place(std::size_t bytes, std::size_t& offset)
+		{
+				if(_count_ == 0)
+				{
+						_write_offset_ = 0;
+				}
+				if(bytes > _arena_size_ or _count_ == _entries_.size())
+				{
+						return false;
+				}
+				if(_count_ == 0)
+				{
+						offset = 0;
+						return true;
+				}
+				const auto start = entry(_next_id_ - _count_).offset;
+				if(_write_offset_ > start)
+				{
+						if(_write_offset_ + bytes <= _arena_size_)
+						{
+								offset = _write_offset_;
+								return true;
+						}
+						offset = 0;
+						return bytes <= start;
+				}
+				offset = _write_offset_;
+				return _write_offset_ + bytes <= start;
+		}
+
+		/**
+		 * @brief Drops the oldest frame, false if a dump still needs it.
+		 */
+		bool evict()
+		{
+				const auto oldest = _next_id_ - _count_;
+				if(_dumping_ and oldest >= _dump_next_ and oldest < _dump_end_)
+				{
+						return false;
+				}
+				--_count_;
+				++_statistics_.evicted_frames;
+				return true;
+		}
+
+		void ingest_loop()
+		{
+				std::unique_lock lock(_mutex_);
+				while(true)
+				{
+						_frame_queued_.wait(lock, [this] { return _stopping_ or not _queue_.empty(); });
+						if(_queue_.empty())
+						{
+								return;
+						}
+						auto frame = std::move(_queue_.front());
+						_queue_.pop_front();
+
+						/* Age first, then room for an uncompressed copy, the most it can take. */
+						while(_count_ > 0 and frame->timestamp - entry(_next_id_ - _count_).timestamp > _options_.window)
+						{
+								if(not evict())
+								{
+										break;
+								}
+						}
+						bool room					= true;
+						std::size_t bytes = 0;
+						for(const auto& plane : frame->planes)
+						{
+								bytes += round_up(plane.size());
+						}
+						std::size_t offset = 0;
+						while(not place(bytes, offset))
+						{
+								if(_count_ == 0 or not evict())
+								{
+										room = false;
+										break;
+								}
+						}
+						if(not room or frame->planes.size() > VIDEO_MAX_PLANES)
+						{
+								if(_dumping_)
+								{
+										++_statistics_.dropped_while_dumping;
+								}
+								else
+								{
+										++_statistics_.dropped_frames;
+								}
+								continue;
+						}
+						lock.unlock();
+
+						Entry stored;
+						stored.offset			 = offset;
+						stored.timestamp	 = frame->timestamp;
+						stored.frame_order = frame->frame_order;
+						stored.sequence		 = frame->sequence;
+						stored.codec			 = _options_.compress ? _options_.codec : Raw_Codec::Stored;
+						auto* target			 = _arena_.data.get() + offset;
+						for(std::size_t plane = 0; plane < frame->planes.size(); ++plane)
+						{
+								const auto& source = frame->planes[plane];
+								auto size						= _options_.compress ? raw_compress(_options_.codec,
+																																				_options_.level,
+																																				source.data(),
+																																				source.size(),
+																																				target,
+																																				source.size())
+																												 : 0;
+								if(size == 0)
+								{
+										std::memcpy(target, source.data(), source.size());
+										size = source.size();
+								}
+								stored.stored_bytes[plane] = size;
+								stored.bytes_used[plane]	 = source.size();
+								target += round_up(size);
+						}
+						stored.size = static_cast<std::size_t>(target - (_arena_.data.get() + offset));
+						frame.reset();
+
+						lock.lock();
+						entry(_next_id_++) = stored;
+						++_count_;
+						_write_offset_ = offset + stored.size;
+						++_statistics_.stored_frames;
+				}
+		}
+
+		void dump(std::string path)
+		{
+				bool failed					 = false;
+				uintmax_t dumped		 = 0;
+				try
+				{
+						Raw_Recording_Writer writer(path, _layout_, _fps_, _options_.frames_per_chunk);
+						while(true)
+						{
+								Entry stored;
+								{
+										std::lock_guard lock(_mutex_);
+										if(_dump_next_ == _dump_end_)
+										{
+												break;
+										}
+										stored = entry(_dump_next_);
+								}
+
+								Raw_Frame frame;
+								frame.timestamp		= stored.timestamp;
+								frame.frame_order = stored.frame_order;
+								frame.sequence		= stored.sequence;
+								frame.codec				= stored.codec;
+								frame.bytes_used	= stored.bytes_used;
+								auto* data				= _arena_.data.get() + stored.offset;
+								for(std::size_t plane = 0; plane < _layout_.num_memory_planes; ++plane)
+								{
+										frame.planes.emplace_back(data, stored.stored_bytes[plane]);
+										data += round_up(stored.stored_bytes[plane]);
+								}
+								writer.write(frame);
+								++dumped;
+
+								std::lock_guard lock(_mutex_);
+								++_dump_next_;
+						}
+						writer.close();
+				}
+				catch(const std::exception& e)
+				{
+						std::cerr << "Pre-event dump to " << path << " failed: " << e.what() << std::endl;
+						failed = true;
+				}
+
+				std::lock_guard lock(_mutex_);
+				_dumping_ = false;
+				++_statistics_.dumps;
+				_statistics_.dumped_frames += dumped;
+				_statistics_.dump_errors += failed;
+		}
+
+	private:
+		Pre_Event_Ring_Options _options_;
+		Image_Layout _layout_;
+		double _fps_							= 0;
+		std::size_t _frame_bytes_ = 0;
+		std::size_t _arena_size_	= 0;
+		Raw_Block _arena_;
+		/**
+		 * @brief Index of the held frames by id, the oldest is _next_id_ - _count_.
+		 */
+		std::vector<Entry> _entries_;
+		uintmax_t _next_id_				 = 0;
+		std::size_t _count_				 = 0;
+		std::size_t _write_offset_ = 0;
+		uintmax_t _dump_next_			 = 0;
+		uintmax_t _dump_end_			 = 0;
+		bool _dumping_						 = false;
+		bool _stopping_						 = false;
+		std::deque<Frame_Handle> _queue_;
+		Pre_Event_Ring_Statistics _statistics_;
+		std::mutex _mutex_;
+		std::condition_variable _frame_queued_;
+		std::thread _ingest_thread_;
+		std::thread _dump_thread_;
+};
+
+} // namespace Cartrack
+
+#endif // PRE_EVENT_RING_HPP
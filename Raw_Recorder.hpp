@@ -0,0 +1,749 @@
+#ifndef RAW_RECORDER_HPP
+#define RAW_RECORDER_HPP
+
+#include "Frame_Handle.hpp"
+#include "Raw_Recording.hpp"
+
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <sys/uio.h>
+#include <thread>
+#ifdef LIBURING_AVAILABLE
+#		include <liburing.h>
+#endif
+
+namespace Cartrack
+{
+
+struct Raw_Recorder_Options
+{
+		/**
+		 * @brief Frames being written at the same time. A zero copy frame keeps its
+		 * driver buffer until its write completes, so leave the backend enough
+		 * num_buffers for this many plus what capture needs.
+		 */
+		unsigned int queue_depth = 4;
+		/**
+		 * @brief Frames covered by one chunk index. Smaller chunks lose fewer
+		 * frames to a crash, each costs an index block and, without O_DIRECT, an
+		 * fdatasync.
+		 */
+		uint32_t frames_per_chunk = 64;
+		/**
+		 * @brief Bypass the page cache with O_DIRECT, falls back to buffered writes
+		 * on file systems that refuse it (tmpfs).
+		 */
+		bool direct_io = true;
+		/**
+		 * @brief Submit through io_uring when built with LIBURING_AVAILABLE,
+		 * otherwise a writer thread calls pwritev.
+		 */
+		bool use_io_uring = true;
+};
+
+struct Raw_Recorder_Statistics
+{
+		uintmax_t written_frames = 0;
+		/**
+		 * @brief Frames refused because queue_depth writes were already pending,
+		 * the disk is slower than the camera.
+		 */
+		uintmax_t dropped_frames = 0;
+		/**
+		 * @brief Frames the driver dropped before they reached the recorder,
+		 * counted from sequence number gaps of Frame_Handles.
+		 */
+		uintmax_t capture_gaps		= 0;
+		uintmax_t zero_copy_frames = 0;
+		uintmax_t copied_frames		 = 0;
+		uintmax_t sealed_chunks		 = 0;
+		uintmax_t write_errors		 = 0;
+		uintmax_t bytes_written		 = 0;
+		/**
+		 * @brief Time since the first frame, frozen once the recorder is closed.
+		 */
+		std::chrono::nanoseconds elapsed{0};
+
+		[[nodiscard]] double megabytes_per_second() const
+		{
+				return elapsed.count() > 0 ? bytes_written / 1e6 / std::chrono::duration<double>(elapsed).count() : 0;
+		}
+};
+
+/**
+ * @brief Writes frames in the raw recording format (Raw_Recording.hpp) without
+ * keeping the capture thread busy or filling the page cache with video.
+ *
+ * record(Frame_Handle) writes straight from the mapped V4L2 buffer: the handle
+ * is held until the write completes, then the buffer returns to the driver.
+ * vb2 buffers are page aligned and mapped in whole pages, so each plane is
+ * written rounded up to a block without a copy; the bytes past bytesused are
+ * padding. Frames whose planes are not page aligned, and plain spans given to
+ * record(planes, ...), are copied once into a pool buffer of the recorder.
+ *
+ * Writes are issued at precomputed offsets, any number can be in flight and
+ * complete in any order. A chunk index is written once every frame it covers
+ * has completed, after an fdatasync when the page cache is in the way. record
+ * never blocks: when queue_depth writes are pending the frame is counted in
+ * dropped_frames and let go. With io_uring, completions are reaped on the
+ * calling thread during record and flush, which must not be called from
+ * several threads at once; with the writer thread they are released there.
+ * A failed write leaves a hole, readers skip the frame.
+ */
+class Raw_Recorder
+{
+	public:
+		Raw_Recorder(const std::string& path,
+								 const Image_Layout& layout,
+								 double fps										 = 0,
+								 const Raw_Recorder_Options& options = {})
+				: _options_(options)
+				, _layout_(layout)
+				, _chunk_builder_(options.frames_per_chunk)
+		{
+				_options_.queue_depth = std::max(1u, _options_.queue_depth);
+				constexpr int flags		= O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+				if(_options_.direct_io)
+				{
+						_file_descriptor_ = ::open(path.c_str(), flags | O_DIRECT, 0644);
+						_direct_io_				= _file_descriptor_ != -1;
+				}
+				if(_file_descriptor_ == -1)
+				{
+						_file_descriptor_ = ::open(path.c_str(), flags, 0644);
+				}
+				if(_file_descriptor_ == -1)
+				{
+						throw std::runtime_error("Cannot create recording " + path + " -> " + strerror(errno));
+				}
+
+				Multiplanar_Buffer_View largest;
+				for(std::size_t plane = 0; plane < layout.num_memory_planes; ++plane)
+				{
+						largest.emplace_back(static_cast<Data_Type*>(nullptr), layout.memory_plane_sizes[plane]);
+				}
+				_max_record_size_ = raw_record_size(largest);
+
+				_slots_.resize(_options_.queue_depth);
+				for(std::size_t slot = 0; slot < _slots_.size(); ++slot)
+				{
+						_slots_[slot].header_block = Raw_Block::allocate(Raw_Recording_Alignment);
+						_free_slots_.push_back(slot);
+				}
+
+				const auto header = make_raw_recording_header(layout, fps, _chunk_builder_.frames_per_chunk());
+				auto& block							= _slots_[0].header_block;
+				std::memcpy(block.data.get(), &header, sizeof(header));
+				if(not write_block(block, 0))
+				{
+						const auto error = std::string{strerror(errno)};
+						::close(_file_descriptor_);
+						throw std::runtime_error("Raw recording header write: " + error);
+				}
+				_file_offset_ = Raw_Recording_Alignment;
+
+#ifdef LIBURING_AVAILABLE
+				if(_options_.use_io_uring)
+				{
+						/* A frame write, and per chunk an fsync and its index. */
+						_uring_ready_ = io_uring_queue_init(2 * _options_.queue_depth + 2, &_ring_, 0) == 0;
+				}
+				if(not _uring_ready_)
+#endif
+				{
+						_writer_ = std::thread(&Raw_Recorder::write_loop, this);
+				}
+		}
+
+		~Raw_Recorder()
+		{
+				close();
+		}
+
+		Raw_Recorder(const Raw_Recorder&)						 = delete;
+		Raw_Recorder& operator=(const Raw_Recorder&) = delete;
+
+		/**
+		 * @brief Queues the frame for writing, without a copy when its planes are
+		 * page aligned. Returns false when it was dropped.
+		 */
+		bool record(const Frame_Handle& frame)
+		{
+				if(not frame)
+				{
+						return false;
+				}
+				{
+						std::lock_guard lock(_mutex_);
+						if(_has_sequence_ and frame->sequence > _last_sequence_ + 1)
+						{
+								_statistics_.capture_gaps += frame->sequence - _last_sequence_ - 1;
+						}
+						_has_sequence_	= true;
+						_last_sequence_ = frame->sequence;
+				}
+				return submit(frame->planes, frame->timestamp, frame->frame_order, frame->sequence, frame);
+		}
+
+		/**
+		 * @brief Copies the planes into a pool buffer and queues them, the spans
+		 * can be reused as soon as this returns.
+		 */
+		bool record(const Multiplanar_Buffer_View& planes,
+								std::chrono::nanoseconds timestamp,
+								uintmax_t frame_order,
+								uint32_t sequence)
+		{
+				return submit(planes, timestamp, frame_order, sequence, {});
+		}
+
+		/**
+		 * @brief Waits for every queued write, including the indexes of full
+		 * chunks, and for the data to reach the disk.
+		 */
+		void flush()
+		{
+				if(_file_descriptor_ == -1)
+				{
+						return;
+				}
+#ifdef LIBURING_AVAILABLE
+				if(_uring_ready_)
+				{
+						while(writes_pending())
+						{
+								io_uring_cqe* completion = nullptr;
+								if(io_uring_wait_cqe(&_ring_, &completion) == 0)
+								{
+										complete(completion);
+								}
+								submit_ready_chunks();
+						}
+				}
+#endif
+				{
+						std::unique_lock lock(_mutex_);
+						_write_done_.wait(lock, [this] { return not writes_pending_locked(); });
+				}
+				::fdatasync(_file_descriptor_);
+		}
+
+		/**
+		 * @brief Flushes, seals the last chunk and writes the footer that lets
+		 * readers index the file without walking it. Called by the destructor.
+		 */
+		void close()
+		{
+				if(_file_descriptor_ == -1)
+				{
+						return;
+				}
+				flush();
+				if(_writer_.joinable())
+				{
+						{
+								std::lock_guard lock(_mutex_);
+								_stopping_ = true;
+						}
+						_pending_changed_.notify_all();
+						_writer_.join();
+				}
+#ifdef LIBURING_AVAILABLE
+				if(_uring_ready_)
+				{
+						io_uring_queue_exit(&_ring_);
+						_uring_ready_ = false;
+				}
+#endif
+
+				/* Everything completed, what is left is written in place. */
+				if(not _chunk_builder_.empty())
+				{
+						const auto chunk = _chunk_builder_.seal(_file_offset_);
+						if(write_block(chunk, _file_offset_))
+						{
+								++_statistics_.sealed_chunks;
+						}
+						_file_offset_ += static_cast<off_t>(chunk.size);
+				}
+				const auto footer = _chunk_builder_.footer();
+				if(not write_block(footer, _file_offset_))
+				{
+						std::cerr << "Raw recording footer write failed: " << strerror(errno) << std::endl;
+				}
+				::fdatasync(_file_descriptor_);
+				::close(_file_descriptor_);
+				_file_descriptor_ = -1;
+				_chunks_.clear();
+
+				std::lock_guard lock(_mutex_);
+				if(_started_)
+				{
+						_statistics_.elapsed = std::chrono::steady_clock::now() - _start_time_;
+				}
+				_closed_ = true;
+		}
+
+		[[nodiscard]] Raw_Recorder_Statistics statistics()
+		{
+				std::lock_guard lock(_mutex_);
+				auto statistics = _statistics_;
+				if(_started_ and not _closed_)
+				{
+						statistics.elapsed = std::chrono::steady_clock::now() - _start_time_;
+				}
+				return statistics;
+		}
+
+		[[nodiscard]] bool direct_io() const
+		{
+				return _direct_io_;
+		}
+
+		[[nodiscard]] bool uses_io_uring() const
+		{
+				return _uring_ready_;
+		}
+
+	private:
+		/**
+		 * @brief Index block of a chunk, written once its frames are.
+		 */
+		struct Pending_Chunk
+		{
+				Raw_Block block;
+				off_t offset							= 0;
+				unsigned int outstanding = 0;
+				bool sealed								= false;
+				iovec iov{};
+		};
+
+		struct Write_Slot
+		{
+				Frame_Handle frame;
+				Raw_Block header_block;
+				Raw_Block copy_block;
+				Pending_Chunk* chunk = nullptr;
+				std::array<iovec, VIDEO_MAX_PLANES + 1> iov{};
+				int iov_count			= 0;
+				off_t offset			= 0;
+				std::size_t bytes = 0;
+				bool zero_copy		= false;
+		};
+
+		static bool page_aligned(const Data_Type* address)
+		{
+				return reinterpret_cast<uintptr_t>(address) % Raw_Recording_Alignment == 0;
+		}
+
+		bool write_block(const Raw_Block& block, off_t offset)
+		{
+				return ::pwrite(_file_descriptor_, block.data.get(), block.size, offset) == ssize_t(block.size);
+		}
+
+		bool writes_pending_locked() const
+		{
+				return _free_slots_.size() != _slots_.size()
+							 or std::any_of(_chunks_.begin(), _chunks_.end(), [](const auto& chunk) { return chunk.sealed; });
+		}
+
+		bool writes_pending()
+		{
+				std::lock_guard lock(_mutex_);
+				return writes_pending_locked();
+		}
+
+		bool submit(const Multiplanar_Buffer_View& planes,
+								std::chrono::nanoseconds timestamp,
+								uintmax_t frame_order,
+								uint32_t sequence,
+								const Frame_Handle& frame)
+		{
+				if(_file_descriptor_ == -1 or planes.size() != _layout_.num_memory_planes)
+				{
+						return false;
+				}
+				for(std::size_t plane = 0; plane < planes.size(); ++plane)
+				{
+						if(planes[plane].size() > _layout_.memory_plane_sizes[plane])
+						{
+								return false;
+						}
+				}
+				reap();
+
+				std::size_t slot_index = 0;
+				{
+						std::lock_guard lock(_mutex_);
+						if(not _started_)
+						{
+								_started_		 = true;
+								_start_time_ = std::chrono::steady_clock::now();
+						}
+						if(_free_slots_.empty())
+						{
+								++_statistics_.dropped_frames;
+								return false;
+						}
+						slot_index = _free_slots_.front();
+						_free_slots_.pop_front();
+				}
+				auto& slot = _slots_[slot_index];
+
+#ifdef LIBURING_AVAILABLE
+				/* Taken before the frame gets a file offset and an index entry, a
+				 * refused frame leaves no gap in the file. */
+				io_uring_sqe* entry = nullptr;
+				if(_uring_ready_)
+				{
+						entry = reserve_sqes(1) ? io_uring_get_sqe(&_ring_) : nullptr;
+						if(entry == nullptr)
+						{
+								std::lock_guard lock(_mutex_);
+								++_statistics_.dropped_frames;
+								_free_slots_.push_back(slot_index);
+								_write_done_.notify_all();
+								return false;
+						}
+				}
+#endif
+
+				slot.bytes = fill_raw_frame_header(slot.header_block.data.get(), planes, timestamp, frame_order, sequence);
+				slot.iov[0]		 = {slot.header_block.data.get(), Raw_Recording_Alignment};
+				slot.iov_count = 1;
+				slot.zero_copy = frame and std::all_of(planes.begin(),
+																							 planes.end(),
+																							 [](const auto& plane) { return page_aligned(plane.data()); });
+				if(slot.zero_copy)
+				{
+						slot.frame = frame;
+						for(const auto& plane : planes)
+						{
+								slot.iov[slot.iov_count++] = {plane.data(), raw_recording_round_up(plane.size())};
+						}
+				}
+				else
+				{
+						if(not slot.copy_block.data)
+						{
+								slot.copy_block = Raw_Block::allocate(_max_record_size_);
+						}
+						std::size_t offset = 0;
+						for(const auto& plane : planes)
+						{
+								const auto rounded = raw_recording_round_up(plane.size());
+								std::memcpy(slot.copy_block.data.get() + offset, plane.data(), plane.size());
+								std::memset(slot.copy_block.data.get() + offset + plane.size(), 0, rounded - plane.size());
+								offset += rounded;
+						}
+						slot.iov[slot.iov_count++] = {slot.copy_block.data.get(), offset};
+				}
+
+				{
+						std::lock_guard lock(_mutex_);
+						slot.offset = _file_offset_;
+						_file_offset_ += static_cast<off_t>(slot.bytes);
+
+						if(_chunks_.empty() or _chunks_.back().sealed)
+						{
+								_chunks_.emplace_back();
+						}
+						auto& chunk = _chunks_.back();
+						++chunk.outstanding;
+						slot.chunk = &chunk;
+						_chunk_builder_.add(static_cast<uint64_t>(slot.offset), timestamp, sequence);
+						if(_chunk_builder_.full())
+						{
+								/* Its place follows the frames, the next chunk starts after it. */
+								chunk.offset = _file_offset_;
+								chunk.block	 = _chunk_builder_.seal(static_cast<uint64_t>(chunk.offset));
+								chunk.iov		 = {chunk.block.data.get(), chunk.block.size};
+								chunk.sealed = true;
+								_file_offset_ += static_cast<off_t>(chunk.block.size);
+						}
+				}
+
+#ifdef LIBURING_AVAILABLE
+				if(_uring_ready_)
+				{
+						io_uring_prep_writev(entry, _file_descriptor_, slot.iov.data(), slot.iov_count, slot.offset);
+						io_uring_sqe_set_data(entry, tag(&slot, Slot_Write));
+						io_uring_submit(&_ring_);
+						return true;
+				}
+#endif
+				{
+						std::lock_guard lock(_mutex_);
+						_pending_.push_back(slot_index);
+				}
+				_pending_changed_.notify_one();
+				return true;
+		}
+
+		/**
+		 * @brief Releases the frame of a finished write and frees its slot. The
+		 * chunk becomes ready to be indexed with its last frame.
+		 */
+		void finish(Write_Slot& slot, ssize_t result)
+		{
+				slot.frame.reset();
+				std::lock_guard lock(_mutex_);
+				if(result == ssize_t(slot.bytes))
+				{
+						++_statistics_.written_frames;
+						_statistics_.bytes_written += slot.bytes;
+						++(slot.zero_copy ? _statistics_.zero_copy_frames : _statistics_.copied_frames);
+				}
+				else if(_statistics_.write_errors++ == 0)
+				{
+						std::cerr << "Raw recording write failed: "
+											<< (result < 0 ? strerror(int(-result)) : "short write") << std::endl;
+				}
+
+				auto* chunk = slot.chunk;
+				slot.chunk	= nullptr;
+				if(--chunk->outstanding == 0 and chunk->sealed)
+				{
+						_ready_chunks_.push_back(chunk);
+						_pending_changed_.notify_one();
+				}
+				_free_slots_.push_back(static_cast<std::size_t>(&slot - _slots_.data()));
+				_write_done_.notify_all();
+		}
+
+		void finish_chunk(Pending_Chunk* chunk, ssize_t result)
+		{
+				std::lock_guard lock(_mutex_);
+				if(result == ssize_t(chunk->block.size))
+				{
+						++_statistics_.sealed_chunks;
+						_statistics_.bytes_written += chunk->block.size;
+				}
+				else if(_statistics_.write_errors++ == 0)
+				{
+						std::cerr << "Raw recording chunk index write failed: "
+											<< (result < 0 ? strerror(int(-result)) : "short write") << std::endl;
+				}
+				_chunks_.remove_if([chunk](const Pending_Chunk& pending) { return &pending == chunk; });
+				_write_done_.notify_all();
+		}
+
+#ifdef LIBURING_AVAILABLE
+		enum Write_Kind : uintptr_t { Slot_Write = 0, Chunk_Write = 1, Chunk_Sync = 2 };
+
+		static void* tag(void* pointer, Write_Kind kind)
+		{
+				return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(pointer) | kind);
+		}
+
+		void complete(io_uring_cqe* completion)
+		{
+				const auto data		= reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(completion));
+				const auto result = completion->res;
+				io_uring_cqe_seen(&_ring_, completion);
+
+				auto* pointer = reinterpret_cast<void*>(data & ~uintptr_t{3});
+				switch(static_cast<Write_Kind>(data & 3))
+				{
+						case Slot_Write:
+								finish(*static_cast<Write_Slot*>(pointer), result);
+								break;
+						case Chunk_Write:
+								finish_chunk(static_cast<Pending_Chunk*>(pointer), result);
+								break;
+						case Chunk_Sync:
+								break;
+				}
+		}
+
+		/**
+		 * @brief Makes room for count submission entries. A full submission
+		 * queue is submitted, and completions are reaped while the kernel
+		 * refuses more work. False when the ring cannot take entries at all.
+		 */
+		bool reserve_sqes(unsigned count)
+		{
+				while(io_uring_sq_space_left(&_ring_) < count)
+				{
+						const int submitted			 = io_uring_submit(&_ring_);
+						io_uring_cqe* completion = nullptr;
+						if(submitted >= 0)
+						{
+								if(io_uring_peek_cqe(&_ring_, &completion) == 0)
+								{
+										complete(completion);
+								}
+								continue;
+						}
+						if(io_uring_wait_cqe(&_ring_, &completion) != 0)
+						{
+								return false;
+						}
+						complete(completion);
+				}
+				return true;
+		}
+
+		/**
+		 * @brief Index writes of chunks whose frames completed, behind an
+		 * fdatasync when writes went through the page cache.
+		 */
+		void submit_ready_chunks()
+		{
+				std::deque<Pending_Chunk*> ready;
+				{
+						std::lock_guard lock(_mutex_);
+						ready.swap(_ready_chunks_);
+				}
+				for(auto* chunk : ready)
+				{
+						/* The linked pair has to go into one submission, a link does not span two. */
+						if(not reserve_sqes(_direct_io_ ? 1 : 2))
+						{
+								finish_chunk(chunk, -EBUSY);
+								continue;
+						}
+						if(not _direct_io_)
+						{
+								io_uring_sqe* sync = io_uring_get_sqe(&_ring_);
+								io_uring_prep_fsync(sync, _file_descriptor_, IORING_FSYNC_DATASYNC);
+								io_uring_sqe_set_flags(sync, IOSQE_IO_LINK);
+								io_uring_sqe_set_data(sync, tag(chunk, Chunk_Sync));
+						}
+						io_uring_sqe* entry = io_uring_get_sqe(&_ring_);
+						io_uring_prep_writev(entry, _file_descriptor_, &chunk->iov, 1, chunk->offset);
+						io_uring_sqe_set_data(entry, tag(chunk, Chunk_Write));
+				}
+				if(not ready.empty())
+				{
+						io_uring_submit(&_ring_);
+				}
+		}
+#endif
+
+		void reap()
+		{
+#ifdef LIBURING_AVAILABLE
+				if(_uring_ready_)
+				{
+						io_uring_cqe* completion = nullptr;
+						while(io_uring_peek_cqe(&_ring_, &completion) == 0)
+						{
+								complete(completion);
+						}
+						submit_ready_chunks();
+				}
+#endif
+		}
+
+		static ssize_t write_vector(int file_descriptor, iovec* iov, int iov_count, off_t offset, std::size_t bytes)
+		{
+				std::size_t written = 0;
+				while(written < bytes)
+				{
+						const auto result = ::pwritev(file_descriptor, iov, iov_count, offset + off_t(written));
+						if(result == -1 and errno == EINTR)
+						{
+								continue;
+						}
+						if(result <= 0)
+						{
+								return result == 0 ? ssize_t(written) : -errno;
+						}
+						written += static_cast<std::size_t>(result);
+						/* Short buffered write, continue after what was taken. */
+						auto remaining = static_cast<std::size_t>(result);
+						while(iov_count > 0 and remaining >= iov->iov_len)
+						{
+								remaining -= iov->iov_len;
+								++iov;
+								--iov_count;
+						}
+						if(iov_count > 0)
+						{
+								iov->iov_base = static_cast<Data_Type*>(iov->iov_base) + remaining;
+								iov->iov_len -= remaining;
+						}
+				}
+				return ssize_t(written);
+		}
+
+		void write_loop()
+		{
+				for(;;)
+				{
+						Write_Slot* slot		 = nullptr;
+						Pending_Chunk* chunk = nullptr;
+						{
+								std::unique_lock lock(_mutex_);
+								_pending_changed_.wait(
+										lock, [this] { return _stopping_ or not _pending_.empty() or not _ready_chunks_.empty(); });
+								if(not _ready_chunks_.empty())
+								{
+										chunk = _ready_chunks_.front();
+										_ready_chunks_.pop_front();
+								}
+								else if(not _pending_.empty())
+								{
+										slot = &_slots_[_pending_.front()];
+										_pending_.pop_front();
+								}
+								else
+								{
+										return;
+								}
+						}
+
+						if(chunk)
+						{
+								if(not _direct_io_)
+								{
+										::fdatasync(_file_descriptor_);
+								}
+								finish_chunk(chunk,
+														 write_vector(_file_descriptor_, &chunk->iov, 1, chunk->offset, chunk->block.size));
+						}
+						else
+						{
+								finish(*slot, write_vector(_file_descriptor_, slot->iov.data(), slot->iov_count, slot->offset, slot->bytes));
+						}
+				}
+		}
+
+	private:
+		Raw_Recorder_Options _options_;
+		Image_Layout _layout_;
+		int _file_descriptor_ = -1;
+		bool _direct_io_			= false;
+		bool _uring_ready_		= false;
+#ifdef LIBURING_AVAILABLE
+		struct io_uring _ring_{};
+#endif
+		std::size_t _max_record_size_ = 0;
+		off_t _file_offset_						= 0;
+		std::vector<Write_Slot> _slots_;
+		std::deque<std::size_t> _free_slots_;
+		std::deque<std::size_t> _pending_;
+		Raw_Chunk_Builder _chunk_builder_;
+		std::list<Pending_Chunk> _chunks_;
+		std::deque<Pending_Chunk*> _ready_chunks_;
+		std::mutex _mutex_;
+		std::condition_variable _pending_changed_;
+		std::condition_variable _write_done_;
+		bool _stopping_ = false;
+		std::thread _writer_;
+		bool _has_sequence_			= false;
+		uint32_t _last_sequence_ = 0;
+		bool _started_					 = false;
+		bool _closed_						 = false;
+		std::chrono::steady_clock::time_point _start_time_;
+		Raw_Recorder_Statistics _statistics_;
+};
+
+} // namespace Cartrack
+
+#endif // RAW_RECORDER_HPP
@@ -0,0 +1,913 @@
+#ifndef RAW_RECORDING_HPP
+#define RAW_RECORDING_HPP
+
+#include "Abstract_Capture_Backend.hpp"
+#include "Frame_Handle.hpp"
+#include "Image_View.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+namespace Cartrack
+{
+
+/**
+ * @brief File format of raw captures, written by Raw_Recording_Writer and
+ * Raw_Recorder, read by Raw_Recording_Reader and Replay_Backend.
+ *
+ * Everything is made of Raw_Recording_Alignment blocks, so frames can be written
+ * with O_DIRECT and mapped back with every plane page aligned:
+ *
+ *   header | frame ... frame | chunk index | frame ... frame | chunk index | footer
+ *
+ * A frame record is a Raw_Frame_Header block followed by the memory planes of
+ * the frame, each starting on its own block. Every frames_per_chunk frames the
+ * writer seals a chunk: once the frames are on disk it appends a Raw_Chunk_Header
+ * with an index entry per frame, chained to the previous chunk. Closing the file
+ * seals the last chunk and appends a Raw_Recording_Footer pointing at it.
+ *
+ * Readers of a closed file read the footer and walk the chunk chain, a few
+ * blocks per thousand frames, and seek with a binary search on the index. After
+ * a crash there is no footer: the file is walked from the start, sealed chunks
+ * are trusted and frames after the last one are kept as far as their records
+ * are intact.
+ *
+ * Planes may be stored compressed (Recording_Compression.hpp), then
+ * stored_bytes tells their size on disk and bytes_used their decoded size. A
+ * delta frame holds the difference to the frame recorded before it.
+ */
+static constexpr uint32_t Raw_Recording_Magic			= 0x57415243; // "CRAW"
+static constexpr uint32_t Raw_Frame_Magic					= 0x4d415246; // "FRAM"
+static constexpr uint32_t Raw_Chunk_Magic					= 0x4b4e4843; // "CHNK"
+static constexpr uint32_t Raw_Footer_Magic				= 0x444e4543; // "CEND"
+static constexpr uint32_t Raw_Recording_Version		= 4;
+static constexpr std::size_t Raw_Recording_Alignment = 4096;
+
+/**
+ * @brief How the planes of a frame are stored.
+ */
+enum class Raw_Codec : uint8_t
+{
+		Stored = 0,
+		LZ4		 = 1,
+		Zstd	 = 2
+};
+
+[[nodiscard]] inline const char*
+raw_codec_name(Raw_Codec codec)
+{
+		switch(codec)
+		{
+				case Raw_Codec::Stored:
+						return "stored";
+				case Raw_Codec::LZ4:
+						return "lz4";
+				case Raw_Codec::Zstd:
+						return "zstd";
+		}
+		return "unknown";
+}
+
+struct Raw_Recording_Header
+{
+		uint32_t magic	 = Raw_Recording_Magic;
+		uint32_t version = Raw_Recording_Version;
+		/**
+		 * @brief Pixel format, resolution, strides and plane sizes of every frame.
+		 */
+		Image_Layout_Record layout;
+		/**
+		 * @brief Rate the camera was configured for, informative only. Replay
+		 * paces by the recorded timestamps.
+		 */
+		double fps								= 0;
+		uint32_t frames_per_chunk = 0;
+		uint32_t reserved					= 0;
+};
+
+struct Raw_Frame_Header
+{
+		uint32_t magic			= Raw_Frame_Magic;
+		uint32_t num_planes = 0;
+		/**
+		 * @brief Bytes from the start of this header to the next record.
+		 */
+		uint64_t record_size = 0;
+		/**
+		 * @brief Capture time, CLOCK_MONOTONIC of the recording host.
+		 */
+		int64_t timestamp		 = 0;
+		uint64_t frame_order = 0;
+		/**
+		 * @brief Driver sequence number, gaps are frames the driver dropped.
+		 */
+		uint32_t sequence = 0;
+		Raw_Codec codec		= Raw_Codec::Stored;
+		/**
+		 * @brief Nonzero when the decoded planes are byte wise differences to the
+		 * previous frame of the file.
+		 */
+		uint8_t delta			= 0;
+		uint16_t reserved = 0;
+		std::array<uint64_t, VIDEO_MAX_PLANES> bytes_used{};
+		/**
+		 * @brief Bytes of each plane on disk, 0 when it is stored as is. A plane
+		 * that did not get smaller is stored as is even in a compressed frame.
+		 */
+		std::array<uint64_t, VIDEO_MAX_PLANES> stored_bytes{};
+};
+
+struct Raw_Index_Entry
+{
+		/**
+		 * @brief File offset of the frame's Raw_Frame_Header.
+		 */
+		uint64_t offset		= 0;
+		int64_t timestamp = 0;
+		uint32_t sequence = 0;
+		uint32_t reserved = 0;
+};
+
+struct Raw_Chunk_Header
+{
+		uint32_t magic			 = Raw_Chunk_Magic;
+		uint32_t num_entries = 0;
+		/**
+		 * @brief Bytes from the start of this header to the next record.
+		 */
+		uint64_t record_size = 0;
+		/**
+		 * @brief File offset of the previous chunk header, 0 for the first chunk.
+		 */
+		uint64_t previous_chunk = 0;
+		/**
+		 * @brief raw_recording_checksum of the entries that follow.
+		 */
+		uint32_t checksum = 0;
+		uint32_t reserved = 0;
+};
+
+struct Raw_Recording_Footer
+{
+		uint32_t magic		= Raw_Footer_Magic;
+		uint32_t checksum = 0;
+		uint64_t last_chunk = 0;
+		uint64_t num_chunks = 0;
+		uint64_t num_frames = 0;
+};
+
+static_assert(std::is_trivially_copyable_v<Raw_Recording_Header>
+									and std::is_trivially_copyable_v<Raw_Frame_Header>
+									and std::is_trivially_copyable_v<Raw_Chunk_Header>
+									and std::is_trivially_copyable_v<Raw_Recording_Footer>,
+							"Raw recording headers are written as they are");
+static_assert(offsetof(Raw_Recording_Header, layout) == 8
+									and offsetof(Raw_Recording_Header, fps) == 8 + sizeof(Image_Layout_Record)
+									and sizeof(Raw_Recording_Header) == 24 + sizeof(Image_Layout_Record),
+							"Raw_Recording_Header has no padding, every byte written is defined");
+static_assert(sizeof(Raw_Recording_Header) <= Raw_Recording_Alignment
+									and sizeof(Raw_Frame_Header) <= Raw_Recording_Alignment
+									and sizeof(Raw_Recording_Footer) <= Raw_Recording_Alignment,
+							"Raw recording headers must fit a block");
+
+/**
+ * @brief File header for a recording of frames in layout, zeroed first so no
+ * byte written depends on the build.
+ */
+[[nodiscard]] inline Raw_Recording_Header
+make_raw_recording_header(const Image_Layout& layout, double fps, uint32_t frames_per_chunk)
+{
+		Raw_Recording_Header header;
+		std::memset(static_cast<void*>(&header), 0, sizeof(header));
+		header.magic						= Raw_Recording_Magic;
+		header.version					= Raw_Recording_Version;
+		header.layout						= make_image_layout_record(layout);
+		header.fps							= fps;
+		header.frames_per_chunk = frames_per_chunk;
+		return header;
+}
+
+[[nodiscard]] constexpr std::size_t
+raw_recording_round_up(std::size_t bytes)
+{
+		return (bytes + Raw_Recording_Alignment - 1) / Raw_Recording_Alignment * Raw_Recording_Alignment;
+}
+
+/**
+ * @brief Size of the record holding a frame with these plane sizes.
+ */
+[[nodiscard]] inline std::size_t
+raw_record_size(const Multiplanar_Buffer_View& planes)
+{
+		std::size_t size = Raw_Recording_Alignment;
+		for(const auto& plane : planes)
+		{
+				size += raw_recording_round_up(plane.size());
+		}
+		return size;
+}
+
+/**
+ * @brief FNV-1a, catches torn and zeroed index blocks, not meant against tampering.
+ */
+[[nodiscard]] inline uint32_t
+raw_recording_checksum(const void* data, std::size_t bytes)
+{
+		uint32_t hash			= 2166136261u;
+		const auto* bytes_ = static_cast<const uint8_t*>(data);
+		for(std::size_t i = 0; i < bytes; ++i)
+		{
+				hash = (hash ^ bytes_[i]) * 16777619u;
+		}
+		return hash;
+}
+
+[[nodiscard]] inline uint32_t
+raw_footer_checksum(const Raw_Recording_Footer& footer)
+{
+		auto copy			= footer;
+		copy.checksum = 0;
+		return raw_recording_checksum(&copy, sizeof(copy));
+}
+
+/**
+ * @brief Zeroed, block aligned memory, what O_DIRECT needs to write from.
+ */
+struct Raw_Block
+{
+		struct Free_Deleter
+		{
+				void operator()(Data_Type* block) const
+				{
+						std::free(block);
+				}
+		};
+
+		std::unique_ptr<Data_Type[], Free_Deleter> data;
+		std::size_t size = 0;
+
+		static Raw_Block allocate(std::size_t bytes)
+		{
+				Raw_Block block;
+				block.size = raw_recording_round_up(std::max<std::size_t>(bytes, 1));
+				block.data.reset(static_cast<Data_Type*>(std::aligned_alloc(Raw_Recording_Alignment, block.size)));
+				if(not block.data)
+				{
+						throw std::bad_alloc();
+				}
+				std::memset(block.data.get(), 0, block.size);
+				return block;
+		}
+};
+
+/**
+ * @brief One frame of a recording. planes are what is stored on disk, read
+ * from a reader they point into the mapping and stay valid as long as it.
+ * Unless encoded(), they are the image itself.
+ */
+struct Raw_Frame
+{
+		Multiplanar_Buffer_View planes;
+		std::chrono::nanoseconds timestamp{0};
+		uintmax_t frame_order = 0;
+		uint32_t sequence			= 0;
+		Raw_Codec codec				= Raw_Codec::Stored;
+		bool delta						= false;
+		/**
+		 * @brief Decoded size of each plane, only meaningful when encoded().
+		 */
+		std::array<std::size_t, VIDEO_MAX_PLANES> bytes_used{};
+
+		[[nodiscard]] bool encoded() const
+		{
+				return codec != Raw_Codec::Stored or delta;
+		}
+};
+
+/**
+ * @brief Writes the header block of a frame record into block, which must hold
+ * Raw_Recording_Alignment bytes. Returns the size of the whole record.
+ */
+inline std::size_t
+fill_raw_frame_header(Data_Type* block, const Raw_Frame& frame)
+{
+		const auto& planes = frame.planes;
+		if(planes.size() > VIDEO_MAX_PLANES)
+		{
+				throw std::runtime_error("Raw recording frame has too many planes");
+		}
+
+		Raw_Frame_Header header;
+		header.num_planes	 = static_cast<uint32_t>(planes.size());
+		header.record_size = raw_record_size(planes);
+		header.timestamp	 = frame.timestamp.count();
+		header.frame_order = frame.frame_order;
+		header.sequence		 = frame.sequence;
+		header.codec			 = frame.codec;
+		header.delta			 = frame.delta;
+		for(std::size_t plane = 0; plane < planes.size(); ++plane)
+		{
+				header.bytes_used[plane] = planes[plane].size();
+				if(frame.encoded() and frame.bytes_used[plane] != planes[plane].size())
+				{
+						header.bytes_used[plane]	 = frame.bytes_used[plane];
+						header.stored_bytes[plane] = planes[plane].size();
+				}
+		}
+
+		std::memset(block, 0, Raw_Recording_Alignment);
+		std::memcpy(block, &header, sizeof(header));
+		return header.record_size;
+}
+
+inline std::size_t
+fill_raw_frame_header(Data_Type* block,
+											const Multiplanar_Buffer_View& planes,
+											std::chrono::nanoseconds timestamp,
+											uintmax_t frame_order,
+											uint32_t sequence)
+{
+		return fill_raw_frame_header(block, Raw_Frame{planes, timestamp, frame_order, sequence});
+}
+
+/**
+ * @brief Frames of the chunk being filled and the chain of sealed chunks,
+ * shared by the writers. Offsets are assigned by the writer, this only
+ * assembles the blocks.
+ */
+class Raw_Chunk_Builder
+{
+	public:
+		explicit Raw_Chunk_Builder(uint32_t frames_per_chunk)
+				: _frames_per_chunk_(std::max(1u, frames_per_chunk))
+		{
+				_entries_.reserve(_frames_per_chunk_);
+		}
+
+		void add(uint64_t offset, std::chrono::nanoseconds timestamp, uint32_t sequence)
+		{
+				_entries_.push_back(Raw_Index_Entry{offset, timestamp.count(), sequence, 0});
+		}
+
+		[[nodiscard]] bool full() const
+		{
+				return _entries_.size() >= _frames_per_chunk_;
+		}
+
+		[[nodiscard]] bool empty() const
+		{
+				return _entries_.empty();
+		}
+
+		[[nodiscard]] std::size_t chunk_size() const
+		{
+				return raw_recording_round_up(sizeof(Raw_Chunk_Header) + _entries_.size() * sizeof(Raw_Index_Entry));
+		}
+
+		/**
+		 * @brief Index block of the frames added since the last seal, to be
+		 * written at offset once they are on disk.
+		 */
+		[[nodiscard]] Raw_Block seal(uint64_t offset)
+		{
+				Raw_Chunk_Header header;
+				header.num_entries		= static_cast<uint32_t>(_entries_.size());
+				header.record_size		= chunk_size();
+				header.previous_chunk = _last_chunk_;
+				header.checksum =
+						raw_recording_checksum(_entries_.data(), _entries_.size() * sizeof(Raw_Index_Entry));
+
+				auto block = Raw_Block::allocate(header.record_size);
+				std::memcpy(block.data.get(), &header, sizeof(header));
+				std::memcpy(block.data.get() + sizeof(header), _entries_.data(), _entries_.size() * sizeof(Raw_Index_Entry));
+
+				_last_chunk_ = offset;
+				++_num_chunks_;
+				_num_frames_ += _entries_.size();
+				_entries_.clear();
+				return block;
+		}
+
+		[[nodiscard]] Raw_Block footer() const
+		{
+				Raw_Recording_Footer footer;
+				footer.last_chunk = _last_chunk_;
+				footer.num_chunks = _num_chunks_;
+				footer.num_frames = _num_frames_;
+				footer.checksum		= raw_footer_checksum(footer);
+
+				auto block = Raw_Block::allocate(Raw_Recording_Alignment);
+				std::memcpy(block.data.get(), &footer, sizeof(footer));
+				return block;
+		}
+
+		[[nodiscard]] uint32_t frames_per_chunk() const
+		{
+				return _frames_per_chunk_;
+		}
+
+	private:
+		uint32_t _frames_per_chunk_ = 0;
+		std::vector<Raw_Index_Entry> _entries_;
+		uint64_t _last_chunk_ = 0;
+		uint64_t _num_chunks_ = 0;
+		uint64_t _num_frames_ = 0;
+};
+
+/**
+ * @brief Straightforward synchronous writer of the raw recording format through
+ * the page cache. Fine for tests and short clips, sustained capture to disk
+ * wants Raw_Recorder, which keeps writes off the capture thread.
+ *
+ * Sealing a chunk waits for fdatasync, so a chunk index never points at frames
+ * that are not on disk.
+ */
+class Raw_Recording_Writer
+{
+	public:
+		Raw_Recording_Writer(const std::string& path,
+												 const Image_Layout& layout,
+												 double fps								 = 0,
+												 uint32_t frames_per_chunk = 64)
+				: _chunks_(frames_per_chunk)
+		{
+				_file_descriptor_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+				if(_file_descriptor_ == -1)
+				{
+						throw std::runtime_error("Cannot create recording " + path + " -> " + strerror(errno));
+				}
+
+				const auto header = make_raw_recording_header(layout, fps, _chunks_.frames_per_chunk());
+				auto block							= Raw_Block::allocate(Raw_Recording_Alignment);
+				std::memcpy(block.data.get(), &header, sizeof(header));
+				write_all(block.data.get(), block.size);
+				_padding_			= Raw_Block::allocate(Raw_Recording_Alignment);
+				_frame_header_ = Raw_Block::allocate(Raw_Recording_Alignment);
+		}
+
+		~Raw_Recording_Writer()
+		{
+				try
+				{
+						close();
+				}
+				catch(const std::exception& e)
+				{
+						std::cerr << e.what() << std::endl;
+				}
+		}
+
+		Raw_Recording_Writer(const Raw_Recording_Writer&)						 = delete;
+		Raw_Recording_Writer& operator=(const Raw_Recording_Writer&) = delete;
+
+		void write(const Multiplanar_Buffer_View& planes,
+							 std::chrono::nanoseconds timestamp,
+							 uintmax_t frame_order,
+							 uint32_t sequence)
+		{
+				write(Raw_Frame{planes, timestamp, frame_order, sequence});
+		}
+
+		void write(const Frame_Lease& frame)
+		{
+				write(frame.planes, frame.timestamp, frame.frame_order, frame.sequence);
+		}
+
+		/**
+		 * @brief Writes a frame as it is given, e.g. already encoded. Throws
+		 * when the write fails, the file then ends with the previous frame.
+		 */
+		void write(const Raw_Frame& frame)
+		{
+				const auto start = _offset_;
+				fill_raw_frame_header(_frame_header_.data.get(), frame);
+				try
+				{
+						write_all(_frame_header_.data.get(), _frame_header_.size);
+						for(const auto& plane : frame.planes)
+						{
+								write_all(plane.data(), plane.size());
+								write_all(_padding_.data.get(), raw_recording_round_up(plane.size()) - plane.size());
+						}
+				}
+				catch(...)
+				{
+						/* Cut the partial record off, later frames follow the last complete one. */
+						_offset_ = start;
+						if(::ftruncate(_file_descriptor_, off_t(start)) == -1
+							 or ::lseek(_file_descriptor_, off_t(start), SEEK_SET) == -1)
+						{
+								std::cerr << "Raw recording rewind failed: " << strerror(errno) << std::endl;
+						}
+						throw;
+				}
+				_chunks_.add(start, frame.timestamp, frame.sequence);
+				++_written_frames_;
+
+				if(_chunks_.full())
+				{
+						seal_chunk();
+				}
+		}
+
+		/**
+		 * @brief Seals the last chunk and writes the footer. Called by the
+		 * destructor, call it directly to see errors.
+		 */
+		void close()
+		{
+				if(_file_descriptor_ == -1)
+				{
+						return;
+				}
+				if(not _chunks_.empty())
+				{
+						seal_chunk();
+				}
+				const auto footer = _chunks_.footer();
+				write_all(footer.data.get(), footer.size);
+				::fdatasync(_file_descriptor_);
+				::close(_file_descriptor_);
+				_file_descriptor_ = -1;
+		}
+
+		[[nodiscard]] uintmax_t written_frames() const
+		{
+				return _written_frames_;
+		}
+
+	private:
+		void seal_chunk()
+		{
+				::fdatasync(_file_descriptor_);
+				const auto chunk = _chunks_.seal(_offset_);
+				write_all(chunk.data.get(), chunk.size);
+		}
+
+		void write_all(const Data_Type* data, std::size_t bytes)
+		{
+				_offset_ += bytes;
+				while(bytes > 0)
+				{
+						const auto written = ::write(_file_descriptor_, data, bytes);
+						if(written == -1)
+						{
+								if(errno == EINTR)
+								{
+										continue;
+								}
+								throw std::runtime_error(std::string{"Raw recording write: "} + strerror(errno));
+						}
+						data += written;
+						bytes -= static_cast<std::size_t>(written);
+				}
+		}
+
+	private:
+		int _file_descriptor_ = -1;
+		uint64_t _offset_			= 0;
+		Raw_Chunk_Builder _chunks_;
+		Raw_Block _padding_;
+		Raw_Block _frame_header_;
+		uintmax_t _written_frames_ = 0;
+};
+
+/**
+ * @brief Maps a raw recording and indexes its frames, see the format above.
+ *
+ * The mapping is private: writing into a frame gives the writer its own copy
+ * of the touched pages and leaves the file alone. Nothing is read until asked
+ * for, besides the index.
+ */
+class Raw_Recording_Reader
+{
+	public:
+		explicit Raw_Recording_Reader(const std::string& path)
+				: _path_(path)
+		{
+				const int file_descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+				if(file_descriptor == -1)
+				{
+						throw std::runtime_error("Cannot open recording " + path + " -> " + strerror(errno));
+				}
+				struct stat status;
+				if(fstat(file_descriptor, &status) == -1 or status.st_size < off_t(Raw_Recording_Alignment))
+				{
+						::close(file_descriptor);
+						throw std::runtime_error("Not a raw recording: " + path);
+				}
+
+				_mapping_size_ = static_cast<std::size_t>(status.st_size);
+				void* mapping = ::mmap(nullptr, _mapping_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, file_descriptor, 0);
+				/* The mapping keeps the file alive. */
+				::close(file_descriptor);
+				if(mapping == MAP_FAILED)
+				{
+						throw std::runtime_error("mmap: " + std::string{strerror(errno)});
+				}
+				_mapping_ = static_cast<Data_Type*>(mapping);
+
+				std::memcpy(&_header_, _mapping_, sizeof(_header_));
+				const auto layout = _header_.magic == Raw_Recording_Magic and _header_.version == Raw_Recording_Version
+																? image_layout_from_record(_header_.layout)
+																: std::nullopt;
+				if(not layout)
+				{
+						::munmap(_mapping_, _mapping_size_);
+						throw std::runtime_error("Not a raw recording of version " + std::to_string(Raw_Recording_Version)
+																		 + ": " + path);
+				}
+				_layout_ = *layout;
+
+				if(not read_chunk_chain())
+				{
+						scan();
+				}
+		}
+
+		~Raw_Recording_Reader()
+		{
+				::munmap(_mapping_, _mapping_size_);
+		}
+
+		Raw_Recording_Reader(const Raw_Recording_Reader&)						 = delete;
+		Raw_Recording_Reader& operator=(const Raw_Recording_Reader&) = delete;
+
+		[[nodiscard]] const Raw_Recording_Header& header() const
+		{
+				return _header_;
+		}
+
+		[[nodiscard]] const Image_Layout& layout() const
+		{
+				return _layout_;
+		}
+
+		[[nodiscard]] const std::string& path() const
+		{
+				return _path_;
+		}
+
+		/**
+		 * @brief Every readable frame, ordered as recorded.
+		 */
+		[[nodiscard]] const std::vector<Raw_Index_Entry>& index() const
+		{
+				return _index_;
+		}
+
+		[[nodiscard]] std::size_t frame_count() const
+		{
+				return _index_.size();
+		}
+
+		/**
+		 * @brief Frames covered by a chunk index. The rest were recovered from an
+		 * unfinished file and may be torn if the writer died mid frame.
+		 */
+		[[nodiscard]] std::size_t sealed_frames() const
+		{
+				return _sealed_frames_;
+		}
+
+		[[nodiscard]] std::size_t chunk_count() const
+		{
+				return _chunk_count_;
+		}
+
+		/**
+		 * @brief The file was closed properly and indexed through its footer.
+		 */
+		[[nodiscard]] bool finalized() const
+		{
+				return _finalized_;
+		}
+
+		/**
+		 * @brief Frame at index, with empty planes if its record is damaged.
+		 */
+		[[nodiscard]] Raw_Frame frame(std::size_t index) const
+		{
+				Raw_Frame frame;
+				const auto& entry = _index_.at(index);
+				Raw_Frame_Header header;
+				if(not read_frame_header(entry.offset, header))
+				{
+						return frame;
+				}
+
+				frame.timestamp		= std::chrono::nanoseconds{header.timestamp};
+				frame.frame_order = header.frame_order;
+				frame.sequence		= header.sequence;
+				frame.codec				= header.codec;
+				frame.delta				= header.delta != 0;
+				std::size_t plane_offset = entry.offset + Raw_Recording_Alignment;
+				for(uint32_t plane = 0; plane < header.num_planes; ++plane)
+				{
+						const auto stored = stored_size(header, plane);
+						frame.planes.emplace_back(_mapping_ + plane_offset, stored);
+						frame.bytes_used[plane] = header.bytes_used[plane];
+						plane_offset += raw_recording_round_up(stored);
+				}
+				return frame;
+		}
+
+		/**
+		 * @brief Index of the first frame recorded at or after timestamp,
+		 * frame_count() if there is none. O(log n), touches no frame data.
+		 */
+		[[nodiscard]] std::size_t find(std::chrono::nanoseconds timestamp) const
+		{
+				const auto found = std::lower_bound(_index_.begin(),
+																						_index_.end(),
+																						timestamp.count(),
+																						[](const Raw_Index_Entry& entry, int64_t value)
+																						{ return entry.timestamp < value; });
+				return static_cast<std::size_t>(found - _index_.begin());
+		}
+
+		/**
+		 * @brief Asks the kernel to start reading the frame in, e.g. the next one
+		 * while the current is processed.
+		 */
+		void prefetch(std::size_t index) const
+		{
+				if(index >= _index_.size())
+				{
+						return;
+				}
+				const auto offset = _index_[index].offset;
+				const auto end		= index + 1 < _index_.size() ? _index_[index + 1].offset : _mapping_size_;
+				madvise(_mapping_ + offset, end - offset, MADV_WILLNEED);
+		}
+
+	private:
+		template <typename T>
+		bool read_at(uint64_t offset, T& value) const
+		{
+				if(offset < Raw_Recording_Alignment or offset % Raw_Recording_Alignment
+					 or offset + Raw_Recording_Alignment > _mapping_size_)
+				{
+						return false;
+				}
+				std::memcpy(&value, _mapping_ + offset, sizeof(T));
+				return true;
+		}
+
+		bool read_frame_header(uint64_t offset, Raw_Frame_Header& header) const
+		{
+				if(not read_at(offset, header) or header.magic != Raw_Frame_Magic
+					 or header.num_planes != _layout_.num_memory_planes
+					 or header.record_size < Raw_Recording_Alignment or header.record_size > _mapping_size_ - offset)
+				{
+						return false;
+				}
+				std::size_t size = Raw_Recording_Alignment;
+				for(uint32_t plane = 0; plane < header.num_planes; ++plane)
+				{
+						size += raw_recording_round_up(stored_size(header, plane));
+				}
+				return size <= header.record_size;
+		}
+
+		static std::size_t stored_size(const Raw_Frame_Header& header, uint32_t plane)
+		{
+				return header.stored_bytes[plane] != 0 ? header.stored_bytes[plane] : header.bytes_used[plane];
+		}
+
+		/**
+		 * @brief Entries of a valid chunk at offset, empty if it is not one.
+		 */
+		bool read_chunk(uint64_t offset, Raw_Chunk_Header& header, std::vector<Raw_Index_Entry>& entries) const
+		{
+				if(not read_at(offset, header) or header.magic != Raw_Chunk_Magic
+					 or header.record_size > _mapping_size_ - offset
+					 or sizeof(header) + std::size_t(header.num_entries) * sizeof(Raw_Index_Entry) > header.record_size)
+				{
+						return false;
+				}
+				const auto* data = _mapping_ + offset + sizeof(header);
+				if(raw_recording_checksum(data, header.num_entries * sizeof(Raw_Index_Entry)) != header.checksum)
+				{
+						return false;
+				}
+				entries.resize(header.num_entries);
+				std::memcpy(entries.data(), data, entries.size() * sizeof(Raw_Index_Entry));
+				return true;
+		}
+
+		/**
+		 * @brief Index of a closed file, from its footer back through the chunks.
+		 */
+		bool read_chunk_chain()
+		{
+				Raw_Recording_Footer footer;
+				if(not read_at(_mapping_size_ - Raw_Recording_Alignment, footer) or footer.magic != Raw_Footer_Magic
+					 or footer.checksum != raw_footer_checksum(footer))
+				{
+						return false;
+				}
+
+				std::vector<std::vector<Raw_Index_Entry>> chunks;
+				auto offset = footer.last_chunk;
+				for(uint64_t chunk = 0; chunk < footer.num_chunks; ++chunk)
+				{
+						Raw_Chunk_Header header;
+						chunks.emplace_back();
+						if(not read_chunk(offset, header, chunks.back()))
+						{
+								return false;
+						}
+						offset = header.previous_chunk;
+				}
+
+				std::vector<Raw_Index_Entry> index;
+				index.reserve(footer.num_frames);
+				for(auto chunk = chunks.rbegin(); chunk != chunks.rend(); ++chunk)
+				{
+						index.insert(index.end(), chunk->begin(), chunk->end());
+				}
+				if(index.size() != footer.num_frames)
+				{
+						return false;
+				}
+
+				_index_				 = std::move(index);
+				_sealed_frames_ = _index_.size();
+				_chunk_count_	 = chunks.size();
+				_finalized_		 = true;
+				return true;
+		}
+
+		/**
+		 * @brief Index of an unfinished file, record by record from the start.
+		 */
+		void scan()
+		{
+				std::vector<Raw_Index_Entry> unsealed;
+				std::vector<Raw_Index_Entry> entries;
+				uint64_t offset = Raw_Recording_Alignment;
+				while(offset + Raw_Recording_Alignment <= _mapping_size_)
+				{
+						Raw_Frame_Header frame;
+						Raw_Chunk_Header chunk;
+						if(read_frame_header(offset, frame))
+						{
+								unsealed.push_back(Raw_Index_Entry{offset, frame.timestamp, frame.sequence, 0});
+								offset += frame.record_size;
+						}
+						else if(read_chunk(offset, chunk, entries))
+						{
+								/* The chunk seals the frames walked over since the previous one. */
+								_index_.insert(_index_.end(), entries.begin(), entries.end());
+								std::erase_if(unsealed,
+															[&entries](const Raw_Index_Entry& entry)
+															{
+																	return std::any_of(entries.begin(),
+																										 entries.end(),
+																										 [&entry](const Raw_Index_Entry& sealed)
+																										 { return sealed.offset == entry.offset; });
+															});
+								_sealed_frames_ += entries.size();
+								++_chunk_count_;
+								offset += chunk.record_size;
+						}
+						else
+						{
+								break;
+						}
+				}
+
+				_index_.insert(_index_.end(), unsealed.begin(), unsealed.end());
+				std::sort(_index_.begin(),
+									_index_.end(),
+									[](const Raw_Index_Entry& left, const Raw_Index_Entry& right)
+									{ return left.offset < right.offset; });
+		}
+
+	private:
+		std::string _path_;
+		Data_Type* _mapping_			= nullptr;
+		std::size_t _mapping_size_ = 0;
+		Raw_Recording_Header _header_;
+		Image_Layout _layout_;
+		std::vector<Raw_Index_Entry> _index_;
+		std::size_t _sealed_frames_ = 0;
+		std::size_t _chunk_count_		= 0;
+		bool _finalized_						= false;
+};
+
+} // namespace Cartrack
+
+#endif // RAW_RECORDING_HPP
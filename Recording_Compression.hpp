@@ -0,0 +1,717 @@
+#ifndef RECORDING_COMPRESSION_HPP
+#define RECORDING_COMPRESSION_HPP
+
+#include "Raw_Recording.hpp"
+#include "Worker_Pool.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <thread>
+#ifdef LZ4_AVAILABLE
+#		include <lz4.h>
+#endif
+#ifdef ZSTD_AVAILABLE
+#		include <zstd.h>
+#endif
+#if defined(__SSE2__)
+#		include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#		include <arm_neon.h>
+#endif
+
+namespace Cartrack
+{
+
+[[nodiscard]] inline bool
+raw_codec_available(Raw_Codec codec)
+{
+		switch(codec)
+		{
+				case Raw_Codec::Stored:
+						return true;
+				case Raw_Codec::LZ4:
+#ifdef LZ4_AVAILABLE
+						return true;
+#else
+						return false;
+#endif
+				case Raw_Codec::Zstd:
+#ifdef ZSTD_AVAILABLE
+						return true;
+#else
+						return false;
+#endif
+		}
+		return false;
+}
+
+/**
+ * @brief LZ4 when built with it, the fastest, else zstd, else stored.
+ */
+[[nodiscard]] inline Raw_Codec
+default_raw_codec()
+{
+		if(raw_codec_available(Raw_Codec::LZ4))
+		{
+				return Raw_Codec::LZ4;
+		}
+		return raw_codec_available(Raw_Codec::Zstd) ? Raw_Codec::Zstd : Raw_Codec::Stored;
+}
+
+/**
+ * @brief target = current - previous, byte wise and wrapping. Static parts of
+ * the scene turn into zeros, which every codec squeezes well.
+ */
+inline void
+delta_encode(Data_Type* target, const Data_Type* current, const Data_Type* previous, std::size_t bytes)
+{
+		std::size_t i = 0;
+#if defined(__SSE2__)
+		for(; i + 16 <= bytes; i += 16)
+		{
+				const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current + i));
+				const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(previous + i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), _mm_sub_epi8(a, b));
+		}
+#elif defined(__ARM_NEON)
+		for(; i + 16 <= bytes; i += 16)
+		{
+				const auto a = vld1q_u8(reinterpret_cast<const uint8_t*>(current + i));
+				const auto b = vld1q_u8(reinterpret_cast<const uint8_t*>(previous + i));
+				vst1q_u8(reinterpret_cast<uint8_t*>(target + i), vsubq_u8(a, b));
+		}
+#endif
+		for(; i < bytes; ++i)
+		{
+				target[i] = Data_Type(uint8_t(uint8_t(current[i]) - uint8_t(previous[i])));
+		}
+}
+
+/**
+ * @brief data += difference, turns the previous frame in data into the one
+ * delta_encode was given.
+ */
+inline void
+delta_decode(Data_Type* data, const Data_Type* difference, std::size_t bytes)
+{
+		std::size_t i = 0;
+#if defined(__SSE2__)
+		for(; i + 16 <= bytes; i += 16)
+		{
+				const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+				const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(difference + i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_add_epi8(a, b));
+		}
+#elif defined(__ARM_NEON)
+		for(; i + 16 <= bytes; i += 16)
+		{
+				const auto a = vld1q_u8(reinterpret_cast<const uint8_t*>(data + i));
+				const auto b = vld1q_u8(reinterpret_cast<const uint8_t*>(difference + i));
+				vst1q_u8(reinterpret_cast<uint8_t*>(data + i), vaddq_u8(a, b));
+		}
+#endif
+		for(; i < bytes; ++i)
+		{
+				data[i] = Data_Type(uint8_t(uint8_t(data[i]) + uint8_t(difference[i])));
+		}
+}
+
+/**
+ * @brief Room raw_compress may need for bytes of input.
+ */
+[[nodiscard]] inline std::size_t
+raw_compress_bound(Raw_Codec codec, std::size_t bytes)
+{
+		switch(codec)
+		{
+#ifdef LZ4_AVAILABLE
+				case Raw_Codec::LZ4:
+						return static_cast<std::size_t>(LZ4_compressBound(static_cast<int>(bytes)));
+#endif
+#ifdef ZSTD_AVAILABLE
+				case Raw_Codec::Zstd:
+						return ZSTD_compressBound(bytes);
+#endif
+				default:
+						return bytes;
+		}
+}
+
+/**
+ * @brief Compressed size of source in target, 0 if it did not get smaller,
+ * then the plane is to be stored as is.
+ */
+[[nodiscard]] inline std::size_t
+raw_compress(Raw_Codec codec,
+						 [[maybe_unused]] int level,
+						 [[maybe_unused]] const Data_Type* source,
+						 std::size_t bytes,
+						 [[maybe_unused]] Data_Type* target,
+						 [[maybe_unused]] std::size_t capacity)
+{
+		std::size_t compressed = 0;
+		switch(codec)
+		{
+#ifdef LZ4_AVAILABLE
+				case Raw_Codec::LZ4:
+				{
+						/* level is LZ4's acceleration here, higher is faster and larger. */
+						const auto result = LZ4_compress_fast(reinterpret_cast<const char*>(source),
+																									reinterpret_cast<char*>(target),
+																									static_cast<int>(bytes),
+																									static_cast<int>(capacity),
+																									std::max(1, level));
+						compressed				= result > 0 ? static_cast<std::size_t>(result) : 0;
+						break;
+				}
+#endif
+#ifdef ZSTD_AVAILABLE
+				case Raw_Codec::Zstd:
+				{
+						thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> context(ZSTD_createCCtx(),
+																																										&ZSTD_freeCCtx);
+						const auto result = ZSTD_compressCCtx(context.get(), target, capacity, source, bytes, level);
+						compressed				= ZSTD_isError(result) ? 0 : result;
+						break;
+				}
+#endif
+				default:
+						break;
+		}
+		return compressed < bytes ? compressed : 0;
+}
+
+/**
+ * @brief Decompresses exactly decoded_bytes into target, false if the data is
+ * damaged or the codec was not built in.
+ */
+[[nodiscard]] inline bool
+raw_decompress(Raw_Codec codec,
+							 [[maybe_unused]] const Data_Type* source,
+							 [[maybe_unused]] std::size_t bytes,
+							 [[maybe_unused]] Data_Type* target,
+							 [[maybe_unused]] std::size_t decoded_bytes)
+{
+		switch(codec)
+		{
+#ifdef LZ4_AVAILABLE
+				case Raw_Codec::LZ4:
+						return LZ4_decompress_safe(reinterpret_cast<const char*>(source),
+																			 reinterpret_cast<char*>(target),
+																			 static_cast<int>(bytes),
+																			 static_cast<int>(decoded_bytes))
+									 == static_cast<int>(decoded_bytes);
+#endif
+#ifdef ZSTD_AVAILABLE
+				case Raw_Codec::Zstd:
+				{
+						thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context(ZSTD_createDCtx(),
+																																										&ZSTD_freeDCtx);
+						return ZSTD_decompressDCtx(context.get(), target, decoded_bytes, source, bytes) == decoded_bytes;
+				}
+#endif
+				default:
+						return false;
+		}
+}
+
+/**
+ * @brief Turns the frames of a recording back into images, whatever their
+ * codec. Delta frames build on the previously decoded one, so sequential reads
+ * cost one frame each; a jump decodes forward from the last key frame before
+ * the target.
+ */
+class Raw_Frame_Decoder
+{
+	public:
+		/**
+		 * @brief Image of the frame at index. Planes point into the mapping for a
+		 * frame stored as is, else into the decoder, valid until the next call.
+		 * Empty if the frame or one it depends on is damaged, or its codec was not
+		 * built in.
+		 */
+		[[nodiscard]] Multiplanar_Buffer_View decode(const Raw_Recording_Reader& reader, std::size_t index)
+		{
+				auto frame = reader.frame(index);
+				if(not frame.encoded())
+				{
+						return std::move(frame.planes);
+				}
+
+				if(not frame.delta or _decoded_ + 1 != index)
+				{
+						auto key = index;
+						while(key > 0 and reader.frame(key).delta)
+						{
+								--key;
+						}
+						for(; key < index; ++key)
+						{
+								if(not apply(reader.frame(key)))
+								{
+										return {};
+								}
+						}
+				}
+				if(not apply(frame))
+				{
+						return {};
+				}
+				_decoded_ = index;
+
+				Multiplanar_Buffer_View planes;
+				for(auto& plane : _planes_)
+				{
+						planes.emplace_back(plane.data(), plane.size());
+				}
+				return planes;
+		}
+
+	private:
+		bool apply(const Raw_Frame& frame)
+		{
+				_decoded_ = Nothing_Decoded;
+				if(frame.planes.empty() or (frame.delta and _planes_.size() != frame.planes.size()))
+				{
+						return false;
+				}
+				_planes_.resize(frame.planes.size());
+
+				for(std::size_t plane = 0; plane < frame.planes.size(); ++plane)
+				{
+						const auto& stored = frame.planes[plane];
+						const auto bytes	 = frame.bytes_used[plane];
+						auto& image				 = _planes_[plane];
+						if(frame.delta and image.size() != bytes)
+						{
+								return false;
+						}
+
+						const Data_Type* difference = stored.data();
+						if(stored.size() != bytes)
+						{
+								auto& target = frame.delta ? _scratch_ : image;
+								target.resize(bytes);
+								if(not raw_decompress(frame.codec, stored.data(), stored.size(), target.data(), bytes))
+								{
+										return false;
+								}
+								difference = target.data();
+						}
+						else if(not frame.delta)
+						{
+								image.assign(stored.begin(), stored.end());
+						}
+
+						if(frame.delta)
+						{
+								delta_decode(image.data(), difference, bytes);
+						}
+				}
+				return true;
+		}
+
+	private:
+		static constexpr std::size_t Nothing_Decoded = std::numeric_limits<std::size_t>::max();
+
+		Multiplanar_Buffer _planes_;
+		Aligned_Buffer _scratch_;
+		std::size_t _decoded_ = Nothing_Decoded;
+};
+
+struct Compressed_Recorder_Options
+{
+		Raw_Codec codec = default_raw_codec();
+		/**
+		 * @brief zstd compression level, or LZ4 acceleration (higher is faster).
+		 */
+		int level = 1;
+		/**
+		 * @brief Store frames as differences to the previous one, lossless and
+		 * usually far smaller for fixed cameras.
+		 */
+		bool delta = true;
+		/**
+		 * @brief A frame without delta every this many, bounds what a seek has to
+		 * decode and what a damaged frame takes with it.
+		 */
+		uint32_t key_frame_interval = 30;
+		/**
+		 * @brief Compression threads, 0 for one per hardware thread. Planes of a
+		 * frame and consecutive frames are compressed in parallel.
+		 */
+		unsigned int workers = 0;
+		/**
+		 * @brief Frames copied in and waiting for compression or the disk, more
+		 * are dropped.
+		 */
+		unsigned int queue_depth		= 8;
+		uint32_t frames_per_chunk = 64;
+};
+
+struct Compressed_Recorder_Statistics
+{
+		uintmax_t written_frames = 0;
+		/**
+		 * @brief Frames refused because queue_depth frames were pending, the
+		 * workers or the disk are too slow for the camera.
+		 */
+		uintmax_t dropped_frames = 0;
+		uintmax_t key_frames		 = 0;
+		uintmax_t write_errors	 = 0;
+		uintmax_t raw_bytes			 = 0;
+		uintmax_t stored_bytes	 = 0;
+		/**
+		 * @brief Summed over workers, the CPU time compression took.
+		 */
+		std::chrono::nanoseconds compression_time{0};
+		std::chrono::nanoseconds elapsed{0};
+
+		[[nodiscard]] double compression_ratio() const
+		{
+				return stored_bytes > 0 ? double(raw_bytes) / stored_bytes : 0;
+		}
+
+		/**
+		 * @brief Raw input compressed per second of one worker.
+		 */
+		[[nodiscard]] double megabytes_per_second_per_core() const
+		{
+				return compression_time.count() > 0
+									 ? raw_bytes / 1e6 / std::chrono::duration<double>(compression_time).count()
+									 : 0;
+		}
+
+		/**
+		 * @brief Raw input recorded per second of wall time.
+		 */
+		[[nodiscard]] double megabytes_per_second() const
+		{
+				return elapsed.count() > 0 ? raw_bytes / 1e6 / std::chrono::duration<double>(elapsed).count() : 0;
+		}
+};
+
+/**
+ * @brief Records frames compressed, so a camera fits the bandwidth of flash
+ * storage. Lossless: replay decodes them bit exact.
+ *
+ * record copies the frame into one of queue_depth slots and returns, the
+ * driver buffer is free again right away. Each plane is then a job on the
+ * worker pool: the delta to the previous frame's slot, when enabled, and the
+ * codec. A writer thread takes frames in recording order once all their planes
+ * are done and appends them with Raw_Recording_Writer; compressed output is
+ * small enough for the page cache. When every slot is taken the frame is
+ * dropped and counted, record never waits for the workers.
+ *
+ * A frame the writer fails to append breaks the delta chain: the deltas
+ * already queued behind it are dropped and the next frame recorded is a key
+ * frame.
+ *
+ * record is meant to be called from one capturing thread.
+ */
+class Compressed_Recorder
+{
+	public:
+		Compressed_Recorder(const std::string& path,
+												const Image_Layout& layout,
+												double fps																 = 0,
+												const Compressed_Recorder_Options& options = {})
+				: _options_(options)
+				, _writer_(path, layout, fps, options.frames_per_chunk)
+				, _pipeline_(std::max(2u, options.queue_depth),
+										 options.workers,
+										 [this](std::size_t index) { write_slot(index); })
+		{
+				if(not raw_codec_available(_options_.codec))
+				{
+						throw std::runtime_error(std::string{"Compressed_Recorder: "} + raw_codec_name(_options_.codec)
+																		 + " is not built in");
+				}
+				_options_.queue_depth				 = std::max(2u, _options_.queue_depth);
+				_options_.key_frame_interval = std::max(1u, _options_.key_frame_interval);
+
+				_slots_.resize(_options_.queue_depth);
+				for(std::size_t slot = 0; slot < _slots_.size(); ++slot)
+				{
+						auto& buffers = _slots_[slot];
+						buffers.raw.resize(layout.num_memory_planes);
+						buffers.encoded.resize(layout.num_memory_planes);
+						for(std::size_t plane = 0; plane < layout.num_memory_planes; ++plane)
+						{
+								buffers.raw[plane].reserve(layout.memory_plane_sizes[plane]);
+								buffers.encoded[plane].resize(raw_compress_bound(_options_.codec, layout.memory_plane_sizes[plane]));
+						}
+				}
+				_started_ = std::chrono::steady_clock::now();
+		}
+
+		~Compressed_Recorder()
+		{
+				close();
+		}
+
+		Compressed_Recorder(const Compressed_Recorder&)						 = delete;
+		Compressed_Recorder& operator=(const Compressed_Recorder&) = delete;
+
+		bool record(const Frame_Handle& frame)
+		{
+				return frame and record(frame->planes, frame->timestamp, frame->frame_order, frame->sequence);
+		}
+
+		/**
+		 * @brief Copies the planes and queues them, false if the frame was
+		 * dropped. The spans can be reused as soon as this returns.
+		 */
+		bool record(const Multiplanar_Buffer_View& planes,
+								std::chrono::nanoseconds timestamp,
+								uintmax_t frame_order,
+								uint32_t sequence)
+		{
+				const auto acquired = planes.size() == _slots_.front().raw.size() ? _pipeline_.acquire() : std::nullopt;
+				if(not acquired)
+				{
+						std::lock_guard lock(_mutex_);
+						++_statistics_.dropped_frames;
+						return false;
+				}
+				const auto index = *acquired;
+				auto& slot			 = _slots_[index];
+				for(std::size_t plane = 0; plane < planes.size(); ++plane)
+				{
+						slot.raw[plane].assign(planes[plane].begin(), planes[plane].end());
+						if(slot.encoded[plane].size() < raw_compress_bound(_options_.codec, planes[plane].size()))
+						{
+								slot.encoded[plane].resize(raw_compress_bound(_options_.codec, planes[plane].size()));
+						}
+				}
+				slot.frame						= Raw_Frame{};
+				slot.frame.timestamp	 = timestamp;
+				slot.frame.frame_order = frame_order;
+				slot.frame.sequence		 = sequence;
+				slot.frame.codec			 = _options_.codec;
+				slot.frame.planes.resize(planes.size());
+
+				{
+						std::lock_guard lock(_mutex_);
+						slot.previous = No_Slot;
+						if(_options_.delta and _previous_slot_ != No_Slot and _since_key_frame_ < _options_.key_frame_interval
+							 and same_sizes(_slots_[_previous_slot_], slot))
+						{
+								slot.previous = _previous_slot_;
+								++_slots_[slot.previous].references;
+								++_since_key_frame_;
+						}
+						else
+						{
+								_since_key_frame_ = 1;
+								++_statistics_.key_frames;
+						}
+						slot.frame.delta = slot.previous != No_Slot;
+
+						/* The newest frame stays readable until the next one took its reference. */
+						if(_previous_slot_ != No_Slot)
+						{
+								release(_previous_slot_);
+						}
+						_previous_slot_ = index;
+						slot.references	= 2;
+				}
+
+				_pipeline_.enqueue(index, static_cast<unsigned int>(planes.size()));
+				for(std::size_t plane = 0; plane < planes.size(); ++plane)
+				{
+						_pipeline_.submit([this, index, plane] { encode(index, plane); });
+				}
+				return true;
+		}
+
+		/**
+		 * @brief Waits until every recorded frame is compressed and written.
+		 */
+		void flush()
+		{
+				_pipeline_.flush();
+		}
+
+		/**
+		 * @brief Flushes and closes the file. Called by the destructor.
+		 */
+		void close()
+		{
+				if(not _pipeline_.close())
+				{
+						return;
+				}
+				try
+				{
+						_writer_.close();
+				}
+				catch(const std::exception& e)
+				{
+						std::cerr << e.what() << std::endl;
+						std::lock_guard lock(_mutex_);
+						++_statistics_.write_errors;
+				}
+		}
+
+		[[nodiscard]] Compressed_Recorder_Statistics statistics()
+		{
+				std::lock_guard lock(_mutex_);
+				auto statistics		 = _statistics_;
+				statistics.elapsed = std::chrono::steady_clock::now() - _started_;
+				return statistics;
+		}
+
+		[[nodiscard]] std::size_t workers() const
+		{
+				return _pipeline_.workers();
+		}
+
+	private:
+		struct Slot
+		{
+				Multiplanar_Buffer raw;
+				Multiplanar_Buffer encoded;
+				Raw_Frame frame;
+				std::size_t previous = No_Slot;
+				/**
+				 * @brief Its own pending write, the next frame's delta and being the
+				 * newest frame each keep raw alive.
+				 */
+				unsigned int references = 0;
+		};
+
+		static bool same_sizes(const Slot& a, const Slot& b)
+		{
+				for(std::size_t plane = 0; plane < a.raw.size(); ++plane)
+				{
+						if(a.raw[plane].size() != b.raw[plane].size())
+						{
+								return false;
+						}
+				}
+				return true;
+		}
+
+		void encode(std::size_t index, std::size_t plane)
+		{
+				const auto started = std::chrono::steady_clock::now();
+				auto& slot				 = _slots_[index];
+				auto& raw					 = slot.raw[plane];
+				auto& encoded			 = slot.encoded[plane];
+
+				const Data_Type* source = raw.data();
+				thread_local Aligned_Buffer difference;
+				if(slot.previous != No_Slot)
+				{
+						difference.resize(raw.size());
+						delta_encode(difference.data(), raw.data(), _slots_[slot.previous].raw[plane].data(), raw.size());
+						source = difference.data();
+				}
+
+				auto stored = raw_compress(_options_.codec, _options_.level, source, raw.size(), encoded.data(), encoded.size());
+				if(stored == 0 and source != raw.data())
+				{
+						std::memcpy(encoded.data(), source, raw.size());
+						stored = raw.size();
+				}
+				const auto elapsed = std::chrono::steady_clock::now() - started;
+
+				std::lock_guard lock(_mutex_);
+				slot.frame.bytes_used[plane] = raw.size();
+				slot.frame.planes[plane]		 = stored == 0 ? std::span(raw.data(), raw.size()) : std::span(encoded.data(), stored);
+				_statistics_.compression_time += elapsed;
+				if(_pipeline_.complete(index) and slot.previous != No_Slot)
+				{
+						release(slot.previous);
+						slot.previous = No_Slot;
+				}
+		}
+
+		/**
+		 * @brief Appends one frame, on the pipeline's consumer thread in
+		 * recording order.
+		 */
+		void write_slot(std::size_t index)
+		{
+				auto& slot						 = _slots_[index];
+				uintmax_t raw_bytes		 = 0;
+				uintmax_t stored_bytes = 0;
+				for(std::size_t plane = 0; plane < slot.frame.planes.size(); ++plane)
+				{
+						raw_bytes += slot.frame.bytes_used[plane];
+						stored_bytes += slot.frame.planes[plane].size();
+				}
+
+				/* A delta on a frame that is not in the file cannot be decoded. */
+				const bool skipped = slot.frame.delta and _delta_chain_broken_;
+				bool failed				 = false;
+				if(not skipped)
+				{
+						try
+						{
+								_writer_.write(slot.frame);
+						}
+						catch(const std::exception& e)
+						{
+								std::cerr << e.what() << std::endl;
+								failed = true;
+						}
+				}
+
+				std::lock_guard lock(_mutex_);
+				if(skipped)
+				{
+						++_statistics_.dropped_frames;
+				}
+				else if(failed)
+				{
+						++_statistics_.write_errors;
+						_delta_chain_broken_ = true;
+						_since_key_frame_		 = _options_.key_frame_interval;
+				}
+				else
+				{
+						_delta_chain_broken_ = false;
+						++_statistics_.written_frames;
+						_statistics_.raw_bytes += raw_bytes;
+						_statistics_.stored_bytes += stored_bytes;
+				}
+				release(index);
+		}
+
+		/**
+		 * @brief Drops a reference, with _mutex_ held. The slot is free once it
+		 * is written and no delta needs its raw planes.
+		 */
+		void release(std::size_t index)
+		{
+				if(--_slots_[index].references == 0)
+				{
+						_pipeline_.release(index);
+				}
+		}
+
+	private:
+		static constexpr std::size_t No_Slot = std::numeric_limits<std::size_t>::max();
+
+		Compressed_Recorder_Options _options_;
+		Raw_Recording_Writer _writer_;
+		std::vector<Slot> _slots_;
+		std::size_t _previous_slot_			= No_Slot;
+		uint32_t _since_key_frame_			= 0;
+		/**
+		 * @brief Set by a failed write, cleared by the next key frame written.
+		 */
+		bool _delta_chain_broken_ = false;
+		Compressed_Recorder_Statistics _statistics_;
+		std::chrono::steady_clock::time_point _started_;
+		std::mutex _mutex_;
+		Ordered_Slot_Pipeline _pipeline_;
+};
+
+} // namespace Cartrack
+
+#endif // RECORDING_COMPRESSION_HPP
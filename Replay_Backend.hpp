@@ -0,0 +1,267 @@
+#ifndef REPLAY_BACKEND_HPP
+#define REPLAY_BACKEND_HPP
+
+#include "Stored_Controls_Backend.hpp"
+#include "Raw_Recording.hpp"
+#include "Recording_Compression.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <linux/videodev2.h>
+#include <stdexcept>
+#include <thread>
+
+namespace Cartrack
+{
+
+/**
+ * @brief Capture_Backend playing back a raw recording (Raw_Recording.hpp), to
+ * reproduce field issues and benchmark pipelines on real data.
+ *
+ * The file is mapped through Raw_Recording_Reader and frames are spans straight
+ * into the page cache, nothing is copied. A consumer writing into a frame gets
+ * its own copy of the touched pages, the file is left alone. Compressed
+ * recordings are decoded into a buffer of the backend instead, valid until the
+ * next frame. The next frame is
+ * prefetched while the current one is consumed, so sequential replay runs at
+ * disk read ahead speed.
+ *
+ * Pacing follows Stream_Configuration::Replay. Frames are never skipped to keep
+ * up: a consumer slower than the pace gets every frame late. Timestamps are the
+ * recorded ones, shifted by the recording's length on each loop so they keep
+ * increasing.
+ *
+ * Controls are stored, they do not change the recorded frames.
+ */
+class Replay_Backend : public Stored_Controls_Backend
+{
+	public:
+		explicit Replay_Backend(const Stream_Configuration& params)
+				: _reader_(params.replay.path)
+		{
+				_configuration_ = params;
+				if(_reader_.frame_count() == 0)
+				{
+						throw std::runtime_error("Recording holds no frames: " + _reader_.path());
+				}
+
+				_image_layout_ = _reader_.layout();
+				_recorded_fps_ = _reader_.header().fps;
+				if(_recorded_fps_ <= 0 and _reader_.frame_count() > 1)
+				{
+						_recorded_fps_ = 1e9 / static_cast<double>(average_interval().count());
+				}
+
+				_configuration_.width				 = _image_layout_.width;
+				_configuration_.height			 = _image_layout_.height;
+				_configuration_.pixel_format = _image_layout_.pixel_format;
+				_configuration_.v4l2.contiguous = _image_layout_.num_memory_planes == 1;
+				if(_configuration_.replay.pacing == Stream_Configuration::Replay::Pacing::Fixed_Fps)
+				{
+						set_period(_configuration_.fps);
+				}
+				_reader_.prefetch(0);
+		}
+
+	public:
+		/**
+		 * @brief Next recorded frame, empty once the recording is over unless
+		 * replay.loop is set.
+		 */
+		[[nodiscard]] Multiplanar_Buffer_View get_frame_data() override
+		{
+				if(_position_ >= _reader_.frame_count())
+				{
+						if(not _configuration_.replay.loop)
+						{
+								return {};
+						}
+						/* Keep the gap between the last and first frame one frame period long. */
+						_loop_offset_ += duration() + average_interval();
+						_position_ = 0;
+				}
+
+				const auto index		 = _position_++;
+				auto frame					 = _reader_.frame(index);
+				const auto timestamp = frame.timestamp + _loop_offset_;
+				if(frame.encoded())
+				{
+						frame.planes = _decoder_.decode(_reader_, index);
+				}
+				_reader_.prefetch(_position_);
+
+				pace(timestamp);
+
+				_frame_timestamp_ = timestamp;
+				++_frame_order_;
+				_recorded_frame_order_ = frame.frame_order;
+				return std::move(frame.planes);
+		}
+
+		[[nodiscard]] Image_View get_image_view()
+		{
+				return make_image_view(_image_layout_, get_frame_data());
+		}
+
+		template <Pixel_Format Format>
+		[[nodiscard]] Typed_Image_View<Format> get_image_view()
+		{
+				if(Format != _configuration_.pixel_format)
+				{
+						throw std::runtime_error("get_image_view format differs from the recorded one");
+				}
+				return make_typed_image_view<Format>(_image_layout_, get_frame_data());
+		}
+
+		/**
+		 * @brief Continues from the first frame recorded at or after timestamp, in
+		 * the recording's own clock. Pacing restarts from there. Returns false and
+		 * stays put when the recording ends before timestamp.
+		 */
+		bool seek(std::chrono::nanoseconds timestamp)
+		{
+				const auto found = _reader_.find(timestamp);
+				if(found == _reader_.frame_count())
+				{
+						return false;
+				}
+				_position_ = found;
+				_anchored_ = false;
+				return true;
+		}
+
+		[[nodiscard]] std::size_t frame_count() const
+		{
+				return _reader_.frame_count();
+		}
+
+		/**
+		 * @brief Index of the frame the next get_frame_data returns.
+		 */
+		[[nodiscard]] std::size_t position() const
+		{
+				return _position_;
+		}
+
+		[[nodiscard]] std::chrono::nanoseconds first_timestamp() const
+		{
+				return std::chrono::nanoseconds{_reader_.index().front().timestamp};
+		}
+
+		[[nodiscard]] std::chrono::nanoseconds last_timestamp() const
+		{
+				return std::chrono::nanoseconds{_reader_.index().back().timestamp};
+		}
+
+		/**
+		 * @brief get_frame_order of the recording host for the last frame returned.
+		 */
+		[[nodiscard]] uintmax_t recorded_frame_order() const
+		{
+				return _recorded_frame_order_;
+		}
+
+		[[nodiscard]] bool finished() const
+		{
+				return not _configuration_.replay.loop and _position_ >= _reader_.frame_count();
+		}
+
+		/**
+		 * @brief Switches to Fixed_Fps pacing at new_fps, 0 to Unthrottled.
+		 */
+		[[nodiscard]] double set_fps(double new_fps) override
+		{
+				_configuration_.replay.pacing = new_fps > 0 ? Stream_Configuration::Replay::Pacing::Fixed_Fps
+																										: Stream_Configuration::Replay::Pacing::Unthrottled;
+				set_period(new_fps);
+				_anchored_ = false;
+				return get_fps();
+		}
+
+		/**
+		 * @brief Pace of the replay, the recorded rate for Original pacing.
+		 */
+		[[nodiscard]] double get_fps() const override
+		{
+				switch(_configuration_.replay.pacing)
+				{
+						case Stream_Configuration::Replay::Pacing::Original:
+								return _recorded_fps_;
+						case Stream_Configuration::Replay::Pacing::Fixed_Fps:
+								return _fps_;
+						case Stream_Configuration::Replay::Pacing::Unthrottled:
+								break;
+				}
+				return 0;
+		}
+
+	private:
+		std::chrono::nanoseconds duration() const
+		{
+				return last_timestamp() - first_timestamp();
+		}
+
+		std::chrono::nanoseconds average_interval() const
+		{
+				if(_reader_.frame_count() < 2 or duration().count() <= 0)
+				{
+						return std::chrono::nanoseconds{1};
+				}
+				return duration() / static_cast<int64_t>(_reader_.frame_count() - 1);
+		}
+
+		void set_period(double fps)
+		{
+				_fps_		 = fps > 0 ? fps : 0;
+				_period_ = _fps_ > 0 ? std::chrono::duration_cast<std::chrono::nanoseconds>(
+															 std::chrono::duration<double>(1.0 / _fps_))
+														 : std::chrono::nanoseconds{0};
+		}
+
+		/**
+		 * @brief Sleeps until the frame is due. The schedule is anchored on the
+		 * first frame after construction, a seek or a pacing change.
+		 */
+		void pace(std::chrono::nanoseconds timestamp)
+		{
+				const auto pacing = _configuration_.replay.pacing;
+				if(pacing == Stream_Configuration::Replay::Pacing::Unthrottled
+					 or (pacing == Stream_Configuration::Replay::Pacing::Fixed_Fps and _period_.count() == 0))
+				{
+						return;
+				}
+
+				if(not _anchored_)
+				{
+						_anchored_					= true;
+						_anchor_time_				= std::chrono::steady_clock::now();
+						_anchor_timestamp_	= timestamp;
+						_frames_since_anchor_ = 0;
+						return;
+				}
+
+				++_frames_since_anchor_;
+				const auto due = pacing == Stream_Configuration::Replay::Pacing::Original
+														 ? timestamp - _anchor_timestamp_
+														 : _period_ * static_cast<int64_t>(_frames_since_anchor_);
+				std::this_thread::sleep_until(_anchor_time_ + due);
+		}
+
+	private:
+		Raw_Recording_Reader _reader_;
+		Raw_Frame_Decoder _decoder_;
+		std::size_t _position_ = 0;
+		std::chrono::nanoseconds _loop_offset_{0};
+		double _recorded_fps_ = 0;
+		double _fps_					= 0;
+		std::chrono::nanoseconds _period_{0};
+		bool _anchored_ = false;
+		std::chrono::steady_clock::time_point _anchor_time_;
+		std::chrono::nanoseconds _anchor_timestamp_{0};
+		uintmax_t _frames_since_anchor_		= 0;
+		uintmax_t _recorded_frame_order_ = 0;
+};
+
+} // namespace Cartrack
+
+#endif // REPLAY_BACKEND_HPP
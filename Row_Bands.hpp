@@ -0,0 +1,126 @@
+#ifndef ROW_BANDS_HPP
+#define ROW_BANDS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#ifdef _OPENMP
+#		include <omp.h>
+#endif
+
+namespace Cartrack
+{
+
+/**
+ * @brief How a per frame kernel splits its rows over threads, given per call.
+ *
+ * The default runs on the calling thread: a capture loop converting one
+ * stream should not wake a team of threads behind the back of the others.
+ * Parallel runs need the OpenMP runtime (-fopenmp), without it everything
+ * runs sequentially.
+ */
+struct Parallelism
+{
+		/**
+		 * @brief 0 for every thread OpenMP may use.
+		 */
+		unsigned int threads = 1;
+		/**
+		 * @brief Bytes one band reads and writes, 0 for half the L2 cache, so a
+		 * band and the next one's prefetch stay in the core's own cache.
+		 */
+		std::size_t band_bytes = 0;
+};
+
+/**
+ * @brief L2 size of the first CPU, 512 KiB when neither sysconf nor sysfs know.
+ */
+[[nodiscard]] inline std::size_t
+l2_cache_bytes()
+{
+		static const std::size_t bytes = []() -> std::size_t
+		{
+#ifdef _SC_LEVEL2_CACHE_SIZE
+				if(const long size = sysconf(_SC_LEVEL2_CACHE_SIZE); size > 0)
+				{
+						return static_cast<std::size_t>(size);
+				}
+#endif
+				/* Most ARM boards only report it here, as "1024K". */
+				std::ifstream file("/sys/devices/system/cpu/cpu0/cache/index2/size");
+				std::size_t size = 0;
+				std::string unit;
+				if(file >> size and size > 0)
+				{
+						file >> unit;
+						return unit == "M" ? size << 20 : unit == "K" ? size << 10 : size;
+				}
+				return std::size_t(512) << 10;
+		}();
+		return bytes;
+}
+
+/**
+ * @brief Threads a call with these settings runs on.
+ */
+[[nodiscard]] inline unsigned int
+resolve_threads(const Parallelism& parallelism)
+{
+#ifdef _OPENMP
+		return parallelism.threads == 0 ? static_cast<unsigned int>(omp_get_max_threads()) : parallelism.threads;
+#else
+		(void)parallelism;
+		return 1;
+#endif
+}
+
+/**
+ * @brief Rows per band when every row touches row_bytes, a multiple of
+ * row_alignment so subsampled planes split on whole rows.
+ */
+[[nodiscard]] inline uint32_t
+band_rows(std::size_t row_bytes, uint32_t row_alignment, const Parallelism& parallelism)
+{
+		const auto budget = parallelism.band_bytes > 0 ? parallelism.band_bytes : l2_cache_bytes() / 2;
+		const auto rows		= static_cast<uint32_t>(std::min<std::size_t>(budget / std::max<std::size_t>(row_bytes, 1), UINT32_MAX));
+		return std::max(rows / row_alignment, 1u) * row_alignment;
+}
+
+/**
+ * @brief Calls band(first_row, row_count) for consecutive bands covering
+ * [0, height). Bands are handed out dynamically, a core slowed down by an
+ * interrupt or a busy sibling takes fewer of them. band must not throw when
+ * running on more than one thread.
+ */
+template <typename Band>
+inline void
+for_each_row_band(uint32_t height, uint32_t rows_per_band, const Parallelism& parallelism, Band&& band)
+{
+		rows_per_band			 = std::max(rows_per_band, 1u);
+		const auto bands	 = static_cast<int>((height + rows_per_band - 1) / rows_per_band);
+		const auto threads = std::min<unsigned int>(resolve_threads(parallelism), static_cast<unsigned int>(bands));
+		if(threads <= 1)
+		{
+				for(uint32_t first = 0; first < height; first += rows_per_band)
+				{
+						band(first, std::min(rows_per_band, height - first));
+				}
+				return;
+		}
+
+#ifdef _OPENMP
+#		pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+#endif
+		for(int index = 0; index < bands; ++index)
+		{
+				const auto first = static_cast<uint32_t>(index) * rows_per_band;
+				band(first, std::min(rows_per_band, height - first));
+		}
+}
+
+} // namespace Cartrack
+
+#endif // ROW_BANDS_HPP
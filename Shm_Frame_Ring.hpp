@@ -0,0 +1,417 @@
+#ifndef SHM_FRAME_RING_HPP
+#define SHM_FRAME_RING_HPP
+
+#include "Abstract_Capture_Backend.hpp"
+#include "Image_View.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Cartrack
+{
+
+/**
+ * @brief Layout of the shared memory object, identical in every process mapping
+ * it. The header is followed by slot_count slots of slot_stride bytes, each a
+ * Shm_Slot_Header followed by the memory planes of one frame back to back.
+ */
+static constexpr uint32_t Shm_Frame_Ring_Magic	 = 0x474e4952; // "RING"
+static constexpr uint32_t Shm_Frame_Ring_Version = 3;
+static constexpr std::size_t Shm_Slot_Alignment	 = 4096;
+
+struct alignas(64) Shm_Ring_Header
+{
+		uint32_t magic	 = Shm_Frame_Ring_Magic;
+		uint32_t version = Shm_Frame_Ring_Version;
+		uint32_t slot_count	 = 0;
+		uint32_t reserved		 = 0;
+		uint64_t slot_stride = 0;
+		Image_Layout_Record layout;
+		/**
+		 * @brief Frames published so far, frame n lives in slot n % slot_count.
+		 */
+		alignas(64) std::atomic<uint64_t> published{0};
+};
+
+struct alignas(64) Shm_Slot_Header
+{
+		/**
+		 * @brief Seqlock, odd while the writer is copying into the slot.
+		 */
+		std::atomic<uint64_t> sequence{0};
+		uint64_t frame_index = 0;
+		int64_t timestamp		 = 0;
+		uint64_t frame_order = 0;
+		std::array<uint64_t, VIDEO_MAX_PLANES> bytes_used{};
+};
+
+static_assert(offsetof(Shm_Ring_Header, slot_stride) == 16 and offsetof(Shm_Ring_Header, layout) == 24,
+							"Shm_Ring_Header is shared between builds, its layout must not change");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+							"Seqlock counters are shared between processes, they must be lock free");
+
+/**
+ * @brief Frame copied out of a Shm_Frame_Ring. The storage is reused by
+ * subsequent reads into the same object.
+ */
+struct Shm_Frame
+{
+		Aligned_Buffer storage;
+		Multiplanar_Buffer_View planes;
+		Image_View image;
+		uint64_t frame_index = 0;
+		std::chrono::nanoseconds timestamp{0};
+		uintmax_t frame_order = 0;
+};
+
+/**
+ * @brief Capture side of a broadcast ring in /dev/shm for consumers that can
+ * afford one copy but must never slow capture down, e.g. dashboards and loggers.
+ *
+ * Every frame costs exactly one copy into the next slot, whatever the number of
+ * readers. The writer never waits: it overwrites the oldest slot, and a reader
+ * that was copying from it notices through the slot's seqlock and drops the frame.
+ *
+ * The object is created fresh, an existing one of the same name is unlinked
+ * first so readers still attached to it are not corrupted. It is unlinked again
+ * on destruction, attached readers keep their mapping.
+ */
+class Shm_Frame_Ring_Writer
+{
+	public:
+		/**
+		 * @brief name is a POSIX shared memory name like "/camera0". The layout fixes
+		 * the slot size, pass the backend's image_layout().
+		 */
+		Shm_Frame_Ring_Writer(std::string name, const Image_Layout& layout, uint32_t slot_count = 8)
+				: _name_(std::move(name))
+		{
+				if(slot_count < 2)
+				{
+						throw std::runtime_error("Shm_Frame_Ring needs at least 2 slots");
+				}
+
+				std::size_t payload = 0;
+				for(std::size_t i = 0; i < layout.num_memory_planes; ++i)
+				{
+						payload += layout.memory_plane_sizes[i];
+				}
+				const std::size_t slot_stride = round_up(sizeof(Shm_Slot_Header) + payload, Shm_Slot_Alignment);
+				_size_ = round_up(sizeof(Shm_Ring_Header), Shm_Slot_Alignment) + slot_stride * slot_count;
+
+				shm_unlink(_name_.c_str());
+				const int fd = shm_open(_name_.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+				if(-1 == fd)
+				{
+						throw std::runtime_error("shm_open " + _name_ + ": " + strerror(errno));
+				}
+				if(-1 == ftruncate(fd, static_cast<off_t>(_size_)))
+				{
+						const std::string error{strerror(errno)};
+						close(fd);
+						shm_unlink(_name_.c_str());
+						throw std::runtime_error("ftruncate " + _name_ + ": " + error);
+				}
+				_memory_ = static_cast<std::byte*>(mmap(nullptr, _size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+				close(fd);
+				if(MAP_FAILED == static_cast<void*>(_memory_))
+				{
+						shm_unlink(_name_.c_str());
+						throw std::runtime_error("mmap " + _name_ + ": " + strerror(errno));
+				}
+
+				/* ftruncate zero fills, the atomics start from 0 as constructed here. */
+				_header_							= new(_memory_) Shm_Ring_Header;
+				_header_->slot_count	= slot_count;
+				_header_->slot_stride = slot_stride;
+				_header_->layout			= make_image_layout_record(layout);
+				_layout_							= layout;
+				for(uint32_t i = 0; i < slot_count; ++i)
+				{
+						new(slot_address(i)) Shm_Slot_Header;
+				}
+		}
+
+		~Shm_Frame_Ring_Writer()
+		{
+				munmap(_memory_, _size_);
+				shm_unlink(_name_.c_str());
+		}
+
+		Shm_Frame_Ring_Writer(const Shm_Frame_Ring_Writer&)						 = delete;
+		Shm_Frame_Ring_Writer& operator=(const Shm_Frame_Ring_Writer&) = delete;
+
+		/**
+		 * @brief Copies a frame into the next slot. Planes beyond the slot's
+		 * capacity are truncated, which only happens if the layout changed.
+		 */
+		void publish(const Multiplanar_Buffer_View& planes,
+								 std::chrono::nanoseconds timestamp,
+								 uintmax_t frame_order)
+		{
+				const uint64_t frame_index = _header_->published.load(std::memory_order_relaxed);
+				auto* slot = slot_address(frame_index % _header_->slot_count);
+				auto* data = reinterpret_cast<std::byte*>(slot) + sizeof(Shm_Slot_Header);
+
+				const uint64_t sequence = slot->sequence.load(std::memory_order_relaxed);
+				slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_release);
+
+				const auto& layout = _layout_;
+				std::size_t offset = 0;
+				for(std::size_t i = 0; i < layout.num_memory_planes; ++i)
+				{
+						const std::size_t bytes = i < planes.size()
+																					? std::min(planes[i].size(), layout.memory_plane_sizes[i])
+																					: 0;
+						if(bytes)
+						{
+								std::memcpy(data + offset, planes[i].data(), bytes);
+						}
+						slot->bytes_used[i] = bytes;
+						offset += layout.memory_plane_sizes[i];
+				}
+				slot->frame_index = frame_index;
+				slot->timestamp		= timestamp.count();
+				slot->frame_order = frame_order;
+
+				slot->sequence.store(sequence + 2, std::memory_order_release);
+				_header_->published.store(frame_index + 1, std::memory_order_release);
+		}
+
+		/**
+		 * @brief Captures a frame from the backend and publishes it. Returns false
+		 * if the backend returned no frame.
+		 */
+		bool publish(Capture_Backend& backend)
+		{
+				const auto planes = backend.get_frame_data();
+				if(planes.empty())
+				{
+						return false;
+				}
+				publish(planes, backend.get_frame_timestamp(), backend.get_frame_order());
+				return true;
+		}
+
+		[[nodiscard]] uint64_t published() const
+		{
+				return _header_->published.load(std::memory_order_relaxed);
+		}
+
+		[[nodiscard]] const std::string& name() const
+		{
+				return _name_;
+		}
+
+	private:
+		static constexpr std::size_t round_up(std::size_t value, std::size_t alignment)
+		{
+				return (value + alignment - 1) / alignment * alignment;
+		}
+
+		Shm_Slot_Header* slot_address(uint64_t slot)
+		{
+				return reinterpret_cast<Shm_Slot_Header*>(
+						_memory_ + round_up(sizeof(Shm_Ring_Header), Shm_Slot_Alignment) + slot * _header_->slot_stride);
+		}
+
+	private:
+		std::string _name_;
+		std::size_t _size_				= 0;
+		std::byte* _memory_				= nullptr;
+		Shm_Ring_Header* _header_ = nullptr;
+		Image_Layout _layout_;
+};
+
+/**
+ * @brief Reading side, any number of them in any process. Reads never block
+ * the writer or each other, a frame overwritten while it was copied is
+ * detected and skipped.
+ */
+class Shm_Frame_Ring_Reader
+{
+	public:
+		/**
+		 * @brief Starts at the newest frame, older ones already in the ring are skipped.
+		 */
+		explicit Shm_Frame_Ring_Reader(const std::string& name)
+		{
+				const int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+				if(-1 == fd)
+				{
+						throw std::runtime_error("shm_open " + name + ": " + strerror(errno));
+				}
+				struct stat status;
+				if(-1 == fstat(fd, &status) or std::size_t(status.st_size) < sizeof(Shm_Ring_Header))
+				{
+						close(fd);
+						throw std::runtime_error("Shm_Frame_Ring " + name + " is not initialized");
+				}
+				_size_	 = status.st_size;
+				_memory_ = static_cast<const std::byte*>(mmap(nullptr, _size_, PROT_READ, MAP_SHARED, fd, 0));
+				close(fd);
+				if(MAP_FAILED == static_cast<const void*>(_memory_))
+				{
+						throw std::runtime_error("mmap " + name + ": " + strerror(errno));
+				}
+
+				_header_ = reinterpret_cast<const Shm_Ring_Header*>(_memory_);
+				const auto layout = _header_->magic == Shm_Frame_Ring_Magic and _header_->version == Shm_Frame_Ring_Version
+																? image_layout_from_record(_header_->layout)
+																: std::nullopt;
+				if(not layout or slot_offset(_header_->slot_count) > _size_)
+				{
+						munmap(const_cast<std::byte*>(_memory_), _size_);
+						throw std::runtime_error("Shm_Frame_Ring " + name + " has an unknown layout");
+				}
+				_layout_ = *layout;
+
+				const auto published = _header_->published.load(std::memory_order_acquire);
+				_next_frame_				 = published ? published - 1 : 0;
+		}
+
+		~Shm_Frame_Ring_Reader()
+		{
+				munmap(const_cast<std::byte*>(_memory_), _size_);
+		}
+
+		Shm_Frame_Ring_Reader(const Shm_Frame_Ring_Reader&)						 = delete;
+		Shm_Frame_Ring_Reader& operator=(const Shm_Frame_Ring_Reader&) = delete;
+
+		/**
+		 * @brief Copies the next frame in order into frame. When the reader fell
+		 * more than a ring behind it jumps to the oldest frame still there, the
+		 * skipped ones count as lost. Returns false when there is no new frame.
+		 */
+		bool read_next(Shm_Frame& frame)
+		{
+				for(;;)
+				{
+						const uint64_t published = _header_->published.load(std::memory_order_acquire);
+						if(_next_frame_ >= published)
+						{
+								return false;
+						}
+
+						/* The writer may already be overwriting the oldest slot. */
+						const uint64_t oldest_safe = published > _header_->slot_count - 1
+																						 ? published - (_header_->slot_count - 1)
+																						 : 0;
+						if(_next_frame_ < oldest_safe)
+						{
+								_lost_frames_ += oldest_safe - _next_frame_;
+								_next_frame_ = oldest_safe;
+						}
+
+						if(read(_next_frame_, frame))
+						{
+								++_next_frame_;
+								return true;
+						}
+						++_lost_frames_;
+						++_next_frame_;
+				}
+		}
+
+		/**
+		 * @brief Copies the newest frame, skipping everything in between. Returns
+		 * false when there is no frame newer than the last one read.
+		 */
+		bool read_latest(Shm_Frame& frame)
+		{
+				const uint64_t published = _header_->published.load(std::memory_order_acquire);
+				if(published > _next_frame_ + 1)
+				{
+						_lost_frames_ += published - 1 - _next_frame_;
+						_next_frame_ = published - 1;
+				}
+				return read_next(frame);
+		}
+
+		/**
+		 * @brief Frames this reader never got, because it fell behind or the
+		 * writer overwrote them during the copy.
+		 */
+		[[nodiscard]] uintmax_t lost_frames() const
+		{
+				return _lost_frames_;
+		}
+
+		[[nodiscard]] const Image_Layout& image_layout() const
+		{
+				return _layout_;
+		}
+
+	private:
+		std::size_t slot_offset(uint64_t slot) const
+		{
+				const std::size_t header_size =
+						(sizeof(Shm_Ring_Header) + Shm_Slot_Alignment - 1) / Shm_Slot_Alignment * Shm_Slot_Alignment;
+				return header_size + slot * _header_->slot_stride;
+		}
+
+		bool read(uint64_t frame_index, Shm_Frame& frame)
+		{
+				const auto* slot = reinterpret_cast<const Shm_Slot_Header*>(
+						_memory_ + slot_offset(frame_index % _header_->slot_count));
+				const auto* data = reinterpret_cast<const std::byte*>(slot) + sizeof(Shm_Slot_Header);
+				const auto& layout = _layout_;
+
+				const uint64_t before = slot->sequence.load(std::memory_order_acquire);
+				if(before & 1 or slot->frame_index != frame_index)
+				{
+						return false;
+				}
+
+				std::size_t payload = 0;
+				for(std::size_t i = 0; i < layout.num_memory_planes; ++i)
+				{
+						payload += layout.memory_plane_sizes[i];
+				}
+				frame.storage.resize(payload);
+				std::memcpy(frame.storage.data(), data, payload);
+				const auto bytes_used	 = slot->bytes_used;
+				const auto timestamp	 = slot->timestamp;
+				const auto frame_order = slot->frame_order;
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if(slot->sequence.load(std::memory_order_relaxed) != before)
+				{
+						return false;
+				}
+
+				frame.planes.clear();
+				std::size_t offset = 0;
+				for(std::size_t i = 0; i < layout.num_memory_planes; ++i)
+				{
+						frame.planes.emplace_back(frame.storage.data() + offset,
+																			std::min<std::size_t>(bytes_used[i], layout.memory_plane_sizes[i]));
+						offset += layout.memory_plane_sizes[i];
+				}
+				frame.image				= make_image_view(layout, frame.planes);
+				frame.frame_index = frame_index;
+				frame.timestamp		= std::chrono::nanoseconds{timestamp};
+				frame.frame_order = frame_order;
+				return true;
+		}
+
+	private:
+		std::size_t _size_							= 0;
+		const std::byte* _memory_				= nullptr;
+		const Shm_Ring_Header* _header_ = nullptr;
+		Image_Layout _layout_;
+		uint64_t _next_frame_						= 0;
+		uintmax_t _lost_frames_					= 0;
+};
+
+} // namespace Cartrack
+
+#endif // SHM_FRAME_RING_HPP
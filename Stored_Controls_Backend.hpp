@@ -0,0 +1,242 @@
+#ifndef STORED_CONTROLS_BACKEND_HPP
+#define STORED_CONTROLS_BACKEND_HPP
+
+#include "Abstract_Capture_Backend.hpp"
+#include "Image_View.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <linux/videodev2.h>
+#include <unordered_map>
+
+namespace Cartrack
+{
+
+/**
+ * @brief Common base of the backends without a device behind them, like
+ * Synthetic_Backend and Replay_Backend. Controls are plain stored values keyed
+ * by V4L2 control id, reading one never set gives 0. put_frame_data copies
+ * frames of get_frame_data, and the frame geometry comes from _image_layout_,
+ * which the derived backend fills in its constructor.
+ */
+class Stored_Controls_Backend : public Capture_Backend
+{
+	public:
+		[[nodiscard]] std::vector<std::vector<size_t>> put_frame_data(
+				std::vector<Multiplanar_Buffer_View>& userspace_frames) override
+		{
+				std::vector<std::vector<size_t>> sizes(userspace_frames.size());
+				for(std::size_t frame_index = 0; frame_index < userspace_frames.size(); ++frame_index)
+				{
+						auto& userspace_frame = userspace_frames[frame_index];
+						const auto frame			= get_frame_data();
+						sizes[frame_index].resize(frame.size());
+						for(std::size_t plane = 0; plane < frame.size() and plane < userspace_frame.size(); ++plane)
+						{
+								const auto bytes = std::min(frame[plane].size(), userspace_frame[plane].size());
+								std::memcpy(userspace_frame[plane].data(), frame[plane].data(), bytes);
+								sizes[frame_index][plane] = bytes;
+						}
+				}
+				return sizes;
+		}
+
+		[[nodiscard]] const Image_Layout& image_layout() const
+		{
+				return _image_layout_;
+		}
+
+		[[nodiscard]] Pixel_Format get_pixel_format() const override
+		{
+				return _configuration_.pixel_format;
+		}
+
+		bool set_zoom(int value) override
+		{
+				return set_control(V4L2_CID_ZOOM_ABSOLUTE, value);
+		}
+
+		[[nodiscard]] int get_zoom() const override
+		{
+				return get_control(V4L2_CID_ZOOM_ABSOLUTE);
+		}
+
+		bool set_focus(int value) override
+		{
+				return set_control(V4L2_CID_FOCUS_ABSOLUTE, value);
+		}
+
+		[[nodiscard]] int get_focus() const override
+		{
+				return get_control(V4L2_CID_FOCUS_ABSOLUTE);
+		}
+
+		bool set_sharpness(int value) override
+		{
+				return set_control(V4L2_CID_SHARPNESS, value);
+		}
+
+		[[nodiscard]] int get_sharpness() const override
+		{
+				return get_control(V4L2_CID_SHARPNESS);
+		}
+
+		bool set_auto_focus(bool value) override
+		{
+				return set_control(V4L2_CID_FOCUS_AUTO, value);
+		}
+
+		[[nodiscard]] bool get_auto_focus() const override
+		{
+				return get_control(V4L2_CID_FOCUS_AUTO);
+		}
+
+		bool set_brightness(int value) override
+		{
+				return set_control(V4L2_CID_BRIGHTNESS, value);
+		}
+
+		[[nodiscard]] int get_brightness() const override
+		{
+				return get_control(V4L2_CID_BRIGHTNESS);
+		}
+
+		bool set_contrast(int value) override
+		{
+				return set_control(V4L2_CID_CONTRAST, value);
+		}
+
+		[[nodiscard]] int get_contrast() const override
+		{
+				return get_control(V4L2_CID_CONTRAST);
+		}
+
+		bool set_saturation(int value) override
+		{
+				return set_control(V4L2_CID_SATURATION, value);
+		}
+
+		[[nodiscard]] int get_saturation() const override
+		{
+				return get_control(V4L2_CID_SATURATION);
+		}
+
+		bool set_hue(int value) override
+		{
+				return set_control(V4L2_CID_HUE, value);
+		}
+
+		[[nodiscard]] int get_hue() const override
+		{
+				return get_control(V4L2_CID_HUE);
+		}
+
+		bool set_gain(int value) override
+		{
+				return set_control(V4L2_CID_GAIN, value);
+		}
+
+		[[nodiscard]] int get_gain() const override
+		{
+				return get_control(V4L2_CID_GAIN);
+		}
+
+		bool set_exposure(int value) override
+		{
+				return set_control(V4L2_CID_EXPOSURE, value);
+		}
+
+		[[nodiscard]] int get_exposure() const override
+		{
+				return get_control(V4L2_CID_EXPOSURE);
+		}
+
+		bool set_white_balance_temperature(int value) override
+		{
+				return set_control(V4L2_CID_WHITE_BALANCE_TEMPERATURE, value);
+		}
+
+		[[nodiscard]] int get_white_balance_temperature() const override
+		{
+				return get_control(V4L2_CID_WHITE_BALANCE_TEMPERATURE);
+		}
+
+		[[nodiscard]] bool get_auto_white_balance_val() const override
+		{
+				return get_control(V4L2_CID_AUTO_WHITE_BALANCE);
+		}
+
+		bool set_auto_white_balance(bool enable) override
+		{
+				return set_control(V4L2_CID_AUTO_WHITE_BALANCE, enable);
+		}
+
+		bool set_auto_exposure_mode(int type) override
+		{
+				return set_control(V4L2_CID_EXPOSURE_AUTO, type);
+		}
+
+		[[nodiscard]] int get_auto_exposure_current_value() const override
+		{
+				return get_control(V4L2_CID_EXPOSURE_AUTO);
+		}
+
+		bool enable_auto_exposure_auto_priority_mode(bool on) override
+		{
+				return set_control(V4L2_CID_EXPOSURE_AUTO_PRIORITY, on);
+		}
+
+		[[nodiscard]] bool is_auto_exposure_auto_priority_enabled() const override
+		{
+				return get_control(V4L2_CID_EXPOSURE_AUTO_PRIORITY);
+		}
+
+		bool set_manual_exposure_value(int val) override
+		{
+				return set_control(V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_MANUAL)
+							 and set_control(V4L2_CID_EXPOSURE_ABSOLUTE, val);
+		}
+
+		[[nodiscard]] int get_manual_exposure_value() const override
+		{
+				return get_control(V4L2_CID_EXPOSURE_ABSOLUTE);
+		}
+
+		[[nodiscard]] unsigned int get_width() const override
+		{
+				return _image_layout_.width;
+		}
+
+		[[nodiscard]] unsigned int get_height() const override
+		{
+				return _image_layout_.height;
+		}
+
+		[[nodiscard]] constexpr size_t num_planes() const override
+		{
+				return _image_layout_.num_memory_planes;
+		}
+
+	protected:
+		bool set_control(uint32_t id, int value)
+		{
+				_controls_[id] = value;
+				return true;
+		}
+
+		int get_control(uint32_t id) const
+		{
+				const auto found = _controls_.find(id);
+				return found == _controls_.end() ? 0 : found->second;
+		}
+
+	protected:
+		Image_Layout _image_layout_;
+
+	private:
+		std::unordered_map<uint32_t, int> _controls_;
+};
+
+} // namespace Cartrack
+
+#endif // STORED_CONTROLS_BACKEND_HPP
@@ -0,0 +1,300 @@
+#ifndef STREAM_HUB_HPP
+#define STREAM_HUB_HPP
+
+#include "Color_Conversion.hpp"
+#include "isgursoy_V4L2.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+namespace Cartrack
+{
+
+/**
+ * @brief Frame produced by a converter, tightly packed in one memory plane.
+ */
+struct Converted_Image
+{
+		Image_Layout layout;
+		Aligned_Buffer data;
+
+		[[nodiscard]] Image_View view() const
+		{
+				auto* bytes = const_cast<Data_Type*>(data.data());
+				return make_image_view(layout, Multiplanar_Buffer_View{std::span(bytes, data.size())});
+		}
+};
+
+/**
+ * @brief Writes source into target, whose layout and storage are already sized
+ * for the target format and the source dimensions.
+ */
+using Frame_Converter = std::function<void(const Image_View& source, Converted_Image& target)>;
+
+/**
+ * @brief What a subscriber gets. source keeps the driver buffer alive, so it is
+ * fine to hand the whole thing to another thread. converted is empty for
+ * subscribers of the native format, image points to whichever one applies.
+ */
+struct Stream_Frame
+{
+		Frame_Handle source;
+		std::shared_ptr<const Converted_Image> converted;
+		Image_View image;
+};
+
+struct Subscription
+{
+		/**
+		 * @brief Upper bound of the delivered rate, 0 for every frame. Decimation
+		 * follows capture timestamps, so a driver dropping frames does not make a
+		 * subscriber fall further behind.
+		 */
+		double max_fps = 0;
+		/**
+		 * @brief Invalid for the native format, anything else needs a converter
+		 * registered for the pair before subscribing.
+		 */
+		Pixel_Format pixel_format = Pixel_Format::Invalid;
+		/**
+		 * @brief Runs on the dispatching thread, return quickly or hand the frame on.
+		 */
+		std::function<void(const Stream_Frame&)> callback;
+};
+
+using Subscription_ID = unsigned int;
+
+struct Subscription_Statistics
+{
+		uintmax_t delivered = 0;
+		uintmax_t decimated = 0;
+};
+
+/**
+ * @brief Fans one capture stream out to consumers that want different rates and
+ * formats, e.g. full rate NV12 for recording, 5 fps RGB for inference and 1 fps
+ * thumbnails.
+ *
+ * Every captured frame is checked against each subscriber's rate. A conversion
+ * runs at most once per frame no matter how many due subscribers asked for that
+ * format, and only when at least one of them is due. Converted images of
+ * frames nobody holds any more are reused for the next frame.
+ *
+ * Needs Buffering::Internal, frames are acquired as handles. Not thread safe,
+ * subscribe and dispatch from the capturing thread.
+ */
+class Stream_Hub
+{
+	public:
+		explicit Stream_Hub(std::shared_ptr<V4L2_Backend> backend)
+				: _backend_(std::move(backend))
+		{
+				if(not _backend_)
+				{
+						throw std::runtime_error("Stream_Hub needs a backend");
+				}
+		}
+
+		void register_converter(Pixel_Format from, Pixel_Format to, Frame_Converter converter)
+		{
+				_converters_[{from, to}].convert = std::move(converter);
+		}
+
+		/**
+		 * @brief Registers convert_image for every target it can make from the
+		 * backend's format, with the matrix and range the driver negotiated.
+		 * Conversions run on the dispatching thread unless parallelism asks for
+		 * more.
+		 */
+		void register_color_converters(const Parallelism& parallelism = {})
+		{
+				const auto native = _backend_->get_pixel_format();
+				for(const auto target : color_conversion_targets)
+				{
+						if(target != native and color_conversion_supported(native, target))
+						{
+								register_converter(native,
+																	 target,
+																	 [parallelism](const Image_View& source, Converted_Image& image)
+																	 { convert_image(source, image.view(), best_color_conversion_kernel(), parallelism); });
+						}
+				}
+		}
+
+		Subscription_ID subscribe(Subscription subscription)
+		{
+				if(not subscription.callback)
+				{
+						throw std::runtime_error("Subscription without callback");
+				}
+				const auto native = _backend_->get_pixel_format();
+				if(subscription.pixel_format == native)
+				{
+						subscription.pixel_format = Pixel_Format::Invalid;
+				}
+				if(subscription.pixel_format != Pixel_Format::Invalid
+					 and not _converters_.contains({native, subscription.pixel_format}))
+				{
+						throw std::runtime_error("No converter registered for the subscribed pixel format");
+				}
+
+				Subscriber subscriber;
+				subscriber.id						= _next_id_++;
+				subscriber.subscription = std::move(subscription);
+				if(subscriber.subscription.max_fps > 0)
+				{
+						subscriber.period = std::chrono::duration_cast<std::chrono::nanoseconds>(
+								std::chrono::duration<double>(1.0 / subscriber.subscription.max_fps));
+				}
+				_subscribers_.push_back(std::move(subscriber));
+				return _subscribers_.back().id;
+		}
+
+		void unsubscribe(Subscription_ID id)
+		{
+				std::erase_if(_subscribers_, [id](const Subscriber& subscriber) { return subscriber.id == id; });
+		}
+
+		/**
+		 * @brief Captures one frame and delivers it to every subscriber that is due.
+		 * Returns false if the backend returned no frame.
+		 */
+		bool dispatch()
+		{
+				auto handle = _backend_->acquire_frame();
+				if(not handle)
+				{
+						return false;
+				}
+
+				const auto timestamp = handle->timestamp;
+				bool anyone_due			 = false;
+				for(auto& subscriber : _subscribers_)
+				{
+						subscriber.due = subscriber.period.count() == 0 or timestamp >= subscriber.next_due;
+						if(subscriber.due)
+						{
+								anyone_due = true;
+								/* Keep the cadence, but do not burst to catch up after a stall. */
+								subscriber.next_due = std::max(subscriber.next_due + subscriber.period,
+																							 timestamp + subscriber.period / 2);
+						}
+						else
+						{
+								++subscriber.statistics.decimated;
+						}
+				}
+				if(not anyone_due)
+				{
+						return true;
+				}
+
+				const auto native_view = make_image_view(_backend_->image_layout(), handle->planes);
+				for(auto& [formats, converter] : _converters_)
+				{
+						converter.current.reset();
+				}
+
+				for(auto& subscriber : _subscribers_)
+				{
+						if(not subscriber.due)
+						{
+								continue;
+						}
+
+						Stream_Frame frame;
+						frame.source = handle;
+						if(subscriber.subscription.pixel_format == Pixel_Format::Invalid)
+						{
+								frame.image = native_view;
+						}
+						else
+						{
+								frame.converted = convert(native_view, subscriber.subscription.pixel_format);
+								frame.image			= frame.converted->view();
+						}
+						++subscriber.statistics.delivered;
+						subscriber.subscription.callback(frame);
+				}
+				return true;
+		}
+
+		[[nodiscard]] Subscription_Statistics statistics(Subscription_ID id) const
+		{
+				const auto found = std::find_if(_subscribers_.begin(),
+																				_subscribers_.end(),
+																				[id](const Subscriber& subscriber) { return subscriber.id == id; });
+				return found == _subscribers_.end() ? Subscription_Statistics{} : found->statistics;
+		}
+
+		/**
+		 * @brief Conversions actually run, at most one per format and frame.
+		 */
+		[[nodiscard]] uintmax_t conversion_count() const
+		{
+				return _conversion_count_;
+		}
+
+		[[nodiscard]] std::size_t size() const
+		{
+				return _subscribers_.size();
+		}
+
+	private:
+		std::shared_ptr<const Converted_Image> convert(const Image_View& source, Pixel_Format target)
+		{
+				auto& converter = _converters_.at({source.pixel_format, target});
+				if(converter.current)
+				{
+						return converter.current;
+				}
+
+				/* The previous image is free again once no subscriber holds it. */
+				if(not converter.recycled or converter.recycled.use_count() > 1)
+				{
+						converter.recycled = std::make_shared<Converted_Image>();
+				}
+				auto& image = *converter.recycled;
+				if(image.layout.width != source.width or image.layout.height != source.height)
+				{
+						image.layout = make_packed_image_layout(target, source.width, source.height, false);
+						image.data.resize(image.layout.memory_plane_sizes[0]);
+				}
+
+				converter.convert(source, image);
+				++_conversion_count_;
+				converter.current = converter.recycled;
+				return converter.current;
+		}
+
+	private:
+		struct Subscriber
+		{
+				Subscription_ID id = 0;
+				Subscription subscription;
+				std::chrono::nanoseconds period{0};
+				std::chrono::nanoseconds next_due{0};
+				bool due = false;
+				Subscription_Statistics statistics;
+		};
+
+		struct Registered_Converter
+		{
+				Frame_Converter convert;
+				std::shared_ptr<Converted_Image> recycled;
+				std::shared_ptr<const Converted_Image> current;
+		};
+
+		std::shared_ptr<V4L2_Backend> _backend_;
+		std::map<std::pair<Pixel_Format, Pixel_Format>, Registered_Converter> _converters_;
+		std::vector<Subscriber> _subscribers_;
+		Subscription_ID _next_id_		= 0;
+		uintmax_t _conversion_count_ = 0;
+};
+
+} // namespace Cartrack
+
+#endif // STREAM_HUB_HPP
@@ -0,0 +1,385 @@
+#ifndef SYNTHETIC_BACKEND_HPP
+#define SYNTHETIC_BACKEND_HPP
+
+#include "Stored_Controls_Backend.hpp"
+#include "Pixel_Format_Descriptor.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <linux/videodev2.h>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#ifdef LIBJPEG_AVAILABLE
+#		include <cstdio>
+#		include <jpeglib.h>
+#endif
+
+namespace Cartrack
+{
+
+/**
+ * @brief Capture_Backend without a device. Produces a moving test pattern in any
+ * Pixel_Format at the configured resolution, either paced at fps or as fast as
+ * frames are requested, with optional timestamp jitter and frame drops
+ * (Stream_Configuration::Synthetic).
+ *
+ * Frames come in the same layout a driver would use for the format: tightly
+ * packed, multi planar when v4l2.contiguous is false. Buffers are owned by the
+ * backend and cycled like internal buffering, a frame stays valid until
+ * distinct_frames more have been taken. MJPEG frames are real JPEG when built
+ * with LIBJPEG_AVAILABLE, otherwise an SOI/EOI wrapped placeholder that only
+ * exercises the byte paths.
+ */
+class Synthetic_Backend : public Stored_Controls_Backend
+{
+	public:
+		explicit Synthetic_Backend(const Stream_Configuration& params)
+		{
+				_configuration_					= params;
+				const auto& descriptor = describe(_configuration_.pixel_format);
+				if(not descriptor.valid())
+				{
+						throw std::runtime_error("Pixel format not supported");
+				}
+				if(_configuration_.width == 0 or _configuration_.height == 0)
+				{
+						throw std::runtime_error("Synthetic_Backend needs width and height");
+				}
+
+				const bool multiplanar = not _configuration_.v4l2.contiguous or not descriptor.contiguous;
+				_image_layout_				 = make_packed_image_layout(
+						_configuration_.pixel_format, _configuration_.width, _configuration_.height, multiplanar);
+
+				_random_.seed(_configuration_.synthetic.seed);
+				set_period(_configuration_.fps);
+
+				const auto distinct_frames = std::max(1u, _configuration_.synthetic.distinct_frames);
+				_frames_.resize(distinct_frames);
+				_frame_views_.resize(distinct_frames);
+				for(unsigned int frame = 0; frame < distinct_frames; ++frame)
+				{
+						render(frame);
+				}
+				_schedule_origin_ = std::chrono::steady_clock::now().time_since_epoch();
+		}
+
+	public:
+		[[nodiscard]] Multiplanar_Buffer_View get_frame_data() override
+		{
+				const auto& synthetic = _configuration_.synthetic;
+				/* Capped below 1, a backend that never delivers is not useful. */
+				std::bernoulli_distribution dropped(std::clamp(synthetic.drop_probability, 0.0, 0.99));
+
+				std::chrono::nanoseconds capture_time{0};
+				do
+				{
+						capture_time = scheduled_time(_sequence_++) + sample_jitter();
+				} while(dropped(_random_) and ++_dropped_frames_);
+
+				if(not synthetic.unthrottled and _period_.count() > 0)
+				{
+						std::this_thread::sleep_until(std::chrono::steady_clock::time_point(capture_time));
+				}
+
+				_frame_timestamp_ = capture_time;
+				++_frame_order_;
+				return _frame_views_[(_sequence_ - 1) % _frame_views_.size()];
+		}
+
+		[[nodiscard]] Image_View get_image_view()
+		{
+				return make_image_view(_image_layout_, get_frame_data());
+		}
+
+		template <Pixel_Format Format>
+		[[nodiscard]] Typed_Image_View<Format> get_image_view()
+		{
+				if(Format != _configuration_.pixel_format)
+				{
+						throw std::runtime_error("get_image_view format differs from the configured one");
+				}
+				return make_typed_image_view<Format>(_image_layout_, get_frame_data());
+		}
+
+		/**
+		 * @brief Frames skipped by drop injection so far.
+		 */
+		[[nodiscard]] uintmax_t dropped_frames() const
+		{
+				return _dropped_frames_;
+		}
+
+		[[nodiscard]] double set_fps(double new_fps) override
+		{
+				/* Keep timestamps continuous, the new rate starts at the next frame. */
+				const auto next = scheduled_time(_sequence_);
+				set_period(new_fps);
+				_schedule_origin_ = next;
+				_schedule_base_		= _sequence_;
+				return get_fps();
+		}
+
+		[[nodiscard]] double get_fps() const override
+		{
+				return _fps_;
+		}
+
+	private:
+		void set_period(double fps)
+		{
+				_fps_		 = fps > 0 ? fps : 0;
+				_period_ = _fps_ > 0 ? std::chrono::duration_cast<std::chrono::nanoseconds>(
+															 std::chrono::duration<double>(1.0 / _fps_))
+														 : std::chrono::nanoseconds{0};
+		}
+
+		std::chrono::nanoseconds scheduled_time(uintmax_t sequence) const
+		{
+				return _schedule_origin_ + _period_ * static_cast<int64_t>(sequence - _schedule_base_);
+		}
+
+		std::chrono::nanoseconds sample_jitter()
+		{
+				const auto jitter = _configuration_.synthetic.jitter;
+				if(jitter.count() <= 0)
+				{
+						return std::chrono::nanoseconds{0};
+				}
+				std::normal_distribution<double> distribution(0.0, static_cast<double>(jitter.count()));
+				const auto limit = _period_.count() > 0 ? _period_.count() / 2 : 3 * jitter.count();
+				return std::chrono::nanoseconds{
+						std::clamp<int64_t>(static_cast<int64_t>(distribution(_random_)), -limit, limit)};
+		}
+
+		struct Rgb
+		{
+				uint8_t r, g, b;
+		};
+
+		struct Yuv
+		{
+				uint8_t y, u, v;
+		};
+
+		static Rgb pattern(uint32_t x, uint32_t y, unsigned int frame)
+		{
+				/* Diagonal gradients moving at different speeds, every frame differs. */
+				return {static_cast<uint8_t>(x + frame * 8),
+								static_cast<uint8_t>(y + frame * 4),
+								static_cast<uint8_t>((x + y) / 2 + frame * 2)};
+		}
+
+		static Yuv to_yuv(Rgb c)
+		{
+				/* BT.601 limited range, what UVC cameras deliver. */
+				return {static_cast<uint8_t>(16 + ((66 * c.r + 129 * c.g + 25 * c.b + 128) >> 8)),
+								static_cast<uint8_t>(128 + ((-38 * c.r - 74 * c.g + 112 * c.b + 128) >> 8)),
+								static_cast<uint8_t>(128 + ((112 * c.r - 94 * c.g - 18 * c.b + 128) >> 8))};
+		}
+
+		void render(unsigned int frame)
+		{
+				auto& planes = _frames_[frame];
+				planes.resize(_image_layout_.num_memory_planes);
+				Multiplanar_Buffer_View memory;
+				for(std::size_t i = 0; i < _image_layout_.num_memory_planes; ++i)
+				{
+						planes[i].assign(_image_layout_.memory_plane_sizes[i], Data_Type{0});
+						memory.emplace_back(planes[i].data(), planes[i].size());
+				}
+
+				const auto image	= make_image_view(_image_layout_, memory);
+				const auto width	= _image_layout_.width;
+				const auto height = _image_layout_.height;
+
+				switch(_configuration_.pixel_format)
+				{
+						case Pixel_Format::YUYV422:
+								for(uint32_t y = 0; y < height; ++y)
+								{
+										auto* row = image.plane(0).row(y);
+										for(uint32_t x = 0; x < width; x += 2)
+										{
+												const auto left	 = to_yuv(pattern(x, y, frame));
+												const auto right = to_yuv(pattern(std::min(x + 1, width - 1), y, frame));
+												row[2 * x]			 = left.y;
+												row[2 * x + 1]	 = left.u;
+												if(x + 1 < width)
+												{
+														row[2 * x + 2] = right.y;
+														row[2 * x + 3] = left.v;
+												}
+										}
+								}
+								break;
+
+						case Pixel_Format::NV12:
+						case Pixel_Format::NV12sp:
+						case Pixel_Format::YUV422P:
+						{
+								const bool interleaved = image.num_planes == 2;
+								for(uint32_t y = 0; y < height; ++y)
+								{
+										auto* luma = image.plane(0).row(y);
+										for(uint32_t x = 0; x < width; ++x)
+										{
+												luma[x] = to_yuv(pattern(x, y, frame)).y;
+										}
+								}
+								const auto& chroma = image.plane(1);
+								const uint32_t vertical_subsampling =
+										describe(_configuration_.pixel_format).planes[1].vertical_subsampling;
+								for(uint32_t y = 0; y < chroma.height; ++y)
+								{
+										for(uint32_t x = 0; x < chroma.width; ++x)
+										{
+												const auto c = to_yuv(pattern(2 * x, vertical_subsampling * y, frame));
+												if(interleaved)
+												{
+														chroma.row(y)[2 * x]		 = c.u;
+														chroma.row(y)[2 * x + 1] = c.v;
+												}
+												else
+												{
+														chroma.row(y)[x]				 = c.u;
+														image.plane(2).row(y)[x] = c.v;
+												}
+										}
+								}
+								break;
+						}
+
+						case Pixel_Format::BGR24:
+						case Pixel_Format::RGB24:
+						{
+								const bool bgr = _configuration_.pixel_format == Pixel_Format::BGR24;
+								for(uint32_t y = 0; y < height; ++y)
+								{
+										auto* row = image.plane(0).row(y);
+										for(uint32_t x = 0; x < width; ++x)
+										{
+												const auto c		 = pattern(x, y, frame);
+												row[3 * x]			 = bgr ? c.b : c.r;
+												row[3 * x + 1]	 = c.g;
+												row[3 * x + 2]	 = bgr ? c.r : c.b;
+										}
+								}
+								break;
+						}
+
+						case Pixel_Format::RGBA32:
+								for(uint32_t y = 0; y < height; ++y)
+								{
+										auto* row = image.plane(0).row(y);
+										for(uint32_t x = 0; x < width; ++x)
+										{
+												const auto c		 = pattern(x, y, frame);
+												row[4 * x]			 = c.r;
+												row[4 * x + 1]	 = c.g;
+												row[4 * x + 2]	 = c.b;
+												row[4 * x + 3]	 = 255;
+										}
+								}
+								break;
+
+						case Pixel_Format::GRAY8:
+								for(uint32_t y = 0; y < height; ++y)
+								{
+										auto* row = image.plane(0).row(y);
+										for(uint32_t x = 0; x < width; ++x)
+										{
+												row[x] = to_yuv(pattern(x, y, frame)).y;
+										}
+								}
+								break;
+
+						case Pixel_Format::MJPEG:
+								memory[0] = memory[0].first(encode_jpeg(frame, memory[0]));
+								break;
+
+						case Pixel_Format::Invalid:
+								break;
+				}
+
+				_frame_views_[frame] = memory;
+		}
+
+		/**
+		 * @brief Returns the number of bytes written into target.
+		 */
+		std::size_t encode_jpeg(unsigned int frame, std::span<Data_Type> target) const
+		{
+				const auto width	= _image_layout_.width;
+				const auto height = _image_layout_.height;
+#ifdef LIBJPEG_AVAILABLE
+				std::vector<uint8_t> rgb(std::size_t(width) * height * 3);
+				for(uint32_t y = 0; y < height; ++y)
+				{
+						for(uint32_t x = 0; x < width; ++x)
+						{
+								const auto c												 = pattern(x, y, frame);
+								rgb[(std::size_t(y) * width + x) * 3]		 = c.r;
+								rgb[(std::size_t(y) * width + x) * 3 + 1] = c.g;
+								rgb[(std::size_t(y) * width + x) * 3 + 2] = c.b;
+						}
+				}
+
+				jpeg_compress_struct compressor;
+				jpeg_error_mgr errors;
+				compressor.err = jpeg_std_error(&errors);
+				jpeg_create_compress(&compressor);
+
+				unsigned char* encoded		= nullptr;
+				unsigned long encoded_size = 0;
+				jpeg_mem_dest(&compressor, &encoded, &encoded_size);
+				compressor.image_width			= width;
+				compressor.image_height			= height;
+				compressor.input_components = 3;
+				compressor.in_color_space		= JCS_RGB;
+				jpeg_set_defaults(&compressor);
+				jpeg_set_quality(&compressor, 80, TRUE);
+				jpeg_start_compress(&compressor, TRUE);
+				while(compressor.next_scanline < compressor.image_height)
+				{
+						JSAMPROW row = rgb.data() + std::size_t(compressor.next_scanline) * width * 3;
+						jpeg_write_scanlines(&compressor, &row, 1);
+				}
+				jpeg_finish_compress(&compressor);
+				jpeg_destroy_compress(&compressor);
+
+				const std::size_t bytes = std::min<std::size_t>(encoded_size, target.size());
+				std::memcpy(target.data(), encoded, bytes);
+				free(encoded);
+				return bytes;
+#else
+				/* SOI, pseudo random entropy data, EOI. Roughly the size of a real frame. */
+				const std::size_t bytes = std::min<std::size_t>(std::size_t(width) * height / 8 + 4, target.size());
+				std::mt19937 noise(frame);
+				for(std::size_t i = 2; i + 2 < bytes; ++i)
+				{
+						target[i] = Data_Type(noise() & 0xfe);
+				}
+				target[0]					= Data_Type{0xff};
+				target[1]					= Data_Type{0xd8};
+				target[bytes - 2] = Data_Type{0xff};
+				target[bytes - 1] = Data_Type{0xd9};
+				return bytes;
+#endif
+		}
+
+	private:
+		std::vector<Multiplanar_Buffer> _frames_;
+		std::vector<Multiplanar_Buffer_View> _frame_views_;
+		std::mt19937_64 _random_;
+		double _fps_ = 0;
+		std::chrono::nanoseconds _period_{0};
+		std::chrono::nanoseconds _schedule_origin_{0};
+		uintmax_t _schedule_base_									 = 0;
+		uintmax_t _sequence_											 = 0;
+		uintmax_t _dropped_frames_								 = 0;
+};
+
+} // namespace Cartrack
+
+#endif // SYNTHETIC_BACKEND_HPP
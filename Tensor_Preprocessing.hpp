@@ -0,0 +1,807 @@
+#ifndef TENSOR_PREPROCESSING_HPP
+#define TENSOR_PREPROCESSING_HPP
+
+#include "Image_Resize.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace Cartrack
+{
+
+/**
+ * @brief What preprocess_to_tensor writes: a planar (CHW) tensor of width x
+ * height with the frame letterboxed into it.
+ *
+ * Every channel is normalized as (value - mean) / standard_deviation with
+ * value in 0..255, both given in the order of the tensor's channels. Int8
+ * tensors are quantized on top of that:
+ * round(normalized / int8_scale) + int8_zero_point.
+ */
+struct Tensor_Options
+{
+		uint32_t width	= 640;
+		uint32_t height = 640;
+		/**
+		 * @brief Channel order of the tensor, BGR for models trained on OpenCV frames.
+		 */
+		bool bgr = false;
+		/**
+		 * @brief Scale both axes alike and pad, otherwise stretch to the tensor.
+		 */
+		bool keep_aspect_ratio = true;
+		/**
+		 * @brief Value of the padding in 0..255, normalized like the pixels.
+		 */
+		float pad_value = 114;
+		std::array<float, 3> mean{0, 0, 0};
+		std::array<float, 3> standard_deviation{255, 255, 255};
+		float int8_scale		= 1.0f / 128;
+		int int8_zero_point = 0;
+		/**
+		 * @brief Instruction set of the row kernels, Scalar is the reference.
+		 */
+		Color_Conversion_Kernel kernel = best_color_conversion_kernel();
+		Parallelism parallelism;
+};
+
+/**
+ * @brief Where the frame landed inside the tensor, to map detections back:
+ * frame_x = (tensor_x - left) / scale_x.
+ */
+struct Letterbox
+{
+		float scale_x		= 1;
+		float scale_y		= 1;
+		uint32_t left		= 0;
+		uint32_t top		= 0;
+		uint32_t width	= 0;
+		uint32_t height = 0;
+};
+
+[[nodiscard]] inline Letterbox
+make_letterbox(uint32_t frame_width, uint32_t frame_height, const Tensor_Options& options)
+{
+		Letterbox box;
+		box.scale_x = float(options.width) / float(frame_width);
+		box.scale_y = float(options.height) / float(frame_height);
+		if(options.keep_aspect_ratio)
+		{
+				box.scale_x = box.scale_y = std::min(box.scale_x, box.scale_y);
+		}
+		box.width	 = std::clamp<uint32_t>(static_cast<uint32_t>(std::lround(frame_width * box.scale_x)), 1, options.width);
+		box.height = std::clamp<uint32_t>(static_cast<uint32_t>(std::lround(frame_height * box.scale_y)), 1, options.height);
+		box.left	 = (options.width - box.width) / 2;
+		box.top		 = (options.height - box.height) / 2;
+		return box;
+}
+
+namespace detail
+{
+
+/**
+ * @brief Y'CbCr to R'G'B' in float, R = luma * (Y - black) + red_from_v * V'
+ * and so on, with the exact factors of the matrix and range.
+ */
+struct Float_Yuv_Coefficients
+{
+		float black				 = 0;
+		float luma				 = 1;
+		float red_from_v	 = 0;
+		float green_from_u = 0;
+		float green_from_v = 0;
+		float blue_from_u	 = 0;
+};
+
+inline Float_Yuv_Coefficients
+float_yuv_coefficients(const Color_Encoding& encoding)
+{
+		const bool bt709				= encoding.ycbcr_encoding == Ycbcr_Encoding::BT709;
+		const float kr					= bt709 ? 0.2126f : 0.299f;
+		const float kb					= bt709 ? 0.0722f : 0.114f;
+		const float kg					= 1 - kr - kb;
+		const bool limited			= encoding.range == Quantization_Range::Limited;
+		const float chroma_scale = limited ? 255.0f / 224 : 1.0f;
+
+		Float_Yuv_Coefficients coefficients;
+		coefficients.black				= limited ? 16.0f : 0.0f;
+		coefficients.luma					= limited ? 255.0f / 219 : 1.0f;
+		coefficients.red_from_v		= 2 * (1 - kr) * chroma_scale;
+		coefficients.blue_from_u	= 2 * (1 - kb) * chroma_scale;
+		coefficients.green_from_u = 2 * (1 - kb) * kb / kg * chroma_scale;
+		coefficients.green_from_v = 2 * (1 - kr) * kr / kg * chroma_scale;
+		return coefficients;
+}
+
+/**
+ * @brief Per channel value * gain + offset, normalization and int8
+ * quantization folded into one multiply add.
+ */
+struct Channel_Affine
+{
+		std::array<float, 3> gain{};
+		std::array<float, 3> offset{};
+};
+
+inline Channel_Affine
+channel_affine(const Tensor_Options& options, bool int8)
+{
+		Channel_Affine affine;
+		for(std::size_t channel = 0; channel < 3; ++channel)
+		{
+				affine.gain[channel]	 = 1.0f / options.standard_deviation[channel];
+				affine.offset[channel] = -options.mean[channel] / options.standard_deviation[channel];
+				if(int8)
+				{
+						affine.gain[channel] /= options.int8_scale;
+						affine.offset[channel] = affine.offset[channel] / options.int8_scale + float(options.int8_zero_point);
+				}
+		}
+		return affine;
+}
+
+template <typename Element>
+inline Element
+tensor_value(float value)
+{
+		if constexpr(std::is_same_v<Element, int8_t>)
+		{
+				/* Rounds to nearest by truncating a positive value, lround does not vectorize. */
+				return static_cast<int8_t>(static_cast<int>(std::clamp(value, -128.0f, 127.0f) + 128.5f) - 128);
+		}
+		else
+		{
+				return value;
+		}
+}
+
+/**
+ * @brief Horizontal taps of the content columns, one array per field so
+ * gathers load their indexes straight from it. Chroma indexes point at the U
+ * sample of the interleaved pair.
+ */
+struct Tensor_Columns
+{
+		std::vector<uint32_t> luma_first;
+		std::vector<uint32_t> luma_second;
+		std::vector<float> luma_weight;
+		std::vector<uint32_t> chroma_first;
+		std::vector<uint32_t> chroma_second;
+		std::vector<float> chroma_weight;
+};
+
+/**
+ * @brief Memory of the calls on one thread, kept between frames: once the
+ * sizes settled a call allocates nothing. The columns belong to the call
+ * running on the thread, the blended rows to the band it works on.
+ */
+struct Tensor_Scratch
+{
+		Tensor_Columns columns;
+		std::vector<float> blended_luma;
+		std::vector<float> blended_chroma;
+};
+
+inline Tensor_Scratch&
+tensor_scratch()
+{
+		static thread_local Tensor_Scratch scratch;
+		return scratch;
+}
+
+/**
+ * @brief One content row for the kernels: the vertically blended source rows,
+ * the column taps and the channel rows to write in R, G, B order.
+ */
+template <typename Element>
+struct Tensor_Row
+{
+		const float* luma							= nullptr;
+		const float* chroma						= nullptr;
+		const Tensor_Columns* columns = nullptr;
+		std::array<Element*, 3> out{};
+		Float_Yuv_Coefficients yuv;
+		std::array<float, 3> gain{};
+		std::array<float, 3> offset{};
+};
+
+/**
+ * @brief Samples [begin, count) of a row blended between two source rows, the
+ * tail the SIMD kernels leave and the whole row for the reference.
+ */
+inline void
+blend_rows_scalar(const uint8_t* top, const uint8_t* bottom, float weight, float* blended, uint32_t begin, uint32_t count)
+{
+		for(uint32_t x = begin; x < count; ++x)
+		{
+				blended[x] = top[x] + weight * (float(bottom[x]) - float(top[x]));
+		}
+}
+
+/**
+ * @brief Samples, converts, clamps and normalizes columns [begin, width). The
+ * SIMD kernels do the same float operations in the same order, without fused
+ * multiply adds, so on one compiler they write the same tensor.
+ */
+template <typename Element>
+inline void
+tensor_row_scalar(const Tensor_Row<Element>& row, uint32_t begin, uint32_t width)
+{
+		/* Copies, int8 stores could alias anything behind a reference. */
+		const auto yuv		 = row.yuv;
+		const auto gain		 = row.gain;
+		const auto offset	 = row.offset;
+		const auto out		 = row.out;
+		const auto& taps	 = *row.columns;
+		const float* luma	 = row.luma;
+		const float* uv		 = row.chroma;
+		for(uint32_t x = begin; x < width; ++x)
+		{
+				const float left	 = luma[taps.luma_first[x]];
+				const float y			 = left + taps.luma_weight[x] * (luma[taps.luma_second[x]] - left);
+				const float u_left = uv[taps.chroma_first[x]];
+				const float v_left = uv[taps.chroma_first[x] + 1];
+				const float u			 = u_left + taps.chroma_weight[x] * (uv[taps.chroma_second[x]] - u_left) - 128;
+				const float v			 = v_left + taps.chroma_weight[x] * (uv[taps.chroma_second[x] + 1] - v_left) - 128;
+
+				const float y_scaled = (y - yuv.black) * yuv.luma;
+				const float r				 = std::clamp(y_scaled + yuv.red_from_v * v, 0.0f, 255.0f);
+				const float g				 = std::clamp(y_scaled - yuv.green_from_u * u - yuv.green_from_v * v, 0.0f, 255.0f);
+				const float b				 = std::clamp(y_scaled + yuv.blue_from_u * u, 0.0f, 255.0f);
+				out[0][x]						 = tensor_value<Element>(r * gain[0] + offset[0]);
+				out[1][x]						 = tensor_value<Element>(g * gain[1] + offset[1]);
+				out[2][x]						 = tensor_value<Element>(b * gain[2] + offset[2]);
+		}
+}
+
+#ifdef CARTRACK_X86_KERNELS
+
+__attribute__((target("sse4.1"))) inline void
+blend_rows_sse4(const uint8_t* top, const uint8_t* bottom, float weight, float* blended, uint32_t count)
+{
+		const auto factor = _mm_set1_ps(weight);
+		uint32_t x				= 0;
+		for(; x + 4 <= count; x += 4)
+		{
+				int32_t top_bytes, bottom_bytes;
+				std::memcpy(&top_bytes, top + x, 4);
+				std::memcpy(&bottom_bytes, bottom + x, 4);
+				const auto upper = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(top_bytes)));
+				const auto lower = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bottom_bytes)));
+				_mm_storeu_ps(blended + x, _mm_add_ps(upper, _mm_mul_ps(factor, _mm_sub_ps(lower, upper))));
+		}
+		blend_rows_scalar(top, bottom, weight, blended, x, count);
+}
+
+/**
+ * @brief Samples of 4 columns, component 1 is V of the chroma pairs.
+ */
+__attribute__((target("sse4.1"))) inline __m128
+sample_columns_sse4(const float* row,
+										const uint32_t* first,
+										const uint32_t* second,
+										const float* weight,
+										uint32_t component)
+{
+		const auto left	 = _mm_setr_ps(row[first[0] + component],
+																 row[first[1] + component],
+																 row[first[2] + component],
+																 row[first[3] + component]);
+		const auto right = _mm_setr_ps(row[second[0] + component],
+																	 row[second[1] + component],
+																	 row[second[2] + component],
+																	 row[second[3] + component]);
+		return _mm_add_ps(left, _mm_mul_ps(_mm_loadu_ps(weight), _mm_sub_ps(right, left)));
+}
+
+/**
+ * @brief Normalized R, G, B of columns [x, x + 4).
+ */
+template <typename Element>
+__attribute__((target("sse4.1"))) inline void
+tensor_pixels_sse4(const Tensor_Row<Element>& row, uint32_t x, __m128 (&channels)[3])
+{
+		const auto& taps	 = *row.columns;
+		const auto& yuv		 = row.yuv;
+		const auto bias		 = _mm_set1_ps(128);
+		const auto zero		 = _mm_setzero_ps();
+		const auto maximum = _mm_set1_ps(255);
+		const auto y			 = sample_columns_sse4(
+				 row.luma, taps.luma_first.data() + x, taps.luma_second.data() + x, taps.luma_weight.data() + x, 0);
+		const auto u =
+				_mm_sub_ps(sample_columns_sse4(
+											 row.chroma, taps.chroma_first.data() + x, taps.chroma_second.data() + x, taps.chroma_weight.data() + x, 0),
+									 bias);
+		const auto v =
+				_mm_sub_ps(sample_columns_sse4(
+											 row.chroma, taps.chroma_first.data() + x, taps.chroma_second.data() + x, taps.chroma_weight.data() + x, 1),
+									 bias);
+
+		const auto y_scaled = _mm_mul_ps(_mm_sub_ps(y, _mm_set1_ps(yuv.black)), _mm_set1_ps(yuv.luma));
+		const __m128 rgb[3] = {
+				_mm_add_ps(y_scaled, _mm_mul_ps(_mm_set1_ps(yuv.red_from_v), v)),
+				_mm_sub_ps(_mm_sub_ps(y_scaled, _mm_mul_ps(_mm_set1_ps(yuv.green_from_u), u)),
+									 _mm_mul_ps(_mm_set1_ps(yuv.green_from_v), v)),
+				_mm_add_ps(y_scaled, _mm_mul_ps(_mm_set1_ps(yuv.blue_from_u), u)),
+		};
+		for(int channel = 0; channel < 3; ++channel)
+		{
+				const auto clamped = _mm_min_ps(_mm_max_ps(rgb[channel], zero), maximum);
+				channels[channel]	 = _mm_add_ps(_mm_mul_ps(clamped, _mm_set1_ps(row.gain[channel])), _mm_set1_ps(row.offset[channel]));
+		}
+}
+
+/**
+ * @brief tensor_value of 8 lanes: clamped, rounded by truncating the positive
+ * value and saturated to int8.
+ */
+__attribute__((target("sse4.1"))) inline __m128i
+quantize_sse4(__m128 low, __m128 high)
+{
+		const auto minimum = _mm_set1_ps(-128.0f);
+		const auto maximum = _mm_set1_ps(127.0f);
+		const auto half		 = _mm_set1_ps(128.5f);
+		const auto bias		 = _mm_set1_epi32(128);
+		const auto first	 = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_min_ps(_mm_max_ps(low, minimum), maximum), half)), bias);
+		const auto second =
+				_mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_min_ps(_mm_max_ps(high, minimum), maximum), half)), bias);
+		return _mm_packs_epi16(_mm_packs_epi32(first, second), _mm_setzero_si128());
+}
+
+/**
+ * @brief The row comes by value, a float store could alias its factors
+ * behind a reference and force a reload per column.
+ */
+template <typename Element>
+__attribute__((target("sse4.1"))) inline void
+tensor_row_sse4(const Tensor_Row<Element> row, uint32_t width)
+{
+		uint32_t x = 0;
+		for(; x + 8 <= width; x += 8)
+		{
+				__m128 low[3], high[3];
+				tensor_pixels_sse4(row, x, low);
+				tensor_pixels_sse4(row, x + 4, high);
+				for(int channel = 0; channel < 3; ++channel)
+				{
+						if constexpr(std::is_same_v<Element, int8_t>)
+						{
+								_mm_storel_epi64(reinterpret_cast<__m128i*>(row.out[channel] + x), quantize_sse4(low[channel], high[channel]));
+						}
+						else
+						{
+								_mm_storeu_ps(row.out[channel] + x, low[channel]);
+								_mm_storeu_ps(row.out[channel] + x + 4, high[channel]);
+						}
+				}
+		}
+		tensor_row_scalar(row, x, width);
+}
+
+__attribute__((target("avx2"))) inline void
+blend_rows_avx2(const uint8_t* top, const uint8_t* bottom, float weight, float* blended, uint32_t count)
+{
+		const auto factor = _mm256_set1_ps(weight);
+		uint32_t x				= 0;
+		for(; x + 8 <= count; x += 8)
+		{
+				const auto upper =
+						_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(top + x))));
+				const auto lower =
+						_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(bottom + x))));
+				_mm256_storeu_ps(blended + x, _mm256_add_ps(upper, _mm256_mul_ps(factor, _mm256_sub_ps(lower, upper))));
+		}
+		blend_rows_scalar(top, bottom, weight, blended, x, count);
+}
+
+/**
+ * @brief Samples of 8 columns through gathers.
+ */
+__attribute__((target("avx2"))) inline __m256
+sample_columns_avx2(const float* row,
+										const uint32_t* first,
+										const uint32_t* second,
+										const float* weight,
+										uint32_t component)
+{
+		const auto left	 = _mm256_i32gather_ps(row + component, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first)), 4);
+		const auto right = _mm256_i32gather_ps(row + component, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(second)), 4);
+		return _mm256_add_ps(left, _mm256_mul_ps(_mm256_loadu_ps(weight), _mm256_sub_ps(right, left)));
+}
+
+template <typename Element>
+__attribute__((target("avx2"))) inline void
+tensor_row_avx2(const Tensor_Row<Element> row, uint32_t width)
+{
+		const auto& taps	 = *row.columns;
+		const auto& yuv		 = row.yuv;
+		const auto bias		 = _mm256_set1_ps(128);
+		const auto zero		 = _mm256_setzero_ps();
+		const auto maximum = _mm256_set1_ps(255);
+		uint32_t x				 = 0;
+		for(; x + 8 <= width; x += 8)
+		{
+				const auto y = sample_columns_avx2(
+						row.luma, taps.luma_first.data() + x, taps.luma_second.data() + x, taps.luma_weight.data() + x, 0);
+				const auto u = _mm256_sub_ps(sample_columns_avx2(row.chroma,
+																												 taps.chroma_first.data() + x,
+																												 taps.chroma_second.data() + x,
+																												 taps.chroma_weight.data() + x,
+																												 0),
+																		 bias);
+				const auto v = _mm256_sub_ps(sample_columns_avx2(row.chroma,
+																												 taps.chroma_first.data() + x,
+																												 taps.chroma_second.data() + x,
+																												 taps.chroma_weight.data() + x,
+																												 1),
+																		 bias);
+
+				const auto y_scaled = _mm256_mul_ps(_mm256_sub_ps(y, _mm256_set1_ps(yuv.black)), _mm256_set1_ps(yuv.luma));
+				const __m256 rgb[3] = {
+						_mm256_add_ps(y_scaled, _mm256_mul_ps(_mm256_set1_ps(yuv.red_from_v), v)),
+						_mm256_sub_ps(_mm256_sub_ps(y_scaled, _mm256_mul_ps(_mm256_set1_ps(yuv.green_from_u), u)),
+													_mm256_mul_ps(_mm256_set1_ps(yuv.green_from_v), v)),
+						_mm256_add_ps(y_scaled, _mm256_mul_ps(_mm256_set1_ps(yuv.blue_from_u), u)),
+				};
+				for(int channel = 0; channel < 3; ++channel)
+				{
+						const auto clamped = _mm256_min_ps(_mm256_max_ps(rgb[channel], zero), maximum);
+						const auto value	 = _mm256_add_ps(_mm256_mul_ps(clamped, _mm256_set1_ps(row.gain[channel])),
+																							 _mm256_set1_ps(row.offset[channel]));
+						if constexpr(std::is_same_v<Element, int8_t>)
+						{
+								_mm_storel_epi64(reinterpret_cast<__m128i*>(row.out[channel] + x),
+																 quantize_sse4(_mm256_castps256_ps128(value), _mm256_extractf128_ps(value, 1)));
+						}
+						else
+						{
+								_mm256_storeu_ps(row.out[channel] + x, value);
+						}
+				}
+		}
+		tensor_row_scalar(row, x, width);
+}
+
+#endif
+
+#ifdef __ARM_NEON
+
+inline void
+blend_rows_neon(const uint8_t* top, const uint8_t* bottom, float weight, float* blended, uint32_t count)
+{
+		const auto factor = vdupq_n_f32(weight);
+		uint32_t x				= 0;
+		for(; x + 8 <= count; x += 8)
+		{
+				const auto upper = vmovl_u8(vld1_u8(top + x));
+				const auto lower = vmovl_u8(vld1_u8(bottom + x));
+				for(int half = 0; half < 2; ++half)
+				{
+						const auto up		 = vcvtq_f32_u32(vmovl_u16(half == 0 ? vget_low_u16(upper) : vget_high_u16(upper)));
+						const auto down	 = vcvtq_f32_u32(vmovl_u16(half == 0 ? vget_low_u16(lower) : vget_high_u16(lower)));
+						/* Multiply, then add: a fused vfmaq would round differently from the reference. */
+						vst1q_f32(blended + x + 4 * half, vaddq_f32(up, vmulq_f32(factor, vsubq_f32(down, up))));
+				}
+		}
+		blend_rows_scalar(top, bottom, weight, blended, x, count);
+}
+
+inline float32x4_t
+sample_columns_neon(const float* row,
+										const uint32_t* first,
+										const uint32_t* second,
+										const float* weight,
+										uint32_t component)
+{
+		const float left_samples[4]	 = {row[first[0] + component],
+																		row[first[1] + component],
+																		row[first[2] + component],
+																		row[first[3] + component]};
+		const float right_samples[4] = {row[second[0] + component],
+																		row[second[1] + component],
+																		row[second[2] + component],
+																		row[second[3] + component]};
+		const auto left							 = vld1q_f32(left_samples);
+		return vaddq_f32(left, vmulq_f32(vld1q_f32(weight), vsubq_f32(vld1q_f32(right_samples), left)));
+}
+
+template <typename Element>
+inline void
+tensor_pixels_neon(const Tensor_Row<Element>& row, uint32_t x, float32x4_t (&channels)[3])
+{
+		const auto& taps	 = *row.columns;
+		const auto& yuv		 = row.yuv;
+		const auto bias		 = vdupq_n_f32(128);
+		const auto zero		 = vdupq_n_f32(0);
+		const auto maximum = vdupq_n_f32(255);
+		const auto y			 = sample_columns_neon(
+				 row.luma, taps.luma_first.data() + x, taps.luma_second.data() + x, taps.luma_weight.data() + x, 0);
+		const auto u =
+				vsubq_f32(sample_columns_neon(
+											row.chroma, taps.chroma_first.data() + x, taps.chroma_second.data() + x, taps.chroma_weight.data() + x, 0),
+									bias);
+		const auto v =
+				vsubq_f32(sample_columns_neon(
+											row.chroma, taps.chroma_first.data() + x, taps.chroma_second.data() + x, taps.chroma_weight.data() + x, 1),
+									bias);
+
+		const auto y_scaled			 = vmulq_f32(vsubq_f32(y, vdupq_n_f32(yuv.black)), vdupq_n_f32(yuv.luma));
+		const float32x4_t rgb[3] = {
+				vaddq_f32(y_scaled, vmulq_f32(vdupq_n_f32(yuv.red_from_v), v)),
+				vsubq_f32(vsubq_f32(y_scaled, vmulq_f32(vdupq_n_f32(yuv.green_from_u), u)),
+									vmulq_f32(vdupq_n_f32(yuv.green_from_v), v)),
+				vaddq_f32(y_scaled, vmulq_f32(vdupq_n_f32(yuv.blue_from_u), u)),
+		};
+		for(int channel = 0; channel < 3; ++channel)
+		{
+				const auto clamped = vminq_f32(vmaxq_f32(rgb[channel], zero), maximum);
+				channels[channel]	 = vaddq_f32(vmulq_f32(clamped, vdupq_n_f32(row.gain[channel])), vdupq_n_f32(row.offset[channel]));
+		}
+}
+
+/**
+ * @brief tensor_value of 8 lanes, vcvtq truncates like the cast.
+ */
+inline int8x8_t
+quantize_neon(float32x4_t low, float32x4_t high)
+{
+		const auto minimum = vdupq_n_f32(-128.0f);
+		const auto maximum = vdupq_n_f32(127.0f);
+		const auto half		 = vdupq_n_f32(128.5f);
+		const auto bias		 = vdupq_n_s32(128);
+		const auto first	 = vsubq_s32(vcvtq_s32_f32(vaddq_f32(vminq_f32(vmaxq_f32(low, minimum), maximum), half)), bias);
+		const auto second	 = vsubq_s32(vcvtq_s32_f32(vaddq_f32(vminq_f32(vmaxq_f32(high, minimum), maximum), half)), bias);
+		return vqmovn_s16(vcombine_s16(vmovn_s32(first), vmovn_s32(second)));
+}
+
+template <typename Element>
+inline void
+tensor_row_neon(const Tensor_Row<Element> row, uint32_t width)
+{
+		uint32_t x = 0;
+		for(; x + 8 <= width; x += 8)
+		{
+				float32x4_t low[3], high[3];
+				tensor_pixels_neon(row, x, low);
+				tensor_pixels_neon(row, x + 4, high);
+				for(int channel = 0; channel < 3; ++channel)
+				{
+						if constexpr(std::is_same_v<Element, int8_t>)
+						{
+								vst1_s8(row.out[channel] + x, quantize_neon(low[channel], high[channel]));
+						}
+						else
+						{
+								vst1q_f32(row.out[channel] + x, low[channel]);
+								vst1q_f32(row.out[channel] + x + 4, high[channel]);
+						}
+				}
+		}
+		tensor_row_scalar(row, x, width);
+}
+
+#endif
+
+inline void
+blend_rows(Color_Conversion_Kernel kernel, const uint8_t* top, const uint8_t* bottom, float weight, float* blended, uint32_t count)
+{
+		switch(kernel)
+		{
+#ifdef CARTRACK_X86_KERNELS
+				case Color_Conversion_Kernel::SSE4:
+						blend_rows_sse4(top, bottom, weight, blended, count);
+						return;
+				case Color_Conversion_Kernel::AVX2:
+						blend_rows_avx2(top, bottom, weight, blended, count);
+						return;
+#endif
+#ifdef __ARM_NEON
+				case Color_Conversion_Kernel::NEON:
+						blend_rows_neon(top, bottom, weight, blended, count);
+						return;
+#endif
+				default:
+						blend_rows_scalar(top, bottom, weight, blended, 0, count);
+						return;
+		}
+}
+
+template <typename Element>
+inline void
+tensor_row(Color_Conversion_Kernel kernel, const Tensor_Row<Element>& row, uint32_t width)
+{
+		switch(kernel)
+		{
+#ifdef CARTRACK_X86_KERNELS
+				case Color_Conversion_Kernel::SSE4:
+						tensor_row_sse4(row, width);
+						return;
+				case Color_Conversion_Kernel::AVX2:
+						tensor_row_avx2(row, width);
+						return;
+#endif
+#ifdef __ARM_NEON
+				case Color_Conversion_Kernel::NEON:
+						tensor_row_neon(row, width);
+						return;
+#endif
+				default:
+						tensor_row_scalar(row, 0, width);
+						return;
+		}
+}
+
+/**
+ * @brief Writes output rows [first_row, first_row + rows) of every channel.
+ * Content rows blend the two source rows around them into float rows, then
+ * one pass samples the columns, converts, clamps and normalizes. All of it
+ * stays in L1.
+ */
+template <typename Element>
+inline void
+preprocess_band(const Image_View& source,
+								Element* tensor,
+								const Tensor_Options& options,
+								const Letterbox& box,
+								const Tensor_Columns& columns,
+								uint32_t first_row,
+								uint32_t rows)
+{
+		constexpr bool int8			 = std::is_same_v<Element, int8_t>;
+		const auto affine				 = channel_affine(options, int8);
+		const std::size_t plane	 = std::size_t(options.width) * options.height;
+		const int red						 = options.bgr ? 2 : 0;
+		const int blue					 = options.bgr ? 0 : 2;
+		const auto& chroma_plane = source.plane(1);
+
+		std::array<Element, 3> padding{};
+		for(std::size_t channel = 0; channel < 3; ++channel)
+		{
+				padding[channel] = tensor_value<Element>(options.pad_value * affine.gain[channel] + affine.offset[channel]);
+		}
+
+		auto& scratch = tensor_scratch();
+		scratch.blended_luma.resize(source.width);
+		scratch.blended_chroma.resize(2 * std::size_t(chroma_plane.width));
+
+		Tensor_Row<Element> row;
+		row.luma		= scratch.blended_luma.data();
+		row.chroma	= scratch.blended_chroma.data();
+		row.columns = &columns;
+		row.yuv			= float_yuv_coefficients(source.color_encoding);
+		row.gain		= {affine.gain[red], affine.gain[1], affine.gain[blue]};
+		row.offset	= {affine.offset[red], affine.offset[1], affine.offset[blue]};
+		for(uint32_t y = first_row; y < first_row + rows; ++y)
+		{
+				std::array<Element*, 3> out;
+				for(std::size_t channel = 0; channel < 3; ++channel)
+				{
+						out[channel] = tensor + channel * plane + std::size_t(y) * options.width;
+				}
+				if(y < box.top or y >= box.top + box.height)
+				{
+						for(std::size_t channel = 0; channel < 3; ++channel)
+						{
+								std::fill_n(out[channel], options.width, padding[channel]);
+						}
+						continue;
+				}
+
+				const float step_y		= float(source.height) / float(box.height);
+				const auto luma_row		= resample_tap(float(y - box.top), step_y, source.height, 1, false);
+				const auto chroma_row = resample_tap(float(y - box.top), step_y, chroma_plane.height, 2, false);
+				blend_rows(options.kernel,
+									 source.plane(0).row(luma_row.first),
+									 source.plane(0).row(luma_row.second),
+									 luma_row.weight,
+									 scratch.blended_luma.data(),
+									 source.width);
+				blend_rows(options.kernel,
+									 chroma_plane.row(chroma_row.first),
+									 chroma_plane.row(chroma_row.second),
+									 chroma_row.weight,
+									 scratch.blended_chroma.data(),
+									 2 * chroma_plane.width);
+
+				for(std::size_t channel = 0; channel < 3; ++channel)
+				{
+						std::fill_n(out[channel], box.left, padding[channel]);
+						std::fill_n(out[channel] + box.left + box.width, options.width - box.left - box.width, padding[channel]);
+				}
+				row.out = {out[red] + box.left, out[1] + box.left, out[blue] + box.left};
+				tensor_row(options.kernel, row, box.width);
+		}
+}
+
+template <typename Element>
+inline Letterbox
+preprocess_to_tensor(const Image_View& source, std::span<Element> tensor, const Tensor_Options& options)
+{
+		if(source.pixel_format != Pixel_Format::NV12 and source.pixel_format != Pixel_Format::NV12sp)
+		{
+				throw std::runtime_error("preprocess_to_tensor source is not NV12");
+		}
+		if(source.empty() or source.width == 0 or source.height == 0)
+		{
+				throw std::runtime_error("preprocess_to_tensor source is empty");
+		}
+		if(options.width == 0 or options.height == 0
+			 or tensor.size() < 3 * std::size_t(options.width) * options.height)
+		{
+				throw std::runtime_error("preprocess_to_tensor tensor is smaller than 3 x width x height");
+		}
+		if(not color_conversion_kernel_available(options.kernel))
+		{
+				throw std::runtime_error(std::string{"Tensor kernel not available: "}
+																 + color_conversion_kernel_name(options.kernel));
+		}
+
+		const auto box					 = make_letterbox(source.width, source.height, options);
+		const float step_x			 = float(source.width) / float(box.width);
+		const auto& chroma_plane = source.plane(1);
+		auto& columns						 = tensor_scratch().columns;
+		columns.luma_first.resize(box.width);
+		columns.luma_second.resize(box.width);
+		columns.luma_weight.resize(box.width);
+		columns.chroma_first.resize(box.width);
+		columns.chroma_second.resize(box.width);
+		columns.chroma_weight.resize(box.width);
+		for(uint32_t x = 0; x < box.width; ++x)
+		{
+				const auto luma						= resample_tap(float(x), step_x, source.width, 1, true);
+				const auto chroma					= resample_tap(float(x), step_x, chroma_plane.width, 2, true);
+				columns.luma_first[x]			= luma.first;
+				columns.luma_second[x]		= luma.second;
+				columns.luma_weight[x]		= luma.weight;
+				columns.chroma_first[x]		= 2 * chroma.first;
+				columns.chroma_second[x]	= 2 * chroma.second;
+				columns.chroma_weight[x]	= chroma.weight;
+		}
+
+		/* A band reads about two source rows per output row and writes three channel rows. */
+		const std::size_t row_bytes = 2 * (source.plane(0).stride + chroma_plane.stride) * source.height / box.height
+																	+ 3 * std::size_t(options.width) * sizeof(Element);
+		for_each_row_band(options.height,
+											band_rows(row_bytes, 1, options.parallelism),
+											options.parallelism,
+											[&](uint32_t first_row, uint32_t rows)
+											{ preprocess_band(source, tensor.data(), options, box, columns, first_row, rows); });
+		return box;
+}
+
+} // namespace detail
+
+/**
+ * @brief NV12 frame to a letterboxed, normalized float CHW tensor in one pass:
+ * each output row samples the frame bilinearly, converts with the frame's
+ * matrix and range and normalizes before it is written. The source is read
+ * once at most, the tensor written once, nothing in between leaves the cache.
+ *
+ * Works on the driver planes directly, e.g. make_image_view(backend.image_layout(),
+ * backend.get_frame_data()). tensor needs 3 x width x height elements.
+ */
+inline Letterbox
+preprocess_to_tensor(const Image_View& source, std::span<float> tensor, const Tensor_Options& options)
+{
+		return detail::preprocess_to_tensor(source, tensor, options);
+}
+
+/**
+ * @brief Same, quantized to int8 with options.int8_scale and int8_zero_point.
+ */
+inline Letterbox
+preprocess_to_tensor(const Image_View& source, std::span<int8_t> tensor, const Tensor_Options& options)
+{
+		return detail::preprocess_to_tensor(source, tensor, options);
+}
+
+} // namespace Cartrack
+
+#endif // TENSOR_PREPROCESSING_HPP
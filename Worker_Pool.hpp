@@ -0,0 +1,303 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace Cartrack
+{
+
+/**
+ * @brief Fixed set of threads running queued jobs in submission order, for
+ * CPU bound stages like compression and decoding that must stay off the
+ * capture thread.
+ *
+ * Jobs report their results themselves, the pool only runs them. The
+ * destructor finishes every queued job before joining.
+ */
+class Worker_Pool
+{
+	public:
+		/**
+		 * @brief 0 threads means one per hardware thread.
+		 */
+		explicit Worker_Pool(unsigned int num_threads = 0)
+		{
+				if(num_threads == 0)
+				{
+						num_threads = std::max(1u, std::thread::hardware_concurrency());
+				}
+				_threads_.reserve(num_threads);
+				for(unsigned int thread = 0; thread < num_threads; ++thread)
+				{
+						_threads_.emplace_back(&Worker_Pool::run, this);
+				}
+		}
+
+		~Worker_Pool()
+		{
+				{
+						std::lock_guard lock(_mutex_);
+						_stopping_ = true;
+				}
+				_job_available_.notify_all();
+				for(auto& thread : _threads_)
+				{
+						thread.join();
+				}
+		}
+
+		Worker_Pool(const Worker_Pool&)						 = delete;
+		Worker_Pool& operator=(const Worker_Pool&) = delete;
+
+		void submit(std::function<void()> job)
+		{
+				{
+						std::lock_guard lock(_mutex_);
+						_jobs_.push_back(std::move(job));
+				}
+				_job_available_.notify_one();
+		}
+
+		/**
+		 * @brief Blocks until every job submitted so far has finished.
+		 */
+		void wait()
+		{
+				std::unique_lock lock(_mutex_);
+				_idle_.wait(lock, [this] { return _jobs_.empty() and _running_ == 0; });
+		}
+
+		[[nodiscard]] std::size_t size() const
+		{
+				return _threads_.size();
+		}
+
+	private:
+		void run()
+		{
+				std::unique_lock lock(_mutex_);
+				while(true)
+				{
+						_job_available_.wait(lock, [this] { return _stopping_ or not _jobs_.empty(); });
+						if(_jobs_.empty())
+						{
+								return;
+						}
+						auto job = std::move(_jobs_.front());
+						_jobs_.pop_front();
+						++_running_;
+						lock.unlock();
+						job();
+						lock.lock();
+						--_running_;
+						if(_jobs_.empty() and _running_ == 0)
+						{
+								_idle_.notify_all();
+						}
+				}
+		}
+
+	private:
+		std::vector<std::thread> _threads_;
+		std::deque<std::function<void()>> _jobs_;
+		std::mutex _mutex_;
+		std::condition_variable _job_available_;
+		std::condition_variable _idle_;
+		std::size_t _running_ = 0;
+		bool _stopping_				= false;
+};
+
+/**
+ * @brief Slots of work filled by one producer, processed by a Worker_Pool
+ * and handed to a consumer thread in the order they were queued. It is the
+ * shape of the compressing recorder and the MJPEG decoder: the capture thread
+ * copies a frame into a free slot and returns, jobs finish out of order, the
+ * consumer writes or delivers frames in capture order.
+ *
+ * The pipeline only hands out slot indexes, the owner keeps the slots. A slot
+ * is acquired, enqueued with the number of jobs that will complete it, given
+ * to the consumer once all of them did, and free again after release. When no
+ * slot is free acquire fails, the producer never waits for the workers.
+ *
+ * Jobs and the consumer touch the owner's slots, so the owner declares the
+ * pipeline after them and closes it first.
+ */
+class Ordered_Slot_Pipeline
+{
+	public:
+		using Consumer = std::function<void(std::size_t slot)>;
+
+		/**
+		 * @brief 0 threads means one per hardware thread.
+		 */
+		Ordered_Slot_Pipeline(std::size_t num_slots, unsigned int num_threads, Consumer consumer)
+				: _consumer_(std::move(consumer))
+				, _outstanding_(num_slots, 0)
+				, _pool_(num_threads)
+		{
+				for(std::size_t slot = 0; slot < num_slots; ++slot)
+				{
+						_free_slots_.push_back(slot);
+				}
+				_consumer_thread_ = std::thread(&Ordered_Slot_Pipeline::consume_loop, this);
+		}
+
+		~Ordered_Slot_Pipeline()
+		{
+				close();
+		}
+
+		Ordered_Slot_Pipeline(const Ordered_Slot_Pipeline&)						 = delete;
+		Ordered_Slot_Pipeline& operator=(const Ordered_Slot_Pipeline&) = delete;
+
+		/**
+		 * @brief A free slot, nothing when all are taken or the pipeline is closed.
+		 * Only the caller touches the slot until it is enqueued.
+		 */
+		std::optional<std::size_t> acquire()
+		{
+				std::lock_guard lock(_mutex_);
+				if(_closed_ or _free_slots_.empty())
+				{
+						return std::nullopt;
+				}
+				const auto slot = _free_slots_.front();
+				_free_slots_.pop_front();
+				return slot;
+		}
+
+		/**
+		 * @brief Queues an acquired slot behind the ones queued before it. It goes
+		 * to the consumer after complete was called jobs times.
+		 */
+		void enqueue(std::size_t slot, unsigned int jobs)
+		{
+				{
+						std::lock_guard lock(_mutex_);
+						_outstanding_[slot] = jobs;
+						_queued_.push_back(slot);
+				}
+				_slot_ready_.notify_one();
+		}
+
+		void submit(std::function<void()> job)
+		{
+				_pool_.submit(std::move(job));
+		}
+
+		/**
+		 * @brief One job of the slot finished. True for the last one, the slot
+		 * may be with the consumer as soon as this returns.
+		 */
+		bool complete(std::size_t slot)
+		{
+				std::lock_guard lock(_mutex_);
+				if(--_outstanding_[slot] != 0)
+				{
+						return false;
+				}
+				_slot_ready_.notify_one();
+				return true;
+		}
+
+		/**
+		 * @brief Makes a slot free again, from the consumer or whenever the owner
+		 * no longer needs its contents.
+		 */
+		void release(std::size_t slot)
+		{
+				std::lock_guard lock(_mutex_);
+				_free_slots_.push_back(slot);
+		}
+
+		/**
+		 * @brief Waits until every slot enqueued so far went through the consumer.
+		 */
+		void flush()
+		{
+				std::unique_lock lock(_mutex_);
+				_consumed_.wait(lock, [this] { return _queued_.empty() and not _consuming_; });
+		}
+
+		/**
+		 * @brief Flushes and stops the consumer thread. Returns false when it was
+		 * already closed.
+		 */
+		bool close()
+		{
+				{
+						std::lock_guard lock(_mutex_);
+						if(_closed_)
+						{
+								return false;
+						}
+				}
+				flush();
+				{
+						std::lock_guard lock(_mutex_);
+						_closed_ = true;
+				}
+				_slot_ready_.notify_all();
+				_consumer_thread_.join();
+				return true;
+		}
+
+		[[nodiscard]] std::size_t workers() const
+		{
+				return _pool_.size();
+		}
+
+	private:
+		void consume_loop()
+		{
+				std::unique_lock lock(_mutex_);
+				while(true)
+				{
+						_slot_ready_.wait(lock,
+															[this] { return _closed_ or (not _queued_.empty() and _outstanding_[_queued_.front()] == 0); });
+						if(_queued_.empty() or _outstanding_[_queued_.front()] != 0)
+						{
+								if(_closed_)
+								{
+										return;
+								}
+								continue;
+						}
+						const auto slot = _queued_.front();
+						_queued_.pop_front();
+						_consuming_ = true;
+						lock.unlock();
+
+						_consumer_(slot);
+
+						lock.lock();
+						_consuming_ = false;
+						_consumed_.notify_all();
+				}
+		}
+
+	private:
+		Consumer _consumer_;
+		std::deque<std::size_t> _free_slots_;
+		std::deque<std::size_t> _queued_;
+		std::vector<unsigned int> _outstanding_;
+		bool _consuming_ = false;
+		bool _closed_		 = false;
+		std::mutex _mutex_;
+		std::condition_variable _slot_ready_;
+		std::condition_variable _consumed_;
+		std::thread _consumer_thread_;
+		/* Last, its jobs finish before anything else here goes away. */
+		Worker_Pool _pool_;
+};
+
+} // namespace Cartrack
+
+#endif // WORKER_POOL_HPP
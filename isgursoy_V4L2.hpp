@@ -2,11 +2,19 @@
 #define ISGURSOY_V4L2_HPP
 
 #include "Abstract_Capture_Backend.hpp"
+#include "Device_Discovery.hpp"
+#include "Device_IO.hpp"
+#include "Device_Profile.hpp"
+#include "Frame_Handle.hpp"
+#include "Image_View.hpp"
+#include "Lock_Free_Queue.hpp"
+#include "Pixel_Format_Descriptor.hpp"
 
 #include <fcntl.h>
 #include <linux/videodev2.h>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -16,7 +24,12 @@
 #include <array>
 #include <cstring>
 #include <numeric>
+#include <optional>
+#include <span>
+#include <unordered_map>
 #include <compare>
+#include <ctime>
+#include <future>
 #include <unistd.h>
 
 namespace Cartrack
@@ -50,26 +63,74 @@ xioctl(int fd, int request, void* arg)
 		return r;
 }
 
+/**
+ * @brief Outcome of a control change submitted with V4L2_Backend::submit_control.
+ *
+ * first_sequence is the driver sequence number of the first frame whose
+ * timestamp is not older than the moment the driver accepted the change. Sensors
+ * with pipelined exposure may need a frame or two more to show it, that is
+ * beyond what V4L2 reports.
+ */
+struct Control_Result
+{
+		bool applied								= false;
+		int error										= 0;
+		uint32_t first_sequence			= 0;
+		uintmax_t first_frame_order = 0;
+};
+
+/**
+ * @brief One control of a batch, for VIDIOC_G_EXT_CTRLS and VIDIOC_S_EXT_CTRLS.
+ */
+struct Control_Value
+{
+		uint32_t id		= 0;
+		int32_t value = 0;
+};
+
 class V4L2_Backend : public Capture_Backend
 {
 	public:
-		explicit V4L2_Backend(const Stream_Configuration& params)
+		/**
+		 * @brief io is where system calls on the device go, inject a
+		 * Fake_V4L2_Device to run without hardware.
+		 */
+		explicit V4L2_Backend(const Stream_Configuration& params,
+													std::shared_ptr<Device_IO> io = linux_device_io())
+				: _io_(std::move(io))
 		{
 				auto& _configuration_ = this->_configuration_;
 				_configuration_				= params;
-				if(pixel_formats_fourcc.find(_configuration_.pixel_format)
-					 == pixel_formats_fourcc.end())
+				const auto& descriptor = describe(_configuration_.pixel_format);
+				if(not descriptor.valid())
 				{
 						throw std::runtime_error("Pixel format not supported");
 				}
 
+				if(not descriptor.contiguous and _configuration_.v4l2.contiguous)
+				{
+						throw std::runtime_error(
+								"Pixel format keeps its planes in separate buffers, v4l2.contiguous must be false");
+				}
+
 				_buffer_plane_type_ = get_buffer_type_v4l2();
-				_pixel_format_ = v4l2_fourcc(pixel_formats_fourcc.at(_configuration_.pixel_format)[0],
-												pixel_formats_fourcc.at(_configuration_.pixel_format)[1],
-												pixel_formats_fourcc.at(_configuration_.pixel_format)[2],
-												pixel_formats_fourcc.at(_configuration_.pixel_format)[3]);
+				_pixel_format_			= descriptor.v4l2_pixel_format();
 				this->_frame_order_ = 0;
-				_device_dev_path_		= "/dev/video" + std::to_string(_configuration_.device_index);
+				if(_configuration_.device_identity.empty())
+				{
+						_device_dev_path_ = "/dev/video" + std::to_string(_configuration_.device_index);
+				}
+				else
+				{
+						const auto node = Device_Discovery::resolve(_configuration_.device_identity, *_io_);
+						if(not node)
+						{
+								throw std::runtime_error("No capture device found for "
+																				 + _configuration_.device_identity);
+						}
+						_device_dev_path_							= node->path;
+						_configuration_.device_index = node->index;
+				}
 				if(is_mjpeg())
 				{
 						_limit_range_ = false;
@@ -78,6 +139,21 @@ class V4L2_Backend : public Capture_Backend
 				setup_device();
 
 				setup_buffering();
+				_leases_->device_file_descriptor = _device_file_descriptor_;
+				_leases_->io										 = _io_;
+
+				if(get_memory_mapping_type_v4l2() == V4L2_MEMORY_USERPTR)
+				{
+						_grab_frame_ = &V4L2_Backend::grab_userptr_frame;
+				}
+				else if(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE == _buffer_plane_type_)
+				{
+						_grab_frame_ = &V4L2_Backend::grab_mapped_frame<V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE>;
+				}
+				else
+				{
+						_grab_frame_ = &V4L2_Backend::grab_mapped_frame<V4L2_BUF_TYPE_VIDEO_CAPTURE>;
+				}
 
 				if(-1
 					 == xioctl(
@@ -89,6 +165,25 @@ class V4L2_Backend : public Capture_Backend
 
 		~V4L2_Backend() override
 		{
+				{
+						/* Handles still alive from here on must not queue into a closing device. */
+						std::lock_guard lock(_leases_->mutex);
+						_leases_->open = false;
+				}
+				if(const auto leased = _leases_->outstanding.load(); leased)
+				{
+						std::cerr << leased << " frame handles outlive their V4L2_Backend" << std::endl;
+				}
+
+				while(auto command = _control_commands_.try_pop())
+				{
+						command->completion.set_value(Control_Result{.error = ECANCELED});
+				}
+				for(auto& awaiting : _controls_awaiting_frame_)
+				{
+						awaiting.completion.set_value(awaiting.result);
+				}
+
 				if(-1
 					 == xioctl(_device_file_descriptor_, VIDIOC_STREAMOFF, &this->_buffer_plane_type_))
 				{
@@ -104,7 +199,7 @@ class V4L2_Backend : public Capture_Backend
 								for(int j = 0; j < planes_count; ++j)
 								{
 										if(-1
-											 == munmap(_mapped_buffers_[i][j].data(), _mapped_buffers_[i][j].size()))
+											 == _io_->munmap(_mapped_buffers_[i][j].data(), _mapped_buffers_[i][j].size()))
 										{
 												std::cerr << "munmap failed" << std::endl;
 										}
@@ -116,14 +211,14 @@ class V4L2_Backend : public Capture_Backend
 				{
 						for(const auto& exbuf : planes)
 						{
-								if(-1 == close(exbuf.first))
+								if(-1 == _io_->close(exbuf.first))
 								{
 										std::cerr << "close failed" << std::endl;
 								}
 						}
 				}
 
-				if(-1 == close(_device_file_descriptor_))
+				if(-1 == _io_->close(_device_file_descriptor_))
 				{
 						std::cerr << "close failed" << std::endl;
 				}
@@ -135,7 +230,7 @@ class V4L2_Backend : public Capture_Backend
 				auto& _configuration_ = this->_configuration_;
 				struct stat st;
 
-				if(stat(_device_dev_path_.c_str(), &st) == -1)
+				if(_io_->stat(_device_dev_path_, st) == -1)
 				{
 						throw std::runtime_error("Cannot identify camera device: " + _device_dev_path_
 																		 + " -> " + strerror(errno));
@@ -146,7 +241,7 @@ class V4L2_Backend : public Capture_Backend
 						throw std::runtime_error("Camera device is not a device: " + _device_dev_path_);
 				}
 
-				if(_device_file_descriptor_ = open(_device_dev_path_.c_str(), O_RDWR | O_NONBLOCK, 0);
+				if(_device_file_descriptor_ = _io_->open(_device_dev_path_, O_RDWR | O_NONBLOCK);
 					 -1 == _device_file_descriptor_)
 				{
 						throw std::runtime_error("Cannot open camera device " + _device_dev_path_ + " -> "
@@ -181,6 +276,26 @@ class V4L2_Backend : public Capture_Backend
 						throw std::runtime_error("Camera device does not support streaming i/o.");
 				}
 
+				if(_configuration_.v4l2.device_profile_cache)
+				{
+						_device_profile_ =
+								Device_Profile::load_or_probe(*_io_, _device_file_descriptor_, _device_dev_path_, v4l2_environment);
+
+						if(const auto choice = _device_profile_->best_mode(_configuration_); not choice)
+						{
+								std::cerr << "Device profile does not list the requested pixel format." << std::endl;
+						}
+						else if(not choice->exact)
+						{
+								std::cerr << "Requested " << _configuration_.width << "x" << _configuration_.height
+													<< "@" << _configuration_.fps << " is not offered, using " << choice->width
+													<< "x" << choice->height << "@" << choice->fps << std::endl;
+								_configuration_.width	 = choice->width;
+								_configuration_.height = choice->height;
+								_configuration_.fps		 = static_cast<uint32_t>(std::lround(choice->fps));
+						}
+				}
+
 				struct v4l2_cropcap cropcap;
 				zero_that(cropcap);
 
@@ -288,6 +403,13 @@ class V4L2_Backend : public Capture_Backend
 						throw std::runtime_error("VIDIOC_S_FMT: " + std::string(strerror(errno)));
 				}
 
+				/*
+				 * Driver may pad rows, kernels must follow its bytesperline. The range
+				 * requested above is only a wish, conversions use the colorimetry the
+				 * driver answered with.
+				 */
+				_image_layout_ = make_image_layout(_v4l2_capture_format_, _configuration_.pixel_format);
+
 				std::cout << "Fps is set to: " << set_fps(_configuration_.fps) << std::endl;
 				set_auto_exposure_mode(
 						/*V4L2_EXPOSURE_MANUAL ,*/ V4L2_EXPOSURE_APERTURE_PRIORITY);
@@ -336,6 +458,7 @@ class V4L2_Backend : public Capture_Backend
 				{
 						_num_buffers_ = req.count;
 						_buffer_dma_fds_.resize(_num_buffers_);
+						_buffer_planes_.resize(_num_buffers_);
 						this->_mapped_buffers_.resize(_num_buffers_);
 
 						for(auto buffer_index = 0; buffer_index < _num_buffers_; ++buffer_index)
@@ -387,7 +510,7 @@ class V4L2_Backend : public Capture_Backend
 												expbuf.plane = 0;
 
 												const auto err =
-														ioctl(this->_device_file_descriptor_, VIDIOC_EXPBUF, &expbuf);
+														xioctl(this->_device_file_descriptor_, VIDIOC_EXPBUF, &expbuf);
 												if(err == -1)
 												{
 														// close(this->_device_file_descriptor_);
@@ -408,8 +531,7 @@ class V4L2_Backend : public Capture_Backend
 										}
 
 										_mapped_buffers_[buffer_index][0] = std::span(
-												(Data_Type*) mmap(nullptr /* start anywhere */,
-																					buf.length,
+												(Data_Type*) _io_->mmap(buf.length,
 																					PROT_READ | PROT_WRITE /* required */,
 																					MAP_SHARED /* recommended */,
 																					dmabuf ? expbuf.fd : this->_device_file_descriptor_,
@@ -440,7 +562,7 @@ class V4L2_Backend : public Capture_Backend
 												if(dmabuf)
 												{
 														expbuf.plane = plane_index;
-														if(ioctl(this->_device_file_descriptor_, VIDIOC_EXPBUF, &expbuf)
+														if(xioctl(this->_device_file_descriptor_, VIDIOC_EXPBUF, &expbuf)
 															 == -1)
 														{
 																// close(this->_device_file_descriptor_);
@@ -456,14 +578,13 @@ class V4L2_Backend : public Capture_Backend
 														{
 																std::cout << "DMABUF FD for buf: " << expbuf.index << " is "
 																					<< expbuf.fd << std::endl;
-																_buffer_dma_fds_[buffer_index].emplace_back(expbuf.fd,
-																																						buf.length);
+																_buffer_dma_fds_[buffer_index].emplace_back(
+																		expbuf.fd, buf.m.planes[plane_index].length);
 														}
 												}
 
 												_mapped_buffers_[buffer_index][plane_index] =
-														std::span((Data_Type*) mmap(
-																					nullptr /* start anywhere */,
+														std::span((Data_Type*) _io_->mmap(
 																					buf.m.planes[plane_index].length,
 																					PROT_READ | PROT_WRITE /* required */,
 																					MAP_SHARED /* recommended */,
@@ -574,20 +695,15 @@ class V4L2_Backend : public Capture_Backend
 				return this->_pixel_format_ == V4L2_PIX_FMT_MJPEG;
 		}
 
-		[[nodiscard]] bool try_device() const
+		int xioctl(int fd, unsigned long request, void* arg) const
 		{
-				fd_set fds;
-				struct timeval tv;
-				int r = 0;
-
-				FD_ZERO(&fds);
-				FD_SET(_device_file_descriptor_, &fds);
-
-				/* Timeout. */
-				tv.tv_sec	 = 0;
-				tv.tv_usec = _timeout_in_milli * 1000;
+				return Cartrack::xioctl(*_io_, fd, request, arg);
+		}
 
-				r = select(_device_file_descriptor_ + 1, &fds, NULL, NULL, &tv);
+		[[nodiscard]] bool try_device() const
+		{
+				const int r =
+						_io_->wait_readable(_device_file_descriptor_, std::chrono::milliseconds{_timeout_in_milli});
 
 				if(-1 == r)
 				{
@@ -607,156 +723,326 @@ class V4L2_Backend : public Capture_Backend
 				return true;
 		}
 
-	public:
-		[[nodiscard]] Multiplanar_Buffer_View get_frame_data() override
+		/**
+		 * @brief USERPTR frame path, captures into the internally allocated buffers.
+		 */
+		[[nodiscard]] Multiplanar_Buffer_View grab_userptr_frame()
 		{
 				auto& _configuration_ = this->_configuration_;
-				auto& _frame_order_		= this->_frame_order_;
-				if(get_memory_mapping_type_v4l2() == V4L2_MEMORY_USERPTR)
-				{
-						const int planes_count = this->num_planes();
+				const int planes_count = this->num_planes();
 
-						std::vector<Multiplanar_Buffer_View> per_buffer_planes;
-						per_buffer_planes.resize(_num_buffers_);
+				std::vector<Multiplanar_Buffer_View> per_buffer_planes;
+				per_buffer_planes.resize(_num_buffers_);
 
-						for(int buffer_index = 0; buffer_index < _num_buffers_; ++buffer_index)
-						{
-								per_buffer_planes[buffer_index].resize(planes_count);
-								for(auto plane_index = 0; plane_index < planes_count; ++plane_index)
-								{
-										per_buffer_planes[buffer_index][plane_index] = std::span<Data_Type>(
-												(Data_Type*) _allocated_buffers_[buffer_index][plane_index].data(),
-												_allocated_buffers_[buffer_index][plane_index].size());
-								}
-						}
-						std::vector<std::vector<size_t>> bytes_used_per_buffer =
-								put_frame_data(per_buffer_planes);
-						if(bytes_used_per_buffer.empty())
-						{
-								return {};
-						}
-						if(bytes_used_per_buffer.front().empty())
+				for(int buffer_index = 0; buffer_index < _num_buffers_; ++buffer_index)
+				{
+						per_buffer_planes[buffer_index].resize(planes_count);
+						for(auto plane_index = 0; plane_index < planes_count; ++plane_index)
 						{
-								return {};
+								per_buffer_planes[buffer_index][plane_index] = std::span<Data_Type>(
+										(Data_Type*) _allocated_buffers_[buffer_index][plane_index].data(),
+										_allocated_buffers_[buffer_index][plane_index].size());
 						}
+				}
+				std::vector<std::vector<size_t>> bytes_used_per_buffer =
+						put_frame_data(per_buffer_planes);
+				if(bytes_used_per_buffer.empty())
+				{
+						return {};
+				}
+				if(bytes_used_per_buffer.front().empty())
+				{
+						return {};
+				}
 
-						Multiplanar_Buffer_View planes_to_return;
+				Multiplanar_Buffer_View planes_to_return;
 
-						if(_configuration_.v4l2.buffer_usage_policy
-							 == Stream_Configuration::V4L2::Internal_Buffering_Strategy::Oldest)
-						{
-								const auto& buffer_to_use = per_buffer_planes[0];
-								const auto bytes_used			= bytes_used_per_buffer[0];
+				if(_configuration_.v4l2.buffer_usage_policy
+					 == Stream_Configuration::V4L2::Internal_Buffering_Strategy::Oldest)
+				{
+						const auto& buffer_to_use = per_buffer_planes[0];
+						const auto bytes_used			= bytes_used_per_buffer[0];
 
-								for(auto plane_index = 0; plane_index < planes_count; ++plane_index)
-								{
-										planes_to_return.emplace_back(buffer_to_use[plane_index].data(),
-																									bytes_used[plane_index]);
-								}
-						}
-						else
+						for(auto plane_index = 0; plane_index < planes_count; ++plane_index)
 						{
-								const auto& buffer_to_use = per_buffer_planes.back();
-								const auto& bytes_used		= bytes_used_per_buffer.back();
+								planes_to_return.emplace_back(buffer_to_use[plane_index].data(),
+																							bytes_used[plane_index]);
+						}
+				}
+				else
+				{
+						const auto& buffer_to_use = per_buffer_planes.back();
+						const auto& bytes_used		= bytes_used_per_buffer.back();
 
-								for(auto plane_index = 0; plane_index < planes_count; ++plane_index)
-								{
-										planes_to_return.emplace_back(buffer_to_use[plane_index].data(),
-																									bytes_used[plane_index]);
-								}
+						for(auto plane_index = 0; plane_index < planes_count; ++plane_index)
+						{
+								planes_to_return.emplace_back(buffer_to_use[plane_index].data(),
+																							bytes_used[plane_index]);
 						}
-						return planes_to_return;
 				}
+				return planes_to_return;
+		}
 
-				const int planes_count = this->num_planes();
+		/**
+		 * @brief Runs on the capturing thread only, between two frames.
+		 */
+		void apply_pending_controls()
+		{
+				if(_control_commands_.empty())
+				{
+						return;
+				}
 
-				Multiplanar_Buffer_View planes_to_return;
+				std::vector<Control_Command> commands;
+				while(auto command = _control_commands_.try_pop())
+				{
+						commands.push_back(std::move(*command));
+				}
+
+				/* Everything queued since the last frame goes to the driver in one batch. */
+				std::vector<Control_Value> controls;
+				for(const auto& command : commands)
+				{
+						controls.push_back(Control_Value{command.id, command.value});
+				}
+				const bool batch_applied = commands.size() > 1 and set_controls(controls);
 
-				auto take_span = [this, &planes_count](const v4l2_buffer& buf,
-														 Multiplanar_Buffer_View& collected_planes)
+				timespec applied_at{};
+				for(auto& command : commands)
 				{
-						if(get_buffer_type_v4l2() == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+						if(not batch_applied
+							 and not write_control(command.id, command.value, "queued control"))
 						{
-								for(auto plane_index = 0; plane_index < planes_count; ++plane_index)
-								{
-										collected_planes.emplace_back(
-												std::assume_aligned<Alignment_Size>(
-														_mapped_buffers_[buf.index][plane_index].data()),
-												buf.m.planes[plane_index].bytesused);
-								}
+								command.completion.set_value(Control_Result{.error = errno});
+								continue;
 						}
-						else if(get_buffer_type_v4l2() == V4L2_BUF_TYPE_VIDEO_CAPTURE)
+
+						if(applied_at.tv_sec == 0)
 						{
-								collected_planes.emplace_back(
-										std::assume_aligned<Alignment_Size>(_mapped_buffers_[buf.index][0].data()),
-										buf.bytesused);
+								clock_gettime(CLOCK_MONOTONIC, &applied_at);
 						}
-				};
 
-				auto queue_buf = [this](v4l2_buffer& buf)
+						Applied_Control awaiting;
+						awaiting.applied_at			= applied_at;
+						awaiting.result.applied = true;
+						awaiting.completion			= std::move(command.completion);
+						_controls_awaiting_frame_.push_back(std::move(awaiting));
+				}
+		}
+
+		[[nodiscard]] std::optional<int32_t> read_control(uint32_t id, const char* name) const
+		{
+				if(const auto cached = _control_cache_.find(id); cached != _control_cache_.end())
+				{
+						return cached->second.load(std::memory_order_relaxed);
+				}
+
+				struct v4l2_control ctrl = {0};
+				ctrl.id									 = id;
+				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
 				{
-						if(-1 == xioctl(_device_file_descriptor_, VIDIOC_QBUF, &buf))
+						if(name)
 						{
-								const int err = errno; // Get the error number
-								std::cerr << "VIDIOC_QBUF failed in frame grabbing" << err << ": "
-													<< strerror(err) << std::endl;
-								return false;
+								std::cerr << "error getting " << name << std::endl;
 						}
-						return true;
-				};
+						return std::nullopt;
+				}
+				return ctrl.value;
+		}
+
+		bool write_control(uint32_t id, int32_t value, const char* name)
+		{
+				value = clamp_to_profile(id, value);
+
+				struct v4l2_control ctrl = {0};
+				ctrl.id									 = id;
+				ctrl.value							 = value;
+				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
+				{
+						const int err = errno;
+						std::cerr << "error setting " << name << std::endl;
+						errno = err;
+						return false;
+				}
+				/* Driver may round the value, it writes back what it took. */
+				update_cached_control(id, ctrl.value);
+				return true;
+		}
+
+		bool transfer_ext_controls(unsigned long request, std::vector<v4l2_ext_control>& controls) const
+		{
+				v4l2_ext_controls batch;
+				zero_that(batch);
+				batch.which		 = V4L2_CTRL_WHICH_CUR_VAL;
+				batch.count		 = controls.size();
+				batch.controls = controls.data();
+				if(-1 == xioctl(_device_file_descriptor_, request, &batch))
+				{
+						const int err = errno;
+						std::cerr << (request == VIDIOC_S_EXT_CTRLS ? "VIDIOC_S_EXT_CTRLS" : "VIDIOC_G_EXT_CTRLS")
+											<< " failed at control index " << batch.error_idx << ": " << strerror(err)
+											<< std::endl;
+						errno = err;
+						return false;
+				}
+				return true;
+		}
+
+		[[nodiscard]] int32_t clamp_to_profile(uint32_t id, int32_t value) const
+		{
+				return _device_profile_ ? _device_profile_->clamp_control(id, value) : value;
+		}
 
-				auto deque_buf = [this](v4l2_buffer& buf)
+		void update_cached_control(uint32_t id, int32_t value)
+		{
+				if(const auto cached = _control_cache_.find(id); cached != _control_cache_.end())
 				{
-						if(-1 == xioctl(_device_file_descriptor_, VIDIOC_DQBUF, &buf))
-						{
-								switch(errno)
-								{
-										case EAGAIN:
-												return false;
+						cached->second.store(value, std::memory_order_relaxed);
+				}
+		}
 
-										case EIO:
-												/* Could ignore EIO, see spec. */
-												/* fall through */
-												break;
-										default:
-												const int err = errno; // Get the error number
-												std::cerr << "VIDIOC_DQBUF failed in frame grabbing" << err << ": "
-																	<< strerror(err) << std::endl;
-												return false;
-								}
-						}
+		void complete_applied_controls(const v4l2_buffer& buf)
+		{
+				if(_controls_awaiting_frame_.empty())
+				{
+						return;
+				}
+
+				/* Without monotonic timestamps the first dequeued frame is the best guess. */
+				const bool comparable = (buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK)
+																== V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+				const auto captured_at = std::pair{buf.timestamp.tv_sec, buf.timestamp.tv_usec * 1000};
+
+				std::erase_if(_controls_awaiting_frame_,
+											[&](Applied_Control& awaiting)
+											{
+													const auto applied_at =
+															std::pair{awaiting.applied_at.tv_sec, awaiting.applied_at.tv_nsec};
+													if(comparable and captured_at < applied_at)
+													{
+															return false;
+													}
+													awaiting.result.first_sequence		= buf.sequence;
+													awaiting.result.first_frame_order = this->_frame_order_;
+													awaiting.completion.set_value(awaiting.result);
+													return true;
+											});
+		}
+
+		[[nodiscard]] static std::chrono::nanoseconds to_timestamp(const timeval& timestamp)
+		{
+				return std::chrono::seconds(timestamp.tv_sec) + std::chrono::microseconds(timestamp.tv_usec);
+		}
+
+		template <v4l2_buf_type Buffer_Type>
+		[[nodiscard]] v4l2_buffer instantiate_buffer(v4l2_plane* planes) const
+		{
+				v4l2_buffer buf;
+				zero_that(buf);
+
+				buf.type	 = Buffer_Type;
+				buf.memory = get_memory_mapping_type_v4l2();
+
+				if constexpr(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE == Buffer_Type)
+				{
+						memset(planes, 0, VIDEO_MAX_PLANES * sizeof(v4l2_plane));
+						buf.m.planes = planes;
+						buf.length	 = this->num_planes();
+				}
+
+				return buf;
+		}
+
+		bool queue_buffer(v4l2_buffer& buf) const
+		{
+				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_QBUF, &buf))
+				{
+						const int err = errno; // Get the error number
+						std::cerr << "VIDIOC_QBUF failed in frame grabbing" << err << ": " << strerror(err)
+											<< std::endl;
+						return false;
+				}
+				return true;
+		}
 
-						if(buf.index >= _num_buffers_)
+		template <v4l2_buf_type Buffer_Type>
+		bool dequeue_buffer(v4l2_buffer& buf)
+		{
+				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_DQBUF, &buf))
+				{
+						switch(errno)
 						{
-								return false;
+								case EAGAIN:
+										return false;
+
+								case EIO:
+										/* Could ignore EIO, see spec. */
+										/* fall through */
+										break;
+								default:
+										const int err = errno; // Get the error number
+										std::cerr << "VIDIOC_DQBUF failed in frame grabbing" << err << ": "
+															<< strerror(err) << std::endl;
+										return false;
 						}
+				}
 
-						return true;
-				};
+				if(buf.index >= _num_buffers_)
+				{
+						return false;
+				}
+
+				complete_applied_controls(buf);
+				this->_frame_timestamp_ = to_timestamp(buf.timestamp);
 
-				auto instantiate_buf = [this]() -> v4l2_buffer
+				if constexpr(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE == Buffer_Type)
 				{
-						v4l2_buffer buf;
-						zero_that(buf);
+						/* Buffer is queued back on a later call, its planes must outlive this frame. */
+						auto& planes = _buffer_planes_[buf.index];
+						std::copy_n(buf.m.planes, this->num_planes(), planes.begin());
+						buf.m.planes = planes.data();
+				}
 
-						buf.type	 = get_buffer_type_v4l2();
-						buf.memory = get_memory_mapping_type_v4l2();
+				return true;
+		}
 
-						v4l2_plane planes[this->num_planes()];
-						if(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE == this->_buffer_plane_type_)
+		template <v4l2_buf_type Buffer_Type>
+		void take_span(const v4l2_buffer& buf, Multiplanar_Buffer_View& collected_planes) const
+		{
+				if constexpr(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE == Buffer_Type)
+				{
+						const int planes_count = this->num_planes();
+						for(auto plane_index = 0; plane_index < planes_count; ++plane_index)
 						{
-								memset(planes, 0, this->num_planes() * sizeof(v4l2_plane));
-								buf.m.planes = planes;
-								buf.length	 = this->num_planes();
+								collected_planes.emplace_back(std::assume_aligned<Alignment_Size>(
+																									_mapped_buffers_[buf.index][plane_index].data()),
+																							buf.m.planes[plane_index].bytesused);
 						}
+				}
+				else
+				{
+						collected_planes.emplace_back(
+								std::assume_aligned<Alignment_Size>(_mapped_buffers_[buf.index][0].data()),
+								buf.bytesused);
+				}
+		}
+
+		/**
+		 * @brief MMAP frame path. Instantiated once per buffer type and selected at
+		 * construction, so nothing on the way branches on the plane type per frame.
+		 */
+		template <v4l2_buf_type Buffer_Type>
+		[[nodiscard]] Multiplanar_Buffer_View grab_mapped_frame()
+		{
+				auto& _configuration_ = this->_configuration_;
+				auto& _frame_order_		= this->_frame_order_;
 
-						return buf;
-				};
+				Multiplanar_Buffer_View planes_to_return;
 
 				while(not _buffer_of_buffers.empty())
 				{
 						auto buf = _buffer_of_buffers.front();
-						queue_buf(buf);
+						queue_buffer(buf);
 						_buffer_of_buffers.pop_front();
 				}
 
@@ -770,15 +1056,16 @@ class V4L2_Backend : public Capture_Backend
 				if(_configuration_.v4l2.buffer_usage_policy
 					 == Stream_Configuration::V4L2::Internal_Buffering_Strategy::Oldest)
 				{
-						auto buf = instantiate_buf();
+						v4l2_plane planes[VIDEO_MAX_PLANES];
+						auto buf = instantiate_buffer<Buffer_Type>(planes);
 
 						++_frame_order_;
 
-						if(deque_buf(buf))
+						if(dequeue_buffer<Buffer_Type>(buf))
 						{
-								take_span(buf, planes_to_return);
+								take_span<Buffer_Type>(buf, planes_to_return);
+								_buffer_of_buffers.push_back(buf);
 						}
-						_buffer_of_buffers.push_back(buf);
 				}
 				else if(_configuration_.v4l2.buffer_usage_policy
 								== Stream_Configuration::V4L2::Internal_Buffering_Strategy::Only_Newest)
@@ -786,23 +1073,26 @@ class V4L2_Backend : public Capture_Backend
 						static const unsigned int dummy_buffer_index =
 								std::numeric_limits<unsigned int>::max() - 1;
 
-						std::map<long, std::pair<Multiplanar_Buffer_View, v4l2_buffer>> ordered_buffers;
+						std::map<uint64_t, std::pair<Multiplanar_Buffer_View, v4l2_buffer>> ordered_buffers;
 						for(auto buffer_order = 0; buffer_order < this->_num_buffers_; ++buffer_order)
 						{
-								auto buf	= instantiate_buf();
+								v4l2_plane planes[VIDEO_MAX_PLANES];
+								auto buf	= instantiate_buffer<Buffer_Type>(planes);
 								buf.index = dummy_buffer_index;
 
 								++_frame_order_;
 
-								if(deque_buf(buf))
+								if(dequeue_buffer<Buffer_Type>(buf))
 								{
 										if(buf.index == dummy_buffer_index)
 										{
 												continue;
 										}
 
-										ordered_buffers[buf.timestamp.tv_usec].second = buf;
-										take_span(buf, ordered_buffers[buf.timestamp.tv_usec].first);
+										const uint64_t timestamp =
+												uint64_t(buf.timestamp.tv_sec) * 1000000 + buf.timestamp.tv_usec;
+										ordered_buffers[timestamp].second = buf;
+										take_span<Buffer_Type>(buf, ordered_buffers[timestamp].first);
 								}
 						}
 
@@ -820,6 +1110,7 @@ class V4L2_Backend : public Capture_Backend
 
 						planes_to_return = ordered_buffers.rbegin()->second.first;
 						_buffer_of_buffers.push_back(ordered_buffers.rbegin()->second.second);
+						this->_frame_timestamp_ = to_timestamp(ordered_buffers.rbegin()->second.second.timestamp);
 
 						for(auto map_iterator = ordered_buffers.begin();
 								map_iterator not_eq ordered_buffers.end();
@@ -827,7 +1118,7 @@ class V4L2_Backend : public Capture_Backend
 						{
 								if(std::next(map_iterator) not_eq ordered_buffers.end())
 								{
-										queue_buf(map_iterator->second.second);
+										queue_buffer(map_iterator->second.second);
 								}
 						}
 				}
@@ -835,6 +1126,270 @@ class V4L2_Backend : public Capture_Backend
 				return planes_to_return;
 		}
 
+	public:
+		[[nodiscard]] Multiplanar_Buffer_View get_frame_data() override
+		{
+				apply_pending_controls();
+				poll_control_events();
+				return (this->*_grab_frame_)();
+		}
+
+		/**
+		 * @brief Frame shared by several consumers without copying. Unlike
+		 * get_frame_data, the buffer is not queued back on the next call but when
+		 * the last copy of the handle is released, from whichever thread that is.
+		 *
+		 * Consumers holding every buffer starve the driver, it has nothing to fill.
+		 * Each call made in that state counts in buffer_starvation_count and returns
+		 * an empty handle once select times out. Allocate num_buffers for the
+		 * frames consumers keep plus what the driver needs. MMAP buffering only.
+		 */
+		[[nodiscard]] Frame_Handle acquire_frame()
+		{
+				if(get_memory_mapping_type_v4l2() == V4L2_MEMORY_USERPTR)
+				{
+						throw std::runtime_error("acquire_frame needs Buffering::Internal");
+				}
+
+				if(_leases_->outstanding.load(std::memory_order_relaxed) >= _num_buffers_)
+				{
+						if(_buffer_starvation_count_++ == 0)
+						{
+								std::cerr << "Consumers hold " << _leases_->outstanding.load()
+													<< " of " << _num_buffers_ << " buffers, capture is starving." << std::endl;
+						}
+				}
+
+				auto planes = get_frame_data();
+				if(planes.empty() or _buffer_of_buffers.empty())
+				{
+						return {};
+				}
+
+				/* Take the buffer off the deferred queue, the handle owns it now. */
+				v4l2_buffer buf = _buffer_of_buffers.back();
+				_buffer_of_buffers.pop_back();
+
+				auto* lease					= new Frame_Lease;
+				lease->planes				= std::move(planes);
+				lease->timestamp		= this->_frame_timestamp_;
+				lease->frame_order	= this->_frame_order_;
+				lease->sequence			= buf.sequence;
+				lease->buffer_index = buf.index;
+
+				_leases_->outstanding.fetch_add(1, std::memory_order_relaxed);
+				return Frame_Handle(lease,
+														[leases = _leases_, buf](const Frame_Lease* released) mutable
+														{
+																delete released;
+																std::lock_guard lock(leases->mutex);
+																leases->outstanding.fetch_sub(1, std::memory_order_relaxed);
+																if(leases->open
+																	 and -1
+																					 == Cartrack::xioctl(
+																							 *leases->io, leases->device_file_descriptor, VIDIOC_QBUF, &buf))
+																{
+																		std::cerr << "VIDIOC_QBUF failed releasing frame handle: "
+																							<< strerror(errno) << std::endl;
+																}
+														});
+		}
+
+		[[nodiscard]] unsigned int leased_buffers() const
+		{
+				return _leases_->outstanding.load(std::memory_order_relaxed);
+		}
+
+		[[nodiscard]] uintmax_t buffer_starvation_count() const
+		{
+				return _buffer_starvation_count_;
+		}
+
+		/**
+		 * @brief Thread safe way of changing a control while another thread captures.
+		 * The change is queued without locking and applied by the capturing thread
+		 * between two frames, the future is fulfilled once a frame captured after
+		 * the change is dequeued. Use it instead of the set_* family, those talk to
+		 * the driver right away from the calling thread.
+		 *
+		 * If the queue is full the future is ready at once with EBUSY.
+		 */
+		[[nodiscard]] std::future<Control_Result> submit_control(uint32_t id, int32_t value)
+		{
+				Control_Command command;
+				command.id		= id;
+				command.value = value;
+				auto future		= command.completion.get_future();
+				if(not _control_commands_.try_push(std::move(command)))
+				{
+						std::promise<Control_Result> rejected;
+						rejected.set_value(Control_Result{.error = EBUSY});
+						return rejected.get_future();
+				}
+				return future;
+		}
+
+		/**
+		 * @brief Reads all controls with one VIDIOC_G_EXT_CTRLS, or from the control
+		 * cache without any ioctl when every id is cached.
+		 */
+		bool get_controls(std::span<Control_Value> controls) const
+		{
+				if(std::all_of(controls.begin(),
+											 controls.end(),
+											 [this](const Control_Value& control)
+											 { return _control_cache_.contains(control.id); }))
+				{
+						for(auto& control : controls)
+						{
+								control.value = _control_cache_.at(control.id).load(std::memory_order_relaxed);
+						}
+						return true;
+				}
+
+				std::vector<v4l2_ext_control> ext_controls(controls.size());
+				for(std::size_t i = 0; i < controls.size(); ++i)
+				{
+						ext_controls[i].id = controls[i].id;
+				}
+
+				if(not transfer_ext_controls(VIDIOC_G_EXT_CTRLS, ext_controls))
+				{
+						return false;
+				}
+
+				for(std::size_t i = 0; i < controls.size(); ++i)
+				{
+						controls[i].value = ext_controls[i].value;
+				}
+				return true;
+		}
+
+		/**
+		 * @brief Writes all controls with one VIDIOC_S_EXT_CTRLS. Drivers apply the
+		 * batch atomically where they can, nothing is written if it fails.
+		 */
+		bool set_controls(std::span<const Control_Value> controls)
+		{
+				std::vector<v4l2_ext_control> ext_controls(controls.size());
+				for(std::size_t i = 0; i < controls.size(); ++i)
+				{
+						ext_controls[i].id		= controls[i].id;
+						ext_controls[i].value = clamp_to_profile(controls[i].id, controls[i].value);
+				}
+
+				if(not transfer_ext_controls(VIDIOC_S_EXT_CTRLS, ext_controls))
+				{
+						return false;
+				}
+
+				for(const auto& control : ext_controls)
+				{
+						update_cached_control(control.id, control.value);
+				}
+				return true;
+		}
+
+		/**
+		 * @brief Keeps the given controls in memory. Changes are tracked through
+		 * V4L2_EVENT_CTRL subscriptions, so auto exposure, other processes and
+		 * v4l2-ctl are seen as well, and the get_* family stops talking to the driver.
+		 *
+		 * Call it before sharing the backend between threads. Events are drained
+		 * by the capturing thread between frames, and by poll_control_events.
+		 * Controls the driver does not have are left uncached.
+		 */
+		void enable_control_cache(std::span<const uint32_t> ids)
+		{
+				std::vector<Control_Value> subscribed;
+				for(const auto id : ids)
+				{
+						if(_control_cache_.contains(id))
+						{
+								continue;
+						}
+
+						v4l2_event_subscription subscription;
+						zero_that(subscription);
+						subscription.type = V4L2_EVENT_CTRL;
+						subscription.id		= id;
+						if(-1 == xioctl(_device_file_descriptor_, VIDIOC_SUBSCRIBE_EVENT, &subscription))
+						{
+								std::cerr << "Control " << id << " can not be cached: " << strerror(errno)
+													<< std::endl;
+								continue;
+						}
+						subscribed.push_back(Control_Value{id, 0});
+				}
+
+				if(not get_controls(subscribed))
+				{
+						/* One unsupported control fails the whole batch, find it out one by one. */
+						std::erase_if(subscribed,
+													[this](Control_Value& control)
+													{
+															const auto value = read_control(control.id, nullptr);
+															control.value		 = value.value_or(0);
+															return not value.has_value();
+													});
+				}
+
+				for(const auto& control : subscribed)
+				{
+						_control_cache_.try_emplace(control.id, control.value);
+				}
+		}
+
+		/**
+		 * @brief Applies pending control change events to the cache without blocking.
+		 */
+		void poll_control_events()
+		{
+				if(_control_cache_.empty())
+				{
+						return;
+				}
+
+				v4l2_event event;
+				for(;;)
+				{
+						zero_that(event);
+						if(-1 == xioctl(_device_file_descriptor_, VIDIOC_DQEVENT, &event))
+						{
+								/* ENOENT, nothing pending. */
+								return;
+						}
+
+						if(event.type == V4L2_EVENT_CTRL and (event.u.ctrl.changes & V4L2_EVENT_CTRL_CH_VALUE))
+						{
+								update_cached_control(event.id, event.u.ctrl.value);
+						}
+				}
+		}
+
+		/**
+		 * @brief Same as get_frame_data, with the planes described by the negotiated
+		 * layout. The view points to driver memory and is valid until the next call.
+		 */
+		[[nodiscard]] Image_View get_image_view()
+		{
+				return make_image_view(_image_layout_, get_frame_data());
+		}
+
+		/**
+		 * @brief get_image_view for a pixel format known at compile time, so the
+		 * processing code can be specialized for it.
+		 */
+		template <Pixel_Format Format>
+		[[nodiscard]] Typed_Image_View<Format> get_image_view()
+		{
+				if(Format != _configuration_.pixel_format)
+				{
+						throw std::runtime_error("Typed image view requested for a different pixel format");
+				}
+				return make_typed_image_view<Format>(_image_layout_, get_frame_data());
+		}
+
 		[[nodiscard]] std::vector<std::vector<size_t>> put_frame_data(
 				std::vector<Multiplanar_Buffer_View>& userspace_frames) override
 		{
@@ -886,6 +1441,9 @@ class V4L2_Backend : public Capture_Backend
 						return sizes;
 				}
 
+				apply_pending_controls();
+				poll_control_events();
+
 				ushort num_queued_buffers = 0;
 				for(auto userspace_frame_index = 0; userspace_frame_index < userspace_frames.size();
 						++userspace_frame_index)
@@ -912,7 +1470,6 @@ class V4L2_Backend : public Capture_Backend
 										planes[plane_index].length =
 												_v4l2_capture_format_.fmt.pix_mp.plane_fmt[plane_index].sizeimage;
 										planes[plane_index].data_offset	 = 0;
-										planes[plane_index].m.mem_offset = 0;
 								}
 
 								buf.m.planes = planes;
@@ -975,8 +1532,11 @@ class V4L2_Backend : public Capture_Backend
 								switch(errno)
 								{
 										case EAGAIN:
-												--num_buffer_requests;
-												try_device();
+												/* Wait for the frame, but do not spin on a device that stopped. */
+												if(try_device())
+												{
+														--num_buffer_requests;
+												}
 												break;
 										case EIO:
 												/* Could ignore EIO, see spec. */
@@ -989,6 +1549,9 @@ class V4L2_Backend : public Capture_Backend
 						}
 						else
 						{
+								complete_applied_controls(buf);
+								this->_frame_timestamp_ = to_timestamp(buf.timestamp);
+
 								if(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE == this->_buffer_plane_type_)
 								{
 										for(auto plane_index = 0; plane_index < buf.length; ++plane_index)
@@ -1014,316 +1577,134 @@ class V4L2_Backend : public Capture_Backend
 
 		bool set_zoom(int value) override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_ZOOM_ABSOLUTE;
-				ctrl.value							 = value;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_ZOOM_ABSOLUTE" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(V4L2_CID_ZOOM_ABSOLUTE, value, "V4L2_CID_ZOOM_ABSOLUTE");
 		}
 
 		[[nodiscard]] int get_zoom() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_ZOOM_ABSOLUTE;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "Error getting V4L2_CID_ZOOM_ABSOLUTE" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_ZOOM_ABSOLUTE, "V4L2_CID_ZOOM_ABSOLUTE").value_or(0);
 		}
 
 		bool set_focus(int value) override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_FOCUS_ABSOLUTE;
-				ctrl.value							 = value;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_FOCUS_ABSOLUTE" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(V4L2_CID_FOCUS_ABSOLUTE, value, "V4L2_CID_FOCUS_ABSOLUTE");
 		}
 
 		[[nodiscard]] int get_focus() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_FOCUS_ABSOLUTE;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "error getting V4L2_CID_FOCUS_ABSOLUTE" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_FOCUS_ABSOLUTE, "V4L2_CID_FOCUS_ABSOLUTE").value_or(0);
 		}
 
 		bool set_sharpness(int value) override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_SHARPNESS;
-				ctrl.value							 = value;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_SHARPNESS" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(V4L2_CID_SHARPNESS, value, "V4L2_CID_SHARPNESS");
 		}
 
 		[[nodiscard]] int get_sharpness() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_SHARPNESS;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "error getting V4L2_CID_SHARPNESS" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_SHARPNESS, "V4L2_CID_SHARPNESS").value_or(0);
 		}
 
 		bool set_auto_focus(bool value) override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_FOCUS_AUTO;
-				ctrl.value							 = value;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_FOCUS_AUTO" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(V4L2_CID_FOCUS_AUTO, value, "V4L2_CID_FOCUS_AUTO");
 		}
 
 		[[nodiscard]] bool get_auto_focus() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_FOCUS_AUTO;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "error getting V4L2_CID_FOCUS_AUTO" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_FOCUS_AUTO, "V4L2_CID_FOCUS_AUTO").value_or(0);
 		}
 
 		bool set_brightness(int value) override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_BRIGHTNESS;
-				ctrl.value							 = value;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_BRIGHTNESS" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(V4L2_CID_BRIGHTNESS, value, "V4L2_CID_BRIGHTNESS");
 		}
 
 		[[nodiscard]] int get_brightness() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_BRIGHTNESS;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "error getting V4L2_CID_BRIGHTNESS" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_BRIGHTNESS, "V4L2_CID_BRIGHTNESS").value_or(0);
 		}
 
 		bool set_contrast(int value) override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_CONTRAST;
-				ctrl.value							 = value;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_CONTRAST" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(V4L2_CID_CONTRAST, value, "V4L2_CID_CONTRAST");
 		}
 
 		[[nodiscard]] int get_contrast() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_CONTRAST;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "error getting V4L2_CID_CONTRAST" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_CONTRAST, "V4L2_CID_CONTRAST").value_or(0);
 		}
 
 		bool set_saturation(int value) override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_SATURATION;
-				ctrl.value							 = value;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_SATURATION" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(V4L2_CID_SATURATION, value, "V4L2_CID_SATURATION");
 		}
 
 		[[nodiscard]] int get_saturation() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_SATURATION;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "error getting V4L2_CID_SATURATION" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_SATURATION, "V4L2_CID_SATURATION").value_or(0);
 		}
 
 		bool set_hue(int value) override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_HUE;
-				ctrl.value							 = value;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_HUE" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(V4L2_CID_HUE, value, "V4L2_CID_HUE");
 		}
 
 		[[nodiscard]] int get_hue() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_HUE;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "error getting V4L2_CID_HUE" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_HUE, "V4L2_CID_HUE").value_or(0);
 		}
 
 		bool set_gain(int value) override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_GAIN;
-				ctrl.value							 = value;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_GAIN" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(V4L2_CID_GAIN, value, "V4L2_CID_GAIN");
 		}
 
 		[[nodiscard]] int get_gain() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_GAIN;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "error getting V4L2_CID_GAIN" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_GAIN, "V4L2_CID_GAIN").value_or(0);
 		}
 
 		bool set_exposure(int value) override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_EXPOSURE_ABSOLUTE;
-				ctrl.value							 = value;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_EXPOSURE_ABSOLUTE" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(V4L2_CID_EXPOSURE_ABSOLUTE, value, "V4L2_CID_EXPOSURE_ABSOLUTE");
 		}
 
 		[[nodiscard]] int get_exposure() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_EXPOSURE_ABSOLUTE;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "error getting V4L2_CID_EXPOSURE_ABSOLUTE" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_EXPOSURE_ABSOLUTE, "V4L2_CID_EXPOSURE_ABSOLUTE").value_or(0);
 		}
 
 		bool set_white_balance_temperature(int value) override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_WHITE_BALANCE_TEMPERATURE;
-				ctrl.value							 = value;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_WHITE_BALANCE_TEMPERATURE" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(V4L2_CID_WHITE_BALANCE_TEMPERATURE, value, "V4L2_CID_WHITE_BALANCE_TEMPERATURE");
 		}
 
 		[[nodiscard]] int get_white_balance_temperature() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_WHITE_BALANCE_TEMPERATURE;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "error getting V4L2_CID_WHITE_BALANCE_TEMPERATURE" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_WHITE_BALANCE_TEMPERATURE, "V4L2_CID_WHITE_BALANCE_TEMPERATURE").value_or(0);
 		}
 
 		[[nodiscard]] bool get_auto_white_balance_val() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_AUTO_WHITE_BALANCE;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "error getting V4L2_CID_AUTO_WHITE_BALANCE" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_AUTO_WHITE_BALANCE, "V4L2_CID_AUTO_WHITE_BALANCE").value_or(0);
 		}
 
 		bool set_auto_white_balance(bool enable) override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_AUTO_WHITE_BALANCE;
-				ctrl.value							 = enable ? 1 : 0;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_AUTO_WHITE_BALANCE" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(V4L2_CID_AUTO_WHITE_BALANCE, enable ? 1 : 0, "V4L2_CID_AUTO_WHITE_BALANCE");
 		}
 
 		bool set_auto_exposure_mode(int type) override
 		{
 				/** V4L2_EXPOSURE_MANUAL and V4L2_EXPOSURE_APERTURE_PRIORITY are commonly
    * used. */
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_EXPOSURE_AUTO;
-				ctrl.value							 = type;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_EXPOSURE_AUTO" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(V4L2_CID_EXPOSURE_AUTO, type, "V4L2_CID_EXPOSURE_AUTO");
 		}
 
 		[[nodiscard]] int get_auto_exposure_current_value() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_EXPOSURE_AUTO;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						return -1;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_EXPOSURE_AUTO, nullptr).value_or(-1);
 		}
 
 		bool enable_auto_exposure_auto_priority_mode(bool on) override
@@ -1345,26 +1726,13 @@ class V4L2_Backend : public Capture_Backend
      * the best possible image quality.
      */
 
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_EXPOSURE_AUTO_PRIORITY;
-				ctrl.value							 = on ? 1 : 0;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
-				{
-						std::cerr << "error setting V4L2_CID_EXPOSURE_AUTO_PRIORITY" << std::endl;
-						return false;
-				}
-				return true;
+				return write_control(
+						V4L2_CID_EXPOSURE_AUTO_PRIORITY, on ? 1 : 0, "V4L2_CID_EXPOSURE_AUTO_PRIORITY");
 		}
 
 		[[nodiscard]] bool is_auto_exposure_auto_priority_enabled() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_EXPOSURE_AUTO_PRIORITY;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "error getting V4L2_CID_EXPOSURE_AUTO_PRIORITY" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_EXPOSURE_AUTO_PRIORITY, "V4L2_CID_EXPOSURE_AUTO_PRIORITY").value_or(0);
 		}
 
 		bool set_manual_exposure_value(int val) override
@@ -1377,28 +1745,24 @@ class V4L2_Backend : public Capture_Backend
      * 100us. It depends on the ambient light to tuning exposure time.
      */
 
-				struct v4l2_control ctrl = {0};
-				set_auto_exposure_mode(V4L2_EXPOSURE_MANUAL);
-
-				ctrl.id		 = V4L2_CID_EXPOSURE_ABSOLUTE;
-				ctrl.value = val;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_CTRL, &ctrl))
+				/* Mode and value in one VIDIOC_S_EXT_CTRLS instead of two round trips. */
+				const std::array<Control_Value, 2> controls{
+						{{V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_MANUAL}, {V4L2_CID_EXPOSURE_ABSOLUTE, val}}};
+				if(set_controls(controls))
 				{
-						std::cerr << "error setting V4L2_CID_EXPOSURE_ABSOLUTE" << std::endl;
-						return false;
+						return true;
 				}
-				return true;
+
+				/* Drivers without extended controls, or refusing the pair, still take
+				 * the two single writes. Like before the batch, a refused mode does not
+				 * stop the value from being written. */
+				set_auto_exposure_mode(V4L2_EXPOSURE_MANUAL);
+				return write_control(V4L2_CID_EXPOSURE_ABSOLUTE, val, "V4L2_CID_EXPOSURE_ABSOLUTE");
 		}
 
 		[[nodiscard]] int get_manual_exposure_value() const override
 		{
-				struct v4l2_control ctrl = {0};
-				ctrl.id									 = V4L2_CID_EXPOSURE_ABSOLUTE;
-				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_G_CTRL, &ctrl))
-				{
-						std::cerr << "error getting V4L2_CID_EXPOSURE_ABSOLUTE" << std::endl;
-				}
-				return ctrl.value;
+				return read_control(V4L2_CID_EXPOSURE_ABSOLUTE, "V4L2_CID_EXPOSURE_ABSOLUTE").value_or(0);
 		}
 
 		[[nodiscard]] double set_fps(double fps) override
@@ -1437,7 +1801,7 @@ class V4L2_Backend : public Capture_Backend
 
 				stream_capabilities_query_payload.type = get_buffer_type_v4l2();
 
-				if(ioctl(_device_file_descriptor_, VIDIOC_G_PARM, &stream_capabilities_query_payload)
+				if(xioctl(_device_file_descriptor_, VIDIOC_G_PARM, &stream_capabilities_query_payload)
 					 == 0)
 				{
 						if(stream_capabilities_query_payload.parm.capture.capability
@@ -1461,10 +1825,70 @@ class V4L2_Backend : public Capture_Backend
 				return _v4l2_capture_format_.fmt.pix.height;
 		}
 
+		/**
+		 * @brief Strides, plane offsets and memory plane sizes of the negotiated
+		 * format. Use memory_plane_sizes to allocate USERPTR frames.
+		 */
+		[[nodiscard]] const Image_Layout& image_layout() const
+		{
+				return _image_layout_;
+		}
+
+		/**
+		 * @brief DMABUF fds exported with VIDIOC_EXPBUF and their lengths, one entry
+		 * per memory plane of every buffer. Empty entries when the driver cannot
+		 * export. The backend owns and closes them.
+		 */
+		[[nodiscard]] const std::vector<std::vector<std::pair<int, size_t>>>& dma_buffer_fds() const
+		{
+				return _buffer_dma_fds_;
+		}
+
+		/**
+		 * @brief Set when Stream_Configuration::V4L2::device_profile_cache is on.
+		 */
+		[[nodiscard]] const std::optional<Device_Profile>& device_profile() const
+		{
+				return _device_profile_;
+		}
+
+	private:
+		struct Control_Command
+		{
+				uint32_t id	 = 0;
+				int32_t value = 0;
+				std::promise<Control_Result> completion;
+		};
+
+		struct Applied_Control
+		{
+				timespec applied_at{};
+				Control_Result result;
+				std::promise<Control_Result> completion;
+		};
+
+		static constexpr std::size_t Control_Queue_Capacity = 64;
+
+		/**
+		 * @brief Shared with every Frame_Handle, so a handle released after the
+		 * backend is gone does not touch a closed device.
+		 */
+		struct Lease_Registry
+		{
+				std::mutex mutex;
+				int device_file_descriptor = -1;
+				std::shared_ptr<Device_IO> io;
+				bool open									 = true;
+				std::atomic<unsigned int> outstanding{0};
+		};
+
 	private:
+		std::shared_ptr<Device_IO> _io_;
 		bool try_mmapped = true;
 		std::vector<std::vector<std::pair<int, size_t>>> _buffer_dma_fds_;
 		v4l2_format _v4l2_capture_format_;
+		Image_Layout _image_layout_;
+		std::optional<Device_Profile> _device_profile_;
 		int _pixel_format_;
 		int _device_file_descriptor_ = -1;
 		v4l2_buf_type _buffer_plane_type_;
@@ -1472,6 +1896,17 @@ class V4L2_Backend : public Capture_Backend
 		bool _limit_range_				 = false;
 		std::vector<Multiplanar_Buffer> _allocated_buffers_;
 		std::deque<v4l2_buffer> _buffer_of_buffers;
+		std::vector<std::array<v4l2_plane, VIDEO_MAX_PLANES>> _buffer_planes_;
+		Multiplanar_Buffer_View (V4L2_Backend::*_grab_frame_)() = nullptr;
+		Lock_Free_Queue<Control_Command, Control_Queue_Capacity> _control_commands_;
+		std::vector<Applied_Control> _controls_awaiting_frame_;
+		/**
+		 * @brief Built once by enable_control_cache, afterwards only the values
+		 * change, so readers on other threads need no lock.
+		 */
+		std::unordered_map<uint32_t, std::atomic<int32_t>> _control_cache_;
+		std::shared_ptr<Lease_Registry> _leases_ = std::make_shared<Lease_Registry>();
+		uintmax_t _buffer_starvation_count_			 = 0;
 		std::string _device_dev_path_;
 		std::vector<Multiplanar_Buffer_View> _mapped_buffers_;
 };
@@ -0,0 +1,604 @@
+#ifndef ISGURSOY_V4L2_OUTPUT_HPP
+#define ISGURSOY_V4L2_OUTPUT_HPP
+
+#include "isgursoy_V4L2.hpp"
+
+#include <sys/select.h>
+
+namespace Cartrack
+{
+
+/**
+ * @brief Writes frames to a V4L2 OUTPUT device, typically a v4l2loopback node
+ * that other applications open as a camera. Mirrors V4L2_Backend: same
+ * Stream_Configuration, same negotiated Image_Layout, buffers queued with
+ * VIDIOC_QBUF and reclaimed with VIDIOC_DQBUF.
+ *
+ * Output_Memory::MMAP copies each frame once into a driver buffer, row by row
+ * following both sides' strides. Output_Memory::DMABUF imports the capture
+ * backend's exported buffers instead, forward_frame then queues the camera's
+ * own memory and keeps its Frame_Handle until the output device hands the
+ * buffer back. Drivers that cannot import DMABUF (v4l2loopback among them,
+ * depending on version) fall back to MMAP, check zero_copy().
+ *
+ * Test with: modprobe v4l2loopback video_nr=10 exclusive_caps=1, then read
+ * /dev/video10 with any V4L2 client while frames are written.
+ */
+class V4L2_Output_Backend
+{
+	public:
+		enum class Output_Memory { MMAP = 0, DMABUF };
+
+	public:
+		explicit V4L2_Output_Backend(const Stream_Configuration& params,
+																 Output_Memory memory = Output_Memory::MMAP)
+				: _configuration_(params)
+				, _memory_(memory == Output_Memory::DMABUF ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP)
+		{
+				const auto& descriptor = describe(_configuration_.pixel_format);
+				if(not descriptor.valid())
+				{
+						throw std::runtime_error("Pixel format not supported");
+				}
+				if(not descriptor.contiguous and _configuration_.v4l2.contiguous)
+				{
+						throw std::runtime_error(
+								"Pixel format keeps its planes in separate buffers, v4l2.contiguous must be false");
+				}
+
+				_buffer_plane_type_ = _configuration_.v4l2.contiguous ? V4L2_BUF_TYPE_VIDEO_OUTPUT
+																															: V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+				_pixel_format_ = descriptor.v4l2_pixel_format();
+
+				if(_configuration_.device_identity.empty())
+				{
+						_device_dev_path_ = "/dev/video" + std::to_string(_configuration_.device_index);
+				}
+				else if(_configuration_.device_identity.starts_with("/"))
+				{
+						/* Device_Discovery only lists capture nodes, output paths are taken as is. */
+						_device_dev_path_ = _configuration_.device_identity;
+				}
+				else
+				{
+						const auto node = Device_Discovery::resolve(_configuration_.device_identity);
+						if(not node)
+						{
+								throw std::runtime_error("No device found for " + _configuration_.device_identity);
+						}
+						_device_dev_path_ = node->path;
+				}
+
+				setup_device();
+				setup_buffering();
+
+				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_STREAMON, &_buffer_plane_type_))
+				{
+						throw std::runtime_error("VIDIOC_STREAMON: " + std::string{strerror(errno)});
+				}
+		}
+
+		~V4L2_Output_Backend()
+		{
+				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_STREAMOFF, &_buffer_plane_type_))
+				{
+						std::cerr << "VIDIOC_STREAMOFF failed" << std::endl;
+				}
+				/* STREAMOFF returned every buffer, forwarded capture buffers can be requeued. */
+				_in_flight_.clear();
+
+				for(auto& planes : _mapped_buffers_)
+				{
+						for(auto& plane : planes)
+						{
+								if(-1 == munmap(plane.data(), plane.size()))
+								{
+										std::cerr << "munmap failed" << std::endl;
+								}
+						}
+				}
+
+				if(-1 == close(_device_file_descriptor_))
+				{
+						std::cerr << "close failed" << std::endl;
+				}
+		}
+
+		V4L2_Output_Backend(const V4L2_Output_Backend&)						 = delete;
+		V4L2_Output_Backend& operator=(const V4L2_Output_Backend&) = delete;
+
+		/**
+		 * @brief Copies a frame into the next free output buffer and queues it.
+		 * The image must have the configured pixel format and size, strides may
+		 * differ. Returns false when no buffer got free within the timeout.
+		 *
+		 * An Image_View of a compressed format does not know how many bytes the
+		 * frame really holds, those go through write_compressed_frame.
+		 */
+		bool write_frame(const Image_View& image, std::chrono::nanoseconds timestamp = {})
+		{
+				if(image.empty() or image.pixel_format != _configuration_.pixel_format
+					 or image.width != _image_layout_.width or image.height != _image_layout_.height)
+				{
+						std::cerr << "Output frame does not match the negotiated format" << std::endl;
+						return false;
+				}
+				if(describe(_configuration_.pixel_format).compressed)
+				{
+						std::cerr << "Compressed output frames need their payload, use write_compressed_frame" << std::endl;
+						return false;
+				}
+				if(_memory_ != V4L2_MEMORY_MMAP)
+				{
+						throw std::runtime_error("write_frame needs Output_Memory::MMAP, use forward_frame");
+				}
+
+				const auto index = take_free_buffer();
+				if(not index)
+				{
+						++_dropped_frames_;
+						return false;
+				}
+
+				auto& mapped = _mapped_buffers_[*index];
+				std::array<std::size_t, VIDEO_MAX_PLANES> bytes_used{};
+				for(std::size_t i = 0; i < _image_layout_.num_planes; ++i)
+				{
+						const auto& destination = _image_layout_.planes[i];
+						const auto& source			= image.plane(i);
+						auto* target						= mapped[destination.memory_plane].data() + destination.offset;
+
+						const std::size_t row_bytes = std::size_t(destination.width) * destination.bytes_per_sample;
+						if(source.stride == destination.stride)
+						{
+								std::memcpy(target, source.data, destination.size());
+						}
+						else
+						{
+								for(uint32_t y = 0; y < destination.height; ++y)
+								{
+										std::memcpy(target + std::size_t(y) * destination.stride, source.row<Data_Type>(y), row_bytes);
+								}
+						}
+						bytes_used[destination.memory_plane] =
+								std::max(bytes_used[destination.memory_plane], destination.offset + destination.size());
+				}
+
+				return queue(*index, bytes_used, timestamp, nullptr, {});
+		}
+
+		/**
+		 * @brief Copies one compressed frame, e.g. a JPEG, into the next free
+		 * output buffer and queues it with bytesused set to the payload size.
+		 * Payloads larger than the buffer are dropped rather than truncated.
+		 */
+		bool write_compressed_frame(std::span<const Data_Type> payload, std::chrono::nanoseconds timestamp = {})
+		{
+				if(not describe(_configuration_.pixel_format).compressed)
+				{
+						std::cerr << "Output format is not compressed, use write_frame" << std::endl;
+						return false;
+				}
+				if(_memory_ != V4L2_MEMORY_MMAP)
+				{
+						throw std::runtime_error("write_compressed_frame needs Output_Memory::MMAP, use forward_frame");
+				}
+				if(payload.empty())
+				{
+						return false;
+				}
+				/* All buffers were allocated with the same size. */
+				if(payload.size() > _mapped_buffers_.front()[0].size())
+				{
+						std::cerr << "Compressed frame of " << payload.size() << " bytes does not fit the "
+											<< _mapped_buffers_.front()[0].size() << " byte output buffer" << std::endl;
+						++_dropped_frames_;
+						return false;
+				}
+
+				const auto index = take_free_buffer();
+				if(not index)
+				{
+						++_dropped_frames_;
+						return false;
+				}
+				std::memcpy(_mapped_buffers_[*index][0].data(), payload.data(), payload.size());
+
+				std::array<std::size_t, VIDEO_MAX_PLANES> bytes_used{};
+				bytes_used[0] = payload.size();
+				return queue(*index, bytes_used, timestamp, nullptr, {});
+		}
+
+		/**
+		 * @brief Forwards a frame captured by source. With DMABUF import the
+		 * camera buffer itself is queued and the handle is held until the output
+		 * device is done with it, otherwise it is copied like write_frame.
+		 */
+		bool forward_frame(const V4L2_Backend& source, const Frame_Handle& frame)
+		{
+				if(not frame)
+				{
+						return false;
+				}
+				if(_memory_ == V4L2_MEMORY_MMAP)
+				{
+						/* Captured planes span bytesused, for compressed formats that is the payload. */
+						if(describe(_configuration_.pixel_format).compressed)
+						{
+								return not frame->planes.empty()
+											 and write_compressed_frame(frame->planes[0], frame->timestamp);
+						}
+						return write_frame(make_image_view(source.image_layout(), frame->planes), frame->timestamp);
+				}
+
+				const auto& dma_fds = source.dma_buffer_fds();
+				if(frame->buffer_index >= dma_fds.size() or dma_fds[frame->buffer_index].size() < _num_planes_)
+				{
+						std::cerr << "Forwarded frame has no exported DMABUF fds" << std::endl;
+						return false;
+				}
+				if(source.image_layout().num_memory_planes != _image_layout_.num_memory_planes)
+				{
+						std::cerr << "Capture has " << source.image_layout().num_memory_planes << " memory planes, the output "
+											<< _image_layout_.num_memory_planes << ", DMABUF cannot be forwarded" << std::endl;
+						return false;
+				}
+				for(std::size_t plane = 0; plane < _num_planes_; ++plane)
+				{
+						/* QBUF refuses a plane shorter than the output's sizeimage. */
+						if(dma_fds[frame->buffer_index][plane].second < _image_layout_.memory_plane_sizes[plane])
+						{
+								std::cerr << "Capture buffer plane " << plane << " is "
+													<< dma_fds[frame->buffer_index][plane].second << " bytes, the output needs "
+													<< _image_layout_.memory_plane_sizes[plane] << std::endl;
+								return false;
+						}
+				}
+				for(std::size_t i = 0; i < _image_layout_.num_planes; ++i)
+				{
+						/* Imported memory is read with the output's layout, it has to be the same. */
+						if(source.image_layout().planes[i].stride != _image_layout_.planes[i].stride
+							 or source.image_layout().planes[i].offset != _image_layout_.planes[i].offset)
+						{
+								std::cerr << "Capture and output layouts differ, DMABUF cannot be forwarded" << std::endl;
+								return false;
+						}
+				}
+
+				const auto index = take_free_buffer();
+				if(not index)
+				{
+						++_dropped_frames_;
+						return false;
+				}
+
+				std::array<std::size_t, VIDEO_MAX_PLANES> bytes_used{};
+				for(std::size_t plane = 0; plane < _num_planes_; ++plane)
+				{
+						bytes_used[plane] = plane < frame->planes.size() ? frame->planes[plane].size() : 0;
+				}
+				return queue(*index, bytes_used, frame->timestamp, &dma_fds[frame->buffer_index], frame);
+		}
+
+		/**
+		 * @brief True when forward_frame queues capture buffers without copying.
+		 */
+		[[nodiscard]] bool zero_copy() const
+		{
+				return _memory_ == V4L2_MEMORY_DMABUF;
+		}
+
+		[[nodiscard]] const Image_Layout& image_layout() const
+		{
+				return _image_layout_;
+		}
+
+		[[nodiscard]] unsigned int get_width() const
+		{
+				return _image_layout_.width;
+		}
+
+		[[nodiscard]] unsigned int get_height() const
+		{
+				return _image_layout_.height;
+		}
+
+		[[nodiscard]] Pixel_Format get_pixel_format() const
+		{
+				return _configuration_.pixel_format;
+		}
+
+		[[nodiscard]] uintmax_t written_frames() const
+		{
+				return _written_frames_;
+		}
+
+		/**
+		 * @brief Frames given up because every buffer was still owned by the
+		 * device, i.e. the reading side consumes slower than frames are written.
+		 */
+		[[nodiscard]] uintmax_t dropped_frames() const
+		{
+				return _dropped_frames_;
+		}
+
+	private:
+		void setup_device()
+		{
+				struct stat st;
+				if(stat(_device_dev_path_.c_str(), &st) == -1 or not S_ISCHR(st.st_mode))
+				{
+						throw std::runtime_error("Cannot identify output device: " + _device_dev_path_);
+				}
+
+				if(_device_file_descriptor_ = open(_device_dev_path_.c_str(), O_RDWR | O_NONBLOCK, 0);
+					 -1 == _device_file_descriptor_)
+				{
+						throw std::runtime_error("Cannot open output device " + _device_dev_path_ + " -> "
+																		 + strerror(errno));
+				}
+
+				v4l2_capability v4l2_environment;
+				zero_that(v4l2_environment);
+				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_QUERYCAP, &v4l2_environment))
+				{
+						throw std::runtime_error("VIDIOC_QUERYCAP: " + _device_dev_path_ + " -> " + strerror(errno));
+				}
+
+				const uint32_t caps = (v4l2_environment.capabilities & V4L2_CAP_DEVICE_CAPS)
+																	? v4l2_environment.device_caps
+																	: v4l2_environment.capabilities;
+				if(not(caps & (V4L2_CAP_VIDEO_OUTPUT | V4L2_CAP_VIDEO_OUTPUT_MPLANE)))
+				{
+						throw std::runtime_error("Device is not a video output device: " + _device_dev_path_);
+				}
+				if(not(caps & V4L2_CAP_STREAMING))
+				{
+						throw std::runtime_error("Output device does not support streaming i/o.");
+				}
+
+				v4l2_format format;
+				zero_that(format);
+				format.type = _buffer_plane_type_;
+				if(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE == _buffer_plane_type_)
+				{
+						format.fmt.pix_mp.width				= _configuration_.width;
+						format.fmt.pix_mp.height			= _configuration_.height;
+						format.fmt.pix_mp.pixelformat = _pixel_format_;
+						format.fmt.pix_mp.field				= V4L2_FIELD_NONE;
+						format.fmt.pix_mp.num_planes	= describe(_configuration_.pixel_format).num_memory_planes;
+				}
+				else
+				{
+						format.fmt.pix.width			 = _configuration_.width;
+						format.fmt.pix.height			 = _configuration_.height;
+						format.fmt.pix.pixelformat = _pixel_format_;
+						format.fmt.pix.field			 = V4L2_FIELD_NONE;
+				}
+
+				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_FMT, &format))
+				{
+						throw std::runtime_error("VIDIOC_S_FMT: " + std::string(strerror(errno)));
+				}
+				_image_layout_ = make_image_layout(format, _configuration_.pixel_format);
+				_num_planes_	 = _image_layout_.num_memory_planes;
+
+				if(_configuration_.fps)
+				{
+						/* v4l2loopback advertises this rate to its readers. */
+						v4l2_streamparm parameters;
+						zero_that(parameters);
+						parameters.type																	 = _buffer_plane_type_;
+						parameters.parm.output.timeperframe.numerator	 = 1;
+						parameters.parm.output.timeperframe.denominator = _configuration_.fps;
+						if(-1 == xioctl(_device_file_descriptor_, VIDIOC_S_PARM, &parameters))
+						{
+								std::cerr << "VIDIOC_S_PARM: " << strerror(errno) << std::endl;
+						}
+				}
+		}
+
+		void setup_buffering()
+		{
+				v4l2_requestbuffers req;
+				zero_that(req);
+				req.count	 = std::max<unsigned short>(_configuration_.num_buffers, 2);
+				req.type	 = _buffer_plane_type_;
+				req.memory = _memory_;
+
+				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_REQBUFS, &req) and _memory_ == V4L2_MEMORY_DMABUF)
+				{
+						std::cerr << "Output device cannot import DMABUF (" << strerror(errno)
+											<< "), forwarded frames will be copied." << std::endl;
+						_memory_	 = V4L2_MEMORY_MMAP;
+						req.memory = _memory_;
+						req.count	 = std::max<unsigned short>(_configuration_.num_buffers, 2);
+						if(-1 == xioctl(_device_file_descriptor_, VIDIOC_REQBUFS, &req))
+						{
+								req.count = 0;
+						}
+				}
+				if(req.count < 1)
+				{
+						throw std::runtime_error("VIDIOC_REQBUFS: " + std::string{strerror(errno)});
+				}
+
+				_num_buffers_ = req.count;
+				_in_flight_.resize(_num_buffers_);
+				for(unsigned int index = 0; index < _num_buffers_; ++index)
+				{
+						_free_buffers_.push_back(index);
+				}
+				if(_memory_ != V4L2_MEMORY_MMAP)
+				{
+						return;
+				}
+
+				_mapped_buffers_.resize(_num_buffers_);
+				for(unsigned int index = 0; index < _num_buffers_; ++index)
+				{
+						v4l2_buffer buf;
+						zero_that(buf);
+						std::array<v4l2_plane, VIDEO_MAX_PLANES> planes{};
+						buf.type	 = _buffer_plane_type_;
+						buf.memory = V4L2_MEMORY_MMAP;
+						buf.index	 = index;
+						if(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE == _buffer_plane_type_)
+						{
+								buf.m.planes = planes.data();
+								buf.length	 = _num_planes_;
+						}
+
+						if(-1 == xioctl(_device_file_descriptor_, VIDIOC_QUERYBUF, &buf))
+						{
+								throw std::runtime_error("VIDIOC_QUERYBUF");
+						}
+
+						for(std::size_t plane = 0; plane < _num_planes_; ++plane)
+						{
+								const bool multiplanar = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE == _buffer_plane_type_;
+								const auto length			 = multiplanar ? planes[plane].length : buf.length;
+								const auto offset			 = multiplanar ? planes[plane].m.mem_offset : buf.m.offset;
+								void* data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, _device_file_descriptor_, offset);
+								if(MAP_FAILED == data)
+								{
+										throw std::runtime_error("mmap: " + std::string{strerror(errno)});
+								}
+								_mapped_buffers_[index].emplace_back(static_cast<Data_Type*>(data), length);
+						}
+				}
+		}
+
+		/**
+		 * @brief Takes back every buffer the device is done with, waits for one if
+		 * none is free.
+		 */
+		std::optional<unsigned int> take_free_buffer()
+		{
+				reclaim_buffers();
+				if(_free_buffers_.empty())
+				{
+						fd_set fds;
+						FD_ZERO(&fds);
+						FD_SET(_device_file_descriptor_, &fds);
+						timeval tv{0, static_cast<suseconds_t>(_timeout_in_milli * 1000)};
+						if(select(_device_file_descriptor_ + 1, nullptr, &fds, nullptr, &tv) > 0)
+						{
+								reclaim_buffers();
+						}
+				}
+				if(_free_buffers_.empty())
+				{
+						return std::nullopt;
+				}
+				const auto index = _free_buffers_.front();
+				_free_buffers_.pop_front();
+				return index;
+		}
+
+		void reclaim_buffers()
+		{
+				for(;;)
+				{
+						v4l2_buffer buf;
+						zero_that(buf);
+						std::array<v4l2_plane, VIDEO_MAX_PLANES> planes{};
+						buf.type	 = _buffer_plane_type_;
+						buf.memory = _memory_;
+						if(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE == _buffer_plane_type_)
+						{
+								buf.m.planes = planes.data();
+								buf.length	 = _num_planes_;
+						}
+						if(-1 == xioctl(_device_file_descriptor_, VIDIOC_DQBUF, &buf))
+						{
+								if(EAGAIN != errno)
+								{
+										std::cerr << "VIDIOC_DQBUF: " << strerror(errno) << std::endl;
+								}
+								return;
+						}
+						if(buf.index < _num_buffers_)
+						{
+								/* A forwarded capture buffer goes back to its camera here. */
+								_in_flight_[buf.index].reset();
+								_free_buffers_.push_back(buf.index);
+						}
+				}
+		}
+
+		bool queue(unsigned int index,
+							 const std::array<std::size_t, VIDEO_MAX_PLANES>& bytes_used,
+							 std::chrono::nanoseconds timestamp,
+							 const std::vector<std::pair<int, size_t>>* dma_fds,
+							 Frame_Handle forwarded)
+		{
+				v4l2_buffer buf;
+				zero_that(buf);
+				std::array<v4l2_plane, VIDEO_MAX_PLANES> planes{};
+				buf.type	= _buffer_plane_type_;
+				buf.memory = _memory_;
+				buf.index	= index;
+				buf.field	= V4L2_FIELD_NONE;
+				buf.timestamp.tv_sec	= static_cast<time_t>(timestamp.count() / 1000000000);
+				buf.timestamp.tv_usec = static_cast<suseconds_t>(timestamp.count() % 1000000000 / 1000);
+
+				if(V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE == _buffer_plane_type_)
+				{
+						for(std::size_t plane = 0; plane < _num_planes_; ++plane)
+						{
+								planes[plane].bytesused = static_cast<uint32_t>(bytes_used[plane]);
+								if(dma_fds)
+								{
+										planes[plane].m.fd	 = (*dma_fds)[plane].first;
+										planes[plane].length = static_cast<uint32_t>((*dma_fds)[plane].second);
+								}
+						}
+						buf.m.planes = planes.data();
+						buf.length	 = _num_planes_;
+				}
+				else
+				{
+						buf.bytesused = static_cast<uint32_t>(bytes_used[0]);
+						if(dma_fds)
+						{
+								buf.m.fd	 = (*dma_fds)[0].first;
+								buf.length = static_cast<uint32_t>((*dma_fds)[0].second);
+						}
+				}
+
+				if(-1 == xioctl(_device_file_descriptor_, VIDIOC_QBUF, &buf))
+				{
+						std::cerr << "VIDIOC_QBUF: " << strerror(errno) << std::endl;
+						_free_buffers_.push_back(index);
+						return false;
+				}
+
+				_in_flight_[index] = std::move(forwarded);
+				++_written_frames_;
+				return true;
+		}
+
+	private:
+		Stream_Configuration _configuration_;
+		v4l2_memory _memory_;
+		v4l2_buf_type _buffer_plane_type_;
+		uint32_t _pixel_format_			 = 0;
+		int _device_file_descriptor_ = -1;
+		std::string _device_dev_path_;
+		Image_Layout _image_layout_;
+		std::size_t _num_planes_		= 1;
+		unsigned int _num_buffers_ = 0;
+		std::vector<Multiplanar_Buffer_View> _mapped_buffers_;
+		std::deque<unsigned int> _free_buffers_;
+		/**
+		 * @brief Capture frames queued by forward_frame, per output buffer.
+		 */
+		std::vector<Frame_Handle> _in_flight_;
+		uintmax_t _written_frames_ = 0;
+		uintmax_t _dropped_frames_ = 0;
+};
+
+} // namespace Cartrack
+
+#endif // ISGURSOY_V4L2_OUTPUT_HPP
@@ -1,137 +1,39 @@
 #include "isgursoy_V4L2.hpp"
+#include "Capture_Group.hpp"
+#include "Dmabuf_Share.hpp"
+#include "isgursoy_V4L2_Output.hpp"
+#include "Synthetic_Backend.hpp"
+#include "Fake_V4L2_Device.hpp"
+#include "Replay_Backend.hpp"
+#include "Raw_Recorder.hpp"
+#include "Recording_Compression.hpp"
+#include "Pre_Event_Ring.hpp"
+#include "Stream_Hub.hpp"
+#include "Shm_Frame_Ring.hpp"
+#include "Color_Conversion.hpp"
+#include "Image_Resize.hpp"
+#include "Tensor_Preprocessing.hpp"
+#include "Mjpeg_Decoder.hpp"
 #include <chrono>
 #include <filesystem>
 #include <algorithm>
+#include <sys/wait.h>
 #ifdef LIBPNG_AVAILABLE
 #		include <png.h>
 #endif
 
-constexpr ushort
-get_num_planes(
-		Cartrack::Pixel_Format px_format)
-{
-		switch(px_format)
-		{
-				case Cartrack::Pixel_Format::NV12sp:
-						return 2;
-				case Cartrack::Pixel_Format::YUV422P:
-						return 3;
-				case Cartrack::Pixel_Format::NV12:
-				case Cartrack::Pixel_Format::YUYV422:
-				case Cartrack::Pixel_Format::MJPEG:
-				case Cartrack::Pixel_Format::BGR24:
-				case Cartrack::Pixel_Format::RGB24:
-						return 1;
-				case Cartrack::Pixel_Format::Invalid:
-				default:
-						return 0;
-		}
-		return 0;
-}
-
-std::vector<size_t>
-get_plane_dimensions(
-		Cartrack::Pixel_Format px_format,
-		size_t width,
-		size_t height)
-{
-		std::vector<size_t> sizes;
-		sizes.resize(get_num_planes(px_format));
-		switch(px_format)
-		{
-				case Cartrack::Pixel_Format::MJPEG:
-				case Cartrack::Pixel_Format::YUYV422:
-						sizes[0] = width * height * 2;
-						break;
-				case Cartrack::Pixel_Format::YUV422P:
-						sizes[0] = width * height;
-						sizes[1] = width * height / 2;
-						sizes[2] = width * height / 2;
-						break;
-				case Cartrack::Pixel_Format::NV12:
-						sizes[0] = width * height * 1.5;
-						break;
-				case Cartrack::Pixel_Format::NV12sp:
-						sizes[0] = width * height;
-						sizes[1] = width * height / 2;
-						break;
-				case Cartrack::Pixel_Format::BGR24:
-				case Cartrack::Pixel_Format::RGB24:
-						sizes[0] = width * height * 3;
-						break;
-				case Cartrack::Pixel_Format::Invalid:
-				default:
-						break;
-		}
-		return sizes;
-}
-
 using Frame_Plane = std::vector<Cartrack::Data_Type>;
 using Frame_Impl	= std::vector<Frame_Plane>;
 using uchar				= unsigned char;
 
+using NV12_View = Cartrack::Typed_Image_View<Cartrack::Pixel_Format::NV12>;
+
 void
 write_frame_to_disk(
-		Cartrack::Multiplanar_Buffer_View& frame,
-		int w,
-		int h,
+		const NV12_View& frame,
 		int order,
 		bool mmap)
 {
-		auto convert_nv12_to_bgr = [](const Cartrack::Multiplanar_Buffer_View& data,
-																	Frame_Impl& bgr_buffer,
-																	size_t width,
-																	size_t height,
-																	bool rgb)
-		{
-				const uchar* y_plane = (uchar*) data[0].data();
-				const uchar* uv_plane =
-						data.size() > 1 ? (uchar*) data[1].data() : (uchar*) y_plane + width * height;
-				uchar* bgr = (uchar*) (bgr_buffer[0].data());
-
-				const unsigned int half_width = width / 2;
-				for(unsigned short y = 0; y < height; ++y)
-				{
-						const unsigned int y_stride	 = y * width;
-						const unsigned int uv_stride = y / 2 * half_width;
-						unsigned int uv_index				 = uv_stride;
-						for(unsigned short x = 0; x < width; ++x)
-						{
-								const unsigned int y_index = 3 * (y_stride + x);
-								if(x % 2 == 0)
-								{
-										uv_index = (uv_stride + x / 2) * 2;
-								}
-
-								const short Y = y_plane[y_index / 3];
-								const short U = uv_plane[uv_index] - 128;
-								const short V = uv_plane[uv_index + 1] - 128;
-
-								bgr[y_index + 1] = std::clamp(
-										static_cast<int>(1.164 * (Y - 16) - 0.813 * V - 0.391 * U), 0, 255);
-								if(rgb)
-								{
-										bgr[y_index + 2] =
-												std::clamp(static_cast<int>(1.164 * (Y - 16) + 2.018 * U), 0, 255);
-
-										bgr[y_index] =
-												std::clamp(static_cast<int>(1.164 * (Y - 16) + 1.596 * V), 0, 255);
-								}
-								else
-								{
-										bgr[y_index] =
-												std::clamp(static_cast<int>(1.164 * (Y - 16) + 2.018 * U), 0, 255);
-
-										bgr[y_index + 2] =
-												std::clamp(static_cast<int>(1.164 * (Y - 16) + 1.596 * V), 0, 255);
-								}
-						}
-				}
-
-				return;
-		};
-
-
 #ifdef LIBPNG_AVAILABLE
 		auto save_rgb_png = [](const std::string& filename,
 													 int width,
@@ -203,20 +105,25 @@ write_frame_to_disk(
 		};
 #endif
 
+		const int w = frame.width;
+		const int h = frame.height;
+
 		Frame_Impl rgb_buffer;
 		rgb_buffer.resize(1);
 		rgb_buffer[0].resize(w * h * 3);
 
-		convert_nv12_to_bgr(frame, rgb_buffer, w, h, true);
+		const auto rgb_layout = Cartrack::make_packed_image_layout(Cartrack::Pixel_Format::RGB24, w, h, false);
+		Cartrack::convert_image(frame, Cartrack::make_image_view(rgb_layout, {std::span(rgb_buffer[0])}));
 
 		std::string filename = "cartrack_" + std::string(mmap ? "mmap" : "userptr") + "test_frame_"
 													 + std::to_string(order) + ".png";
 		save_rgb_png(filename, w, h, rgb_buffer[0]);
 }
 
+template <typename Backend>
 static void
 userptr_capture(
-		std::shared_ptr<Cartrack::V4L2_Backend> backend,
+		std::shared_ptr<Backend> backend,
 		uint num_frames = 1000)
 {
 		if(backend->configuration().buffering
@@ -227,19 +134,17 @@ userptr_capture(
 						<< std::endl;
 		}
 
-		auto px_format	 = backend->get_pixel_format();
-		auto num_planes	 = get_num_planes(px_format);
-		const int width	 = backend->get_width();
-		const int height = backend->get_height();
-		auto plane_dims	 = get_plane_dimensions(px_format, width, height);
+		/* Driver decides sizeimage and row padding, allocate what it negotiated. */
+		const auto& layout	 = backend->image_layout();
+		const auto num_planes = layout.num_memory_planes;
 
-		auto make_empty_frame = [backend, &px_format, &num_planes, &plane_dims]()
+		auto make_empty_frame = [&layout, &num_planes]()
 		{
 				std::vector<Frame_Plane> allocated_cpu_data;
-				allocated_cpu_data.resize(get_num_planes(px_format));
-				for(auto plane_index = 0; plane_index < num_planes; ++plane_index)
+				allocated_cpu_data.resize(num_planes);
+				for(std::size_t plane_index = 0; plane_index < num_planes; ++plane_index)
 				{
-						allocated_cpu_data[plane_index].resize(plane_dims.at(plane_index));
+						allocated_cpu_data[plane_index].resize(layout.memory_plane_sizes[plane_index]);
 				}
 				return allocated_cpu_data;
 		};
@@ -257,7 +162,7 @@ userptr_capture(
 				Cartrack::Multiplanar_Buffer_View& userspace_frame_view =
 						userspace_frames_cpu_views[buffer_index];
 
-				for(auto plane_index = 0; plane_index < num_planes; ++plane_index)
+				for(std::size_t plane_index = 0; plane_index < num_planes; ++plane_index)
 				{
 						userspace_frame_view.emplace_back(std::span<Cartrack::Data_Type>(
 								userspace_frame[plane_index].data(), userspace_frame[plane_index].size()));
@@ -283,7 +188,10 @@ userptr_capture(
 				// for(int j = 0; j < num_buffers; ++j)
 				// {
 				// 		write_frame_to_disk(
-				// 				userspace_frames_cpu_views[j], width, height, i + j + 1, false);
+				// 				Cartrack::make_typed_image_view<Cartrack::Pixel_Format::NV12>(
+				// 						layout, userspace_frames_cpu_views[j]),
+				// 				i + j + 1,
+				// 				false);
 				// }
 		}
 		average_capture_latency /= num_frames;
@@ -292,9 +200,10 @@ userptr_capture(
 		std::cout << "Average capture latency: " << average_capture_latency << " ms" << std::endl;
 }
 
+template <typename Backend>
 static void
 mmap_capture(
-		std::shared_ptr<Cartrack::V4L2_Backend> backend,
+		std::shared_ptr<Backend> backend,
 		uint num_frames = 1000)
 {
 		const auto num_buffers = backend->configuration().num_buffers;
@@ -306,7 +215,7 @@ mmap_capture(
 		auto start_time = std::chrono::high_resolution_clock::now();
 		for(int i = 0; i < num_frames; ++i)
 		{
-				auto frame			= backend->get_frame_data();
+				static_cast<void>(backend->template get_image_view<Cartrack::Pixel_Format::NV12>());
 				auto end_time		= std::chrono::high_resolution_clock::now();
 				std::chrono::duration<double, std::milli> elapsed_time = end_time - start_time;
 				average_capture_latency += elapsed_time.count();
@@ -319,7 +228,7 @@ mmap_capture(
 				// 		continue;
 				// }
 
-				//write_frame_to_disk(frame, width, height, i + 1, true);
+				//write_frame_to_disk(frame, i + 1, true);
 		}
 		average_capture_latency /= num_frames;
 		std::cout << "------------------------------------------------------------------------"
@@ -327,6 +236,98 @@ mmap_capture(
 		std::cout << "Average Frame Latency: " << average_capture_latency << " ms" << std::endl;
 }
 
+/**
+ * @brief Serves frames of the camera to other processes until num_frames were
+ * captured. Pair with a second process running dmabuf_subscribe, e.g. on vivid:
+ * ./v4l2_test 0 publish /tmp/camera0.sock & ./v4l2_test 0 subscribe /tmp/camera0.sock
+ */
+static void
+dmabuf_publish(
+		std::shared_ptr<Cartrack::V4L2_Backend> backend,
+		const std::string& socket_path,
+		uint num_frames = 1000)
+{
+		Cartrack::Dmabuf_Publisher publisher(backend, socket_path);
+		std::cout << "Publishing on " << socket_path << std::endl;
+
+		for(uint i = 0; i < num_frames; ++i)
+		{
+				publisher.publish(backend->acquire_frame());
+		}
+
+		const auto& statistics = publisher.statistics();
+		std::cout << "Published: " << statistics.published << "\tReleased: " << statistics.released
+							<< "\tSkipped: " << statistics.skipped << "\tStarving: "
+							<< backend->buffer_starvation_count() << std::endl;
+}
+
+static void
+dmabuf_subscribe(
+		const std::string& socket_path,
+		uint num_frames = 1000)
+{
+		Cartrack::Dmabuf_Subscriber subscriber(socket_path);
+		const auto& layout = subscriber.image_layout();
+		std::cout << "Subscribed to " << layout.width << "x" << layout.height << " over "
+							<< subscriber.num_buffers() << " shared buffers" << std::endl;
+
+		std::chrono::nanoseconds total_latency{0};
+		uint received = 0;
+		while(received < num_frames and subscriber.connected())
+		{
+				auto frame = subscriber.next_frame();
+				if(not frame)
+				{
+						continue;
+				}
+				timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				total_latency += std::chrono::seconds{now.tv_sec} + std::chrono::nanoseconds{now.tv_nsec}
+												 - frame->timestamp;
+				++received;
+		}
+
+		std::cout << "Received: " << received << "\tAverage latency since capture: "
+							<< (received ? total_latency.count() / received / 1e6 : 0) << " ms" << std::endl;
+}
+
+/**
+ * @brief Re-publishes the camera on an output node with the capture's plane
+ * layout. Single planar on v4l2loopback, e.g. after
+ * modprobe v4l2loopback video_nr=10 exclusive_caps=1,
+ * multiplanar needs an MPLANE output like vivid with multiplanar=2:
+ * ./v4l2_test 0 loopback 10
+ */
+static void
+loopback_forward(
+		std::shared_ptr<Cartrack::V4L2_Backend> backend,
+		int output_index,
+		uint num_frames = 1000)
+{
+		auto output_params				 = backend->configuration();
+		output_params.device_index	 = static_cast<Cartrack::Camera_ID>(output_index);
+		output_params.device_identity.clear();
+		output_params.width	 = backend->get_width();
+		output_params.height = backend->get_height();
+		Cartrack::V4L2_Output_Backend output(output_params,
+																				 Cartrack::V4L2_Output_Backend::Output_Memory::DMABUF);
+		std::cout << "Forwarding to /dev/video" << output_index
+							<< (output_params.v4l2.contiguous ? " single planar" : " multiplanar")
+							<< (output.zero_copy() ? " without copying" : " with one copy per frame") << std::endl;
+
+		uint refused = 0;
+		for(uint i = 0; i < num_frames; ++i)
+		{
+				const auto dropped = output.dropped_frames();
+				if(not output.forward_frame(*backend, backend->acquire_frame()) and dropped == output.dropped_frames())
+				{
+						++refused;
+				}
+		}
+		std::cout << "Written: " << output.written_frames() << "\tDropped: " << output.dropped_frames()
+							<< "\tRefused: " << refused << std::endl;
+}
+
 const static Cartrack::Stream_Configuration
 get_test_setup(int camera_index=0,bool mmap=true)
 {
@@ -368,6 +369,1260 @@ get_test_setup(int camera_index=0,bool mmap=true)
 		return params;
 }
 
+/**
+ * @brief Runs V4L2_Backend against Fake_V4L2_Device: the usual captures at the
+ * emulated sensor rate, the Only_Newest drain with an unthrottled sensor to time
+ * the userspace side alone, then recovery from injected EAGAIN, EIO and an
+ * unplug. Discovery and a backend opened by card name go through the fake too.
+ * No camera needed: ./v4l2_test 0 fake
+ */
+static void
+fake_device_test(int camera_index)
+{
+		Cartrack::Fake_Device_Options options;
+		options.path = "/dev/video" + std::to_string(camera_index);
+
+		for(const bool mmap : {true, false})
+		{
+				auto device	 = std::make_shared<Cartrack::Fake_V4L2_Device>(options);
+				auto params	 = get_test_setup(camera_index, mmap);
+				params.num_buffers = 4;
+				auto backend = std::make_shared<Cartrack::V4L2_Backend>(params, device);
+				if(mmap)
+				{
+						mmap_capture(backend, 30);
+				}
+				else
+				{
+						userptr_capture(backend, 32);
+				}
+				const auto statistics = device->statistics();
+				std::cout << "Sensor frames: " << statistics.produced << "	Overrun: " << statistics.overrun
+									<< "	ioctls: " << statistics.ioctl_calls << std::endl;
+		}
+
+		{
+				auto device		 = std::make_shared<Cartrack::Fake_V4L2_Device>(options);
+				const auto nodes = Cartrack::Device_Discovery::scan(*device);
+				for(const auto& node : nodes)
+				{
+						std::cout << "Discovered " << node.path << "	" << node.card << "	" << node.bus_info << std::endl;
+				}
+
+				auto params				 = get_test_setup(camera_index, true);
+				params.num_buffers = 4;
+				params.device_identity = "card:Fake V4L2 Device";
+				auto backend = std::make_shared<Cartrack::V4L2_Backend>(params, device);
+				mmap_capture(backend, 10);
+		}
+
+		{
+				options.fps = 0;
+				auto device = std::make_shared<Cartrack::Fake_V4L2_Device>(options);
+				auto params = get_test_setup(camera_index, true);
+				params.num_buffers = 4;
+				params.v4l2.buffer_usage_policy =
+						Cartrack::Stream_Configuration::V4L2::Internal_Buffering_Strategy::Only_Newest;
+				Cartrack::V4L2_Backend backend(params, device);
+
+				constexpr int num_frames = 100000;
+				const auto start				 = std::chrono::steady_clock::now();
+				for(int i = 0; i < num_frames; ++i)
+				{
+						(void)backend.get_frame_data();
+				}
+				const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+				std::cout << "Only_Newest drain without sensor wait: " << elapsed.count() / num_frames
+									<< " us per frame, " << device->statistics().ioctl_calls / double(num_frames)
+									<< " ioctls per frame" << std::endl;
+		}
+
+		{
+				auto device = std::make_shared<Cartrack::Fake_V4L2_Device>(options);
+				auto params = get_test_setup(camera_index, true);
+				params.num_buffers = 4;
+				Cartrack::V4L2_Backend backend(params, device);
+
+				device->inject_error(VIDIOC_DQBUF, EAGAIN, 3);
+				device->inject_error(VIDIOC_DQBUF, EIO);
+				int received = 0;
+				for(int i = 0; i < 20; ++i)
+				{
+						received += not backend.get_frame_data().empty();
+				}
+				std::cout << "Frames after injected EAGAIN and EIO: " << received << " of 20" << std::endl;
+
+				device->disconnect();
+				const auto start = std::chrono::steady_clock::now();
+				const bool empty = backend.get_frame_data().empty();
+				const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+				std::cout << "After unplug: " << (empty ? "empty frame" : "frame") << " in " << elapsed.count()
+									<< " ms, injected errors: " << device->statistics().injected_errors << std::endl;
+		}
+}
+
+/**
+ * @brief Changes controls from a second thread with submit_control while the
+ * main thread captures from Fake_V4L2_Device, like a control loop next to a
+ * capture loop without a mutex between them. Every change must report a frame
+ * captured after it was submitted. Then the queue is filled without capturing:
+ * the overflow resolves with EBUSY and the rest with ECANCELED once the backend
+ * goes away. Last a 14 control snapshot through get_controls, and
+ * set_manual_exposure_value on a driver refusing the extended controls batch.
+ * No camera needed: ./v4l2_test 0 controls
+ */
+static void
+control_queue_test(int camera_index)
+{
+		Cartrack::Fake_Device_Options options;
+		options.path = "/dev/video" + std::to_string(camera_index);
+		auto device	 = std::make_shared<Cartrack::Fake_V4L2_Device>(options);
+		auto params	 = get_test_setup(camera_index, true);
+		params.num_buffers = 4;
+		auto backend = std::make_unique<Cartrack::V4L2_Backend>(params, device);
+
+		/* Fake frames start with their driver sequence number. */
+		std::atomic<uint32_t> last_sequence{0};
+		std::atomic<bool> controlling{true};
+		constexpr int num_changes = 10;
+		int late_changes					= 0;
+		int failed_changes				= 0;
+		double frames_to_apply		= 0;
+
+		std::thread control_loop(
+				[&]
+				{
+						for(int value = 1; value <= num_changes; ++value)
+						{
+								const uint32_t submitted_after = last_sequence.load();
+								auto pending									 = backend->submit_control(V4L2_CID_GAIN, value);
+								if(pending.wait_for(std::chrono::seconds{1}) != std::future_status::ready)
+								{
+										++failed_changes;
+										continue;
+								}
+								const auto result = pending.get();
+								if(not result.applied)
+								{
+										++failed_changes;
+										continue;
+								}
+								late_changes += result.first_sequence <= submitted_after;
+								frames_to_apply += result.first_sequence - submitted_after;
+						}
+						controlling = false;
+				});
+
+		while(controlling)
+		{
+				const auto planes = backend->get_frame_data();
+				if(not planes.empty() and planes[0].size() >= sizeof(uint32_t))
+				{
+						uint32_t sequence = 0;
+						std::memcpy(&sequence, planes[0].data(), sizeof(sequence));
+						last_sequence = sequence;
+				}
+		}
+		control_loop.join();
+
+		std::cout << "Changes applied: " << num_changes - failed_changes << " of " << num_changes
+							<< "\tReported before submission: " << late_changes
+							<< "\tFrames until applied: " << frames_to_apply / std::max(1, num_changes - failed_changes)
+							<< "\tGain now: " << backend->get_gain() << " expected " << num_changes << std::endl;
+
+		std::vector<std::future<Cartrack::Control_Result>> flood;
+		for(int i = 0; i < 100; ++i)
+		{
+				flood.push_back(backend->submit_control(V4L2_CID_GAIN, i));
+		}
+		backend.reset();
+		int busy			= 0;
+		int cancelled = 0;
+		for(auto& pending : flood)
+		{
+				const int error = pending.get().error;
+				busy += error == EBUSY;
+				cancelled += error == ECANCELED;
+		}
+		std::cout << "Flooded with 100 changes: " << busy << " EBUSY, " << cancelled << " ECANCELED" << std::endl;
+
+		device	= std::make_shared<Cartrack::Fake_V4L2_Device>(options);
+		backend = std::make_unique<Cartrack::V4L2_Backend>(params, device);
+
+		std::array<Cartrack::Control_Value, 14> snapshot;
+		for(std::size_t i = 0; i < snapshot.size(); ++i)
+		{
+				snapshot[i].id = V4L2_CID_BASE + i;
+		}
+		const auto before = device->statistics().ioctl_calls;
+		const bool read		= backend->get_controls(snapshot);
+		std::cout << "Snapshot of " << snapshot.size() << " controls: " << (read ? "read" : "failed") << " with "
+							<< device->statistics().ioctl_calls - before << " ioctl" << std::endl;
+
+		/* A driver refusing the batch must still get mode and value through single writes. */
+		device->inject_error(VIDIOC_S_EXT_CTRLS, EINVAL);
+		const bool set = backend->set_manual_exposure_value(250);
+		std::cout << "Manual exposure with VIDIOC_S_EXT_CTRLS refused: " << (set ? "set" : "failed") << ", mode "
+							<< backend->get_auto_exposure_current_value() << " expected " << V4L2_EXPOSURE_MANUAL
+							<< ", value " << backend->get_manual_exposure_value() << " expected 250" << std::endl;
+}
+
+/**
+ * @brief Scans the capture nodes in parallel and times it against probing
+ * them one after another, then resolves every identity of every node back to
+ * it and opens the first camera by its bus identity. Works on any machine
+ * with cameras or with vivid: sudo modprobe vivid n_devs=4 && ./v4l2_test 0 discover
+ */
+static void
+discovery_test(int camera_index)
+{
+		auto start			 = std::chrono::steady_clock::now();
+		const auto nodes = Cartrack::Device_Discovery::scan();
+		const std::chrono::duration<double, std::milli> parallel = std::chrono::steady_clock::now() - start;
+		if(nodes.empty())
+		{
+				std::cout << "No capture nodes found, load vivid: sudo modprobe vivid n_devs=4" << std::endl;
+				return;
+		}
+
+		start = std::chrono::steady_clock::now();
+		for(const auto& node : nodes)
+		{
+				(void)Cartrack::Device_Discovery::resolve(node.path);
+		}
+		const std::chrono::duration<double, std::milli> sequential = std::chrono::steady_clock::now() - start;
+		std::cout << nodes.size() << " capture nodes, parallel scan: " << parallel.count()
+							<< " ms, probing them one by one: " << sequential.count() << " ms" << std::endl;
+
+		std::vector<std::string> identities;
+		std::vector<std::string> expected_paths;
+		for(const auto& node : nodes)
+		{
+				std::cout << node.path << "\t" << node.card << "\t" << node.bus_info
+									<< (node.serial.empty() ? "" : "\tserial " + node.serial)
+									<< (node.by_id.empty() ? "" : "\t" + node.by_id) << std::endl;
+				for(const auto& identity :
+						{node.path, node.by_id, node.by_path, node.serial.empty() ? "" : "serial:" + node.serial,
+						 "bus:" + node.bus_info})
+				{
+						if(not identity.empty())
+						{
+								identities.push_back(identity);
+								expected_paths.push_back(node.path);
+						}
+				}
+		}
+
+		/* Cheap USB cameras of one model may share a serial, it resolves to the first of them. */
+		const auto resolved = Cartrack::Device_Discovery::resolve_all(identities);
+		int mismatches			= 0;
+		for(std::size_t i = 0; i < identities.size(); ++i)
+		{
+				if(not resolved[i] or resolved[i]->path != expected_paths[i])
+				{
+						std::cout << "Resolved " << identities[i] << " to " << (resolved[i] ? resolved[i]->path : "nothing")
+											<< ", expected " << expected_paths[i] << std::endl;
+						++mismatches;
+				}
+		}
+		std::cout << identities.size() << " identities resolved with one scan, mismatches: " << mismatches
+							<< std::endl;
+
+		auto params						 = get_test_setup(camera_index, true);
+		params.device_identity = "bus:" + nodes.front().bus_info;
+		params.num_buffers		 = 4;
+		try
+		{
+				mmap_capture(std::make_shared<Cartrack::V4L2_Backend>(params), 10);
+		}
+		catch(const std::exception& error)
+		{
+				std::cout << "Opening " << params.device_identity << " failed: " << error.what() << std::endl;
+		}
+}
+
+/**
+ * @brief Groups three Synthetic_Backend cameras: two at 30 fps with jitter and
+ * injected drops, one at 15 fps, so the fast ones drop every other frame and
+ * resync after every injected drop. Each set is checked against the tolerance
+ * and for frames reused from the previous set. Then 30 and 15 fps with a
+ * budget of one attempt, whose pulled frames have to be checked too. Last a
+ * camera started half a frame out of phase, which no tolerance below half a
+ * period can match.
+ * No camera needed: ./v4l2_test 0 group
+ */
+static void
+capture_group_test(int camera_index)
+{
+		using Synthetic_Pointer = std::shared_ptr<Cartrack::Synthetic_Backend>;
+		auto make_camera				= [camera_index](uint32_t fps, uint64_t seed, double drop_probability)
+		{
+				auto params												= get_test_setup(camera_index, true);
+				params.backend										= Cartrack::Stream_Configuration::Capture_Backends::Synthetic;
+				params.width											= 320;
+				params.height											= 240;
+				params.fps												= fps;
+				params.synthetic.unthrottled			= true;
+				params.synthetic.jitter						= std::chrono::microseconds{500};
+				params.synthetic.drop_probability = drop_probability;
+				params.synthetic.seed							= seed;
+				/* Each camera's schedule starts at its construction, rendering one frame keeps them in phase. */
+				params.synthetic.distinct_frames = 1;
+				return std::make_shared<Cartrack::Synthetic_Backend>(params);
+		};
+
+		const std::vector<Synthetic_Pointer> cameras{make_camera(30, 1, 0.05), make_camera(30, 2, 0.05), make_camera(15, 3, 0)};
+		const auto tolerance = std::chrono::milliseconds{8};
+		Cartrack::Capture_Group group({cameras.begin(), cameras.end()}, tolerance);
+
+		constexpr int num_sets = 300;
+		int out_of_tolerance	 = 0;
+		int reused_frames			 = 0;
+		std::vector<uintmax_t> previous_orders(cameras.size(), 0);
+		for(int i = 0; i < num_sets; ++i)
+		{
+				const auto set = group.next_set();
+				if(not set)
+				{
+						continue;
+				}
+				const auto [oldest, newest] = std::minmax_element(set->frames.begin(),
+																													set->frames.end(),
+																													[](const auto& a, const auto& b)
+																													{ return a.timestamp < b.timestamp; });
+				out_of_tolerance += newest->timestamp - oldest->timestamp > tolerance
+														or newest->timestamp - oldest->timestamp != set->skew;
+				for(std::size_t camera = 0; camera < cameras.size(); ++camera)
+				{
+						reused_frames += set->frames[camera].frame_order <= previous_orders[camera];
+						previous_orders[camera] = set->frames[camera].frame_order;
+				}
+		}
+
+		const auto& statistics = group.statistics();
+		std::cout << "Sets: " << statistics.emitted_sets << " of " << num_sets << "\tFailed: " << statistics.failed_sets
+							<< "\tOut of tolerance: " << out_of_tolerance << "\tReused frames: " << reused_frames
+							<< "\tMean skew: " << statistics.mean_skew().count() / 1e6
+							<< " ms\tMax skew: " << statistics.max_skew.count() / 1e6 << " ms" << std::endl;
+		for(std::size_t camera = 0; camera < cameras.size(); ++camera)
+		{
+				std::cout << "Camera " << camera << " at " << cameras[camera]->get_fps()
+									<< " fps\tdropped by the group: " << statistics.dropped_frames[camera]
+									<< "\tinjected drops: " << cameras[camera]->dropped_frames() << std::endl;
+		}
+
+		Cartrack::Capture_Group one_attempt({make_camera(30, 6, 0), make_camera(15, 7, 0)}, tolerance, 1);
+		int aligned = 0;
+		for(int i = 0; i < 30; ++i)
+		{
+				aligned += one_attempt.next_set().has_value();
+		}
+		std::cout << "One attempt per set: " << aligned << " of 30 sets, failed " << one_attempt.statistics().failed_sets
+							<< std::endl;
+
+		auto in_phase = make_camera(30, 4, 0);
+		std::this_thread::sleep_for(std::chrono::microseconds{1000000 / 60});
+		auto out_of_phase = make_camera(30, 5, 0);
+		Cartrack::Capture_Group drifting({in_phase, out_of_phase}, tolerance);
+		int matched = 0;
+		for(int i = 0; i < 10; ++i)
+		{
+				matched += drifting.next_set().has_value();
+		}
+		std::cout << "Half a frame out of phase: " << matched << " of 10 sets, failed "
+							<< drifting.statistics().failed_sets << std::endl;
+}
+
+/**
+ * @brief Fans one stream out through Stream_Hub: a full rate native recorder,
+ * two 30 fps RGB24 consumers sharing one conversion, a 5 fps thumbnail and a
+ * slow consumer that takes 50 ms per frame on its own thread and drops what
+ * does not fit its two frame mailbox. The others must keep full rate, and once
+ * every handle is gone all buffers must be queued in the driver again.
+ *
+ * Stream_Hub hands out frame handles that requeue V4L2 buffers, so this runs
+ * V4L2_Backend on Fake_V4L2_Device, which counts QBUF and DQBUF. No camera
+ * needed: ./v4l2_test 0 hub
+ */
+static void
+stream_hub_test(int camera_index)
+{
+		Cartrack::Fake_Device_Options options;
+		options.path			 = "/dev/video" + std::to_string(camera_index);
+		auto device				 = std::make_shared<Cartrack::Fake_V4L2_Device>(options);
+		auto params				 = get_test_setup(camera_index, true);
+		params.width			 = 640;
+		params.height			 = 480;
+		params.fps				 = 120;
+		params.num_buffers = 8;
+		auto backend			 = std::make_shared<Cartrack::V4L2_Backend>(params, device);
+
+		struct Slow_Consumer
+		{
+				std::mutex mutex;
+				std::condition_variable wake_up;
+				std::deque<Cartrack::Stream_Frame> mailbox;
+				bool running			= true;
+				uintmax_t dropped = 0;
+				uintmax_t handled = 0;
+		} slow;
+
+		std::thread slow_worker(
+				[&slow]
+				{
+						std::unique_lock lock(slow.mutex);
+						while(slow.running or not slow.mailbox.empty())
+						{
+								if(slow.mailbox.empty())
+								{
+										slow.wake_up.wait(lock);
+										continue;
+								}
+								auto frame = std::move(slow.mailbox.front());
+								slow.mailbox.pop_front();
+								lock.unlock();
+								std::this_thread::sleep_for(std::chrono::milliseconds{50});
+								frame = {};
+								lock.lock();
+								++slow.handled;
+						}
+				});
+
+		{
+				Cartrack::Stream_Hub hub(backend);
+				hub.register_color_converters();
+
+				auto ignore							= [](const Cartrack::Stream_Frame&) {};
+				const auto recorder			= hub.subscribe({0, Cartrack::Pixel_Format::Invalid, ignore});
+				const auto inference		= hub.subscribe({30, Cartrack::Pixel_Format::RGB24, ignore});
+				const auto overlay			= hub.subscribe({30, Cartrack::Pixel_Format::RGB24, ignore});
+				const auto thumbnails		= hub.subscribe({5, Cartrack::Pixel_Format::GRAY8, ignore});
+				const auto slow_consumer = hub.subscribe({0,
+																									Cartrack::Pixel_Format::Invalid,
+																									[&slow](const Cartrack::Stream_Frame& frame)
+																									{
+																											std::lock_guard lock(slow.mutex);
+																											if(slow.mailbox.size() >= 2)
+																											{
+																													++slow.dropped;
+																													return;
+																											}
+																											slow.mailbox.push_back(frame);
+																											slow.wake_up.notify_one();
+																									}});
+
+				constexpr int num_frames = 240;
+				int dispatched					 = 0;
+				const auto start				 = std::chrono::steady_clock::now();
+				for(int i = 0; i < num_frames; ++i)
+				{
+						dispatched += hub.dispatch();
+				}
+				const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+				std::cout << "Dispatched " << dispatched << " of " << num_frames << " at " << dispatched / elapsed.count()
+									<< " fps, sensor overruns: " << device->statistics().overrun
+									<< ", starving: " << backend->buffer_starvation_count() << std::endl;
+				for(const auto& [name, id] : {std::pair{"recorder", recorder},
+																			std::pair{"inference", inference},
+																			std::pair{"overlay", overlay},
+																			std::pair{"thumbnails", thumbnails},
+																			std::pair{"slow consumer", slow_consumer}})
+				{
+						const auto statistics = hub.statistics(id);
+						std::cout << name << "\tdelivered: " << statistics.delivered << "\tdecimated: " << statistics.decimated
+											<< std::endl;
+				}
+				std::lock_guard lock(slow.mutex);
+				std::cout << "Slow consumer handled " << slow.handled << ", dropped " << slow.dropped
+									<< ", conversions run: " << hub.conversion_count() << std::endl;
+		}
+
+		{
+				std::lock_guard lock(slow.mutex);
+				slow.running = false;
+				slow.wake_up.notify_one();
+		}
+		slow_worker.join();
+
+		const auto statistics = device->statistics();
+		std::cout << "After release: " << backend->leased_buffers() << " handles out, "
+							<< statistics.queued - statistics.dequeued << " of " << params.num_buffers
+							<< " buffers queued in the driver" << std::endl;
+}
+
+/**
+ * @brief Runs Shm_Frame_Ring across processes: the parent publishes frames
+ * whose every byte encodes the frame index, a forked fast reader and a forked
+ * slow reader check them. Frame indices must only grow, every gap must be
+ * counted as lost and no copy may be torn. The slow reader falls behind the
+ * four slot ring, so it exercises the overwrite and catch up path. Readers
+ * must also refuse objects of another version or too small to hold a header.
+ * No camera needed: ./v4l2_test 0 shm
+ */
+static void
+shm_ring_test()
+{
+		const std::string stale_name = "/cartrack_ring_stale";
+		for(const bool truncated : {false, true})
+		{
+				shm_unlink(stale_name.c_str());
+				const int fd = shm_open(stale_name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+				Cartrack::Shm_Ring_Header stale;
+				stale.version = Cartrack::Shm_Frame_Ring_Version + 1;
+				const auto size = truncated ? sizeof(stale) / 2 : sizeof(stale);
+				const bool written = -1 != fd and size == static_cast<std::size_t>(write(fd, &stale, size));
+				if(-1 != fd)
+				{
+						close(fd);
+				}
+				std::string outcome = written ? "attached" : "could not be created";
+				if(written)
+				{
+						try
+						{
+								Cartrack::Shm_Frame_Ring_Reader reader(stale_name);
+						}
+						catch(const std::exception& error)
+						{
+								outcome = std::string{"refused: "} + error.what();
+						}
+				}
+				std::cout << (truncated ? "Truncated ring " : "Ring of the next version ") << outcome << std::endl;
+		}
+		shm_unlink(stale_name.c_str());
+
+		constexpr uint64_t num_frames = 3000;
+		const auto layout = Cartrack::make_packed_image_layout(Cartrack::Pixel_Format::NV12, 640, 480, false);
+		Cartrack::Shm_Frame_Ring_Writer writer("/cartrack_ring_test", layout, 4);
+
+		int ready[2];
+		if(-1 == pipe(ready))
+		{
+				std::cerr << "pipe: " << strerror(errno) << std::endl;
+				return;
+		}
+		std::cout.flush();
+
+		std::vector<pid_t> readers;
+		for(const auto pause : {std::chrono::microseconds{0}, std::chrono::microseconds{1000}})
+		{
+				const pid_t pid = fork();
+				if(0 != pid)
+				{
+						readers.push_back(pid);
+						continue;
+				}
+
+				/* The child must leave through _exit, the writer's destructor would unlink the ring. */
+				close(ready[0]);
+				Cartrack::Shm_Frame_Ring_Reader reader(writer.name());
+				const char token = 1;
+				static_cast<void>(write(ready[1], &token, 1));
+				close(ready[1]);
+
+				Cartrack::Shm_Frame frame;
+				uintmax_t received = 0;
+				uintmax_t torn		 = 0;
+				uintmax_t gaps		 = 0;
+				uintmax_t reversed = 0;
+				int64_t last_index = -1;
+				auto idle_since		 = std::chrono::steady_clock::now();
+				while(last_index + 1 < static_cast<int64_t>(num_frames)
+							and std::chrono::steady_clock::now() - idle_since < std::chrono::seconds{1})
+				{
+						if(not reader.read_next(frame))
+						{
+								std::this_thread::yield();
+								continue;
+						}
+						idle_since = std::chrono::steady_clock::now();
+						++received;
+
+						const auto index = static_cast<int64_t>(frame.frame_index);
+						reversed += index <= last_index;
+						gaps += index > last_index + 1 ? index - last_index - 1 : 0;
+						last_index = index;
+
+						const auto expected = std::byte(frame.frame_index * 7);
+						bool consistent = frame.frame_order == frame.frame_index + 1000
+															and frame.timestamp == std::chrono::milliseconds(frame.frame_index);
+						for(const auto& plane : frame.planes)
+						{
+								consistent = consistent and plane.size() > 0
+														 and std::all_of(plane.begin(), plane.end(), [expected](std::byte b) { return b == expected; });
+						}
+						torn += not consistent;
+						std::this_thread::sleep_for(pause);
+				}
+
+				const bool passed = received > 0 and torn == 0 and reversed == 0 and gaps == reader.lost_frames()
+														and last_index + 1 == static_cast<int64_t>(num_frames);
+				std::cout << (pause.count() ? "Slow" : "Fast") << " reader (pid " << getpid() << "): received "
+									<< received << ", lost " << reader.lost_frames() << ", gaps " << gaps << ", torn " << torn
+									<< ", out of order " << reversed << (passed ? "	passed" : "	FAILED") << std::endl;
+				_exit(passed ? 0 : 1);
+		}
+		close(ready[1]);
+
+		char token;
+		for(std::size_t i = 0; i < readers.size(); ++i)
+		{
+				if(1 != read(ready[0], &token, 1))
+				{
+						std::cerr << "A reader died before attaching" << std::endl;
+						break;
+				}
+		}
+		close(ready[0]);
+
+		Cartrack::Aligned_Buffer payload(layout.memory_plane_sizes[0]);
+		const Cartrack::Multiplanar_Buffer_View planes{std::span(payload)};
+		const auto start = std::chrono::steady_clock::now();
+		for(uint64_t i = 0; i < num_frames; ++i)
+		{
+				std::fill(payload.begin(), payload.end(), std::byte(i * 7));
+				writer.publish(planes, std::chrono::milliseconds(i), i + 1000);
+				std::this_thread::sleep_for(std::chrono::microseconds{100});
+		}
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "Published " << writer.published() << " frames at " << writer.published() / elapsed.count()
+							<< " fps" << std::endl;
+
+		int failed = 0;
+		for(const auto pid : readers)
+		{
+				int status = 0;
+				waitpid(pid, &status, 0);
+				failed += not WIFEXITED(status) or 0 != WEXITSTATUS(status);
+		}
+		std::cout << (failed ? "Shared memory ring FAILED" : "Shared memory ring passed") << std::endl;
+}
+
+/**
+ * @brief Records the camera straight from its mapped buffers, the output plays
+ * back with the replay mode: ./v4l2_test 0 record /data/camera0.raw
+ */
+static void
+record_to_disk(
+		std::shared_ptr<Cartrack::V4L2_Backend> backend,
+		const std::string& path,
+		uint num_frames = 1000)
+{
+		Cartrack::Raw_Recorder recorder(path, backend->image_layout(), backend->get_fps());
+		std::cout << "Recording to " << path << (recorder.direct_io() ? " with O_DIRECT" : "")
+							<< (recorder.uses_io_uring() ? " through io_uring" : " from a writer thread") << std::endl;
+
+		for(uint i = 0; i < num_frames; ++i)
+		{
+				recorder.record(backend->acquire_frame());
+		}
+		recorder.flush();
+
+		const auto statistics = recorder.statistics();
+		std::cout << "Written: " << statistics.written_frames << "\tZero copy: " << statistics.zero_copy_frames
+							<< "\tDropped by recorder: " << statistics.dropped_frames
+							<< "\tDropped by driver: " << statistics.capture_gaps
+							<< "\tWrite errors: " << statistics.write_errors << "\t"
+							<< statistics.megabytes_per_second() << " MB/s" << std::endl;
+}
+
+/**
+ * @brief Records compressed with every codec that is built in, then reads the
+ * file back to check it decodes to what was captured:
+ * ./v4l2_test 0 compress [file]
+ */
+static void
+compress_to_disk(
+		std::shared_ptr<Cartrack::V4L2_Backend> backend,
+		const std::string& path,
+		uint num_frames = 300)
+{
+		for(const auto codec : {Cartrack::Raw_Codec::Stored, Cartrack::Raw_Codec::LZ4, Cartrack::Raw_Codec::Zstd})
+		{
+				if(not Cartrack::raw_codec_available(codec))
+				{
+						continue;
+				}
+				for(const bool delta : {false, true})
+				{
+						Cartrack::Compressed_Recorder_Options options;
+						options.codec = codec;
+						options.delta = delta;
+						std::vector<Cartrack::Multiplanar_Buffer> recorded;
+						{
+								Cartrack::Compressed_Recorder recorder(path, backend->image_layout(), backend->get_fps(), options);
+								for(uint i = 0; i < num_frames; ++i)
+								{
+										const auto frame = backend->acquire_frame();
+										if(recorder.record(frame) and recorded.size() < 30)
+										{
+												auto& copy = recorded.emplace_back();
+												for(const auto& plane : frame->planes)
+												{
+														copy.emplace_back(plane.begin(), plane.end());
+												}
+										}
+								}
+								recorder.close();
+
+								const auto statistics = recorder.statistics();
+								std::cout << Cartrack::raw_codec_name(codec) << (delta ? " + delta" : "")
+													<< "	Written: " << statistics.written_frames << "	Dropped: " << statistics.dropped_frames
+													<< "	Ratio: " << statistics.compression_ratio() << "	"
+													<< statistics.megabytes_per_second_per_core() << " MB/s per core on "
+													<< recorder.workers() << " workers	" << statistics.megabytes_per_second() << " MB/s"
+													<< std::endl;
+						}
+
+						Cartrack::Raw_Recording_Reader reader(path);
+						Cartrack::Raw_Frame_Decoder decoder;
+						std::size_t mismatches = 0;
+						for(std::size_t i = 0; i < recorded.size(); ++i)
+						{
+								const auto planes = decoder.decode(reader, i);
+								for(std::size_t plane = 0; plane < recorded[i].size(); ++plane)
+								{
+										mismatches += plane >= planes.size() or planes[plane].size() != recorded[i][plane].size()
+																	or std::memcmp(planes[plane].data(), recorded[i][plane].data(), planes[plane].size()) != 0;
+								}
+						}
+						std::cout << "	Decoded " << recorded.size() << " frames back, " << mismatches << " mismatching planes"
+											<< std::endl;
+				}
+		}
+}
+
+/**
+ * @brief Keeps the last 5 seconds in a pre-event ring, triggers a dump after
+ * 8 seconds and captures on while it is written:
+ * ./v4l2_test 0 pre_event [file] [compress]
+ */
+static void
+pre_event_test(
+		std::shared_ptr<Cartrack::V4L2_Backend> backend,
+		const std::string& path,
+		bool compress)
+{
+		Cartrack::Pre_Event_Ring_Options options;
+		options.window	 = std::chrono::seconds(5);
+		options.compress = compress and Cartrack::default_raw_codec() != Cartrack::Raw_Codec::Stored;
+		const auto fps	 = backend->get_fps();
+		Cartrack::Pre_Event_Ring ring(backend->image_layout(), fps, options);
+		std::cout << "Pre-event arena: " << ring.arena_size() / 1e6 << " MB for "
+							<< Cartrack::Pre_Event_Ring::frames_for(fps, options.window) << " frames"
+							<< (options.compress ? ", compressed" : "") << std::endl;
+
+		const auto frames = static_cast<uint>(fps * 10);
+		for(uint i = 0; i < frames; ++i)
+		{
+				if(i == static_cast<uint>(fps * 8))
+				{
+						std::cout << "Trigger: " << (ring.trigger(path) ? "dumping to " + path : "refused") << std::endl;
+				}
+				ring.push(backend->acquire_frame());
+		}
+		ring.wait_for_dump();
+
+		const auto statistics = ring.statistics();
+		std::cout << "Stored: " << statistics.stored_frames << "	Dropped: " << statistics.dropped_frames
+							<< "	Dropped while dumping: " << statistics.dropped_while_dumping
+							<< "	Dumped: " << statistics.dumped_frames << "	Dump errors: " << statistics.dump_errors
+							<< "	Held: " << statistics.held_frames << " frames, " << statistics.held_bytes / 1e6 << " MB, "
+							<< std::chrono::duration<double>(statistics.held_duration).count() << " s" << std::endl;
+}
+
+/**
+ * @brief Checks every color conversion kernel the CPU runs against the scalar
+ * reference on noise, for every source format, target and encoding, then times
+ * them with the default encoding. False, and exit status 1, when any differs:
+ * ./v4l2_test 0 convert [width] [height]
+ */
+static bool
+conversion_benchmark(
+		uint32_t width,
+		uint32_t height,
+		uint num_frames = 20)
+{
+		using Cartrack::Pixel_Format;
+		const std::array<Cartrack::Color_Encoding, 4> encodings{{
+				{Cartrack::Ycbcr_Encoding::BT601, Cartrack::Quantization_Range::Limited},
+				{Cartrack::Ycbcr_Encoding::BT601, Cartrack::Quantization_Range::Full},
+				{Cartrack::Ycbcr_Encoding::BT709, Cartrack::Quantization_Range::Limited},
+				{Cartrack::Ycbcr_Encoding::BT709, Cartrack::Quantization_Range::Full},
+		}};
+
+		bool bit_exact = true;
+		std::cout << "Color conversion at " << width << "x" << height << ", best kernel: "
+							<< Cartrack::color_conversion_kernel_name(Cartrack::best_color_conversion_kernel()) << std::endl;
+		for(const auto source_format : {Pixel_Format::YUYV422,
+																		Pixel_Format::NV12,
+																		Pixel_Format::NV12sp,
+																		Pixel_Format::YUV422P,
+																		Pixel_Format::BGR24,
+																		Pixel_Format::RGB24,
+																		Pixel_Format::RGBA32,
+																		Pixel_Format::GRAY8})
+		{
+				if(source_format == Pixel_Format::YUYV422 and width % 2 != 0)
+				{
+						continue;
+				}
+				auto source_layout = Cartrack::make_packed_image_layout(source_format, width, height, false);
+				Frame_Plane source(source_layout.memory_plane_sizes[0]);
+				uint32_t state = 1;
+				for(auto& byte : source)
+				{
+						state = state * 1664525u + 1013904223u;
+						byte	= Cartrack::Data_Type(state >> 24);
+				}
+
+				for(const auto target_format : Cartrack::color_conversion_targets)
+				{
+						const auto target_layout = Cartrack::make_packed_image_layout(target_format, width, height, false);
+						Frame_Plane reference(target_layout.memory_plane_sizes[0]);
+						Frame_Plane target(reference.size());
+						const auto reference_view = Cartrack::make_image_view(target_layout, {std::span(reference)});
+						const auto target_view		= Cartrack::make_image_view(target_layout, {std::span(target)});
+
+						std::size_t mismatches = 0;
+						for(const auto& encoding : encodings)
+						{
+								source_layout.color_encoding = encoding;
+								const auto source_view			 = Cartrack::make_image_view(source_layout, {std::span(source)});
+								Cartrack::convert_image(source_view, reference_view, Cartrack::Color_Conversion_Kernel::Scalar);
+								for(const auto kernel : Cartrack::color_conversion_kernels)
+								{
+										if(Cartrack::color_conversion_kernel_available(kernel))
+										{
+												std::fill(target.begin(), target.end(), Cartrack::Data_Type{0});
+												Cartrack::convert_image(source_view, target_view, kernel);
+												mismatches += not std::equal(target.begin(), target.end(), reference.begin());
+										}
+								}
+						}
+
+						source_layout.color_encoding = Cartrack::make_packed_image_layout(source_format, 2, 2, false).color_encoding;
+						const auto source_view			 = Cartrack::make_image_view(source_layout, {std::span(source)});
+						const auto& from						 = Cartrack::describe(source_format).fourcc;
+						const auto& to							 = Cartrack::describe(target_format).fourcc;
+						std::cout << std::string(from.begin(), from.end()) << " to " << std::string(to.begin(), to.end());
+						for(const auto kernel : Cartrack::color_conversion_kernels)
+						{
+								if(not Cartrack::color_conversion_kernel_available(kernel))
+								{
+										continue;
+								}
+								const auto started = std::chrono::steady_clock::now();
+								for(uint i = 0; i < num_frames; ++i)
+								{
+										Cartrack::convert_image(source_view, target_view, kernel);
+								}
+								const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - started;
+								std::cout << "	" << Cartrack::color_conversion_kernel_name(kernel) << " " << elapsed.count() / num_frames
+													<< " ms";
+						}
+						std::cout << "	" << (mismatches == 0 ? "bit exact" : "MISMATCH") << std::endl;
+						bit_exact = bit_exact and mismatches == 0;
+				}
+		}
+		return bit_exact;
+}
+
+/**
+ * @brief Times conversions from 1 to every available thread and prints the
+ * speedup over one thread: ./v4l2_test 0 scaling [width] [height]
+ */
+static void
+conversion_scaling(
+		uint32_t width,
+		uint32_t height,
+		uint num_frames = 20)
+{
+		using Cartrack::Pixel_Format;
+		const auto max_threads = Cartrack::resolve_threads({.threads = 0});
+		std::cout << "Conversion scaling at " << width << "x" << height << ", up to " << max_threads << " threads, "
+							<< Cartrack::color_conversion_kernel_name(Cartrack::best_color_conversion_kernel()) << " kernel, "
+							<< Cartrack::l2_cache_bytes() / 1024 << " KiB L2" << std::endl;
+
+		const std::array<std::pair<Pixel_Format, Pixel_Format>, 4> pairs{{{Pixel_Format::NV12, Pixel_Format::RGB24},
+																																			 {Pixel_Format::YUYV422, Pixel_Format::BGR24},
+																																			 {Pixel_Format::YUV422P, Pixel_Format::RGBA32},
+																																			 {Pixel_Format::RGB24, Pixel_Format::GRAY8}}};
+		for(const auto& [source_format, target_format] : pairs)
+		{
+				const auto source_layout = Cartrack::make_packed_image_layout(source_format, width, height, false);
+				const auto target_layout = Cartrack::make_packed_image_layout(target_format, width, height, false);
+				Frame_Plane source(source_layout.memory_plane_sizes[0], Cartrack::Data_Type{128});
+				Frame_Plane target(target_layout.memory_plane_sizes[0]);
+				const auto source_view = Cartrack::make_image_view(source_layout, {std::span(source)});
+				const auto target_view = Cartrack::make_image_view(target_layout, {std::span(target)});
+
+				const auto& from = Cartrack::describe(source_format).fourcc;
+				const auto& to	 = Cartrack::describe(target_format).fourcc;
+				std::cout << std::string(from.begin(), from.end()) << " to " << std::string(to.begin(), to.end()) << std::endl;
+				double single_thread = 0;
+				for(unsigned int threads = 1; threads <= max_threads; ++threads)
+				{
+						const Cartrack::Parallelism parallelism{.threads = threads};
+						/* Warm up, the first parallel region starts the team. */
+						Cartrack::convert_image(source_view, target_view, Cartrack::best_color_conversion_kernel(), parallelism);
+						const auto started = std::chrono::steady_clock::now();
+						for(uint i = 0; i < num_frames; ++i)
+						{
+								Cartrack::convert_image(source_view, target_view, Cartrack::best_color_conversion_kernel(), parallelism);
+						}
+						const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - started;
+						const auto per_frame																		 = elapsed.count() / num_frames;
+						if(threads == 1)
+						{
+								single_thread = per_frame;
+						}
+						std::cout << "	" << threads << " threads	" << per_frame << " ms	" << 1000 / per_frame << " fps	"
+											<< single_thread / per_frame << "x" << std::endl;
+				}
+		}
+}
+
+/**
+ * @brief Times the fused NV12 to tensor stage on synthetic frames, float and
+ * int8 on every kernel, checked against Scalar. Then the passes it replaces:
+ * NV12 to RGB24, a bilinear resize to the letterbox and normalizing into CHW,
+ * each timed and summed, and how far their tensor is from the fused one:
+ * ./v4l2_test 0 tensor [size]
+ */
+static void
+tensor_benchmark(
+		int camera_index,
+		uint32_t tensor_size,
+		uint num_frames = 100)
+{
+		auto params									 = get_test_setup(camera_index, true);
+		params.backend							 = Cartrack::Stream_Configuration::Capture_Backends::Synthetic;
+		params.synthetic.unthrottled = true;
+		Cartrack::Synthetic_Backend synthetic(params);
+		const auto frame = synthetic.get_frame_data();
+		const auto image = Cartrack::make_image_view(synthetic.image_layout(), frame);
+
+		Cartrack::Tensor_Options options;
+		options.width	 = tensor_size;
+		options.height = tensor_size;
+		std::vector<float> tensor(3 * std::size_t(tensor_size) * tensor_size);
+		std::vector<int8_t> quantized(tensor.size());
+		std::vector<float> reference(tensor.size());
+		std::vector<int8_t> quantized_reference(tensor.size());
+
+		const auto time = [&](const std::string& name, auto&& run)
+		{
+				run();
+				const auto started = std::chrono::steady_clock::now();
+				for(uint i = 0; i < num_frames; ++i)
+				{
+						run();
+				}
+				const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - started;
+				std::cout << name << "	" << elapsed.count() / num_frames << " ms/frame" << std::endl;
+				return elapsed.count() / num_frames;
+		};
+		const auto max_difference = [](const auto& first, const auto& second)
+		{
+				double difference = 0;
+				for(std::size_t i = 0; i < first.size(); ++i)
+				{
+						difference = std::max(difference, std::abs(double(first[i]) - double(second[i])));
+				}
+				return difference;
+		};
+
+		options.kernel = Cartrack::Color_Conversion_Kernel::Scalar;
+		const auto box = Cartrack::preprocess_to_tensor(image, std::span(reference), options);
+		Cartrack::preprocess_to_tensor(image, std::span(quantized_reference), options);
+		std::cout << image.width << "x" << image.height << " NV12 to " << tensor_size << "x" << tensor_size
+							<< " CHW, content " << box.width << "x" << box.height << " at " << box.left << "," << box.top
+							<< std::endl;
+		for(const auto kernel : Cartrack::color_conversion_kernels)
+		{
+				if(not Cartrack::color_conversion_kernel_available(kernel))
+				{
+						continue;
+				}
+				options.kernel		= kernel;
+				const auto name		= std::string(Cartrack::color_conversion_kernel_name(kernel));
+				time("fused float32 " + name, [&] { Cartrack::preprocess_to_tensor(image, std::span(tensor), options); });
+				time("fused int8 " + name, [&] { Cartrack::preprocess_to_tensor(image, std::span(quantized), options); });
+				std::cout << name << " against scalar: float32 max difference " << max_difference(tensor, reference)
+									<< ", int8 max difference " << max_difference(quantized, quantized_reference) << std::endl;
+		}
+
+		/* The same tensor the usual way, each pass over the whole frame. */
+		const auto rgb_layout = Cartrack::make_packed_image_layout(Cartrack::Pixel_Format::RGB24, image.width, image.height, false);
+		const auto box_layout = Cartrack::make_packed_image_layout(Cartrack::Pixel_Format::RGB24, box.width, box.height, false);
+		Frame_Plane rgb(rgb_layout.memory_plane_sizes[0]);
+		Frame_Plane resized(box_layout.memory_plane_sizes[0]);
+		const auto rgb_view			= Cartrack::make_image_view(rgb_layout, {std::span(rgb)});
+		const auto resized_view = Cartrack::make_image_view(box_layout, {std::span(resized)});
+		std::vector<float> unfused(tensor.size());
+		const auto normalize = [&]
+		{
+				const std::size_t plane = std::size_t(tensor_size) * tensor_size;
+				for(std::size_t channel = 0; channel < 3; ++channel)
+				{
+						const float mean			 = options.mean[channel];
+						const float deviation	 = options.standard_deviation[channel];
+						float* out						 = unfused.data() + channel * plane;
+						std::fill_n(out, plane, (options.pad_value - mean) / deviation);
+						for(uint32_t y = 0; y < box.height; ++y)
+						{
+								const auto* row = resized_view.plane(0).row(y);
+								float* target		= out + std::size_t(box.top + y) * tensor_size + box.left;
+								for(uint32_t x = 0; x < box.width; ++x)
+								{
+										target[x] = (float(row[3 * x + channel]) - mean) / deviation;
+								}
+						}
+				}
+		};
+		options.kernel = Cartrack::best_color_conversion_kernel();
+		Cartrack::preprocess_to_tensor(image, std::span(tensor), options);
+		const double convert = time("unfused NV12 to RGB24", [&] { Cartrack::convert_image(image, rgb_view); });
+		const double resize	 = time("unfused RGB24 bilinear to " + std::to_string(box.width) + "x" + std::to_string(box.height),
+															[&] { Cartrack::resize_image(rgb_view, resized_view); });
+		const double normalized = time("unfused normalize to CHW", normalize);
+		double mean_difference = 0;
+		for(std::size_t i = 0; i < tensor.size(); ++i)
+		{
+				mean_difference += std::abs(double(unfused[i]) - double(tensor[i])) / double(tensor.size());
+		}
+		/* Chroma is interpolated, not replicated, in the fused stage: it differs most at sharp colour edges. */
+		std::cout << "unfused float32 total	" << convert + resize + normalized << " ms/frame, difference to fused: max "
+							<< max_difference(unfused, tensor) << ", mean " << mean_difference << std::endl;
+}
+
+/**
+ * @brief Times the plane resizers on a synthetic NV12 frame: the 2x2 box,
+ * bilinear and area to a preview size on every kernel, each checked against
+ * Scalar, a pyramid, and the RGB24 conversion plus resize they replace.
+ * False, and exit status 1, when a kernel differs from Scalar:
+ * ./v4l2_test 0 resize [width] [height]
+ */
+static bool
+resize_benchmark(
+		int camera_index,
+		uint32_t width,
+		uint32_t height,
+		uint num_frames = 100)
+{
+		using Cartrack::Pixel_Format;
+		auto params									 = get_test_setup(camera_index, true);
+		params.backend							 = Cartrack::Stream_Configuration::Capture_Backends::Synthetic;
+		params.synthetic.unthrottled = true;
+		Cartrack::Synthetic_Backend synthetic(params);
+		const auto frame = synthetic.get_frame_data();
+		const auto image = Cartrack::make_image_view(synthetic.image_layout(), frame);
+
+		const auto time = [&](const std::string& name, auto&& run)
+		{
+				run();
+				const auto started = std::chrono::steady_clock::now();
+				for(uint i = 0; i < num_frames; ++i)
+				{
+						run();
+				}
+				const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - started;
+				std::cout << name << "	" << elapsed.count() / num_frames << " ms/frame" << std::endl;
+		};
+		const auto allocate = [](Pixel_Format format, uint32_t w, uint32_t h, Frame_Plane& storage)
+		{
+				const auto layout = Cartrack::make_packed_image_layout(format, w, h, false);
+				storage.assign(layout.memory_plane_sizes[0], Cartrack::Data_Type{0});
+				return Cartrack::make_image_view(layout, {std::span(storage)});
+		};
+
+		std::cout << "Resizing " << image.width << "x" << image.height << " NV12" << std::endl;
+		bool bit_exact		 = true;
+		const auto compare = [&](Cartrack::Resize_Filter filter, const std::string& size, uint32_t w, uint32_t h)
+		{
+				Frame_Plane target_storage;
+				Frame_Plane reference_storage;
+				const auto target		 = allocate(Pixel_Format::NV12, w, h, target_storage);
+				const auto reference = allocate(Pixel_Format::NV12, w, h, reference_storage);
+				Cartrack::resize_image(image, reference, filter, Cartrack::Color_Conversion_Kernel::Scalar);
+				for(const auto kernel : Cartrack::color_conversion_kernels)
+				{
+						if(Cartrack::color_conversion_kernel_available(kernel))
+						{
+								const std::string name = std::string(Cartrack::resize_filter_name(filter)) + " " + size + " "
+																				 + Cartrack::color_conversion_kernel_name(kernel);
+								time(name, [&] { Cartrack::resize_image(image, target, filter, kernel); });
+								if(target_storage != reference_storage)
+								{
+										std::cout << name << " MISMATCH" << std::endl;
+										bit_exact = false;
+								}
+						}
+				}
+		};
+		compare(Cartrack::Resize_Filter::Box, "2x2", image.width / 2, image.height / 2);
+		const std::string preview_size = "to " + std::to_string(width) + "x" + std::to_string(height);
+		compare(Cartrack::Resize_Filter::Bilinear, preview_size, width, height);
+		compare(Cartrack::Resize_Filter::Area, preview_size, width, height);
+
+		Cartrack::Pyramid_Builder builder;
+		std::cout << "Pyramid of " << builder.build(image)->size() << " levels" << std::endl;
+		time("Pyramid", [&] { const auto pyramid = builder.build(image); });
+		std::cout << "Pyramid pool " << builder.pool_size() << ", " << builder.allocations() << " allocations" << std::endl;
+
+		Frame_Plane rgb_storage;
+		Frame_Plane rgb_preview_storage;
+		const auto rgb				 = allocate(Pixel_Format::RGB24, image.width, image.height, rgb_storage);
+		const auto rgb_preview = allocate(Pixel_Format::RGB24, width, height, rgb_preview_storage);
+		time("RGB24 then Bilinear",
+				 [&]
+				 {
+						 Cartrack::convert_image(image, rgb);
+						 Cartrack::resize_image(rgb, rgb_preview);
+				 });
+		return bit_exact;
+}
+
+/**
+ * @brief Decodes synthetic MJPEG frames at full speed into every target, at
+ * full and half scale, and checks that they come out in order:
+ * ./v4l2_test 0 mjpeg [width] [height]
+ */
+static void
+mjpeg_benchmark(
+		int camera_index,
+		uint32_t width,
+		uint32_t height,
+		uint num_frames = 120)
+{
+		auto params									 = get_test_setup(camera_index, true);
+		params.backend							 = Cartrack::Stream_Configuration::Capture_Backends::Synthetic;
+		params.synthetic.unthrottled = true;
+		params.pixel_format					 = Cartrack::Pixel_Format::MJPEG;
+		params.width								 = width;
+		params.height								 = height;
+		Cartrack::Synthetic_Backend synthetic(params);
+
+		/* Encoding is slow, a few distinct frames are cycled. */
+		std::vector<Frame_Plane> jpegs;
+		for(int i = 0; i < 8; ++i)
+		{
+				const auto frame = synthetic.get_frame_data();
+				jpegs.emplace_back(frame[0].begin(), frame[0].end());
+		}
+		std::cout << "MJPEG " << width << "x" << height << ", " << jpegs.front().size() / 1024 << " KiB per frame"
+							<< std::endl;
+
+		for(const auto target : Cartrack::mjpeg_decode_targets)
+		{
+				if(not Cartrack::mjpeg_decode_supported(target))
+				{
+						continue;
+				}
+				for(const uint32_t scale : {1u, 2u})
+				{
+						uintmax_t expected_order = 0;
+						uintmax_t out_of_order	 = 0;
+						uint32_t decoded_width	 = 0;
+						Cartrack::Mjpeg_Decoder decoder(
+								[&](const Cartrack::Decoded_Frame_Handle& frame)
+								{
+										out_of_order += frame->frame_order != expected_order;
+										expected_order = frame->frame_order + 1;
+										decoded_width	 = frame->image.width;
+								},
+								{.target = target, .scale_denominator = scale});
+						for(uint i = 0; i < num_frames; ++i)
+						{
+								/* Like a camera that never waits: frames the workers cannot take are dropped. */
+								while(not decoder.decode(jpegs[i % jpegs.size()], std::chrono::nanoseconds(i), i, i))
+								{
+										std::this_thread::yield();
+								}
+								expected_order = std::min<uintmax_t>(expected_order, i);
+						}
+						decoder.flush();
+
+						const auto statistics = decoder.statistics();
+						const auto& fourcc		= Cartrack::describe(target).fourcc;
+						std::cout << std::string(fourcc.begin(), fourcc.end()) << " 1/" << scale << " (" << decoded_width
+											<< " wide)	" << statistics.frames_per_second() << " fps on " << decoder.workers()
+											<< " workers	decode " << statistics.average_decode_milliseconds() << " ms	latency "
+											<< statistics.average_latency_milliseconds() << " ms (max "
+											<< std::chrono::duration<double, std::milli>(statistics.max_latency).count() << ")	"
+											<< statistics.allocations << " allocations	"
+											<< (out_of_order == 0 and statistics.failed_frames == 0 ? "in order" : "OUT OF ORDER OR FAILED")
+											<< std::endl;
+				}
+		}
+}
+
+/**
+ * @brief Plays a raw recording back, unthrottled to measure read throughput and
+ * then at the recorded pace. Without a recording, 90 synthetic frames are
+ * recorded first: ./v4l2_test 0 replay [recording]
+ */
+static void
+replay_test(int camera_index, std::string path)
+{
+		auto params = get_test_setup(camera_index, true);
+		if(path.empty())
+		{
+				path																= "/tmp/cartrack_replay.raw";
+				auto synthetic_params								= params;
+				synthetic_params.backend						= Cartrack::Stream_Configuration::Capture_Backends::Synthetic;
+				synthetic_params.synthetic.unthrottled = true;
+				Cartrack::Synthetic_Backend synthetic(synthetic_params);
+				Cartrack::Raw_Recording_Writer writer(path, synthetic.image_layout(), synthetic.get_fps());
+				for(int i = 0; i < 90; ++i)
+				{
+						const auto frame = synthetic.get_frame_data();
+						writer.write(frame,
+												 synthetic.get_frame_timestamp(),
+												 synthetic.get_frame_order(),
+												 static_cast<uint32_t>(synthetic.get_frame_order()));
+				}
+				std::cout << "Recorded " << writer.written_frames() << " synthetic frames to " << path << std::endl;
+		}
+
+		params.backend		 = Cartrack::Stream_Configuration::Capture_Backends::Replay;
+		params.replay.path = path;
+		params.replay.pacing = Cartrack::Stream_Configuration::Replay::Pacing::Unthrottled;
+		{
+				Cartrack::Replay_Backend replay(params);
+				std::size_t bytes = 0;
+				const auto start	= std::chrono::steady_clock::now();
+				while(not replay.finished())
+				{
+						for(const auto& plane : replay.get_frame_data())
+						{
+								/* Touch every page, spans alone do not read anything. */
+								for(std::size_t offset = 0; offset < plane.size(); offset += 4096)
+								{
+										bytes += std::to_integer<uint8_t>(plane[offset]) != 0xff ? 4096 : 0;
+								}
+						}
+				}
+				const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+				std::cout << "Unthrottled replay of " << replay.frame_count() << " frames: "
+									<< bytes / elapsed.count() / 1e9 << " GB/s" << std::endl;
+
+				const auto middle = replay.first_timestamp() + (replay.last_timestamp() - replay.first_timestamp()) / 2;
+				replay.seek(middle);
+				std::cout << "Seek to the middle lands on frame " << replay.position() << std::endl;
+		}
+
+		params.replay.pacing = Cartrack::Stream_Configuration::Replay::Pacing::Original;
+		params.replay.loop	 = true;
+		auto replay					 = std::make_shared<Cartrack::Replay_Backend>(params);
+		if(replay->get_pixel_format() == Cartrack::Pixel_Format::NV12)
+		{
+				mmap_capture(replay, 120);
+		}
+}
+
 auto
 main(
 		int argc,
@@ -407,6 +1662,158 @@ main(
 		};
 
 
+		const std::string mode = argc > 2 ? argv[2] : "";
+		if(mode == "publish" or mode == "subscribe")
+		{
+				const std::string socket_path = argc > 3 ? argv[3] : "/tmp/cartrack_v4l2.sock";
+				if(mode == "subscribe")
+				{
+						dmabuf_subscribe(socket_path);
+						return 0;
+				}
+
+				auto params				 = get_test_setup(camera_index, true);
+				params.num_buffers = 4;
+				dmabuf_publish(std::make_shared<Cartrack::V4L2_Backend>(params), socket_path);
+				return 0;
+		}
+
+		if(mode == "synthetic")
+		{
+				/* No camera needed: ./v4l2_test 0 synthetic [unthrottled] */
+				auto params								 = get_test_setup(camera_index, true);
+				params.backend						 = Cartrack::Stream_Configuration::Capture_Backends::Synthetic;
+				params.synthetic.unthrottled = argc > 3 and std::string{argv[3]} == "unthrottled";
+				params.synthetic.jitter		 = std::chrono::microseconds{500};
+				params.synthetic.drop_probability = 0.01;
+				auto backend = std::make_shared<Cartrack::Synthetic_Backend>(params);
+
+				mmap_capture(backend, 100);
+				userptr_capture(backend, 100);
+				std::cout << "Injected drops: " << backend->dropped_frames() << std::endl;
+				return 0;
+		}
+
+		if(mode == "record")
+		{
+				auto params				 = get_test_setup(camera_index, true);
+				params.num_buffers = 8;
+				record_to_disk(std::make_shared<Cartrack::V4L2_Backend>(params),
+											 argc > 3 ? argv[3] : "/tmp/cartrack_record.raw");
+				return 0;
+		}
+
+		if(mode == "compress")
+		{
+				auto params				 = get_test_setup(camera_index, true);
+				params.num_buffers = 8;
+				compress_to_disk(std::make_shared<Cartrack::V4L2_Backend>(params),
+												 argc > 3 ? argv[3] : "/tmp/cartrack_compressed.raw");
+				return 0;
+		}
+
+		if(mode == "convert")
+		{
+				return conversion_benchmark(argc > 3 ? std::atoi(argv[3]) : 1920, argc > 4 ? std::atoi(argv[4]) : 1080) ? 0 : 1;
+		}
+
+		if(mode == "tensor")
+		{
+				tensor_benchmark(camera_index, argc > 3 ? std::atoi(argv[3]) : 640);
+				return 0;
+		}
+
+		if(mode == "mjpeg")
+		{
+				mjpeg_benchmark(camera_index, argc > 3 ? std::atoi(argv[3]) : 1920, argc > 4 ? std::atoi(argv[4]) : 1080);
+				return 0;
+		}
+		if(mode == "resize")
+		{
+				return resize_benchmark(camera_index, argc > 3 ? std::atoi(argv[3]) : 640, argc > 4 ? std::atoi(argv[4]) : 360)
+											 ? 0
+											 : 1;
+		}
+		if(mode == "scaling")
+		{
+				conversion_scaling(argc > 3 ? std::atoi(argv[3]) : 3840, argc > 4 ? std::atoi(argv[4]) : 2160);
+				return 0;
+		}
+
+		if(mode == "pre_event")
+		{
+				auto params				 = get_test_setup(camera_index, true);
+				params.num_buffers = 8;
+				pre_event_test(std::make_shared<Cartrack::V4L2_Backend>(params),
+											 argc > 3 ? argv[3] : "/tmp/cartrack_pre_event.raw",
+											 argc > 4 and std::string(argv[4]) == "compress");
+				return 0;
+		}
+
+		if(mode == "replay")
+		{
+				replay_test(camera_index, argc > 3 ? argv[3] : "");
+				return 0;
+		}
+
+		if(mode == "fake")
+		{
+				fake_device_test(camera_index);
+				return 0;
+		}
+
+		if(mode == "controls")
+		{
+				control_queue_test(camera_index);
+				return 0;
+		}
+
+		if(mode == "discover")
+		{
+				discovery_test(camera_index);
+				return 0;
+		}
+
+		if(mode == "group")
+		{
+				capture_group_test(camera_index);
+				return 0;
+		}
+
+		if(mode == "hub")
+		{
+				stream_hub_test(camera_index);
+				return 0;
+		}
+
+		if(mode == "shm")
+		{
+				shm_ring_test();
+				return 0;
+		}
+
+		if(mode == "loopback")
+		{
+				/* The contiguous NV12 of desktops, then the multiplanar buffers ON_DEVICE captures. */
+				for(const bool contiguous : {true, false})
+				{
+						auto params						 = get_test_setup(camera_index, true);
+						params.num_buffers		 = 4;
+						params.v4l2.contiguous = contiguous;
+						try
+						{
+								loopback_forward(std::make_shared<Cartrack::V4L2_Backend>(params),
+																 argc > 3 ? std::atoi(argv[3]) : 10);
+						}
+						catch(const std::exception& e)
+						{
+								std::cout << (contiguous ? "Single planar" : "Multiplanar") << " forwarding skipped: " << e.what()
+													<< std::endl;
+						}
+				}
+				return 0;
+		}
+
 		run_test(camera_index,true);
 		run_test(camera_index,false);
 
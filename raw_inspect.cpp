@@ -0,0 +1,117 @@
+#include "Raw_Recording.hpp"
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+/**
+ * @brief Prints what a raw recording holds: its layout, how it was closed and
+ * its frames. Usage: raw_inspect <file> [--frames]
+ */
+int
+main(int argc, char* argv[])
+{
+		if(argc < 2)
+		{
+				std::cerr << "Usage: " << argv[0] << " <recording> [--frames]" << std::endl;
+				return 1;
+		}
+		const bool list_frames = argc > 2 and std::strcmp(argv[2], "--frames") == 0;
+
+		try
+		{
+				const Cartrack::Raw_Recording_Reader reader(argv[1]);
+				const auto& header		 = reader.header();
+				const auto& layout		 = reader.layout();
+				const auto& descriptor = Cartrack::describe(layout.pixel_format);
+				const auto& index			 = reader.index();
+
+				std::cout << reader.path() << "\n"
+									<< "	format: " << std::string(descriptor.fourcc.begin(), descriptor.fourcc.end()) << " "
+									<< layout.width << "x" << layout.height << ", " << layout.num_memory_planes << " memory planes\n"
+									<< "	recorded fps: " << header.fps << ", " << header.frames_per_chunk << " frames per chunk\n"
+									<< "	" << (reader.finalized() ? "finalized" : "not finalized, recovered by scanning") << ", "
+									<< reader.chunk_count() << " chunks, " << reader.frame_count() << " frames ("
+									<< reader.sealed_frames() << " indexed)" << std::endl;
+
+				if(index.empty())
+				{
+						return 0;
+				}
+
+				uintmax_t sequence_gaps = 0;
+				for(std::size_t i = 1; i < index.size(); ++i)
+				{
+						if(index[i].sequence > index[i - 1].sequence + 1)
+						{
+								sequence_gaps += index[i].sequence - index[i - 1].sequence - 1;
+						}
+				}
+				const auto duration = std::chrono::duration<double>(std::chrono::nanoseconds(index.back().timestamp)
+																														 - std::chrono::nanoseconds(index.front().timestamp));
+				std::cout << "	duration: " << duration.count() << " s";
+				if(duration.count() > 0)
+				{
+						std::cout << ", average fps: " << (index.size() - 1) / duration.count();
+				}
+				std::cout << ", sequence gaps: " << sequence_gaps << std::endl;
+
+				uintmax_t stored_bytes = 0;
+				uintmax_t image_bytes	 = 0;
+				uintmax_t delta_frames = 0;
+				std::array<uintmax_t, 3> codec_frames{};
+				for(std::size_t i = 0; i < index.size(); ++i)
+				{
+						const auto frame = reader.frame(i);
+						for(std::size_t plane = 0; plane < frame.planes.size(); ++plane)
+						{
+								stored_bytes += frame.planes[plane].size();
+								image_bytes += frame.encoded() ? frame.bytes_used[plane] : frame.planes[plane].size();
+						}
+						delta_frames += frame.delta;
+						++codec_frames[std::min<std::size_t>(static_cast<std::size_t>(frame.codec), codec_frames.size() - 1)];
+				}
+				if(stored_bytes != image_bytes or delta_frames > 0)
+				{
+						std::cout << "	storage:";
+						for(std::size_t codec = 0; codec < codec_frames.size(); ++codec)
+						{
+								if(codec_frames[codec] > 0)
+								{
+										std::cout << " " << Cartrack::raw_codec_name(static_cast<Cartrack::Raw_Codec>(codec)) << " "
+															<< codec_frames[codec];
+								}
+						}
+						std::cout << ", " << delta_frames << " delta frames, " << double(image_bytes) / stored_bytes
+											<< "x smaller" << std::endl;
+				}
+
+				if(list_frames)
+				{
+						for(std::size_t i = 0; i < index.size(); ++i)
+						{
+								const auto frame = reader.frame(i);
+								std::cout << std::setw(8) << i << "  offset " << std::setw(12) << index[i].offset << "  sequence "
+													<< std::setw(8) << index[i].sequence << "  timestamp " << index[i].timestamp << " ns";
+								if(frame.planes.empty())
+								{
+										std::cout << "  damaged";
+								}
+								else if(frame.encoded())
+								{
+										std::cout << "  " << Cartrack::raw_codec_name(frame.codec) << (frame.delta ? " delta" : "");
+								}
+								for(const auto& plane : frame.planes)
+								{
+										std::cout << "  " << plane.size();
+								}
+								std::cout << "\n";
+						}
+				}
+		}
+		catch(const std::exception& exception)
+		{
+				std::cerr << exception.what() << std::endl;
+				return 1;
+		}
+		return 0;
+}